@@ -0,0 +1,743 @@
+#include "framework.h"
+#include "asset-internal.h"
+#include <algorithm>
+
+#include <emmintrin.h>
+
+// PCLMULQDQ is available on every CPU with AVX2; MSVC only signals it through /arch:AVX2
+#if defined(__PCLMUL__) || defined(__AVX2__)
+#	include <wmmintrin.h>
+#	define USE_PCLMUL 1
+#else
+#	define USE_PCLMUL 0
+#endif
+
+namespace Framework
+{
+	// Codecs for files in asset packs, besides the .zip format's own store and deflate.
+	//  * LZ is a byte-oriented LZ77 in the style of LZ4: no entropy coding, so it compresses
+	//      less than deflate, but decodes several times faster.  Each sequence is a token byte
+	//      (literal count in the high nibble, match length - 4 in the low one, 15 meaning more
+	//      bytes follow), the literals, a 16-bit offset, then any extra match length bytes.
+	//      The last sequence is literals only.
+	//  * LZ with a dictionary treats the pack's shared dictionary as if it came right before
+	//      the data, so even tiny files can find matches.  The dictionary is trained from the
+	//      small files in the pack, by picking out the segments with the most content in
+	//      common with other files.
+	//  * EncodeFileForPack picks a codec for each file by estimating how long it'd take to
+	//      load, as the time to read it off disk plus the time to decode it.
+	//  * Big files are deflated in parallel, pigz-style: the data is cut into blocks that are
+	//      compressed independently, each but the last ending in a sync flush, so they join up
+	//      byte-aligned into one ordinary deflate stream.  Matches can't reach back across a
+	//      block boundary, which costs a little compression.  CRCs of big files are likewise
+	//      computed in pieces and combined.
+	//  * CRCs are computed with PCLMULQDQ where the build targets it, else slice-by-16;
+	//      either is several times faster than miniz's table, which goes a nibble at a time.
+
+	namespace AssetCompiler
+	{
+		static const int s_lzMinMatch = 4;
+		static const int s_lzMaxOffset = 65535;
+		static const int s_lzHashBits = 14;
+		static const int s_lzLastLiterals = 5;			// Matches stop this far short of the end
+
+		static inline uint ReadU32(const byte * p)
+		{
+			uint value;
+			memcpy(&value, p, sizeof(value));
+			return value;
+		}
+
+		static inline uint HashU32(uint value)
+		{
+			return (value * 2654435761u) >> (32 - s_lzHashBits);
+		}
+
+		static void WriteLZLength(int length, std::vector<byte> * pOut)
+		{
+			for (; length >= 255; length -= 255)
+				pOut->push_back(255);
+			pOut->push_back(byte(length));
+		}
+
+		static void WriteLZSequence(
+			const byte * pLiterals,
+			int literalCount,
+			int offset,
+			int matchLength,
+			std::vector<byte> * pOut)
+		{
+			int matchCode = (matchLength > 0) ? matchLength - s_lzMinMatch : 0;
+			pOut->push_back(byte((min(literalCount, 15) << 4) | min(matchCode, 15)));
+			if (literalCount >= 15)
+				WriteLZLength(literalCount - 15, pOut);
+			pOut->insert(pOut->end(), pLiterals, pLiterals + literalCount);
+
+			if (matchLength > 0)
+			{
+				pOut->push_back(byte(offset));
+				pOut->push_back(byte(offset >> 8));
+				if (matchCode >= 15)
+					WriteLZLength(matchCode - 15, pOut);
+			}
+		}
+
+		void CompressLZ(
+			const void * pData,
+			size_t sizeBytes,
+			const byte * pDict,
+			size_t dictSize,
+			std::vector<byte> * pEncodedOut)
+		{
+			ASSERT_ERR(pData || sizeBytes == 0);
+			ASSERT_ERR(pDict || dictSize == 0);
+			ASSERT_ERR(pEncodedOut);
+
+			pEncodedOut->clear();
+			pEncodedOut->reserve(sizeBytes + sizeBytes / 255 + 16);
+
+			// Put the dictionary and data in one buffer, so matches can run from one into the other
+			// (only the last 64K of the dictionary is in reach)
+			if (dictSize > s_lzMaxOffset)
+			{
+				pDict += dictSize - s_lzMaxOffset;
+				dictSize = s_lzMaxOffset;
+			}
+			std::vector<byte> buffer(dictSize + sizeBytes);
+			if (dictSize > 0)
+				memcpy(&buffer[0], pDict, dictSize);
+			if (sizeBytes > 0)
+				memcpy(&buffer[dictSize], pData, sizeBytes);
+			const byte * pBuf = buffer.empty() ? nullptr : &buffer[0];
+
+			// Hash table of the last position each 4-byte sequence was seen at, plus 1
+			std::vector<int> table(1 << s_lzHashBits, 0);
+			for (size_t i = 0; i + s_lzMinMatch <= dictSize; ++i)
+				table[HashU32(ReadU32(&pBuf[i]))] = int(i + 1);
+
+			int pos = int(dictSize);
+			int anchor = pos;
+			int end = int(buffer.size());
+			int matchLimit = end - s_lzLastLiterals;
+			while (pos + s_lzMinMatch <= matchLimit)
+			{
+				uint seq = ReadU32(&pBuf[pos]);
+				uint hash = HashU32(seq);
+				int ref = table[hash] - 1;
+				table[hash] = pos + 1;
+
+				if (ref < 0 || pos - ref > s_lzMaxOffset || ReadU32(&pBuf[ref]) != seq)
+				{
+					// Skip ahead faster the longer it's been since the last match
+					pos += 1 + ((pos - anchor) >> 6);
+					continue;
+				}
+
+				// Extend the match forward, and back over any literals
+				int length = s_lzMinMatch;
+				while (pos + length < matchLimit && pBuf[ref + length] == pBuf[pos + length])
+					++length;
+				while (pos > anchor && ref > 0 && pBuf[pos - 1] == pBuf[ref - 1])
+				{
+					--pos;
+					--ref;
+					++length;
+				}
+
+				WriteLZSequence(&pBuf[anchor], pos - anchor, pos - ref, length, pEncodedOut);
+				pos += length;
+				anchor = pos;
+
+				// Index a position inside the match, so runs of similar data keep matching
+				if (pos - 2 >= int(dictSize) && pos - 2 + s_lzMinMatch <= end)
+					table[HashU32(ReadU32(&pBuf[pos - 2]))] = pos - 2 + 1;
+			}
+
+			// Everything after the last match goes out as literals
+			WriteLZSequence(pBuf ? &pBuf[anchor] : nullptr, end - anchor, 0, 0, pEncodedOut);
+		}
+
+		static inline bool ReadLZLength(const byte ** ppSrc, const byte * pSrcEnd, size_t * pLength)
+		{
+			byte b;
+			do
+			{
+				if (*ppSrc >= pSrcEnd)
+					return false;
+				b = *(*ppSrc)++;
+				*pLength += b;
+			}
+			while (b == 255);
+			return true;
+		}
+
+		bool DecompressLZ(
+			const byte * pEncoded,
+			size_t encodedSize,
+			const byte * pDict,
+			size_t dictSize,
+			void * pDataOut,
+			size_t sizeBytes)
+		{
+			ASSERT_ERR(pEncoded || encodedSize == 0);
+			ASSERT_ERR(pDict || dictSize == 0);
+			ASSERT_ERR(pDataOut || sizeBytes == 0);
+
+			// The compressor only sees the last 64K of the dictionary
+			if (dictSize > s_lzMaxOffset)
+			{
+				pDict += dictSize - s_lzMaxOffset;
+				dictSize = s_lzMaxOffset;
+			}
+
+			const byte * pSrc = pEncoded;
+			const byte * pSrcEnd = pEncoded + encodedSize;
+			byte * pDst = (byte *)pDataOut;
+			byte * pDstStart = pDst;
+			byte * pDstEnd = pDst + sizeBytes;
+
+			// Every check is against the ends of the buffers, so corrupt data can't run off them
+			for (;;)
+			{
+				if (pSrc >= pSrcEnd)
+					return false;
+				byte token = *pSrc++;
+
+				size_t literalCount = token >> 4;
+				if (literalCount == 15 && !ReadLZLength(&pSrc, pSrcEnd, &literalCount))
+					return false;
+				if (literalCount > size_t(pSrcEnd - pSrc) || literalCount > size_t(pDstEnd - pDst))
+					return false;
+				memcpy(pDst, pSrc, literalCount);
+				pSrc += literalCount;
+				pDst += literalCount;
+
+				if (pSrc == pSrcEnd)
+					break;
+
+				if (pSrcEnd - pSrc < 2)
+					return false;
+				size_t offset = pSrc[0] | (size_t(pSrc[1]) << 8);
+				pSrc += 2;
+
+				size_t length = token & 15;
+				if (length == 15 && !ReadLZLength(&pSrc, pSrcEnd, &length))
+					return false;
+				length += s_lzMinMatch;
+
+				size_t written = pDst - pDstStart;
+				if (offset == 0 || offset > written + dictSize || length > size_t(pDstEnd - pDst))
+					return false;
+
+				// Part of the match in the dictionary
+				if (offset > written)
+				{
+					size_t fromDict = min(length, offset - written);
+					memcpy(pDst, pDict + dictSize - (offset - written), fromDict);
+					pDst += fromDict;
+					length -= fromDict;
+				}
+
+				// The rest in the output so far, in chunks as big as the offset allows without
+				// a chunk overlapping itself
+				const byte * pMatch = pDst - offset;
+				size_t i = 0;
+				if (offset >= 16)
+				{
+					for (; i + 16 <= length; i += 16)
+						_mm_storeu_si128((__m128i *)&pDst[i], _mm_loadu_si128((const __m128i *)&pMatch[i]));
+				}
+				else if (offset >= 8)
+				{
+					for (; i + 8 <= length; i += 8)
+						_mm_storel_epi64((__m128i *)&pDst[i], _mm_loadl_epi64((const __m128i *)&pMatch[i]));
+				}
+				for (; i < length; ++i)
+					pDst[i] = pMatch[i];
+				pDst += length;
+			}
+
+			return (pDst == pDstEnd);
+		}
+
+		// Dictionary training: count how many of the samples each 8-byte sequence appears in,
+		// score each 64-byte segment of each sample by the sequences in it that are shared with
+		// other samples, and fill the dictionary with the best segments.  The best go at the end,
+		// where the offsets to them are shortest.
+
+		static const int s_dictKmer = 8;
+		static const int s_dictSegment = 64;
+
+		void TrainDictionary(
+			const std::vector<const std::vector<byte> *> & samples,
+			size_t maxSize,
+			std::vector<byte> * pDictOut)
+		{
+			ASSERT_ERR(pDictOut);
+
+			pDictOut->clear();
+			if (samples.size() < 2 || maxSize == 0)
+				return;
+
+			// Number of samples containing each sequence, and the last sample counted for it
+			std::unordered_map<u64, std::pair<int, int>> counts;
+			for (int iSample = 0, c = int(samples.size()); iSample < c; ++iSample)
+			{
+				const std::vector<byte> & sample = *samples[iSample];
+				for (size_t i = 0; i + s_dictKmer <= sample.size(); ++i)
+				{
+					u64 kmer;
+					memcpy(&kmer, &sample[i], sizeof(kmer));
+					std::pair<int, int> & count = counts[kmer];
+					if (count.second != iSample + 1)
+					{
+						++count.first;
+						count.second = iSample + 1;
+					}
+				}
+			}
+
+			struct Segment
+			{
+				const byte *	m_pData;
+				int				m_size;
+				int				m_score;
+			};
+			std::vector<Segment> segments;
+			for (int iSample = 0, c = int(samples.size()); iSample < c; ++iSample)
+			{
+				const std::vector<byte> & sample = *samples[iSample];
+				for (size_t start = 0; start < sample.size(); start += s_dictSegment)
+				{
+					int size = int(min(size_t(s_dictSegment), sample.size() - start));
+					int score = 0;
+					for (int i = 0; i + s_dictKmer <= size; ++i)
+					{
+						u64 kmer;
+						memcpy(&kmer, &sample[start + i], sizeof(kmer));
+						score += counts[kmer].first - 1;
+					}
+					if (score > 0)
+					{
+						Segment segment = { &sample[start], size, score };
+						segments.push_back(segment);
+					}
+				}
+			}
+
+			std::stable_sort(segments.begin(), segments.end(),
+				[](const Segment & a, const Segment & b) { return a.m_score > b.m_score; });
+
+			// Take segments best first, skipping repeats of ones already taken
+			std::vector<const Segment *> chosen;
+			std::unordered_set<std::string> seen;
+			size_t size = 0;
+			for (int i = 0, c = int(segments.size()); i < c && size < maxSize; ++i)
+			{
+				const Segment & segment = segments[i];
+				if (size + segment.m_size > maxSize)
+					continue;
+				if (!seen.insert(std::string((const char *)segment.m_pData, segment.m_size)).second)
+					continue;
+				chosen.push_back(&segment);
+				size += segment.m_size;
+			}
+
+			pDictOut->reserve(size);
+			for (int i = int(chosen.size()) - 1; i >= 0; --i)
+				pDictOut->insert(pDictOut->end(), chosen[i]->m_pData, chosen[i]->m_pData + chosen[i]->m_size);
+		}
+
+		// Codec selection: estimated load time is the stored size over disk bandwidth plus
+		// the original size over the codec's decode speed.  Rough figures for a hard drive
+		// and one core; store's copy is counted as free, since the data has to be read anyway.
+
+		static const double s_diskBytesPerSecond = 150e6;
+		static const double s_decodeBytesPerSecond[] =
+		{
+			0.0,			// PACKCODEC_Auto
+			0.0,			// PACKCODEC_Store
+			300e6,			// PACKCODEC_DeflateFast
+			300e6,			// PACKCODEC_Deflate
+			300e6,			// PACKCODEC_DeflateMax
+			2000e6,			// PACKCODEC_LZ
+			1500e6,			// PACKCODEC_LZDict
+		};
+		cassert(dim(s_decodeBytesPerSecond) == PACKCODEC_Count);
+
+		static double EstimateLoadSeconds(PACKCODEC codec, size_t sizeBytes, size_t sizeStored)
+		{
+			double seconds = double(sizeStored) / s_diskBytesPerSecond;
+			if (s_decodeBytesPerSecond[codec] > 0.0)
+				seconds += double(sizeBytes) / s_decodeBytesPerSecond[codec];
+			return seconds;
+		}
+
+		static const size_t s_deflateBlockSize = 256 * 1024;
+		static const size_t s_crcBlockSize = 1024 * 1024;
+
+		static mz_bool AppendToVector(const void * pBuf, int len, void * pUser)
+		{
+			std::vector<byte> * pVec = (std::vector<byte> *)pUser;
+			pVec->insert(pVec->end(), (const byte *)pBuf, (const byte *)pBuf + len);
+			return MZ_TRUE;
+		}
+
+		static bool DeflateRaw(const void * pData, size_t sizeBytes, int level, std::vector<byte> * pEncodedOut)
+		{
+			int flags = tdefl_create_comp_flags_from_zip_params(level, -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY);
+
+			if (sizeBytes < 2 * s_deflateBlockSize)
+			{
+				size_t sizeOut = 0;
+				void * pOut = tdefl_compress_mem_to_heap(pData, sizeBytes, &sizeOut, flags);
+				if (!pOut)
+					return false;
+				pEncodedOut->assign((const byte *)pOut, (const byte *)pOut + sizeOut);
+				mz_free(pOut);
+				return true;
+			}
+
+			int numBlocks = int((sizeBytes + s_deflateBlockSize - 1) / s_deflateBlockSize);
+			std::vector<std::vector<byte>> blocks(numBlocks);
+			std::vector<byte> blockFailed(numBlocks, 0);
+			ParallelFor(numBlocks, 1, [&](int iStart, int iEnd)
+			{
+				// The compressor's a few hundred KB, too big for the stack
+				tdefl_compressor * pComp = (tdefl_compressor *)malloc(sizeof(tdefl_compressor));
+				if (!pComp)
+				{
+					for (int iBlock = iStart; iBlock < iEnd; ++iBlock)
+						blockFailed[iBlock] = 1;
+					return;
+				}
+
+				for (int iBlock = iStart; iBlock < iEnd; ++iBlock)
+				{
+					size_t offset = size_t(iBlock) * s_deflateBlockSize;
+					size_t size = min(s_deflateBlockSize, sizeBytes - offset);
+					bool isLast = (iBlock == numBlocks - 1);
+
+					tdefl_init(pComp, &AppendToVector, &blocks[iBlock], flags);
+					tdefl_status status = tdefl_compress_buffer(
+											pComp, (const byte *)pData + offset, size,
+											isLast ? TDEFL_FINISH : TDEFL_SYNC_FLUSH);
+					if (status != (isLast ? TDEFL_STATUS_DONE : TDEFL_STATUS_OKAY))
+						blockFailed[iBlock] = 1;
+				}
+
+				free(pComp);
+			});
+
+			size_t sizeOut = 0;
+			for (int iBlock = 0; iBlock < numBlocks; ++iBlock)
+			{
+				if (blockFailed[iBlock])
+					return false;
+				sizeOut += blocks[iBlock].size();
+			}
+
+			pEncodedOut->clear();
+			pEncodedOut->reserve(sizeOut);
+			for (int iBlock = 0; iBlock < numBlocks; ++iBlock)
+				pEncodedOut->insert(pEncodedOut->end(), blocks[iBlock].begin(), blocks[iBlock].end());
+			return true;
+		}
+
+		// CRC-32, a word at a time.  Slice-by-16 looks up each of 16 bytes in its own table,
+		// which folds in that byte's effect on the CRC 15, 14, ... 0 bytes further along, so
+		// the lookups don't depend on each other.  With PCLMULQDQ, the bulk of the data is
+		// folded 64 bytes at a time by carry-less multiplies instead, as in Intel's "Fast CRC
+		// Computation for Generic Polynomials Using PCLMULQDQ Instruction", then reduced to
+		// 32 bits; the tables finish off the tail.
+		struct Crc32Tables
+		{
+			mz_uint32	m_table[16][256];
+
+			Crc32Tables()
+			{
+				for (uint i = 0; i < 256; ++i)
+				{
+					mz_uint32 crc = i;
+					for (int j = 0; j < 8; ++j)
+						crc = (crc >> 1) ^ ((crc & 1) ? 0xedb88320 : 0);
+					m_table[0][i] = crc;
+				}
+				for (int k = 1; k < 16; ++k)
+				{
+					for (int i = 0; i < 256; ++i)
+						m_table[k][i] = (m_table[k-1][i] >> 8) ^ m_table[0][m_table[k-1][i] & 0xff];
+				}
+			}
+		};
+
+		// Takes and returns the CRC before the final inversion
+		static mz_uint32 Crc32Slice16(mz_uint32 crc, const byte * p, size_t len)
+		{
+			static const Crc32Tables s_tables;
+			const mz_uint32 (*t)[256] = s_tables.m_table;
+
+			for (; len >= 16; p += 16, len -= 16)
+			{
+				mz_uint32 a = ReadU32(p) ^ crc;
+				mz_uint32 b = ReadU32(p + 4);
+				mz_uint32 c = ReadU32(p + 8);
+				mz_uint32 d = ReadU32(p + 12);
+				crc = t[15][a & 0xff] ^ t[14][(a >> 8) & 0xff] ^ t[13][(a >> 16) & 0xff] ^ t[12][a >> 24] ^
+					  t[11][b & 0xff] ^ t[10][(b >> 8) & 0xff] ^ t[9][(b >> 16) & 0xff] ^ t[8][b >> 24] ^
+					  t[7][c & 0xff] ^ t[6][(c >> 8) & 0xff] ^ t[5][(c >> 16) & 0xff] ^ t[4][c >> 24] ^
+					  t[3][d & 0xff] ^ t[2][(d >> 8) & 0xff] ^ t[1][(d >> 16) & 0xff] ^ t[0][d >> 24];
+			}
+			for (; len > 0; ++p, --len)
+				crc = t[0][(crc ^ *p) & 0xff] ^ (crc >> 8);
+			return crc;
+		}
+
+#if USE_PCLMUL
+		// Folds a multiple of 16 bytes, at least 64.  Takes and returns the CRC before the
+		// final inversion.  The constants are x^n mod P for the fold distances, bit-reflected,
+		// and P itself with its Barrett reduction constant.
+		static mz_uint32 Crc32Pclmul(mz_uint32 crc, const byte * p, size_t len)
+		{
+			ASSERT_ERR(len >= 64 && len % 16 == 0);
+
+			const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+			const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+			const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124);
+			const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+			const __m128i mask32 = _mm_setr_epi32(-1, 0, -1, 0);
+
+			__m128i x1 = _mm_loadu_si128((const __m128i *)(p + 0));
+			__m128i x2 = _mm_loadu_si128((const __m128i *)(p + 16));
+			__m128i x3 = _mm_loadu_si128((const __m128i *)(p + 32));
+			__m128i x4 = _mm_loadu_si128((const __m128i *)(p + 48));
+			x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(int(crc)));
+			p += 64;
+			len -= 64;
+
+			// Four lanes of 128 bits each, folded forward 512 bits at a time
+			for (; len >= 64; p += 64, len -= 64)
+			{
+				__m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+				__m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+				__m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+				__m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+				x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+				x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+				x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+				x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+				x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *)(p + 0)));
+				x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *)(p + 16)));
+				x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *)(p + 32)));
+				x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *)(p + 48)));
+			}
+
+			// Fold the lanes into one, then the rest of the data 128 bits at a time
+			__m128i lanes[3] = { x2, x3, x4 };
+			for (int i = 0; i < 3; ++i)
+			{
+				__m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+				x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+				x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), lanes[i]);
+			}
+			for (; len >= 16; p += 16, len -= 16)
+			{
+				__m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+				x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+				x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *)p));
+			}
+
+			// Fold 128 bits down to 64
+			x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+			x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+			x2 = _mm_srli_si128(x1, 4);
+			x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k5k0, 0x00);
+			x1 = _mm_xor_si128(x1, x2);
+
+			// Barrett reduction to 32 bits
+			x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), poly, 0x10);
+			x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, mask32), poly, 0x00);
+			x1 = _mm_xor_si128(x1, x2);
+
+			return mz_uint32(_mm_cvtsi128_si32(_mm_srli_si128(x1, 4)));
+		}
+#endif
+
+		mz_uint32 UpdateCrc32(mz_uint32 crc, const void * pData, size_t sizeBytes)
+		{
+			ASSERT_ERR(pData || sizeBytes == 0);
+
+			const byte * p = (const byte *)pData;
+			crc = ~crc;
+#if USE_PCLMUL
+			if (sizeBytes >= 64)
+			{
+				size_t sizeFolded = sizeBytes & ~size_t(15);
+				crc = Crc32Pclmul(crc, p, sizeFolded);
+				p += sizeFolded;
+				sizeBytes -= sizeFolded;
+			}
+#endif
+			return ~Crc32Slice16(crc, p, sizeBytes);
+		}
+
+		// Combining CRCs, as in zlib's crc32_combine: appending len2 zero bytes to the first
+		// message is a linear operator on its CRC, applied by repeated squaring of the
+		// operator for one zero bit, as a 32x32 matrix over GF(2).
+		static mz_uint32 Gf2MatrixTimes(const mz_uint32 * mat, mz_uint32 vec)
+		{
+			mz_uint32 sum = 0;
+			for (; vec; vec >>= 1, ++mat)
+			{
+				if (vec & 1)
+					sum ^= *mat;
+			}
+			return sum;
+		}
+
+		static void Gf2MatrixSquare(mz_uint32 * square, const mz_uint32 * mat)
+		{
+			for (int n = 0; n < 32; ++n)
+				square[n] = Gf2MatrixTimes(mat, mat[n]);
+		}
+
+		static mz_uint32 CombineCrc32(mz_uint32 crc1, mz_uint32 crc2, size_t len2)
+		{
+			if (len2 == 0)
+				return crc1;
+
+			mz_uint32 even[32], odd[32];
+			odd[0] = 0xedb88320;			// CRC-32 polynomial
+			for (int n = 1; n < 32; ++n)
+				odd[n] = 1u << (n - 1);
+
+			Gf2MatrixSquare(even, odd);		// Two zero bits
+			Gf2MatrixSquare(odd, even);		// Four zero bits
+
+			// Each pass squares the operator again, starting from one zero byte
+			for (;;)
+			{
+				Gf2MatrixSquare(even, odd);
+				if (len2 & 1)
+					crc1 = Gf2MatrixTimes(even, crc1);
+				len2 >>= 1;
+				if (len2 == 0)
+					break;
+
+				Gf2MatrixSquare(odd, even);
+				if (len2 & 1)
+					crc1 = Gf2MatrixTimes(odd, crc1);
+				len2 >>= 1;
+				if (len2 == 0)
+					break;
+			}
+
+			return crc1 ^ crc2;
+		}
+
+		mz_uint32 ComputeCrc32(const void * pData, size_t sizeBytes)
+		{
+			ASSERT_ERR(pData || sizeBytes == 0);
+
+			if (sizeBytes < 2 * s_crcBlockSize)
+				return UpdateCrc32(MZ_CRC32_INIT, pData, sizeBytes);
+
+			int numBlocks = int((sizeBytes + s_crcBlockSize - 1) / s_crcBlockSize);
+			std::vector<mz_uint32> crcs(numBlocks);
+			ParallelFor(numBlocks, 1, [&](int iStart, int iEnd)
+			{
+				for (int iBlock = iStart; iBlock < iEnd; ++iBlock)
+				{
+					size_t offset = size_t(iBlock) * s_crcBlockSize;
+					size_t size = min(s_crcBlockSize, sizeBytes - offset);
+					crcs[iBlock] = UpdateCrc32(MZ_CRC32_INIT, (const byte *)pData + offset, size);
+				}
+			});
+
+			mz_uint32 crc = crcs[0];
+			for (int iBlock = 1; iBlock < numBlocks; ++iBlock)
+			{
+				size_t offset = size_t(iBlock) * s_crcBlockSize;
+				crc = CombineCrc32(crc, crcs[iBlock], min(s_crcBlockSize, sizeBytes - offset));
+			}
+			return crc;
+		}
+
+		static bool EncodeWithCodec(
+			const void * pData,
+			size_t sizeBytes,
+			PACKCODEC codec,
+			const std::vector<byte> & dict,
+			std::vector<byte> * pEncodedOut)
+		{
+			switch (codec)
+			{
+			case PACKCODEC_DeflateFast:	return DeflateRaw(pData, sizeBytes, MZ_BEST_SPEED, pEncodedOut);
+			case PACKCODEC_Deflate:		return DeflateRaw(pData, sizeBytes, MZ_DEFAULT_LEVEL, pEncodedOut);
+			case PACKCODEC_DeflateMax:	return DeflateRaw(pData, sizeBytes, MZ_BEST_COMPRESSION, pEncodedOut);
+
+			case PACKCODEC_LZ:
+				CompressLZ(pData, sizeBytes, nullptr, 0, pEncodedOut);
+				return true;
+
+			case PACKCODEC_LZDict:
+				if (dict.empty())
+					return false;
+				CompressLZ(pData, sizeBytes, &dict[0], dict.size(), pEncodedOut);
+				return true;
+
+			default:
+				return false;
+			}
+		}
+
+		PACKCODEC EncodeFileForPack(
+			const void * pData,
+			size_t sizeBytes,
+			PACKCODEC codec,
+			const std::vector<byte> & dict,
+			std::vector<byte> * pEncodedOut)
+		{
+			ASSERT_ERR(pData || sizeBytes == 0);
+			ASSERT_ERR(codec >= 0 && codec < PACKCODEC_Count);
+			ASSERT_ERR(pEncodedOut);
+
+			pEncodedOut->clear();
+			if (sizeBytes == 0 || codec == PACKCODEC_Store)
+				return PACKCODEC_Store;
+
+			if (codec != PACKCODEC_Auto)
+			{
+				// A forced codec still falls back to storing if it can't make the file any smaller
+				if (!EncodeWithCodec(pData, sizeBytes, codec, dict, pEncodedOut) ||
+					pEncodedOut->size() >= sizeBytes)
+				{
+					pEncodedOut->clear();
+					return PACKCODEC_Store;
+				}
+				return codec;
+			}
+
+			static const PACKCODEC s_codecsToTry[] = { PACKCODEC_LZ, PACKCODEC_LZDict, PACKCODEC_Deflate, };
+
+			PACKCODEC codecBest = PACKCODEC_Store;
+			double secondsBest = EstimateLoadSeconds(PACKCODEC_Store, sizeBytes, sizeBytes);
+			std::vector<byte> encoded;
+			for (int i = 0; i < dim(s_codecsToTry); ++i)
+			{
+				if (!EncodeWithCodec(pData, sizeBytes, s_codecsToTry[i], dict, &encoded))
+					continue;
+
+				double seconds = EstimateLoadSeconds(s_codecsToTry[i], sizeBytes, encoded.size());
+				if (seconds < secondsBest)
+				{
+					codecBest = s_codecsToTry[i];
+					secondsBest = seconds;
+					pEncodedOut->swap(encoded);
+				}
+			}
+
+			return codecBest;
+		}
+	}
+}
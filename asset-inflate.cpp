@@ -0,0 +1,599 @@
+#include "framework.h"
+#include "asset-internal.h"
+#include <memory>
+
+#include <emmintrin.h>
+
+namespace Framework
+{
+	// Fast inflate for deflated files in asset packs, along the lines of libdeflate.
+	//  * Bits are read through a 64-bit buffer, refilled 8 bytes at a time, so one refill
+	//      covers a whole length/distance pair, or up to three literals in a row.
+	//  * Huffman codes are decoded with one table lookup: each entry has the code length,
+	//      and the literal, or the length or distance base and its number of extra bits.
+	//      Codes longer than the table's index go through a second-level table.
+	//  * Matches are copied 16 or 8 bytes at a time when the distance allows, letting the
+	//      copy run past the end of the match, as long as there's room left in the output.
+	//  * The whole input and output are in memory, so there's no streaming state.  Anything
+	//      malformed, or that this doesn't handle (such as incomplete Huffman codes, other than
+	//      the one-code distance code deflate allows), makes it return false, and the caller
+	//      falls back to miniz, which is the reference.
+
+	namespace AssetCompiler
+	{
+		// Table entry layout
+		enum
+		{
+			HUFF_CodeLengthMask		= 0xff,			// Bits to consume for this entry
+			HUFF_ExtraShift			= 8,			// Extra bits after the code, or second-level table bits
+			HUFF_ExtraMask			= 0xf,
+			HUFF_Invalid			= 1 << 12,
+			HUFF_EndOfBlock			= 1 << 13,
+			HUFF_Subtable			= 1 << 14,
+			HUFF_Literal			= 1 << 15,
+			HUFF_ValueShift			= 16,			// Literal, base length/distance, or second-level table start
+		};
+
+		static const int s_litlenTableBits = 11;
+		static const int s_distTableBits = 8;
+		static const int s_precodeTableBits = 7;
+		static const int s_maxCodeLength = 15;
+		static const int s_numLitlenSyms = 288;
+		static const int s_numDistSyms = 32;
+		static const int s_numPrecodeSyms = 19;
+
+		// Worst case size of each table, with a full second-level table for every symbol
+		static const int s_litlenTableSize = (1 << s_litlenTableBits) + s_numLitlenSyms * (1 << (s_maxCodeLength - s_litlenTableBits));
+		static const int s_distTableSize = (1 << s_distTableBits) + s_numDistSyms * (1 << (s_maxCodeLength - s_distTableBits));
+		static const int s_precodeTableSize = 1 << s_precodeTableBits;
+
+		static const ushort s_lengthBase[] =
+		{
+			3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+			35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+		};
+		static const byte s_lengthExtra[] =
+		{
+			0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+			3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+		};
+		static const ushort s_distBase[] =
+		{
+			1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+			257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+		};
+		static const byte s_distExtra[] =
+		{
+			0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+			7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+		};
+		static const byte s_precodeOrder[s_numPrecodeSyms] =
+		{
+			16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15,
+		};
+
+		static inline uint MakeEntry(uint value, uint extraBits, uint flags)
+		{
+			return (value << HUFF_ValueShift) | (extraBits << HUFF_ExtraShift) | flags;
+		}
+
+		static uint LitlenEntry(int sym)
+		{
+			if (sym < 256)
+				return MakeEntry(sym, 0, HUFF_Literal);
+			if (sym == 256)
+				return MakeEntry(0, 0, HUFF_EndOfBlock);
+			if (sym - 257 < dim(s_lengthBase))
+				return MakeEntry(s_lengthBase[sym - 257], s_lengthExtra[sym - 257], 0);
+			return MakeEntry(0, 0, HUFF_Invalid);
+		}
+
+		static uint DistEntry(int sym)
+		{
+			if (sym < dim(s_distBase))
+				return MakeEntry(s_distBase[sym], s_distExtra[sym], 0);
+			return MakeEntry(0, 0, HUFF_Invalid);
+		}
+
+		static uint PrecodeEntry(int sym)
+		{
+			return MakeEntry(sym, 0, 0);
+		}
+
+		// Build a decode table for a canonical Huffman code from its code lengths.  Codes must
+		// be complete, except that distance codes (allowSingleCode) can have a single one-bit
+		// code, or none at all; the entries no code reaches are left invalid.
+		static bool BuildDecodeTable(
+			const byte * codeLengths,
+			int numSyms,
+			uint (*symbolEntry)(int sym),
+			int tableBits,
+			uint * table,
+			int tableSize,
+			bool allowSingleCode)
+		{
+			int counts[s_maxCodeLength + 1] = {};
+			for (int sym = 0; sym < numSyms; ++sym)
+				++counts[codeLengths[sym]];
+			counts[0] = 0;
+
+			// Reject oversubscribed codes, and incomplete ones apart from the exception above
+			int left = 1;
+			int maxLength = 0;
+			int numCodes = 0;
+			for (int length = 1; length <= s_maxCodeLength; ++length)
+			{
+				left = (left << 1) - counts[length];
+				if (left < 0)
+					return false;
+				if (counts[length] > 0)
+					maxLength = length;
+				numCodes += counts[length];
+			}
+			if (left > 0 && !(allowSingleCode && (numCodes == 0 || (numCodes == 1 && counts[1] == 1))))
+				return false;
+
+			int mainSize = 1 << tableBits;
+			uint invalid = MakeEntry(0, 0, HUFF_Invalid);
+			for (int i = 0; i < mainSize; ++i)
+				table[i] = invalid;
+
+			int nextCode[s_maxCodeLength + 1] = {};
+			for (int length = 1, code = 0; length <= s_maxCodeLength; ++length)
+			{
+				code = (code + counts[length - 1]) << 1;
+				nextCode[length] = code;
+			}
+
+			int subBits = max(0, maxLength - tableBits);
+			int subtableNext = mainSize;
+			for (int sym = 0; sym < numSyms; ++sym)
+			{
+				int length = codeLengths[sym];
+				if (length == 0)
+					continue;
+
+				// Deflate sends codes most significant bit first, so reverse them for lookup
+				int code = nextCode[length]++;
+				int reversed = 0;
+				for (int i = 0; i < length; ++i)
+					reversed |= ((code >> i) & 1) << (length - 1 - i);
+
+				uint entry = symbolEntry(sym);
+				if (length <= tableBits)
+				{
+					for (int i = reversed; i < mainSize; i += 1 << length)
+						table[i] = entry | length;
+					continue;
+				}
+
+				// Longer codes go in a second-level table under their first tableBits bits
+				int prefix = reversed & (mainSize - 1);
+				if (!(table[prefix] & HUFF_Subtable))
+				{
+					if (subtableNext + (1 << subBits) > tableSize)
+						return false;
+					table[prefix] = MakeEntry(subtableNext, subBits, HUFF_Subtable) | tableBits;
+					for (int i = 0; i < (1 << subBits); ++i)
+						table[subtableNext + i] = invalid;
+					subtableNext += 1 << subBits;
+				}
+
+				uint subtableStart = table[prefix] >> HUFF_ValueShift;
+				int lengthRemaining = length - tableBits;
+				for (int i = reversed >> tableBits; i < (1 << subBits); i += 1 << lengthRemaining)
+					table[subtableStart + i] = entry | lengthRemaining;
+			}
+
+			return true;
+		}
+
+		struct InflateTables
+		{
+			uint	m_litlen[s_litlenTableSize];
+			uint	m_dist[s_distTableSize];
+			uint	m_precode[s_precodeTableSize];
+		};
+
+		// Bit reader.  Past the end of the input it reads zeros, counting how many bytes it's
+		// made up, so it can tell at the end whether any of them were actually used.
+		struct BitReader
+		{
+			const byte *	m_pIn;
+			const byte *	m_pInEnd;
+			u64				m_bitbuf;
+			int				m_bitsLeft;
+			int				m_overread;
+
+			void RefillFast()
+			{
+				u64 word;
+				memcpy(&word, m_pIn, sizeof(word));
+				m_bitbuf |= word << m_bitsLeft;
+				m_pIn += (63 - m_bitsLeft) >> 3;
+				m_bitsLeft |= 56;
+			}
+
+			void Refill()
+			{
+				if (m_pInEnd - m_pIn >= 8)
+				{
+					RefillFast();
+					return;
+				}
+				while (m_bitsLeft <= 56)
+				{
+					if (m_pIn < m_pInEnd)
+						m_bitbuf |= u64(*m_pIn++) << m_bitsLeft;
+					else
+						++m_overread;
+					m_bitsLeft += 8;
+				}
+			}
+
+			uint Peek(int bits) const
+				{ return uint(m_bitbuf & ((u64(1) << bits) - 1)); }
+			void Consume(int bits)
+				{ m_bitbuf >>= bits; m_bitsLeft -= bits; }
+			uint Read(int bits)
+				{ uint value = Peek(bits); Consume(bits); return value; }
+
+			bool OverreadTooFar() const
+				{ return m_overread > 8; }
+		};
+
+		static inline uint DecodeEntry(BitReader * pBits, const uint * table, int tableBits)
+		{
+			uint entry = table[pBits->Peek(tableBits)];
+			if (entry & HUFF_Subtable)
+			{
+				pBits->Consume(tableBits);
+				int subBits = (entry >> HUFF_ExtraShift) & HUFF_ExtraMask;
+				entry = table[(entry >> HUFF_ValueShift) + pBits->Peek(subBits)];
+			}
+			return entry;
+		}
+
+		// Read the value of a length or distance entry, including its extra bits
+		static inline uint ReadEntryValue(BitReader * pBits, uint entry)
+		{
+			int codeLength = entry & HUFF_CodeLengthMask;
+			int extraBits = (entry >> HUFF_ExtraShift) & HUFF_ExtraMask;
+			uint value = (entry >> HUFF_ValueShift) + uint((pBits->m_bitbuf >> codeLength) & ((u64(1) << extraBits) - 1));
+			pBits->Consume(codeLength + extraBits);
+			return value;
+		}
+
+		static inline void CopyMatch(byte * pOut, size_t dist, size_t length)
+		{
+			const byte * pSrc = pOut - dist;
+			for (size_t i = 0; i < length; ++i)
+				pOut[i] = pSrc[i];
+		}
+
+		// Copy a match, rounding its length up to a whole number of chunks; needs up to 16
+		// bytes of room past the end of the match in the output
+		static inline void CopyMatchWide(byte * pOut, size_t dist, size_t length)
+		{
+			const byte * pSrc = pOut - dist;
+			if (dist >= 16)
+			{
+				for (size_t i = 0; i < length; i += 16)
+					_mm_storeu_si128((__m128i *)&pOut[i], _mm_loadu_si128((const __m128i *)&pSrc[i]));
+			}
+			else if (dist >= 8)
+			{
+				for (size_t i = 0; i < length; i += 8)
+					_mm_storel_epi64((__m128i *)&pOut[i], _mm_loadl_epi64((const __m128i *)&pSrc[i]));
+			}
+			else if (dist == 1)
+			{
+				memset(pOut, pSrc[0], length);
+			}
+			else
+			{
+				// Short distances repeat a pattern, so once the first copy of it that's at
+				// least 8 bytes long is written, the rest can be copied from that far back
+				size_t period = dist * ((8 + dist - 1) / dist);
+				size_t head = min(length, period);
+				CopyMatch(pOut, dist, head);
+				for (size_t i = head; i < length; i += 8)
+					_mm_storel_epi64((__m128i *)&pOut[i], _mm_loadl_epi64((const __m128i *)&pOut[i - period]));
+			}
+		}
+
+		static bool ReadDynamicTables(BitReader * pBits, InflateTables * pTables)
+		{
+			pBits->Refill();
+			int numLitlen = int(pBits->Read(5)) + 257;
+			int numDist = int(pBits->Read(5)) + 1;
+			int numPrecode = int(pBits->Read(4)) + 4;
+			if (numLitlen > 286)
+				return false;
+
+			byte precodeLengths[s_numPrecodeSyms] = {};
+			for (int i = 0; i < numPrecode; ++i)
+			{
+				if ((i & 7) == 0)
+					pBits->Refill();
+				precodeLengths[s_precodeOrder[i]] = byte(pBits->Read(3));
+			}
+			if (!BuildDecodeTable(precodeLengths, s_numPrecodeSyms, &PrecodeEntry, s_precodeTableBits, pTables->m_precode, s_precodeTableSize, false))
+				return false;
+
+			// Code lengths for both codes run together, with run-length codes 16-18
+			byte lengths[s_numLitlenSyms + s_numDistSyms] = {};
+			for (int i = 0; i < numLitlen + numDist; )
+			{
+				pBits->Refill();
+				if (pBits->OverreadTooFar())
+					return false;
+
+				uint entry = pTables->m_precode[pBits->Peek(s_precodeTableBits)];
+				if (entry & HUFF_Invalid)
+					return false;
+				pBits->Consume(entry & HUFF_CodeLengthMask);
+				int sym = int(entry >> HUFF_ValueShift);
+
+				int repeatLength, repeatCount;
+				if (sym < 16)
+				{
+					lengths[i++] = byte(sym);
+					continue;
+				}
+				else if (sym == 16)
+				{
+					if (i == 0)
+						return false;
+					repeatLength = lengths[i - 1];
+					repeatCount = 3 + int(pBits->Read(2));
+				}
+				else if (sym == 17)
+				{
+					repeatLength = 0;
+					repeatCount = 3 + int(pBits->Read(3));
+				}
+				else
+				{
+					repeatLength = 0;
+					repeatCount = 11 + int(pBits->Read(7));
+				}
+
+				if (i + repeatCount > numLitlen + numDist)
+					return false;
+				for (int j = 0; j < repeatCount; ++j)
+					lengths[i++] = byte(repeatLength);
+			}
+
+			// There has to be an end-of-block code
+			if (lengths[256] == 0)
+				return false;
+
+			byte distLengths[s_numDistSyms] = {};
+			memcpy(distLengths, &lengths[numLitlen], numDist);
+			memset(&lengths[numLitlen], 0, numDist);
+
+			return BuildDecodeTable(lengths, s_numLitlenSyms, &LitlenEntry, s_litlenTableBits, pTables->m_litlen, s_litlenTableSize, false) &&
+					BuildDecodeTable(distLengths, s_numDistSyms, &DistEntry, s_distTableBits, pTables->m_dist, s_distTableSize, true);
+		}
+
+		static bool BuildFixedTables(InflateTables * pTables)
+		{
+			byte lengths[s_numLitlenSyms];
+			for (int i = 0; i < s_numLitlenSyms; ++i)
+				lengths[i] = (i < 144) ? 8 : (i < 256) ? 9 : (i < 280) ? 7 : 8;
+			byte distLengths[s_numDistSyms];
+			memset(distLengths, 5, sizeof(distLengths));
+
+			return BuildDecodeTable(lengths, s_numLitlenSyms, &LitlenEntry, s_litlenTableBits, pTables->m_litlen, s_litlenTableSize, false) &&
+					BuildDecodeTable(distLengths, s_numDistSyms, &DistEntry, s_distTableBits, pTables->m_dist, s_distTableSize, true);
+		}
+
+		// Decode one Huffman-coded block.  Works on its own copy of the bit reader, so the
+		// compiler can keep it in registers across the byte stores to the output.
+		static bool DecodeHuffmanBlock(
+			BitReader * pBitsInOut,
+			const InflateTables * pTables,
+			const byte * pInFastEnd,
+			byte * pOutStart,
+			byte * pOutFastEnd,
+			byte * pOutEnd,
+			byte ** ppOut)
+		{
+			BitReader bits = *pBitsInOut;
+			byte * pOut = *ppOut;
+			const uint * litlen = pTables->m_litlen;
+			const uint * dist = pTables->m_dist;
+			uint litlenMask = (1u << s_litlenTableBits) - 1;
+			bool blockDone = false;
+
+			// Fast loop: no bounds checks on input or output
+			while (!blockDone && bits.m_pIn < pInFastEnd && pOut < pOutFastEnd)
+			{
+				bits.RefillFast();
+				uint entry = litlen[bits.m_bitbuf & litlenMask];
+
+				// Up to three literals per refill, at 15 bits each
+				if (entry & HUFF_Literal)
+				{
+					bits.Consume(entry & HUFF_CodeLengthMask);
+					*pOut++ = byte(entry >> HUFF_ValueShift);
+					entry = litlen[bits.m_bitbuf & litlenMask];
+					if (entry & HUFF_Literal)
+					{
+						bits.Consume(entry & HUFF_CodeLengthMask);
+						*pOut++ = byte(entry >> HUFF_ValueShift);
+						entry = litlen[bits.m_bitbuf & litlenMask];
+						if (entry & HUFF_Literal)
+						{
+							bits.Consume(entry & HUFF_CodeLengthMask);
+							*pOut++ = byte(entry >> HUFF_ValueShift);
+							continue;
+						}
+					}
+					bits.RefillFast();
+				}
+
+				if (entry & HUFF_Subtable)
+				{
+					bits.Consume(s_litlenTableBits);
+					int subBits = (entry >> HUFF_ExtraShift) & HUFF_ExtraMask;
+					entry = litlen[(entry >> HUFF_ValueShift) + bits.Peek(subBits)];
+					if (entry & HUFF_Literal)
+					{
+						bits.Consume(entry & HUFF_CodeLengthMask);
+						*pOut++ = byte(entry >> HUFF_ValueShift);
+						continue;
+					}
+				}
+
+				if (entry & (HUFF_EndOfBlock | HUFF_Invalid))
+				{
+					if (entry & HUFF_Invalid)
+						return false;
+					bits.Consume(entry & HUFF_CodeLengthMask);
+					blockDone = true;
+					break;
+				}
+
+				// Length and distance fit in the rest of the buffer: at most 20 bits
+				// used so far, then 15 + 13 for the distance
+				uint length = ReadEntryValue(&bits, entry);
+				uint entryDist = DecodeEntry(&bits, dist, s_distTableBits);
+				if (entryDist & HUFF_Invalid)
+					return false;
+				size_t distance = ReadEntryValue(&bits, entryDist);
+				if (distance > size_t(pOut - pOutStart))
+					return false;
+
+				CopyMatchWide(pOut, distance, length);
+				pOut += length;
+			}
+
+			// Careful loop, for the ends of the buffers
+			while (!blockDone)
+			{
+				bits.Refill();
+				if (bits.OverreadTooFar())
+					return false;
+
+				uint entry = DecodeEntry(&bits, litlen, s_litlenTableBits);
+				if (entry & HUFF_Invalid)
+					return false;
+				if (entry & HUFF_Literal)
+				{
+					if (pOut >= pOutEnd)
+						return false;
+					bits.Consume(entry & HUFF_CodeLengthMask);
+					*pOut++ = byte(entry >> HUFF_ValueShift);
+					continue;
+				}
+				if (entry & HUFF_EndOfBlock)
+				{
+					bits.Consume(entry & HUFF_CodeLengthMask);
+					blockDone = true;
+					break;
+				}
+
+				uint length = ReadEntryValue(&bits, entry);
+				bits.Refill();
+				uint entryDist = DecodeEntry(&bits, dist, s_distTableBits);
+				if (entryDist & HUFF_Invalid)
+					return false;
+				size_t distance = ReadEntryValue(&bits, entryDist);
+				if (distance > size_t(pOut - pOutStart) || length > size_t(pOutEnd - pOut))
+					return false;
+
+				CopyMatch(pOut, distance, length);
+				pOut += length;
+			}
+
+			*pBitsInOut = bits;
+			*ppOut = pOut;
+			return true;
+		}
+
+		bool InflateFast(
+			const byte * pCompressed,
+			size_t compressedSize,
+			void * pDataOut,
+			size_t sizeBytes)
+		{
+			ASSERT_ERR(pCompressed || compressedSize == 0);
+			ASSERT_ERR(pDataOut || sizeBytes == 0);
+
+			std::unique_ptr<InflateTables> pTables(new InflateTables);
+
+			BitReader bits = { pCompressed, pCompressed + compressedSize, 0, 0, 0 };
+			byte * pOutStart = (byte *)pDataOut;
+			byte * pOut = pOutStart;
+			byte * pOutEnd = pOutStart + sizeBytes;
+
+			// The fast loop runs while there's enough input to refill without checking, and
+			// enough output for a maximum-length match rounded up to a chunk, after a few literals
+			static const size_t s_outputMargin = 258 + 16 + 3;
+			const byte * pInFastEnd = (compressedSize >= 16) ? pCompressed + compressedSize - 16 : pCompressed;
+			byte * pOutFastEnd = (sizeBytes >= s_outputMargin) ? pOutEnd - s_outputMargin : pOutStart;
+
+			bool isFinal = false;
+			while (!isFinal)
+			{
+				bits.Refill();
+				isFinal = (bits.Read(1) != 0);
+				uint blockType = bits.Read(2);
+
+				if (blockType == 0)
+				{
+					// Stored block: back up to the byte boundary, and copy straight from the input
+					bits.Consume(bits.m_bitsLeft & 7);
+					int bytesInBuffer = bits.m_bitsLeft >> 3;
+					if (bytesInBuffer < bits.m_overread)
+						return false;
+					bits.m_pIn -= bytesInBuffer - bits.m_overread;
+					bits.m_bitbuf = 0;
+					bits.m_bitsLeft = 0;
+					bits.m_overread = 0;
+
+					if (bits.m_pInEnd - bits.m_pIn < 4)
+						return false;
+					uint length = bits.m_pIn[0] | (uint(bits.m_pIn[1]) << 8);
+					uint lengthComplement = bits.m_pIn[2] | (uint(bits.m_pIn[3]) << 8);
+					bits.m_pIn += 4;
+					if (length != (~lengthComplement & 0xffff) ||
+						length > size_t(bits.m_pInEnd - bits.m_pIn) ||
+						length > size_t(pOutEnd - pOut))
+					{
+						return false;
+					}
+					memcpy(pOut, bits.m_pIn, length);
+					bits.m_pIn += length;
+					pOut += length;
+					continue;
+				}
+				else if (blockType == 1)
+				{
+					if (!BuildFixedTables(pTables.get()))
+						return false;
+				}
+				else if (blockType == 2)
+				{
+					if (!ReadDynamicTables(&bits, pTables.get()))
+						return false;
+				}
+				else
+				{
+					return false;
+				}
+
+				if (!DecodeHuffmanBlock(&bits, pTables.get(), pInFastEnd, pOutStart, pOutFastEnd, pOutEnd, &pOut))
+					return false;
+			}
+
+			// Any made-up bytes past the end of the input have to still be in the buffer, unused
+			if (bits.m_overread > (bits.m_bitsLeft >> 3))
+				return false;
+
+			return (pOut == pOutEnd);
+		}
+	}
+}
@@ -3,6 +3,8 @@
 #define MINIZ_HEADER_FILE_ONLY
 #include "miniz.c"
 
+#include <functional>
+
 namespace Framework
 {
 	// Infrastructure for compiling art source files (such as Wavefront .obj meshes, and
@@ -16,33 +18,56 @@ namespace Framework
 	//      result in a directory "foo/bar/baz.obj/" with files in it for verts, indices, etc.
 	//
 	//  * Compiled data is considered out-of-date and recompiled if the mod time of the source
-	//      file is newer than the mod time of the asset pack (the .zip).
+	//      file is newer than the mod time of the asset pack (the .zip), or if the asset's
+	//      flags and settings differ from the ones stored with it.  Assets compiled from other
+	//      files as well, like material libs that generate textures from their materials'
+	//      maps, list those in a "deps" file, and they're checked the same way.
+	//
+	//  * Quality profiles are compiled to sibling packs from the same sources, with each
+	//      profile's limits applied on top of the assets' own settings.
 	//
 	//  * Version numbers for the whole pack system and each asset type are also stored in the
 	//      .zip, and mismatches will trigger recompilation.
 	//
+	//  * Each file is stored with whichever codec should load it fastest (see asset-codec.cpp),
+	//      unless its asset type overrides that.  Images' pixel data is row-filtered like PNG
+	//      and deflated.  Files encoded with anything the .zip format doesn't know about have
+	//      a .zip comment saying how, and loading a pack decodes everything into memory.
+	//
+	//  * Small files are held back until the end of a compile, then used to train a dictionary
+	//      that's stored in the pack, so they can be compressed against one another.
+	//
+	//  * Files with identical contents are only stored once per pack.  Later copies are
+	//      zero-size entries whose .zip comment is "alias:" followed by the path of the first,
+	//      and they're resolved to the same bytes when the pack is loaded.
+	//
 	//  !!!UNDONE: build the list of sources to compile by following dependencies from some root.
 
 	namespace AssetCompiler
 	{
 		enum PACKVER
 		{
-			PACKVER_Current = 3,
+			PACKVER_Current = 6,
 		};
 
 		enum MESHVER
 		{
-			MESHVER_Current = 5,
+			MESHVER_Current = 9,
 		};
 
 		enum MTLVER
 		{
-			MTLVER_Current = 4,
+			MTLVER_Current = 8,
 		};
 
 		enum TEXVER
 		{
-			TEXVER_Current = 1,
+			TEXVER_Current = 5,
+		};
+
+		enum SCENEVER
+		{
+			SCENEVER_Current = 1,
 		};
 
 		struct VersionInfo
@@ -51,18 +76,51 @@ namespace Framework
 			MESHVER		m_meshver;
 			MTLVER		m_mtlver;
 			TEXVER		m_texver;
+			SCENEVER	m_scenever;
 		};
 
+		// How a file's data is compressed in an asset pack
+		enum PACKCODEC
+		{
+			PACKCODEC_Auto,			// Whichever is estimated to load fastest
+			PACKCODEC_Store,
+			PACKCODEC_DeflateFast,
+			PACKCODEC_Deflate,
+			PACKCODEC_DeflateMax,
+			PACKCODEC_LZ,			// Faster to decode than deflate, but not as small
+			PACKCODEC_LZDict,		// LZ, against the pack's dictionary
+
+			PACKCODEC_Count
+		};
+
+		// Check that an asset pack's assets are all present and up to date, and compile
+		// any that aren't (or the whole pack, if it doesn't exist yet).
+		bool CompileAssetPackIfOutOfDate(
+			const char * packPath,
+			const AssetCompileInfo * assets,
+			int numAssets);
+
+		// Get the total uncompressed size of a pack's files, from its directory.
+		bool GetAssetPackDataSize(
+			const char * packPath,
+			i64 * pBytesOut);
+
 		// Load an asset pack file from a zip stream (can be in memory or a file).
+		// If a content store is given, files already loaded by other packs are shared with them.
+		// If verifyCrcs is set, each file's data is checked against the CRC in the directory.
 		bool LoadAssetPackFromZip(
 			mz_zip_archive * pZip,
-			AssetPack * pPackOut);
+			AssetPack * pPackOut,
+			AssetContentStore * pStore = nullptr,
+			bool verifyCrcs = false);
 
 		// Ensure that filenames are printable-ASCII-only, lowercase, and there are no backslashes
 		// (this should really be generalized to allow UTF-8 printable chars)
 		bool NormalizePath(char * path);
 
-		// Write a memory buffer out to an asset pack .zip file.
+		// Write a memory buffer out to an asset pack .zip file, compressed with whichever codec
+		// suits it.  If the zip is being deduplicated and an identical buffer has already been
+		// written to it, this writes an alias instead.
 		bool WriteAssetDataToZip(
 			const char * assetPath,
 			const char * assetSuffix,
@@ -70,6 +128,141 @@ namespace Framework
 			size_t sizeBytes,
 			mz_zip_archive * pZipOut);
 
+		// Write an image out to an asset pack .zip file.  The rows are filtered to make them more
+		// compressible and then deflated, and LoadAssetPackFromZip undoes both, so it reads back
+		// the same as if it had been written with WriteAssetDataToZip.
+		bool WriteImageRowsToZip(
+			const char * assetPath,
+			const char * assetSuffix,
+			const void * pPixels,
+			int2 dims,
+			int bytesPerPixel,
+			mz_zip_archive * pZipOut);
+
+		// Where the asset compilers write their output.  A .zip sink makes a pack file, as above;
+		// a memory sink fills in an AssetPack directly, for apps that compile and load assets
+		// in one step, with no encoding, .zip or decoding in between.
+		class AssetSink
+		{
+		public:
+			virtual			~AssetSink() {}
+
+			// Write a memory buffer as a file of the pack
+			virtual bool	WriteAssetData(
+								const char * assetPath,
+								const char * assetSuffix,
+								const void * pData,
+								size_t sizeBytes) = 0;
+
+			// Write an image; reads back the same as WriteAssetData, but a .zip compresses it better
+			virtual bool	WriteImageRows(
+								const char * assetPath,
+								const char * assetSuffix,
+								const void * pPixels,
+								int2 dims,
+								int bytesPerPixel) = 0;
+		};
+
+		struct PackWriteState;
+
+		// Given the state for the whole pack being written, files are deduplicated and small
+		// ones held back for the pack's dictionary until it's finished (see asset.cpp).
+		class ZipAssetSink : public AssetSink
+		{
+		public:
+			mz_zip_archive *	m_pZip;
+			PackWriteState *	m_pState;
+
+							ZipAssetSink(mz_zip_archive * pZip, PackWriteState * pState = nullptr);
+			virtual bool	WriteAssetData(const char * assetPath, const char * assetSuffix, const void * pData, size_t sizeBytes);
+			virtual bool	WriteImageRows(const char * assetPath, const char * assetSuffix, const void * pPixels, int2 dims, int bytesPerPixel);
+		};
+
+		// Appends each file to the pack's data and directory as it's written
+		class MemoryAssetSink : public AssetSink
+		{
+		public:
+			AssetPack *		m_pPack;
+
+							MemoryAssetSink(AssetPack * pPack);
+			virtual bool	WriteAssetData(const char * assetPath, const char * assetSuffix, const void * pData, size_t sizeBytes);
+			virtual bool	WriteImageRows(const char * assetPath, const char * assetSuffix, const void * pPixels, int2 dims, int bytesPerPixel);
+		};
+
+		// Record the other source files an asset was compiled from, so it's recompiled when
+		// they change too.  Duplicates are fine, and nothing's written if the list is empty.
+		bool WriteAssetDepsToSink(
+			const char * assetPath,
+			const std::vector<std::string> & pathsDep,
+			AssetSink * pSinkOut);
+
+		// Write the pack's version info and manifest (newline-delimited list of asset names),
+		// which LoadAssetPackFromZip checks for.
+		bool WritePackInfoToSink(
+			const std::string & manifest,
+			AssetSink * pSinkOut);
+
+		// PNG-style row filtering for images in asset packs; see asset-rowfilter.cpp.
+		// The filtered data has a filter byte at the start of each row.
+		void FilterRows(
+			const void * pPixels,
+			int2 dims,
+			int bytesPerPixel,
+			byte * pFilteredOut);
+		void UnfilterRows(
+			const byte * pFiltered,
+			int2 dims,
+			int bytesPerPixel,
+			void * pPixelsOut);
+
+		// Codecs for asset packs; see asset-codec.cpp.  EncodeFileForPack returns the codec it
+		// used, which is PACKCODEC_Store if the data's best left as it is; deflated data is raw
+		// deflate, to be stored in the .zip as already compressed.
+		PACKCODEC EncodeFileForPack(
+			const void * pData,
+			size_t sizeBytes,
+			PACKCODEC codec,
+			const std::vector<byte> & dict,
+			std::vector<byte> * pEncodedOut);
+		void CompressLZ(
+			const void * pData,
+			size_t sizeBytes,
+			const byte * pDict,
+			size_t dictSize,
+			std::vector<byte> * pEncodedOut);
+		bool DecompressLZ(
+			const byte * pEncoded,
+			size_t encodedSize,
+			const byte * pDict,
+			size_t dictSize,
+			void * pDataOut,
+			size_t sizeBytes);
+		void TrainDictionary(
+			const std::vector<const std::vector<byte> *> & samples,
+			size_t maxSize,
+			std::vector<byte> * pDictOut);
+
+		// CRC-32 as .zip uses it, continuing from crc (MZ_CRC32_INIT to start), like mz_crc32
+		// but faster; see asset-codec.cpp
+		mz_uint32 UpdateCrc32(
+			mz_uint32 crc,
+			const void * pData,
+			size_t sizeBytes);
+
+		// CRC-32 as .zip uses it, computed across threads for big buffers
+		mz_uint32 ComputeCrc32(
+			const void * pData,
+			size_t sizeBytes);
+
+		// Inflate a raw deflate stream, entirely in memory, faster than miniz does; see
+		// asset-inflate.cpp.  Returns false for anything it can't decode, in which case the
+		// caller should fall back to miniz.
+		bool InflateFast(
+			const byte * pCompressed,
+			size_t compressedSize,
+			void * pDataOut,
+			size_t sizeBytes);
+
 		// Parse an asset pack manifest (newline-delimited list of names) into a set structure.
 		void ParseManifest(
 			const char * manifest,
@@ -89,6 +282,14 @@ namespace Framework
 			int numAssets,
 			mz_zip_archive * pZipOut);
 
+		// Compile assets straight into an AssetPack in memory, through a MemoryAssetSink.  The
+		// pack gets the assets' files and manifest, but no version info or settings, since it's
+		// never checked for being out of date.
+		bool CompileAssetsToPack(
+			const AssetCompileInfo * assets,
+			int numAssets,
+			AssetPack * pPackOut);
+
 		// Check if any assets in a pack are out of date by version number or mod time,
 		// returning a list of ones that need updating (as indices into the assets array).
 		bool FindOutOfDateAssets(
@@ -104,5 +305,18 @@ namespace Framework
 			const AssetCompileInfo * assets,
 			int numAssets,
 			std::vector<int> const & assetsToUpdate);
+
+		// Rewrite an asset pack in-place with the given files first, in that order, and the rest
+		// after them in their existing order.  Files are copied as they are, not recompressed.
+		bool RewriteAssetPackInOrder(
+			const char * packPath,
+			std::vector<std::string> const & pathsFirst);
+
+		// Split [0, count) into chunks of at least grainSize and run them across all cores.
+		// Blocks until they're all done.
+		void ParallelFor(
+			int count,
+			int grainSize,
+			const std::function<void (int iStart, int iEnd)> & func);
 	}
 }
@@ -6,7 +6,13 @@
 namespace Framework
 {
 	// Infrastructure for compiling Wavefront .obj files to vertex/index buffers.
-	//  * Currently uses hard-coded Vertex structure.
+	//  * Binary glTF (.glb) and binary PLY files are also supported; their parsers read
+	//      the binary vertex/index data in place and fill out the same Context, so they
+	//      go through all the same processing below.
+	//  * Vertex attributes are chosen per asset (ACF_VertexNoNormals, ACF_VertexNoUVs,
+	//      ACF_VertexTangents).  Processing is done on the full Vertex struct; deduplication
+	//      and vertex packing are instantiated per attribute set, so they only look at and
+	//      write out the attributes the asset asked for.
 	//  * Creates a single vertex buffer and index buffer, plus a material map that
 	//      identifies which faces get drawn with each material.
 	//  * Groups together all faces with the same material into a contiguous
@@ -14,14 +20,27 @@ namespace Framework
 	//  * Removes degenerate triangles.
 	//  * Deduplicates verts.
 	//  * Generates normals if necessary.
+	//  * Optionally splits positions into their own vertex stream (ACF_SplitVertexStreams),
+	//      for depth-only passes.
+	//  * Also creates a depth-only index buffer, in which all opaque materials are merged into
+	//      one range with positions welded across UV/normal seams, followed by the alpha-tested
+	//      ranges (which still need their UVs).  Alpha-tested materials are found by reading
+	//      the .mtl libraries the .obj references, and changes to them trigger recompiling the mesh.
 	//  * !!!UNDONE: Vertex cache optimization.
 
 	namespace OBJMeshCompiler
 	{
 		static const char * s_suffixMeta		= "/meta";
-		static const char * s_suffixVerts		= "/verts";
 		static const char * s_suffixIndices		= "/indices";
 		static const char * s_suffixMtlMap		= "/material_map";
+		static const char * s_suffixDepthIndices	= "/depth_indices";
+		static const char * s_suffixDepthMtlMap		= "/depth_material_map";
+
+		static const char * s_suffixVerts[VLAYOUT_Count][VSTREAM_Count] =
+		{
+			{ "/verts", nullptr, },						// VLAYOUT_Interleaved
+			{ "/verts_pos", "/verts_attribs", },		// VLAYOUT_Split
+		};
 
 		struct MtlRange
 		{
@@ -36,47 +55,79 @@ namespace Framework
 			std::vector<MtlRange>	m_mtlRanges;
 			box3					m_bounds;
 			bool					m_hasNormals;
+			int						m_vattribs;			// Combination of VATTR flags
+			std::vector<std::string>	m_mtlLibPaths;
+			std::unordered_set<std::string>	m_mtlsAlphaTest;
+
+			// Depth-only index buffer; opaque range is [0, m_depthOpaqueIndexCount),
+			// then m_depthMtlRanges has the alpha-tested ranges
+			std::vector<int>		m_depthIndices;
+			std::vector<MtlRange>	m_depthMtlRanges;
+			int						m_depthOpaqueIndexCount;
 		};
 
 		struct Meta
 		{
-			// Later: vertex format info
-
+			VLAYOUT			m_vlayout;
+			int				m_vattribs;
 			box3			m_bounds;
+			int				m_depthOpaqueIndexCount;
 		};
 
 		// Prototype various helper functions
+		bool CompileMeshFromContext(
+				const AssetCompileInfo * pACI,
+				Context * pCtx,
+				AssetCompiler::AssetSink * pSinkOut);
 		bool ParseOBJ(const char * path, Context * pCtxOut);
 		void RemoveDegenerateTriangles(Context * pCtx);
 		void RemoveEmptyMaterialRanges(Context * pCtx);
 		void DeduplicateVerts(Context * pCtx);
 		void CalculateNormals(Context * pCtx);
 		void NormalizeNormals(Context * pCtx);
-#if VERTEX_TANGENT
+		void CalculateBounds(Context * pCtx);
 		void CalculateTangents(Context * pCtx);
-#endif
 		void SortMaterials(Context * pCtx);
 		void SortTrianglesForVertexCache(Context * pCtx);
 		void SortVerticesForMemoryCache(Context * pCtx);
 		float ComputeACMR(const Context * pCtx, int cacheSize = 32);
 
-		void SerializeMaterialMap(Context * pCtx, std::vector<byte> * pDataOut);
+		void BuildDepthIndices(Context * pCtx, const std::unordered_set<std::string> & mtlsAlphaTest);
+		void PackVertexStreams(
+				const Context * pCtx,
+				VLAYOUT vlayout,
+				std::vector<byte> aStreamsOut[VSTREAM_Count]);
+		void SerializeMaterialMap(const std::vector<MtlRange> & mtlRanges, std::vector<byte> * pDataOut);
+	}
+
+	namespace GLBMeshCompiler
+	{
+		bool ParseGLB(const char * path, OBJMeshCompiler::Context * pCtxOut);
+	}
+
+	namespace PLYMeshCompiler
+	{
+		bool ParsePLY(const char * path, OBJMeshCompiler::Context * pCtxOut);
+	}
+
+	namespace OBJMtlLibCompiler
+	{
+		bool FindAlphaTestedMaterials(const char * path, std::unordered_set<std::string> * pMtlNamesOut);
 	}
 
 
 
-	// Compiler entry point
+	// Compiler entry points
 
 	bool CompileOBJMeshAsset(
 		const AssetCompileInfo * pACI,
-		mz_zip_archive * pZipOut)
+		AssetCompiler::AssetSink * pSinkOut)
 	{
 		ASSERT_ERR(pACI);
 		ASSERT_ERR(pACI->m_pathSrc);
 		ASSERT_ERR(pACI->m_ack == ACK_OBJMesh);
-		ASSERT_ERR(pZipOut);
+		ASSERT_ERR(pSinkOut);
 
-		using namespace AssetCompiler;
 		using namespace OBJMeshCompiler;
 
 		// Read the mesh data from the OBJ file
@@ -84,51 +135,165 @@ namespace Framework
 		if (!ParseOBJ(pACI->m_pathSrc, &ctx))
 			return false;
 
-		// Clean up the mesh
-		SortMaterials(&ctx);
-		RemoveDegenerateTriangles(&ctx);
-		RemoveEmptyMaterialRanges(&ctx);
-		DeduplicateVerts(&ctx);
-		if (!ctx.m_hasNormals)
-			CalculateNormals(&ctx);
-		NormalizeNormals(&ctx);
-#if VERTEX_TANGENT
-		CalculateTangents(&ctx);
-#endif
-		SortTrianglesForVertexCache(&ctx);
-		SortVerticesForMemoryCache(&ctx);
+		// Find out which materials are alpha-tested, from the .mtl libraries the .obj references
+		for (int i = 0, c = int(ctx.m_mtlLibPaths.size()); i < c; ++i)
+		{
+			if (!OBJMtlLibCompiler::FindAlphaTestedMaterials(ctx.m_mtlLibPaths[i].c_str(), &ctx.m_mtlsAlphaTest))
+			{
+				WARN("%s: couldn't read material library %s; assuming its materials are opaque for depth-only passes",
+					pACI->m_pathSrc, ctx.m_mtlLibPaths[i].c_str());
+			}
+		}
 
-#if 0
-		// This can take awhile on a big mesh, so it's commented out by default
-		LOG("%s ACMR: %0.2f", pACI->m_pathSrc, ComputeACMR(&ctx));
-#endif
+		return CompileMeshFromContext(pACI, &ctx, pSinkOut) &&
+			   AssetCompiler::WriteAssetDepsToSink(pACI->m_pathSrc, ctx.m_mtlLibPaths, pSinkOut);
+	}
 
-		// Fill out the metadata struct
-		Meta meta =
-		{
-			ctx.m_bounds,
-		};
+	bool CompileGLBMeshAsset(
+		const AssetCompileInfo * pACI,
+		AssetCompiler::AssetSink * pSinkOut)
+	{
+		ASSERT_ERR(pACI);
+		ASSERT_ERR(pACI->m_pathSrc);
+		ASSERT_ERR(pACI->m_ack == ACK_GLBMesh);
+		ASSERT_ERR(pSinkOut);
 
-		// Write the data out to the archive
+		using namespace OBJMeshCompiler;
 
-		std::vector<byte> serializedMaterialMap;
-		SerializeMaterialMap(&ctx, &serializedMaterialMap);
+		// Read the mesh data from the binary glTF file
+		Context ctx = {};
+		if (!GLBMeshCompiler::ParseGLB(pACI->m_pathSrc, &ctx))
+			return false;
 
-		if (!WriteAssetDataToZip(pACI->m_pathSrc, s_suffixMeta, &meta, sizeof(meta), pZipOut) ||
-			!WriteAssetDataToZip(pACI->m_pathSrc, s_suffixVerts, &ctx.m_verts[0], ctx.m_verts.size() * sizeof(Vertex), pZipOut) ||
-			!WriteAssetDataToZip(pACI->m_pathSrc, s_suffixIndices, &ctx.m_indices[0], ctx.m_indices.size() * sizeof(int), pZipOut) ||
-			!WriteAssetDataToZip(pACI->m_pathSrc, s_suffixMtlMap, &serializedMaterialMap[0], serializedMaterialMap.size(), pZipOut))
-		{
+		return CompileMeshFromContext(pACI, &ctx, pSinkOut);
+	}
+
+	bool CompilePLYMeshAsset(
+		const AssetCompileInfo * pACI,
+		AssetCompiler::AssetSink * pSinkOut)
+	{
+		ASSERT_ERR(pACI);
+		ASSERT_ERR(pACI->m_pathSrc);
+		ASSERT_ERR(pACI->m_ack == ACK_PLYMesh);
+		ASSERT_ERR(pSinkOut);
+
+		using namespace OBJMeshCompiler;
+
+		// Read the mesh data from the binary PLY file
+		Context ctx = {};
+		if (!PLYMeshCompiler::ParsePLY(pACI->m_pathSrc, &ctx))
 			return false;
-		}
 
-		return true;
+		return CompileMeshFromContext(pACI, &ctx, pSinkOut);
 	}
 
 
 
 	namespace OBJMeshCompiler
 	{
+		bool CompileMeshFromContext(
+			const AssetCompileInfo * pACI,
+			Context * pCtx,
+			AssetCompiler::AssetSink * pSinkOut)
+		{
+			ASSERT_ERR(pACI);
+			ASSERT_ERR(pCtx);
+			ASSERT_ERR(pSinkOut);
+
+			using namespace AssetCompiler;
+
+			if (pCtx->m_indices.empty())
+			{
+				WARN("%s: mesh has no triangles", pACI->m_pathSrc);
+				return false;
+			}
+
+			// Work out which vertex attributes to keep
+			int vattribs = VATTR_Default;
+			if (pACI->m_flags & ACF_VertexNoNormals)
+				vattribs &= ~VATTR_Normal;
+			if (pACI->m_flags & ACF_VertexNoUVs)
+				vattribs &= ~VATTR_UV;
+			if (pACI->m_flags & ACF_VertexTangents)
+			{
+				if (vattribs & VATTR_UV)
+					vattribs |= VATTR_Tangent;
+				else
+					WARN("%s: tangents requested without UVs; leaving them out", pACI->m_pathSrc);
+			}
+			pCtx->m_vattribs = vattribs;
+
+			// Clean up the mesh
+			SortMaterials(pCtx);
+			RemoveDegenerateTriangles(pCtx);
+			RemoveEmptyMaterialRanges(pCtx);
+			DeduplicateVerts(pCtx);
+			if (vattribs & VATTR_Normal)
+			{
+				if (!pCtx->m_hasNormals)
+					CalculateNormals(pCtx);
+				NormalizeNormals(pCtx);
+			}
+			if (vattribs & VATTR_Tangent)
+				CalculateTangents(pCtx);
+			SortTrianglesForVertexCache(pCtx);
+			SortVerticesForMemoryCache(pCtx);
+
+			// Build the depth-only index buffer
+			BuildDepthIndices(pCtx, pCtx->m_mtlsAlphaTest);
+
+#if 0
+			// This can take awhile on a big mesh, so it's commented out by default
+			LOG("%s ACMR: %0.2f", pACI->m_pathSrc, ComputeACMR(pCtx));
+			{
+				Context ctxDepth = {};
+				ctxDepth.m_indices = pCtx->m_depthIndices;
+				LOG("%s depth-only ACMR: %0.2f", pACI->m_pathSrc, ComputeACMR(&ctxDepth));
+			}
+#endif
+
+			// Fill out the metadata struct
+			VLAYOUT vlayout = (pACI->m_flags & ACF_SplitVertexStreams) ? VLAYOUT_Split : VLAYOUT_Interleaved;
+			Meta meta =
+			{
+				vlayout,
+				vattribs,
+				pCtx->m_bounds,
+				pCtx->m_depthOpaqueIndexCount,
+			};
+
+			// Write the data out to the archive
+
+			std::vector<byte> serializedMaterialMap;
+			SerializeMaterialMap(pCtx->m_mtlRanges, &serializedMaterialMap);
+
+			std::vector<byte> serializedDepthMaterialMap;
+			SerializeMaterialMap(pCtx->m_depthMtlRanges, &serializedDepthMaterialMap);
+
+			if (!pSinkOut->WriteAssetData(pACI->m_pathSrc, s_suffixMeta, &meta, sizeof(meta)) ||
+				!pSinkOut->WriteAssetData(pACI->m_pathSrc, s_suffixIndices, &pCtx->m_indices[0], pCtx->m_indices.size() * sizeof(int)) ||
+				!pSinkOut->WriteAssetData(pACI->m_pathSrc, s_suffixMtlMap, &serializedMaterialMap[0], serializedMaterialMap.size()) ||
+				!pSinkOut->WriteAssetData(pACI->m_pathSrc, s_suffixDepthIndices, &pCtx->m_depthIndices[0], pCtx->m_depthIndices.size() * sizeof(int)) ||
+				!pSinkOut->WriteAssetData(pACI->m_pathSrc, s_suffixDepthMtlMap, serializedDepthMaterialMap.empty() ? nullptr : &serializedDepthMaterialMap[0], serializedDepthMaterialMap.size()))
+			{
+				return false;
+			}
+
+			std::vector<byte> aStreams[VSTREAM_Count];
+			PackVertexStreams(pCtx, vlayout, aStreams);
+			for (int iStream = 0; iStream < VSTREAM_Count; ++iStream)
+			{
+				// Streams the layout doesn't use (or that have no attributes in them) are left out
+				if (aStreams[iStream].empty())
+					continue;
+
+				if (!pSinkOut->WriteAssetData(pACI->m_pathSrc, s_suffixVerts[vlayout][iStream], &aStreams[iStream][0], aStreams[iStream].size()))
+					return false;
+			}
+
+			return true;
+		}
+
 		bool ParseOBJ(const char * path, Context * pCtxOut)
 		{
 			ASSERT_ERR(path);
@@ -251,6 +416,16 @@ namespace Framework
 
 					OBJfaces.push_back(face);
 				}
+				else if (_stricmp(pToken, "mtllib") == 0)
+				{
+					// Material libraries are relative to the .obj's directory
+					while (const char * pMtlLibName = tph.NextToken())
+					{
+						std::string mtlLibPath = findDirectory(path) + pMtlLibName;
+						replaceChars(mtlLibPath, '\\', '/');
+						pCtxOut->m_mtlLibPaths.push_back(mtlLibPath);
+					}
+				}
 				else if (_stricmp(pToken, "usemtl") == 0)
 				{
 					const char * pMtlName = tph.ExpectOneToken("material name");
@@ -288,7 +463,7 @@ namespace Framework
 			for (int iVert = 0, cVert = int(OBJverts.size()); iVert < cVert; ++iVert)
 			{
 				OBJVertex objv = OBJverts[iVert];
-				Vertex v = { float3(0), float3(0), float2(0) };
+				Vertex v = { float3(0), float3(0), float2(0), float3(0) };
 
 				// OBJ indices are 1-based; fix that (missing components are zeros)
 				if (objv.iPos > 0)
@@ -423,40 +598,46 @@ namespace Framework
 			pCtx->m_mtlRanges.resize(iWrite);
 		}
 
-		void DeduplicateVerts(Context * pCtx)
-		{
-			ASSERT_ERR(pCtx);
-
-			// Set up a hash table for vertices
+		// Hashing and comparison of just the attributes in the vertex format, so verts that
+		// differ only in attributes the asset doesn't use get welded together
 
-			struct VertexHasher
+		template <int vattribs>
+		struct VertexHasher
+		{
+			std::hash<float> fh;
+			size_t operator () (const Vertex & v) const
 			{
-				std::hash<float> fh;
-				size_t operator () (const Vertex & v) const
-				{
-					return fh(v.m_pos.x) ^ fh(v.m_pos.y) ^ fh(v.m_pos.z) ^
-						   fh(v.m_normal.x) ^ fh(v.m_normal.y) ^ fh(v.m_normal.z) ^
-						   fh(v.m_uv.x) ^ fh(v.m_uv.y);
-					// Note: m_tangent not included because it isn't part of the .obj format,
-					// and hasn't been computed yet at this stage in the compilation process
-				}
-			};
+				return fh(v.m_pos.x) ^ fh(v.m_pos.y) ^ fh(v.m_pos.z) ^
+					   ((vattribs & VATTR_Normal) ? (fh(v.m_normal.x) ^ fh(v.m_normal.y) ^ fh(v.m_normal.z)) : 0) ^
+					   ((vattribs & VATTR_UV) ? (fh(v.m_uv.x) ^ fh(v.m_uv.y)) : 0);
+				// Note: m_tangent not included because it isn't part of the source formats,
+				// and hasn't been computed yet at this stage in the compilation process
+			}
+		};
 
-			struct VertexEqualityTester
+		template <int vattribs>
+		struct VertexEqualityTester
+		{
+			bool operator () (const Vertex & u, const Vertex & v) const
 			{
-				bool operator () (const Vertex & u, const Vertex & v) const
-				{
-					return (all(u.m_pos == v.m_pos) &&
-							all(u.m_normal == v.m_normal) &&
-							all(u.m_uv == v.m_uv));
-					// Note: m_tangent not included because it isn't part of the .obj format,
-					// and hasn't been computed yet at this stage in the compilation process
-				}
-			};
+				return (all(u.m_pos == v.m_pos) &&
+						(!(vattribs & VATTR_Normal) || all(u.m_normal == v.m_normal)) &&
+						(!(vattribs & VATTR_UV) || all(u.m_uv == v.m_uv)));
+			}
+		};
+
+		template <int vattribs>
+		void DeduplicateVertsForFormat(Context * pCtx)
+		{
+			ASSERT_ERR(pCtx);
+			ASSERT_ERR(pCtx->m_vattribs == vattribs);
+
+			typedef VertexHasher<vattribs> Hasher;
+			typedef VertexEqualityTester<vattribs> EqualityTester;
 
 			std::vector<Vertex> vertsDeduplicated;
 			std::vector<int> remappingTable;
-			std::unordered_map<Vertex, int, VertexHasher, VertexEqualityTester> mapVertToIndex;
+			std::unordered_map<Vertex, int, Hasher, EqualityTester> mapVertToIndex;
 			std::vector<int> indicesRemapped;
 
 			vertsDeduplicated.reserve(pCtx->m_verts.size());
@@ -503,6 +684,28 @@ namespace Framework
 			pCtx->m_indices.swap(indicesRemapped);
 		}
 
+		void DeduplicateVerts(Context * pCtx)
+		{
+			ASSERT_ERR(pCtx);
+			ASSERT_ERR(pCtx->m_vattribs >= 0 && pCtx->m_vattribs <= VATTR_All);
+
+			typedef void (*DeduplicateVertsFunc)(Context *);
+			static const DeduplicateVertsFunc s_funcs[] =
+			{
+				&DeduplicateVertsForFormat<0>,
+				&DeduplicateVertsForFormat<1>,
+				&DeduplicateVertsForFormat<2>,
+				&DeduplicateVertsForFormat<3>,
+				&DeduplicateVertsForFormat<4>,
+				&DeduplicateVertsForFormat<5>,
+				&DeduplicateVertsForFormat<6>,
+				&DeduplicateVertsForFormat<7>,
+			};
+			cassert(dim(s_funcs) == VATTR_All + 1);
+
+			s_funcs[pCtx->m_vattribs](pCtx);
+		}
+
 		void CalculateNormals(Context * pCtx)
 		{
 			ASSERT_ERR(pCtx);
@@ -546,12 +749,27 @@ namespace Framework
 			}
 		}
 
-#if VERTEX_TANGENT
+		void CalculateBounds(Context * pCtx)
+		{
+			ASSERT_ERR(pCtx);
+
+			box3 bounds(empty);
+			for (int i = 0, c = int(pCtx->m_verts.size()); i < c; ++i)
+			{
+				bounds.mins = min(bounds.mins, pCtx->m_verts[i].m_pos);
+				bounds.maxs = max(bounds.maxs, pCtx->m_verts[i].m_pos);
+			}
+			pCtx->m_bounds = bounds;
+		}
+
 		void CalculateTangents(Context * pCtx)
 		{
 			ASSERT_ERR(pCtx);
 			ASSERT_ERR(pCtx->m_indices.size() % 3 == 0);
 
+			for (int i = 0, c = int(pCtx->m_verts.size()); i < c; ++i)
+				pCtx->m_verts[i].m_tangent = float3(0);
+
 			// Generate a tangent for each triangle, based on triangle's UV mapping,
 			// and accumulate onto vertex
 			for (int i = 0, c = int(pCtx->m_indices.size()); i < c; i += 3)
@@ -610,7 +828,6 @@ namespace Framework
 				ASSERT_WARN(all(isfinite(pCtx->m_verts[i].m_tangent)));
 			}
 		}
-#endif // VERTEX_TANGENT
 
 		void SortMaterials(Context * pCtx)
 		{
@@ -1025,188 +1242,1830 @@ namespace Framework
 			return float(missCount) / float(max(indexCount / 3, 1));
 		}
 
-		void SerializeMaterialMap(Context * pCtx, std::vector<byte> * pDataOut)
+		void BuildDepthIndices(Context * pCtx, const std::unordered_set<std::string> & mtlsAlphaTest)
 		{
 			ASSERT_ERR(pCtx);
-			ASSERT_ERR(pDataOut);
 
-			SerializeHelper sh(pDataOut);
-			for (int i = 0, cRange = int(pCtx->m_mtlRanges.size()); i < cRange; ++i)
+			// Weld verts by position: map each vertex to the first one with the same position.
+			// Depth-only passes don't care about UV/normal seams, so this lets the GPU share
+			// vertex shader work across them.
+
+			struct PositionHasher
 			{
-				const MtlRange & range = pCtx->m_mtlRanges[i];
-				sh.WriteString(range.m_mtlName);
-				sh.Write(range.m_indexStart);
-				sh.Write(range.m_indexCount);
+				std::hash<float> fh;
+				size_t operator () (const float3 & pos) const
+				{
+					return fh(pos.x) ^ fh(pos.y) ^ fh(pos.z);
+				}
+			};
+
+			struct PositionEqualityTester
+			{
+				bool operator () (const float3 & u, const float3 & v) const
+				{
+					return all(u == v);
+				}
+			};
+
+			int vertCount = int(pCtx->m_verts.size());
+			std::vector<int> weldTable(vertCount);
+			std::unordered_map<float3, int, PositionHasher, PositionEqualityTester> mapPosToIndex;
+			mapPosToIndex.reserve(vertCount);
+			for (int i = 0; i < vertCount; ++i)
+			{
+				auto iterAndBool = mapPosToIndex.insert(std::make_pair(pCtx->m_verts[i].m_pos, i));
+				weldTable[i] = iterAndBool.first->second;
 			}
-		}
-	}
 
+			// Opaque ranges all go first, welded and merged into one range
 
+			Context ctxDepth = {};
+			ctxDepth.m_verts.resize(vertCount);		// Only the count matters to the cache optimizer
+			ctxDepth.m_indices.reserve(pCtx->m_indices.size());
 
-	// Load compiled data into a runtime game object
+			for (int iRange = 0, cRange = int(pCtx->m_mtlRanges.size()); iRange < cRange; ++iRange)
+			{
+				const MtlRange & range = pCtx->m_mtlRanges[iRange];
+				if (mtlsAlphaTest.find(range.m_mtlName) != mtlsAlphaTest.end())
+					continue;
 
-	bool DeserializeMaterialMap(const byte * pMtlMap, int mtlMapSize, MaterialLib * pMtlLib, Mesh * pMeshOut);
+				for (int i = range.m_indexStart, iEnd = range.m_indexStart + range.m_indexCount; i < iEnd; ++i)
+					ctxDepth.m_indices.push_back(weldTable[pCtx->m_indices[i]]);
+			}
 
-	bool LoadMeshFromAssetPack(
-		AssetPack * pPack,
-		const char * path,
-		MaterialLib * pMtlLib,
-		Mesh * pMeshOut)
-	{
-		ASSERT_ERR(pPack);
-		ASSERT_ERR(path);
-		ASSERT_ERR(pMeshOut);
+			int opaqueIndexCount = int(ctxDepth.m_indices.size());
+			if (opaqueIndexCount > 0)
+			{
+				MtlRange rangeOpaque = { std::string(), 0, opaqueIndexCount, };
+				ctxDepth.m_mtlRanges.push_back(rangeOpaque);
+			}
 
-		using namespace OBJMeshCompiler;
+			// Alpha-tested ranges follow, unwelded since they still need UVs
+			for (int iRange = 0, cRange = int(pCtx->m_mtlRanges.size()); iRange < cRange; ++iRange)
+			{
+				const MtlRange & range = pCtx->m_mtlRanges[iRange];
+				if (mtlsAlphaTest.find(range.m_mtlName) == mtlsAlphaTest.end())
+					continue;
 
-		pMeshOut->m_pPack = pPack;
+				MtlRange rangeDepth = { range.m_mtlName, int(ctxDepth.m_indices.size()), range.m_indexCount, };
+				ctxDepth.m_mtlRanges.push_back(rangeDepth);
+				ctxDepth.m_indices.insert(
+									ctxDepth.m_indices.end(),
+									pCtx->m_indices.begin() + range.m_indexStart,
+									pCtx->m_indices.begin() + range.m_indexStart + range.m_indexCount);
+			}
 
-		// Look for the data in the asset pack
+			ASSERT_ERR(ctxDepth.m_indices.size() == pCtx->m_indices.size());
 
-		Meta * pMeta;
-		int metaSize;
-		if (!pPack->LookupFile(path, s_suffixMeta, (void **)&pMeta, &metaSize))
-		{
-			WARN("Couldn't find metadata for mesh %s in asset pack %s", path, pPack->m_path.c_str());
-			return false;
+			// Welding changed which verts are shared, so the merged range needs its own cache ordering.
+			// Vertex order is left alone, since the vertex buffer is shared with the regular indices.
+			SortTrianglesForVertexCache(&ctxDepth);
+
+			pCtx->m_depthIndices.swap(ctxDepth.m_indices);
+			pCtx->m_depthOpaqueIndexCount = opaqueIndexCount;
+			pCtx->m_depthMtlRanges.assign(
+									ctxDepth.m_mtlRanges.begin() + ((opaqueIndexCount > 0) ? 1 : 0),
+									ctxDepth.m_mtlRanges.end());
 		}
-		if (metaSize != sizeof(Meta))
+
+		// Copy an attribute into a packed vertex, if the format has it.  Overloaded on
+		// presence, so absent attributes compile away entirely.
+		template <typename T>
+		inline void PackAttrib(byte * pVert, int offset, const T & value, std::true_type)
 		{
-			WARN("Metadata for mesh %s in asset pack %s is wrong size, %d bytes (expected %d)",
-				path, pPack->m_path.c_str(), metaSize, sizeof(Meta));
-			return false;
+			memcpy(pVert + offset, &value, sizeof(T));
 		}
-		pMeshOut->m_bounds = pMeta->m_bounds;
 
-		int vertsSize;
-		if (!pPack->LookupFile(path, s_suffixVerts, (void **)&pMeshOut->m_pVerts, &vertsSize))
+		template <typename T>
+		inline void PackAttrib(byte *, int, const T &, std::false_type)
 		{
-			WARN("Couldn't find verts for mesh %s in asset pack %s", path, pPack->m_path.c_str());
-			return false;
 		}
-		pMeshOut->m_vertCount = vertsSize / sizeof(Vertex);
 
-		int indicesSize;
-		if (!pPack->LookupFile(path, s_suffixIndices, (void **)&pMeshOut->m_pIndices, &indicesSize))
+		template <int vattribs>
+		void PackVertexStreamsForFormat(
+			const Context * pCtx,
+			VLAYOUT vlayout,
+			std::vector<byte> aStreamsOut[VSTREAM_Count])
 		{
-			WARN("Couldn't find indices for mesh %s in asset pack %s", path, pPack->m_path.c_str());
-			return false;
+			ASSERT_ERR(pCtx);
+			ASSERT_ERR(pCtx->m_vattribs == vattribs);
+			ASSERT_ERR(aStreamsOut);
+
+			typedef VertexLayout<vattribs> Layout;
+
+			int vertCount = int(pCtx->m_verts.size());
+			int aStrideBytes[VSTREAM_Count];
+			for (int iStream = 0; iStream < VSTREAM_Count; ++iStream)
+			{
+				aStrideBytes[iStream] = StrideOfVertexStream(vlayout, vattribs, iStream);
+				aStreamsOut[iStream].resize(size_t(vertCount) * aStrideBytes[iStream]);
+			}
+
+			// In the split layout, the attributes go in their own stream, shifted down past the position
+			int attribStream = (vlayout == VLAYOUT_Split) ? VSTREAM_Attribs : VSTREAM_Pos;
+			int attribOffsetBias = (vlayout == VLAYOUT_Split) ? int(sizeof(float3)) : 0;
+
+			for (int i = 0; i < vertCount; ++i)
+			{
+				const Vertex & v = pCtx->m_verts[i];
+
+				byte * pPos = &aStreamsOut[VSTREAM_Pos][size_t(i) * aStrideBytes[VSTREAM_Pos]];
+				memcpy(pPos + Layout::s_offsetPos, &v.m_pos, sizeof(float3));
+
+				if (aStrideBytes[attribStream] == 0)
+					continue;
+
+				byte * pAttribs = &aStreamsOut[attribStream][size_t(i) * aStrideBytes[attribStream]];
+				PackAttrib(pAttribs, Layout::s_offsetNormal - attribOffsetBias, v.m_normal,
+							std::integral_constant<bool, (vattribs & VATTR_Normal) != 0>());
+				PackAttrib(pAttribs, Layout::s_offsetUV - attribOffsetBias, v.m_uv,
+							std::integral_constant<bool, (vattribs & VATTR_UV) != 0>());
+				PackAttrib(pAttribs, Layout::s_offsetTangent - attribOffsetBias, v.m_tangent,
+							std::integral_constant<bool, (vattribs & VATTR_Tangent) != 0>());
+			}
 		}
-		pMeshOut->m_indexCount = indicesSize / sizeof(int);
 
-		byte * pMtlMap;
-		int mtlMapSize;
-		if (!pPack->LookupFile(path, s_suffixMtlMap, (void **)&pMtlMap, &mtlMapSize))
+		void PackVertexStreams(
+			const Context * pCtx,
+			VLAYOUT vlayout,
+			std::vector<byte> aStreamsOut[VSTREAM_Count])
 		{
-			WARN("Couldn't find material map for mesh %s in asset pack %s", path, pPack->m_path.c_str());
-			return false;
+			ASSERT_ERR(pCtx);
+			ASSERT_ERR(pCtx->m_vattribs >= 0 && pCtx->m_vattribs <= VATTR_All);
+
+			typedef void (*PackVertexStreamsFunc)(const Context *, VLAYOUT, std::vector<byte> *);
+			static const PackVertexStreamsFunc s_funcs[] =
+			{
+				&PackVertexStreamsForFormat<0>,
+				&PackVertexStreamsForFormat<1>,
+				&PackVertexStreamsForFormat<2>,
+				&PackVertexStreamsForFormat<3>,
+				&PackVertexStreamsForFormat<4>,
+				&PackVertexStreamsForFormat<5>,
+				&PackVertexStreamsForFormat<6>,
+				&PackVertexStreamsForFormat<7>,
+			};
+			cassert(dim(s_funcs) == VATTR_All + 1);
+
+			s_funcs[pCtx->m_vattribs](pCtx, vlayout, aStreamsOut);
 		}
-		if (!DeserializeMaterialMap(pMtlMap, mtlMapSize, pMtlLib, pMeshOut))
+
+		void SerializeMaterialMap(const std::vector<MtlRange> & mtlRanges, std::vector<byte> * pDataOut)
 		{
-			WARN("Couldn't deserialize material map for mesh %s in asset pack %s", path, pPack->m_path.c_str());
-			return false;
+			ASSERT_ERR(pDataOut);
+
+			SerializeHelper sh(pDataOut);
+			for (int i = 0, cRange = int(mtlRanges.size()); i < cRange; ++i)
+			{
+				const MtlRange & range = mtlRanges[i];
+				sh.WriteString(range.m_mtlName);
+				sh.Write(range.m_indexStart);
+				sh.Write(range.m_indexCount);
+			}
 		}
+	}
 
-		LOG("Loaded %s from asset pack %s - %d verts, %d indices, %d materials",
-			path, pPack->m_path.c_str(), pMeshOut->m_vertCount, pMeshOut->m_indexCount, pMeshOut->m_mtlRanges.size());
 
-		return true;
-	}
 
-	bool DeserializeMaterialMap(const byte * pMtlMap, int mtlMapSize, MaterialLib * pMtlLib, Mesh * pMeshOut)
+	namespace GLBMeshCompiler
 	{
-		ASSERT_ERR(pMtlMap);
-		ASSERT_ERR(mtlMapSize > 0);
-		ASSERT_ERR(pMeshOut);
+		using OBJMeshCompiler::Context;
+		using OBJMeshCompiler::MtlRange;
 
-		DeserializeHelper dh(pMtlMap, mtlMapSize);
-		while (!dh.AtEOF())
+		// Bare-bones JSON DOM, just enough to walk the glTF scene description.
+		// Object members are stored as parallel arrays of names and values.
+		struct JSONValue
 		{
-			Mesh::MtlRange range = {};
+			enum TYPE
+			{
+				TYPE_Null,
+				TYPE_Bool,
+				TYPE_Number,
+				TYPE_String,
+				TYPE_Array,
+				TYPE_Object,
+			};
 
-			// Read data
-			const char * mtlName;
-			if (!dh.ReadString(&mtlName) ||
-				!dh.Read(&range.m_indexStart) ||
-				!dh.Read(&range.m_indexCount))
+			TYPE						m_type;
+			double						m_number;		// Bools are stored here too, as 0 or 1
+			std::string					m_string;
+			std::vector<JSONValue>		m_elements;		// Array elements, or object member values
+			std::vector<std::string>	m_names;		// Object member names
+		};
+
+		class JSONParser
+		{
+		public:
+			JSONParser(const char * text, const char * path)
+			:	m_pCur(text),
+				m_path(path)
+				{}
+
+			bool Parse(JSONValue * pValueOut)
 			{
-				return false;
+				if (!ParseValue(pValueOut, 0))
+					return false;
+				SkipWhitespace();
+				if (*m_pCur)
+				{
+					WARN("%s: JSON syntax error: unexpected data after the end of the document", m_path);
+					return false;
+				}
+				return true;
 			}
 
-			// Validate data
-			if (range.m_indexStart < 0 ||
-				range.m_indexCount <= 0 ||
-				range.m_indexStart + range.m_indexCount > pMeshOut->m_indexCount)
+		private:
+			// Limit nesting so malformed files can't blow the stack
+			static const int s_depthMax = 64;
+
+			const char *	m_pCur;
+			const char *	m_path;
+
+			void SkipWhitespace()
 			{
-				WARN("Corrupt material map: invalid index start/count");
-				return false;
+				while (*m_pCur == ' ' || *m_pCur == '\t' || *m_pCur == '\n' || *m_pCur == '\r')
+					++m_pCur;
 			}
 
-			// Look up material by name
-			if (pMtlLib && *mtlName)
+			bool Expect(const char * literal)
 			{
-				range.m_pMtl = pMtlLib->Lookup(mtlName);
-				ASSERT_WARN_MSG(range.m_pMtl, 
-					"Couldn't find material %s in material library", mtlName);
+				size_t len = strlen(literal);
+				if (strncmp(m_pCur, literal, len) != 0)
+				{
+					WARN("%s: JSON syntax error: expected \"%s\"", m_path, literal);
+					return false;
+				}
+				m_pCur += len;
+				return true;
 			}
 
-			pMeshOut->m_mtlRanges.push_back(range);
-		}
-
-		return true;
+			bool ParseValue(JSONValue * pValueOut, int depth)
+			{
+				if (depth > s_depthMax)
+				{
+					WARN("%s: JSON is nested too deeply", m_path);
+					return false;
+				}
+
+				SkipWhitespace();
+				pValueOut->m_type = JSONValue::TYPE_Null;
+				pValueOut->m_number = 0.0;
+
+				switch (*m_pCur)
+				{
+				case '{':
+					{
+						pValueOut->m_type = JSONValue::TYPE_Object;
+						++m_pCur;
+						SkipWhitespace();
+						if (*m_pCur == '}')
+						{
+							++m_pCur;
+							return true;
+						}
+						for (;;)
+						{
+							SkipWhitespace();
+							pValueOut->m_names.push_back(std::string());
+							if (!ParseString(&pValueOut->m_names.back()))
+								return false;
+							SkipWhitespace();
+							if (!Expect(":"))
+								return false;
+							pValueOut->m_elements.push_back(JSONValue());
+							if (!ParseValue(&pValueOut->m_elements.back(), depth + 1))
+								return false;
+							SkipWhitespace();
+							if (*m_pCur == '}')
+							{
+								++m_pCur;
+								return true;
+							}
+							if (!Expect(","))
+								return false;
+						}
+					}
+
+				case '[':
+					{
+						pValueOut->m_type = JSONValue::TYPE_Array;
+						++m_pCur;
+						SkipWhitespace();
+						if (*m_pCur == ']')
+						{
+							++m_pCur;
+							return true;
+						}
+						for (;;)
+						{
+							pValueOut->m_elements.push_back(JSONValue());
+							if (!ParseValue(&pValueOut->m_elements.back(), depth + 1))
+								return false;
+							SkipWhitespace();
+							if (*m_pCur == ']')
+							{
+								++m_pCur;
+								return true;
+							}
+							if (!Expect(","))
+								return false;
+						}
+					}
+
+				case '"':
+					pValueOut->m_type = JSONValue::TYPE_String;
+					return ParseString(&pValueOut->m_string);
+
+				case 't':
+					pValueOut->m_type = JSONValue::TYPE_Bool;
+					pValueOut->m_number = 1.0;
+					return Expect("true");
+
+				case 'f':
+					pValueOut->m_type = JSONValue::TYPE_Bool;
+					return Expect("false");
+
+				case 'n':
+					return Expect("null");
+
+				default:
+					{
+						char * pNumEnd;
+						pValueOut->m_type = JSONValue::TYPE_Number;
+						pValueOut->m_number = strtod(m_pCur, &pNumEnd);
+						if (pNumEnd == m_pCur)
+						{
+							WARN("%s: JSON syntax error: unexpected character '%c'", m_path, *m_pCur);
+							return false;
+						}
+						m_pCur = pNumEnd;
+						return true;
+					}
+				}
+			}
+
+			bool ParseString(std::string * pStrOut)
+			{
+				if (!Expect("\""))
+					return false;
+
+				for (;;)
+				{
+					char c = *m_pCur;
+					if (!c)
+					{
+						WARN("%s: JSON syntax error: unterminated string", m_path);
+						return false;
+					}
+					++m_pCur;
+
+					if (c == '"')
+						return true;
+
+					if (c != '\\')
+					{
+						*pStrOut += c;
+						continue;
+					}
+
+					// Escape sequences
+					switch (*(m_pCur++))
+					{
+					case '"':	*pStrOut += '"';	break;
+					case '\\':	*pStrOut += '\\';	break;
+					case '/':	*pStrOut += '/';	break;
+					case 'b':	*pStrOut += '\b';	break;
+					case 'f':	*pStrOut += '\f';	break;
+					case 'n':	*pStrOut += '\n';	break;
+					case 'r':	*pStrOut += '\r';	break;
+					case 't':	*pStrOut += '\t';	break;
+					case 'u':
+						{
+							// Encode the UTF-16 code unit as UTF-8 (surrogate pairs aren't combined;
+							// we only use strings for names, so that's good enough)
+							char hex[5] = {};
+							for (int i = 0; i < 4; ++i)
+							{
+								if (!isxdigit(byte(m_pCur[i])))
+								{
+									WARN("%s: JSON syntax error: bad \\u escape", m_path);
+									return false;
+								}
+								hex[i] = m_pCur[i];
+							}
+							m_pCur += 4;
+							uint codeUnit = uint(strtoul(hex, nullptr, 16));
+							if (codeUnit < 0x80)
+							{
+								*pStrOut += char(codeUnit);
+							}
+							else if (codeUnit < 0x800)
+							{
+								*pStrOut += char(0xc0 | (codeUnit >> 6));
+								*pStrOut += char(0x80 | (codeUnit & 0x3f));
+							}
+							else
+							{
+								*pStrOut += char(0xe0 | (codeUnit >> 12));
+								*pStrOut += char(0x80 | ((codeUnit >> 6) & 0x3f));
+								*pStrOut += char(0x80 | (codeUnit & 0x3f));
+							}
+						}
+						break;
+					default:
+						WARN("%s: JSON syntax error: bad escape sequence", m_path);
+						return false;
+					}
+				}
+			}
+		};
+
+		// Accessors for walking the DOM; these all tolerate null or wrongly-typed inputs,
+		// so optional glTF properties can be looked up without checking every step
+
+		const JSONValue * FindMember(const JSONValue * pObject, const char * name)
+		{
+			if (!pObject || pObject->m_type != JSONValue::TYPE_Object)
+				return nullptr;
+			for (int i = 0, c = int(pObject->m_names.size()); i < c; ++i)
+			{
+				if (pObject->m_names[i] == name)
+					return &pObject->m_elements[i];
+			}
+			return nullptr;
+		}
+
+		const JSONValue * FindElement(const JSONValue * pArray, int i)
+		{
+			if (!pArray || pArray->m_type != JSONValue::TYPE_Array ||
+				i < 0 || i >= int(pArray->m_elements.size()))
+			{
+				return nullptr;
+			}
+			return &pArray->m_elements[i];
+		}
+
+		int ElementCount(const JSONValue * pArray)
+		{
+			if (!pArray || pArray->m_type != JSONValue::TYPE_Array)
+				return 0;
+			return int(pArray->m_elements.size());
+		}
+
+		double GetNumber(const JSONValue * pValue, double defaultValue)
+		{
+			if (!pValue || pValue->m_type != JSONValue::TYPE_Number)
+				return defaultValue;
+			return pValue->m_number;
+		}
+
+		int GetInt(const JSONValue * pValue, int defaultValue)
+		{
+			return int(GetNumber(pValue, double(defaultValue)));
+		}
+
+		const char * GetString(const JSONValue * pValue, const char * defaultValue)
+		{
+			if (!pValue || pValue->m_type != JSONValue::TYPE_String)
+				return defaultValue;
+			return pValue->m_string.c_str();
+		}
+
+
+
+		// .glb container format: a 12-byte header, then a JSON chunk, then an optional BIN chunk
+
+		struct GLBHeader
+		{
+			uint	m_magic;
+			uint	m_version;
+			uint	m_length;
+		};
+
+		struct GLBChunkHeader
+		{
+			uint	m_length;
+			uint	m_type;
+		};
+
+		static const uint s_glbMagic		= 0x46546c67;	// "glTF"
+		static const uint s_glbChunkJSON	= 0x4e4f534a;	// "JSON"
+		static const uint s_glbChunkBIN		= 0x004e4942;	// "BIN\0"
+
+		enum GLTFCOMP						// glTF accessor component types
+		{
+			GLTFCOMP_Byte			= 5120,
+			GLTFCOMP_UnsignedByte	= 5121,
+			GLTFCOMP_Short			= 5122,
+			GLTFCOMP_UnsignedShort	= 5123,
+			GLTFCOMP_UnsignedInt	= 5125,
+			GLTFCOMP_Float			= 5126,
+		};
+
+		static const int s_gltfModeTriangles = 4;
+
+		struct GLBFile
+		{
+			const char *		m_path;
+			JSONValue			m_root;
+			const byte *		m_pBin;			// Contents of the BIN chunk, if any
+			size_t				m_binSize;
+		};
+
+		// Typed view of an accessor's data, pointing directly into the BIN chunk
+		struct AccessorView
+		{
+			const byte *	m_pData;
+			int				m_count;
+			int				m_strideBytes;
+			int				m_componentType;
+			int				m_componentCount;
+			bool			m_normalized;
+		};
+
+		// Prototype various helper functions
+		bool GetAccessorView(const GLBFile * pGlb, int iAccessor, AccessorView * pViewOut);
+		void ReadFloats(const AccessorView * pView, int iElement, float * pOut);
+		int ReadIndex(const AccessorView * pView, int iElement);
+		affine3 GetNodeTransform(const JSONValue * pNode);
+		bool AddNode(
+				const GLBFile * pGlb,
+				int iNode,
+				affine3 const & matParentToWorld,
+				int depth,
+				Context * pCtxOut);
+		bool AddMesh(
+				const GLBFile * pGlb,
+				int iMesh,
+				affine3 const & matMeshToWorld,
+				Context * pCtxOut);
+
+		bool ParseGLB(const char * path, Context * pCtxOut)
+		{
+			ASSERT_ERR(path);
+			ASSERT_ERR(pCtxOut);
+
+			// Read the whole file into memory
+			std::vector<byte> data;
+			if (!LoadFile(path, &data, LFK_Binary))
+				return false;
+
+			// Validate the header
+
+			if (data.size() < sizeof(GLBHeader) + sizeof(GLBChunkHeader))
+			{
+				WARN("%s: file is too small to be a .glb", path);
+				return false;
+			}
+
+			const GLBHeader * pHeader = (const GLBHeader *)&data[0];
+			if (pHeader->m_magic != s_glbMagic)
+			{
+				WARN("%s: not a binary glTF file (bad magic number)", path);
+				return false;
+			}
+			if (pHeader->m_version != 2)
+			{
+				WARN("%s: unsupported glTF version %d (expected 2)", path, pHeader->m_version);
+				return false;
+			}
+			if (pHeader->m_length > data.size())
+			{
+				WARN("%s: file is truncated; header says %u bytes, but file is %u bytes",
+					path, pHeader->m_length, uint(data.size()));
+				return false;
+			}
+
+			GLBFile glb = {};
+			glb.m_path = path;
+
+			// Walk the chunks
+
+			std::string jsonText;
+			size_t offset = sizeof(GLBHeader);
+			while (offset + sizeof(GLBChunkHeader) <= pHeader->m_length)
+			{
+				const GLBChunkHeader * pChunk = (const GLBChunkHeader *)&data[offset];
+				offset += sizeof(GLBChunkHeader);
+				if (pChunk->m_length > pHeader->m_length - offset)
+				{
+					WARN("%s: chunk overruns the end of the file", path);
+					return false;
+				}
+
+				const byte * pChunkData = &data[offset];
+				if (pChunk->m_type == s_glbChunkJSON && jsonText.empty())
+					jsonText.assign((const char *)pChunkData, pChunk->m_length);
+				else if (pChunk->m_type == s_glbChunkBIN && !glb.m_pBin)
+				{
+					glb.m_pBin = pChunkData;
+					glb.m_binSize = pChunk->m_length;
+				}
+
+				// Chunks are 4-byte aligned
+				offset += (pChunk->m_length + 3) & ~3U;
+			}
+
+			if (jsonText.empty())
+			{
+				WARN("%s: no JSON chunk found", path);
+				return false;
+			}
+
+			JSONParser parser(jsonText.c_str(), path);
+			if (!parser.Parse(&glb.m_root))
+				return false;
+
+			// Initial state; AddMesh clears m_hasNormals if any primitive lacks normals
+			pCtxOut->m_hasNormals = true;
+
+			// Walk the default scene's node hierarchy, picking up all the mesh instances in it.
+			// If there are no scenes, just take each mesh once, untransformed.
+			const JSONValue * pScenes = FindMember(&glb.m_root, "scenes");
+			if (ElementCount(pScenes) > 0)
+			{
+				int iScene = GetInt(FindMember(&glb.m_root, "scene"), 0);
+				const JSONValue * pScene = FindElement(pScenes, iScene);
+				if (!pScene)
+				{
+					WARN("%s: invalid default scene %d", path, iScene);
+					return false;
+				}
+
+				const JSONValue * pRootNodes = FindMember(pScene, "nodes");
+				for (int i = 0, c = ElementCount(pRootNodes); i < c; ++i)
+				{
+					if (!AddNode(&glb, GetInt(FindElement(pRootNodes, i), -1), affine3(identity), 0, pCtxOut))
+						return false;
+				}
+			}
+			else
+			{
+				for (int i = 0, c = ElementCount(FindMember(&glb.m_root, "meshes")); i < c; ++i)
+				{
+					if (!AddMesh(&glb, i, affine3(identity), pCtxOut))
+						return false;
+				}
+			}
+
+			if (pCtxOut->m_indices.empty())
+			{
+				WARN("%s: no triangles found", path);
+				return false;
+			}
+
+			OBJMeshCompiler::CalculateBounds(pCtxOut);
+
+			return true;
+		}
+
+		bool GetAccessorView(const GLBFile * pGlb, int iAccessor, AccessorView * pViewOut)
+		{
+			ASSERT_ERR(pGlb);
+			ASSERT_ERR(pViewOut);
+
+			const JSONValue * pAccessor = FindElement(FindMember(&pGlb->m_root, "accessors"), iAccessor);
+			if (!pAccessor)
+			{
+				WARN("%s: invalid accessor %d", pGlb->m_path, iAccessor);
+				return false;
+			}
+			if (FindMember(pAccessor, "sparse"))
+			{
+				WARN("%s: accessor %d is sparse; sparse accessors aren't supported", pGlb->m_path, iAccessor);
+				return false;
+			}
+
+			// Figure out the element size
+
+			int componentType = GetInt(FindMember(pAccessor, "componentType"), 0);
+			int componentSize;
+			switch (componentType)
+			{
+			case GLTFCOMP_Byte:
+			case GLTFCOMP_UnsignedByte:		componentSize = 1;	break;
+			case GLTFCOMP_Short:
+			case GLTFCOMP_UnsignedShort:	componentSize = 2;	break;
+			case GLTFCOMP_UnsignedInt:
+			case GLTFCOMP_Float:			componentSize = 4;	break;
+			default:
+				WARN("%s: accessor %d has unknown component type %d", pGlb->m_path, iAccessor, componentType);
+				return false;
+			}
+
+			const char * type = GetString(FindMember(pAccessor, "type"), "");
+			int componentCount;
+			if (strcmp(type, "SCALAR") == 0)
+				componentCount = 1;
+			else if (strcmp(type, "VEC2") == 0)
+				componentCount = 2;
+			else if (strcmp(type, "VEC3") == 0)
+				componentCount = 3;
+			else if (strcmp(type, "VEC4") == 0)
+				componentCount = 4;
+			else
+			{
+				WARN("%s: accessor %d has unsupported type \"%s\"", pGlb->m_path, iAccessor, type);
+				return false;
+			}
+
+			int elementSize = componentSize * componentCount;
+
+			// Find the buffer view and check that the data is in the BIN chunk
+
+			int iBufferView = GetInt(FindMember(pAccessor, "bufferView"), -1);
+			const JSONValue * pBufferView = FindElement(FindMember(&pGlb->m_root, "bufferViews"), iBufferView);
+			if (!pBufferView)
+			{
+				WARN("%s: accessor %d has invalid buffer view %d", pGlb->m_path, iAccessor, iBufferView);
+				return false;
+			}
+
+			int iBuffer = GetInt(FindMember(pBufferView, "buffer"), -1);
+			const JSONValue * pBuffer = FindElement(FindMember(&pGlb->m_root, "buffers"), iBuffer);
+			if (!pBuffer || FindMember(pBuffer, "uri") || !pGlb->m_pBin)
+			{
+				WARN("%s: buffer view %d doesn't refer to the .glb's BIN chunk; external buffers aren't supported",
+					pGlb->m_path, iBufferView);
+				return false;
+			}
+
+			double viewOffset = GetNumber(FindMember(pBufferView, "byteOffset"), 0.0);
+			double viewLength = GetNumber(FindMember(pBufferView, "byteLength"), 0.0);
+			double accessorOffset = GetNumber(FindMember(pAccessor, "byteOffset"), 0.0);
+			int stride = GetInt(FindMember(pBufferView, "byteStride"), 0);
+			if (stride == 0)
+				stride = elementSize;
+			int count = GetInt(FindMember(pAccessor, "count"), 0);
+
+			// Bounds-check everything against the BIN chunk (in doubles, so bad values can't overflow)
+			if (viewOffset < 0.0 || viewLength < 0.0 || viewOffset + viewLength > double(pGlb->m_binSize) ||
+				accessorOffset < 0.0 || stride < elementSize || count < 0 ||
+				(count > 0 && accessorOffset + double(count - 1) * stride + elementSize > viewLength))
+			{
+				WARN("%s: accessor %d is out of bounds of its buffer view", pGlb->m_path, iAccessor);
+				return false;
+			}
+
+			pViewOut->m_pData = pGlb->m_pBin + size_t(viewOffset) + size_t(accessorOffset);
+			pViewOut->m_count = count;
+			pViewOut->m_strideBytes = stride;
+			pViewOut->m_componentType = componentType;
+			pViewOut->m_componentCount = componentCount;
+			const JSONValue * pNormalized = FindMember(pAccessor, "normalized");
+			pViewOut->m_normalized = (pNormalized && pNormalized->m_type == JSONValue::TYPE_Bool && pNormalized->m_number != 0.0);
+
+			return true;
+		}
+
+		void ReadFloats(const AccessorView * pView, int iElement, float * pOut)
+		{
+			ASSERT_ERR(pView);
+			ASSERT_ERR(iElement >= 0 && iElement < pView->m_count);
+			ASSERT_ERR(pOut);
+
+			const byte * pElement = pView->m_pData + size_t(iElement) * pView->m_strideBytes;
+			for (int i = 0; i < pView->m_componentCount; ++i)
+			{
+				switch (pView->m_componentType)
+				{
+				case GLTFCOMP_Float:
+					memcpy(&pOut[i], pElement + i * sizeof(float), sizeof(float));
+					break;
+
+				case GLTFCOMP_UnsignedByte:
+					pOut[i] = float(pElement[i]);
+					if (pView->m_normalized)
+						pOut[i] *= 1.0f / 255.0f;
+					break;
+
+				case GLTFCOMP_UnsignedShort:
+					{
+						unsigned short value;
+						memcpy(&value, pElement + i * sizeof(value), sizeof(value));
+						pOut[i] = float(value);
+						if (pView->m_normalized)
+							pOut[i] *= 1.0f / 65535.0f;
+					}
+					break;
+
+				case GLTFCOMP_Byte:
+					pOut[i] = float(static_cast<signed char>(pElement[i]));
+					if (pView->m_normalized)
+						pOut[i] = max(pOut[i] * (1.0f / 127.0f), -1.0f);
+					break;
+
+				case GLTFCOMP_Short:
+					{
+						short value;
+						memcpy(&value, pElement + i * sizeof(value), sizeof(value));
+						pOut[i] = float(value);
+						if (pView->m_normalized)
+							pOut[i] = max(pOut[i] * (1.0f / 32767.0f), -1.0f);
+					}
+					break;
+
+				case GLTFCOMP_UnsignedInt:
+					{
+						uint value;
+						memcpy(&value, pElement + i * sizeof(value), sizeof(value));
+						pOut[i] = float(value);
+					}
+					break;
+
+				default:
+					ERR("Unexpected component type %d", pView->m_componentType);
+					break;
+				}
+			}
+		}
+
+		int ReadIndex(const AccessorView * pView, int iElement)
+		{
+			ASSERT_ERR(pView);
+			ASSERT_ERR(iElement >= 0 && iElement < pView->m_count);
+
+			const byte * pElement = pView->m_pData + size_t(iElement) * pView->m_strideBytes;
+			switch (pView->m_componentType)
+			{
+			case GLTFCOMP_UnsignedByte:
+				return *pElement;
+
+			case GLTFCOMP_UnsignedShort:
+				{
+					unsigned short index;
+					memcpy(&index, pElement, sizeof(index));
+					return index;
+				}
+
+			case GLTFCOMP_UnsignedInt:
+				{
+					uint index;
+					memcpy(&index, pElement, sizeof(index));
+					// Out-of-range values come out negative and get caught by the caller's bounds check
+					return int(index);
+				}
+
+			default:
+				ERR("Unexpected index component type %d", pView->m_componentType);
+				return -1;
+			}
+		}
+
+		affine3 GetNodeTransform(const JSONValue * pNode)
+		{
+			ASSERT_ERR(pNode);
+
+			// Explicit matrix, stored column-major for column vectors; reading it in
+			// order transposes it to our row-vector convention
+			const JSONValue * pMatrix = FindMember(pNode, "matrix");
+			if (ElementCount(pMatrix) == 16)
+			{
+				float m[16];
+				for (int i = 0; i < 16; ++i)
+					m[i] = float(GetNumber(FindElement(pMatrix, i), 0.0));
+				affine3 mat =
+				{
+					m[0],  m[1],  m[2],  m[3],
+					m[4],  m[5],  m[6],  m[7],
+					m[8],  m[9],  m[10], m[11],
+					m[12], m[13], m[14], m[15],
+				};
+				return mat;
+			}
+
+			// Otherwise, translation/rotation/scale, applied scale first
+			const JSONValue * pTranslation = FindMember(pNode, "translation");
+			const JSONValue * pRotation = FindMember(pNode, "rotation");
+			const JSONValue * pScale = FindMember(pNode, "scale");
+
+			float3 translation =
+			{
+				float(GetNumber(FindElement(pTranslation, 0), 0.0)),
+				float(GetNumber(FindElement(pTranslation, 1), 0.0)),
+				float(GetNumber(FindElement(pTranslation, 2), 0.0)),
+			};
+			quat rotation =
+			{
+				float(GetNumber(FindElement(pRotation, 3), 1.0)),	// Note, glTF stores w last
+				float(GetNumber(FindElement(pRotation, 0), 0.0)),
+				float(GetNumber(FindElement(pRotation, 1), 0.0)),
+				float(GetNumber(FindElement(pRotation, 2), 0.0)),
+			};
+			float3 scale =
+			{
+				float(GetNumber(FindElement(pScale, 0), 1.0)),
+				float(GetNumber(FindElement(pScale, 1), 1.0)),
+				float(GetNumber(FindElement(pScale, 2), 1.0)),
+			};
+
+			return affineMatrix(diagonalMatrix(scale.x, scale.y, scale.z), float3(0.0f)) *
+					affineMatrix(rotation, translation);
+		}
+
+		bool AddNode(
+			const GLBFile * pGlb,
+			int iNode,
+			affine3 const & matParentToWorld,
+			int depth,
+			Context * pCtxOut)
+		{
+			ASSERT_ERR(pGlb);
+			ASSERT_ERR(pCtxOut);
+
+			const JSONValue * pNodes = FindMember(&pGlb->m_root, "nodes");
+			const JSONValue * pNode = FindElement(pNodes, iNode);
+			if (!pNode)
+			{
+				WARN("%s: invalid node %d", pGlb->m_path, iNode);
+				return false;
+			}
+
+			// The node graph is supposed to be a forest, but guard against cycles anyway
+			if (depth > ElementCount(pNodes))
+			{
+				WARN("%s: node hierarchy has a cycle", pGlb->m_path);
+				return false;
+			}
+
+			affine3 matNodeToWorld = GetNodeTransform(pNode) * matParentToWorld;
+
+			if (const JSONValue * pMesh = FindMember(pNode, "mesh"))
+			{
+				if (!AddMesh(pGlb, GetInt(pMesh, -1), matNodeToWorld, pCtxOut))
+					return false;
+			}
+
+			const JSONValue * pChildren = FindMember(pNode, "children");
+			for (int i = 0, c = ElementCount(pChildren); i < c; ++i)
+			{
+				if (!AddNode(pGlb, GetInt(FindElement(pChildren, i), -1), matNodeToWorld, depth + 1, pCtxOut))
+					return false;
+			}
+
+			return true;
+		}
+
+		bool AddMesh(
+			const GLBFile * pGlb,
+			int iMesh,
+			affine3 const & matMeshToWorld,
+			Context * pCtxOut)
+		{
+			ASSERT_ERR(pGlb);
+			ASSERT_ERR(pCtxOut);
+
+			const JSONValue * pMesh = FindElement(FindMember(&pGlb->m_root, "meshes"), iMesh);
+			if (!pMesh)
+			{
+				WARN("%s: invalid mesh %d", pGlb->m_path, iMesh);
+				return false;
+			}
+
+			// Normals transform by the inverse transpose; also, mirroring transforms flip the winding
+			float3x3 matLinear = matrixFromRows(
+									xfmVector(float3(1.0f, 0.0f, 0.0f), matMeshToWorld),
+									xfmVector(float3(0.0f, 1.0f, 0.0f), matMeshToWorld),
+									xfmVector(float3(0.0f, 0.0f, 1.0f), matMeshToWorld));
+			affine3 matNormal = affineMatrix(transpose(inverse(matLinear)), float3(0.0f));
+			bool flipWinding = (dot(cross(matLinear[0], matLinear[1]), matLinear[2]) < 0.0f);
+
+			const JSONValue * pMaterials = FindMember(&pGlb->m_root, "materials");
+			const JSONValue * pPrimitives = FindMember(pMesh, "primitives");
+			for (int iPrim = 0, cPrim = ElementCount(pPrimitives); iPrim < cPrim; ++iPrim)
+			{
+				const JSONValue * pPrim = FindElement(pPrimitives, iPrim);
+
+				int mode = GetInt(FindMember(pPrim, "mode"), s_gltfModeTriangles);
+				if (mode != s_gltfModeTriangles)
+				{
+					WARN("%s: mesh %d primitive %d has mode %d; only triangle lists are supported, so skipping it",
+						pGlb->m_path, iMesh, iPrim, mode);
+					continue;
+				}
+
+				// Look up the vertex attributes
+
+				const JSONValue * pAttribs = FindMember(pPrim, "attributes");
+				const JSONValue * pPosAttrib = FindMember(pAttribs, "POSITION");
+				const JSONValue * pNormalAttrib = FindMember(pAttribs, "NORMAL");
+				const JSONValue * pUvAttrib = FindMember(pAttribs, "TEXCOORD_0");
+
+				if (!pPosAttrib)
+				{
+					WARN("%s: mesh %d primitive %d has no positions; skipping it", pGlb->m_path, iMesh, iPrim);
+					continue;
+				}
+
+				AccessorView viewPos = {}, viewNormal = {}, viewUv = {};
+				if (!GetAccessorView(pGlb, GetInt(pPosAttrib, -1), &viewPos))
+					return false;
+				if (viewPos.m_componentType != GLTFCOMP_Float || viewPos.m_componentCount != 3)
+				{
+					WARN("%s: mesh %d primitive %d positions must be float3", pGlb->m_path, iMesh, iPrim);
+					return false;
+				}
+
+				if (pNormalAttrib)
+				{
+					if (!GetAccessorView(pGlb, GetInt(pNormalAttrib, -1), &viewNormal))
+						return false;
+					if (viewNormal.m_componentType != GLTFCOMP_Float || viewNormal.m_componentCount != 3 ||
+						viewNormal.m_count != viewPos.m_count)
+					{
+						WARN("%s: mesh %d primitive %d normals must be float3, one per position", pGlb->m_path, iMesh, iPrim);
+						return false;
+					}
+				}
+				else
+				{
+					pCtxOut->m_hasNormals = false;
+				}
+
+				if (pUvAttrib)
+				{
+					if (!GetAccessorView(pGlb, GetInt(pUvAttrib, -1), &viewUv))
+						return false;
+					if (viewUv.m_componentCount != 2 || viewUv.m_count != viewPos.m_count)
+					{
+						WARN("%s: mesh %d primitive %d UVs must be 2-component, one per position", pGlb->m_path, iMesh, iPrim);
+						return false;
+					}
+				}
+
+				// Copy out the verts
+
+				int vertBase = int(pCtxOut->m_verts.size());
+				int vertCount = viewPos.m_count;
+				pCtxOut->m_verts.resize(vertBase + vertCount);
+				for (int i = 0; i < vertCount; ++i)
+				{
+					Vertex * pVert = &pCtxOut->m_verts[vertBase + i];
+
+					float3 pos;
+					ReadFloats(&viewPos, i, &pos.x);
+					pVert->m_pos = xfmPoint(pos, matMeshToWorld);
+
+					if (pNormalAttrib)
+					{
+						float3 normal;
+						ReadFloats(&viewNormal, i, &normal.x);
+						pVert->m_normal = xfmVector(normal, matNormal);
+					}
+
+					// glTF UVs are already top-down, so no V-flip here (unlike .obj)
+					if (pUvAttrib)
+						ReadFloats(&viewUv, i, &pVert->m_uv.x);
+				}
+
+				// Copy out the indices, or generate them for non-indexed primitives
+
+				int indexBase = int(pCtxOut->m_indices.size());
+				if (const JSONValue * pIndices = FindMember(pPrim, "indices"))
+				{
+					AccessorView viewIdx = {};
+					if (!GetAccessorView(pGlb, GetInt(pIndices, -1), &viewIdx))
+						return false;
+					if (viewIdx.m_componentCount != 1 ||
+						(viewIdx.m_componentType != GLTFCOMP_UnsignedByte &&
+						 viewIdx.m_componentType != GLTFCOMP_UnsignedShort &&
+						 viewIdx.m_componentType != GLTFCOMP_UnsignedInt))
+					{
+						WARN("%s: mesh %d primitive %d has an invalid index type", pGlb->m_path, iMesh, iPrim);
+						return false;
+					}
+
+					int indexCount = viewIdx.m_count - viewIdx.m_count % 3;
+					pCtxOut->m_indices.resize(indexBase + indexCount);
+					for (int i = 0; i < indexCount; ++i)
+					{
+						int index = ReadIndex(&viewIdx, i);
+						if (index < 0 || index >= vertCount)
+						{
+							WARN("%s: mesh %d primitive %d has out-of-range index %d", pGlb->m_path, iMesh, iPrim, index);
+							return false;
+						}
+						pCtxOut->m_indices[indexBase + i] = vertBase + index;
+					}
+				}
+				else
+				{
+					int indexCount = vertCount - vertCount % 3;
+					pCtxOut->m_indices.resize(indexBase + indexCount);
+					for (int i = 0; i < indexCount; ++i)
+						pCtxOut->m_indices[indexBase + i] = vertBase + i;
+				}
+
+				if (flipWinding)
+				{
+					for (int i = indexBase, c = int(pCtxOut->m_indices.size()); i < c; i += 3)
+						std::swap(pCtxOut->m_indices[i + 1], pCtxOut->m_indices[i + 2]);
+				}
+
+				// Add a material range for the primitive; SortMaterials will merge ranges later.
+				// Alpha-masked materials get drawn separately in depth-only passes.
+				MtlRange range = { std::string(), indexBase, int(pCtxOut->m_indices.size()) - indexBase, };
+				if (const JSONValue * pMtlIndex = FindMember(pPrim, "material"))
+				{
+					int iMtl = GetInt(pMtlIndex, -1);
+					const JSONValue * pMtl = FindElement(pMaterials, iMtl);
+					if (!pMtl)
+					{
+						WARN("%s: mesh %d primitive %d has invalid material %d", pGlb->m_path, iMesh, iPrim, iMtl);
+						return false;
+					}
+
+					if (const char * mtlName = GetString(FindMember(pMtl, "name"), nullptr))
+					{
+						range.m_mtlName = mtlName;
+					}
+					else
+					{
+						// Unnamed material; make up a name from its index
+						char mtlNameGenerated[32];
+						sprintf_s(mtlNameGenerated, "material_%d", iMtl);
+						range.m_mtlName = mtlNameGenerated;
+					}
+					makeLowercase(range.m_mtlName);
+
+					if (strcmp(GetString(FindMember(pMtl, "alphaMode"), "OPAQUE"), "MASK") == 0)
+						pCtxOut->m_mtlsAlphaTest.insert(range.m_mtlName);
+				}
+				pCtxOut->m_mtlRanges.push_back(range);
+			}
+
+			return true;
+		}
+	}
+
+
+
+	namespace PLYMeshCompiler
+	{
+		using OBJMeshCompiler::Context;
+		using OBJMeshCompiler::MtlRange;
+
+		enum PLYTYPE
+		{
+			PLYTYPE_Int8,
+			PLYTYPE_UInt8,
+			PLYTYPE_Int16,
+			PLYTYPE_UInt16,
+			PLYTYPE_Int32,
+			PLYTYPE_UInt32,
+			PLYTYPE_Float32,
+			PLYTYPE_Float64,
+
+			PLYTYPE_Count,
+			PLYTYPE_Invalid = -1,
+		};
+
+		// Each type has an old-style and new-style name
+		static const char * s_plyTypeNames[][2] =
+		{
+			{ "char",	"int8", },		// PLYTYPE_Int8
+			{ "uchar",	"uint8", },		// PLYTYPE_UInt8
+			{ "short",	"int16", },		// PLYTYPE_Int16
+			{ "ushort",	"uint16", },	// PLYTYPE_UInt16
+			{ "int",	"int32", },		// PLYTYPE_Int32
+			{ "uint",	"uint32", },	// PLYTYPE_UInt32
+			{ "float",	"float32", },	// PLYTYPE_Float32
+			{ "double",	"float64", },	// PLYTYPE_Float64
+		};
+		cassert(dim(s_plyTypeNames) == PLYTYPE_Count);
+
+		static const int s_plyTypeSizes[] = { 1, 1, 2, 2, 4, 4, 4, 8, };
+		cassert(dim(s_plyTypeSizes) == PLYTYPE_Count);
+
+		// Vertex properties we care about
+		enum PLYVPROP
+		{
+			PLYVPROP_X,
+			PLYVPROP_Y,
+			PLYVPROP_Z,
+			PLYVPROP_NX,
+			PLYVPROP_NY,
+			PLYVPROP_NZ,
+			PLYVPROP_U,
+			PLYVPROP_V,
+
+			PLYVPROP_Count,
+			PLYVPROP_None = -1,
+		};
+
+		struct Property
+		{
+			std::string		m_name;
+			PLYTYPE			m_type;			// Type of the value, or of the list items
+			PLYTYPE			m_countType;	// Type of the list count, or PLYTYPE_Invalid if not a list
+		};
+
+		struct Element
+		{
+			std::string				m_name;
+			int						m_count;
+			std::vector<Property>	m_props;
+		};
+
+		// Cursor over the binary payload, reading values in place
+		struct Reader
+		{
+			const byte *	m_pCur;
+			const byte *	m_pEnd;
+			bool			m_bigEndian;
+			bool			m_overrun;
+		};
+
+		// Prototype various helper functions
+		PLYTYPE ParsePLYType(const char * name);
+		PLYVPROP ParsePLYVertexProperty(const char * name);
+		double ReadValue(Reader * pReader, PLYTYPE type);
+
+		bool ParsePLY(const char * path, Context * pCtxOut)
+		{
+			ASSERT_ERR(path);
+			ASSERT_ERR(pCtxOut);
+
+			// Read the whole file into memory
+			std::vector<byte> data;
+			if (!LoadFile(path, &data, LFK_Binary))
+				return false;
+
+			if (data.size() < 4 || memcmp(&data[0], "ply", 3) != 0)
+			{
+				WARN("%s: not a PLY file", path);
+				return false;
+			}
+
+			// Find the end of the text header; the binary data starts on the line after "end_header"
+			static const char s_endHeader[] = "end_header";
+			static const size_t s_endHeaderLen = dim(s_endHeader) - 1;
+			size_t headerSize = 0;
+			for (size_t iLine = 0, cData = data.size(); iLine < cData && headerSize == 0; )
+			{
+				size_t iEOL = iLine;
+				while (iEOL < cData && data[iEOL] != '\n')
+					++iEOL;
+				if (iEOL - iLine >= s_endHeaderLen && memcmp(&data[iLine], s_endHeader, s_endHeaderLen) == 0)
+					headerSize = min(iEOL + 1, cData);
+				iLine = iEOL + 1;
+			}
+			if (headerSize == 0)
+			{
+				WARN("%s: couldn't find end of PLY header", path);
+				return false;
+			}
+
+			// Parse the header line-by-line, from a null-terminated copy
+			std::vector<char> headerText(headerSize + 1);
+			memcpy(&headerText[0], &data[0], headerSize);
+
+			bool formatFound = false;
+			bool bigEndian = false;
+			std::vector<Element> elements;
+
+			TextParsingHelper tph(&headerText[0], path);
+			while (tph.NextLine())
+			{
+				char * pToken = tph.NextToken();
+				if (_stricmp(pToken, "format") == 0)
+				{
+					char * tokens[2] = {};
+					tph.ExpectTokens(tokens, dim(tokens), "format and version");
+					tph.ExpectEOL();
+					if (!tokens[0])
+						return false;
+
+					if (_stricmp(tokens[0], "binary_little_endian") == 0)
+						bigEndian = false;
+					else if (_stricmp(tokens[0], "binary_big_endian") == 0)
+						bigEndian = true;
+					else
+					{
+						WARN("%s: unsupported PLY format %s; only binary PLY files are supported", path, tokens[0]);
+						return false;
+					}
+					formatFound = true;
+				}
+				else if (_stricmp(pToken, "element") == 0)
+				{
+					char * tokens[2] = {};
+					tph.ExpectTokens(tokens, dim(tokens), "element name and count");
+					tph.ExpectEOL();
+					if (!tokens[1])
+						return false;
+
+					Element element = { tokens[0], atoi(tokens[1]), };
+					if (element.m_count < 0)
+					{
+						WARN("%s: syntax error at line %d: invalid element count", path, tph.m_iLine);
+						return false;
+					}
+					elements.push_back(element);
+				}
+				else if (_stricmp(pToken, "property") == 0)
+				{
+					if (elements.empty())
+					{
+						WARN("%s: syntax error at line %d: property outside of any element", path, tph.m_iLine);
+						return false;
+					}
+
+					Property prop = { std::string(), PLYTYPE_Invalid, PLYTYPE_Invalid, };
+					char * pType = tph.NextToken();
+					if (pType && _stricmp(pType, "list") == 0)
+					{
+						char * tokens[3] = {};
+						tph.ExpectTokens(tokens, dim(tokens), "list count type, item type, and name");
+						if (!tokens[2])
+							return false;
+						prop.m_countType = ParsePLYType(tokens[0]);
+						prop.m_type = ParsePLYType(tokens[1]);
+						prop.m_name = tokens[2];
+						if (prop.m_countType == PLYTYPE_Invalid)
+						{
+							WARN("%s: syntax error at line %d: unknown type %s", path, tph.m_iLine, tokens[0]);
+							return false;
+						}
+					}
+					else
+					{
+						const char * pName = tph.ExpectOneToken("property name");
+						if (!pType || !pName)
+							return false;
+						prop.m_type = ParsePLYType(pType);
+						prop.m_name = pName;
+					}
+					tph.ExpectEOL();
+
+					if (prop.m_type == PLYTYPE_Invalid)
+					{
+						WARN("%s: syntax error at line %d: unknown property type", path, tph.m_iLine);
+						return false;
+					}
+					elements.back().m_props.push_back(prop);
+				}
+				else if (_stricmp(pToken, "end_header") == 0)
+				{
+					break;
+				}
+				else
+				{
+					// "ply", "comment", "obj_info", or something unknown; just ignore
+				}
+			}
+
+			if (!formatFound)
+			{
+				WARN("%s: PLY header has no format line", path);
+				return false;
+			}
+
+			// Now walk the binary data, element by element
+
+			Reader reader = { &data[0] + headerSize, &data[0] + data.size(), bigEndian, false, };
+			bool hasNormals = false;
+			bool hasUVs = false;
+			std::vector<PLYVPROP> vprops;
+			std::vector<int> faceIndices;
+
+			for (int iElement = 0, cElement = int(elements.size()); iElement < cElement; ++iElement)
+			{
+				const Element & element = elements[iElement];
+				int cProp = int(element.m_props.size());
+
+				if (element.m_name == "vertex")
+				{
+					if (!pCtxOut->m_verts.empty())
+					{
+						WARN("%s: multiple vertex elements", path);
+						return false;
+					}
+
+					// Map each property to the vertex component it supplies, if any
+					vprops.resize(cProp);
+					int vpropsFound = 0;
+					for (int iProp = 0; iProp < cProp; ++iProp)
+					{
+						const Property & prop = element.m_props[iProp];
+						vprops[iProp] = (prop.m_countType == PLYTYPE_Invalid) ? ParsePLYVertexProperty(prop.m_name.c_str()) : PLYVPROP_None;
+						if (vprops[iProp] != PLYVPROP_None)
+							vpropsFound |= (1 << vprops[iProp]);
+					}
+					static const int s_normalMask = (1 << PLYVPROP_NX) | (1 << PLYVPROP_NY) | (1 << PLYVPROP_NZ);
+					static const int s_uvMask = (1 << PLYVPROP_U) | (1 << PLYVPROP_V);
+					hasNormals = ((vpropsFound & s_normalMask) == s_normalMask);
+					hasUVs = ((vpropsFound & s_uvMask) == s_uvMask);
+
+					pCtxOut->m_verts.resize(element.m_count);
+					for (int iVert = 0; iVert < element.m_count; ++iVert)
+					{
+						float values[PLYVPROP_Count] = {};
+						for (int iProp = 0; iProp < cProp; ++iProp)
+						{
+							const Property & prop = element.m_props[iProp];
+							if (prop.m_countType != PLYTYPE_Invalid)
+							{
+								// Skip lists
+								int count = int(ReadValue(&reader, prop.m_countType));
+								for (int i = 0; i < count && !reader.m_overrun; ++i)
+									(void)ReadValue(&reader, prop.m_type);
+								continue;
+							}
+
+							double value = ReadValue(&reader, prop.m_type);
+							if (vprops[iProp] != PLYVPROP_None)
+								values[vprops[iProp]] = float(value);
+						}
+
+						if (reader.m_overrun)
+							break;
+
+						// Flip V-axis, since PLY UVs use a bottom-up convention, like OBJ
+						Vertex * pVert = &pCtxOut->m_verts[iVert];
+						pVert->m_pos = float3(values[PLYVPROP_X], values[PLYVPROP_Y], values[PLYVPROP_Z]);
+						pVert->m_normal = float3(values[PLYVPROP_NX], values[PLYVPROP_NY], values[PLYVPROP_NZ]);
+						pVert->m_uv = hasUVs ? float2(values[PLYVPROP_U], 1.0f - values[PLYVPROP_V]) : float2(0.0f);
+					}
+				}
+				else if (element.m_name == "face")
+				{
+					for (int iFace = 0; iFace < element.m_count && !reader.m_overrun; ++iFace)
+					{
+						for (int iProp = 0; iProp < cProp; ++iProp)
+						{
+							const Property & prop = element.m_props[iProp];
+							if (prop.m_countType == PLYTYPE_Invalid)
+							{
+								(void)ReadValue(&reader, prop.m_type);
+								continue;
+							}
+
+							int count = int(ReadValue(&reader, prop.m_countType));
+							bool isIndices = (prop.m_name == "vertex_indices" || prop.m_name == "vertex_index");
+							faceIndices.clear();
+							for (int i = 0; i < count && !reader.m_overrun; ++i)
+							{
+								double value = ReadValue(&reader, prop.m_type);
+								if (isIndices)
+									faceIndices.push_back(int(value));
+							}
+
+							// Triangulate the face
+							for (int i = 2, c = int(faceIndices.size()); i < c; ++i)
+							{
+								pCtxOut->m_indices.push_back(faceIndices[0]);
+								pCtxOut->m_indices.push_back(faceIndices[i - 1]);
+								pCtxOut->m_indices.push_back(faceIndices[i]);
+							}
+						}
+					}
+				}
+				else
+				{
+					// Some other element; skip over it
+					for (int i = 0; i < element.m_count && !reader.m_overrun; ++i)
+					{
+						for (int iProp = 0; iProp < cProp; ++iProp)
+						{
+							const Property & prop = element.m_props[iProp];
+							int count = 1;
+							if (prop.m_countType != PLYTYPE_Invalid)
+								count = int(ReadValue(&reader, prop.m_countType));
+							for (int j = 0; j < count && !reader.m_overrun; ++j)
+								(void)ReadValue(&reader, prop.m_type);
+						}
+					}
+				}
+
+				if (reader.m_overrun)
+				{
+					WARN("%s: file is truncated in element %s", path, element.m_name.c_str());
+					return false;
+				}
+			}
+
+			// Validate indices, now that we know how many verts there are
+			for (int i = 0, c = int(pCtxOut->m_indices.size()), cVert = int(pCtxOut->m_verts.size()); i < c; ++i)
+			{
+				if (pCtxOut->m_indices[i] < 0 || pCtxOut->m_indices[i] >= cVert)
+				{
+					WARN("%s: face has out-of-range vertex index %d", path, pCtxOut->m_indices[i]);
+					return false;
+				}
+			}
+
+			if (pCtxOut->m_indices.empty())
+			{
+				WARN("%s: no faces found", path);
+				return false;
+			}
+
+			// PLY has no materials, so everything goes in one range
+			MtlRange range = { std::string(), 0, int(pCtxOut->m_indices.size()), };
+			pCtxOut->m_mtlRanges.push_back(range);
+
+			pCtxOut->m_hasNormals = hasNormals;
+			OBJMeshCompiler::CalculateBounds(pCtxOut);
+
+			return true;
+		}
+
+		PLYTYPE ParsePLYType(const char * name)
+		{
+			ASSERT_ERR(name);
+
+			for (int i = 0; i < PLYTYPE_Count; ++i)
+			{
+				if (_stricmp(name, s_plyTypeNames[i][0]) == 0 ||
+					_stricmp(name, s_plyTypeNames[i][1]) == 0)
+				{
+					return PLYTYPE(i);
+				}
+			}
+			return PLYTYPE_Invalid;
+		}
+
+		PLYVPROP ParsePLYVertexProperty(const char * name)
+		{
+			ASSERT_ERR(name);
+
+			// UVs go by several names in the wild
+			static const struct { const char * m_name; PLYVPROP m_vprop; } s_names[] =
+			{
+				{ "x",			PLYVPROP_X, },
+				{ "y",			PLYVPROP_Y, },
+				{ "z",			PLYVPROP_Z, },
+				{ "nx",			PLYVPROP_NX, },
+				{ "ny",			PLYVPROP_NY, },
+				{ "nz",			PLYVPROP_NZ, },
+				{ "u",			PLYVPROP_U, },
+				{ "v",			PLYVPROP_V, },
+				{ "s",			PLYVPROP_U, },
+				{ "t",			PLYVPROP_V, },
+				{ "texture_u",	PLYVPROP_U, },
+				{ "texture_v",	PLYVPROP_V, },
+			};
+
+			for (int i = 0; i < dim(s_names); ++i)
+			{
+				if (_stricmp(name, s_names[i].m_name) == 0)
+					return s_names[i].m_vprop;
+			}
+			return PLYVPROP_None;
+		}
+
+		double ReadValue(Reader * pReader, PLYTYPE type)
+		{
+			ASSERT_ERR(pReader);
+			ASSERT_ERR(type >= 0 && type < PLYTYPE_Count);
+
+			int sizeBytes = s_plyTypeSizes[type];
+			if (pReader->m_overrun || pReader->m_pEnd - pReader->m_pCur < sizeBytes)
+			{
+				pReader->m_overrun = true;
+				return 0.0;
+			}
+
+			// Copy to an aligned buffer, swapping bytes if necessary
+			byte buf[8];
+			if (pReader->m_bigEndian)
+			{
+				for (int i = 0; i < sizeBytes; ++i)
+					buf[i] = pReader->m_pCur[sizeBytes - 1 - i];
+			}
+			else
+			{
+				memcpy(buf, pReader->m_pCur, sizeBytes);
+			}
+			pReader->m_pCur += sizeBytes;
+
+			switch (type)
+			{
+			case PLYTYPE_Int8:		return *(signed char *)buf;
+			case PLYTYPE_UInt8:		return *(unsigned char *)buf;
+			case PLYTYPE_Int16:		return *(short *)buf;
+			case PLYTYPE_UInt16:	return *(unsigned short *)buf;
+			case PLYTYPE_Int32:		return *(int *)buf;
+			case PLYTYPE_UInt32:	return *(uint *)buf;
+			case PLYTYPE_Float32:	return *(float *)buf;
+			case PLYTYPE_Float64:	return *(double *)buf;
+			default:
+				ERR("Unexpected PLY type %d", type);
+				return 0.0;
+			}
+		}
 	}
 
 
 
-	// Helper function for quick and dirty apps - just compile and load a mesh in one step.
-	// Totally unnecessarily serializing, compressing, decompressing, and deserializing
-	// all the data here...but whatever.
+	// Load compiled data into a runtime game object
 
-	bool LoadOBJMesh(
+	bool DeserializeMaterialMap(
+			const byte * pMtlMap,
+			int mtlMapSize,
+			int indexCount,
+			MaterialLib * pMtlLib,
+			std::vector<Mesh::MtlRange> * pMtlRangesOut);
+
+	bool LoadMeshFromAssetPack(
+		AssetPack * pPack,
 		const char * path,
+		MaterialLib * pMtlLib,
 		Mesh * pMeshOut)
 	{
+		ASSERT_ERR(pPack);
 		ASSERT_ERR(path);
 		ASSERT_ERR(pMeshOut);
 
-		// Set up an in-memory zip stream
-		mz_zip_archive zipWrite = {};
-		CHECK_ERR(mz_zip_writer_init_heap(&zipWrite, 0, 0));
+		using namespace OBJMeshCompiler;
+
+		pMeshOut->m_pPack = pPack;
 
-		// Compile the mesh to it
-		AssetCompileInfo aci = { path, ACK_OBJMesh };
-		if (!AssetCompiler::CompileFullAssetPackToZip(&aci, 1, &zipWrite))
+		// Look for the data in the asset pack
+
+		Meta * pMeta;
+		i64 metaSize;
+		if (!pPack->LookupFile(path, s_suffixMeta, (void **)&pMeta, &metaSize))
+		{
+			WARN("Couldn't find metadata for mesh %s in asset pack %s", path, pPack->m_path.c_str());
+			return false;
+		}
+		if (metaSize != sizeof(Meta))
+		{
+			WARN("Metadata for mesh %s in asset pack %s is wrong size, %lld bytes (expected %d)",
+				path, pPack->m_path.c_str(), metaSize, sizeof(Meta));
+			return false;
+		}
+		if (pMeta->m_vlayout < 0 || pMeta->m_vlayout >= VLAYOUT_Count)
 		{
-			mz_zip_writer_end(&zipWrite);
+			WARN("Metadata for mesh %s in asset pack %s has invalid vertex layout %d",
+				path, pPack->m_path.c_str(), pMeta->m_vlayout);
 			return false;
 		}
+		if (pMeta->m_vattribs < 0 || pMeta->m_vattribs > VATTR_All)
+		{
+			WARN("Metadata for mesh %s in asset pack %s has invalid vertex attributes 0x%x",
+				path, pPack->m_path.c_str(), pMeta->m_vattribs);
+			return false;
+		}
+		pMeshOut->m_vlayout = pMeta->m_vlayout;
+		pMeshOut->m_vattribs = pMeta->m_vattribs;
+		pMeshOut->m_bounds = pMeta->m_bounds;
+
+		// Look for each of the vertex streams the layout has, and check they all agree on vertex count
+		pMeshOut->m_vertCount = -1;
+		for (int iStream = 0; iStream < VSTREAM_Count; ++iStream)
+		{
+			int strideBytes = StrideOfVertexStream(pMeta->m_vlayout, pMeta->m_vattribs, iStream);
+			if (strideBytes == 0)
+				continue;
+
+			i64 vertsSize;
+			if (!pPack->LookupFile(path, s_suffixVerts[pMeta->m_vlayout][iStream], &pMeshOut->m_apVerts[iStream], &vertsSize))
+			{
+				WARN("Couldn't find vertex stream %d for mesh %s in asset pack %s", iStream, path, pPack->m_path.c_str());
+				return false;
+			}
+
+			i64 vertCount = vertsSize / strideBytes;
+			if (vertsSize % strideBytes != 0 || vertCount > INT_MAX ||
+				(pMeshOut->m_vertCount >= 0 && vertCount != pMeshOut->m_vertCount))
+			{
+				WARN("Vertex stream %d for mesh %s in asset pack %s is wrong size, %lld bytes",
+					iStream, path, pPack->m_path.c_str(), vertsSize);
+				return false;
+			}
+			pMeshOut->m_vertCount = int(vertCount);
+		}
+
+		i64 indicesSize;
+		if (!pPack->LookupFile(path, s_suffixIndices, (void **)&pMeshOut->m_pIndices, &indicesSize))
+		{
+			WARN("Couldn't find indices for mesh %s in asset pack %s", path, pPack->m_path.c_str());
+			return false;
+		}
+		pMeshOut->m_indexCount = int(indicesSize / sizeof(int));
 
-		void * pData;
-		size_t sizeBytes;
-		if (!mz_zip_writer_finalize_heap_archive(&zipWrite, &pData, &sizeBytes))
+		byte * pMtlMap;
+		i64 mtlMapSize;
+		if (!pPack->LookupFile(path, s_suffixMtlMap, (void **)&pMtlMap, &mtlMapSize))
+		{
+			WARN("Couldn't find material map for mesh %s in asset pack %s", path, pPack->m_path.c_str());
+			return false;
+		}
+		if (!DeserializeMaterialMap(pMtlMap, int(mtlMapSize), pMeshOut->m_indexCount, pMtlLib, &pMeshOut->m_mtlRanges))
 		{
-			WARN("Couldn't finalize archive");
-			mz_zip_writer_end(&zipWrite);
+			WARN("Couldn't deserialize material map for mesh %s in asset pack %s", path, pPack->m_path.c_str());
 			return false;
 		}
 
-		// Turn around and load the pack right back in
+		// Depth-only index buffer and its alpha-tested ranges
 
-		mz_zip_archive zipRead = {};
-		CHECK_ERR(mz_zip_reader_init_mem(&zipRead, pData, sizeBytes, 0));
+		i64 depthIndicesSize;
+		if (!pPack->LookupFile(path, s_suffixDepthIndices, (void **)&pMeshOut->m_pDepthIndices, &depthIndicesSize))
+		{
+			WARN("Couldn't find depth-only indices for mesh %s in asset pack %s", path, pPack->m_path.c_str());
+			return false;
+		}
+		pMeshOut->m_depthIndexCount = int(depthIndicesSize / sizeof(int));
 
-		AssetPack * pPack = new AssetPack;
-		pPack->m_path = "(in memory)";
+		if (pMeta->m_depthOpaqueIndexCount < 0 || pMeta->m_depthOpaqueIndexCount > pMeshOut->m_depthIndexCount)
+		{
+			WARN("Metadata for mesh %s in asset pack %s has invalid depth-only opaque index count %d",
+				path, pPack->m_path.c_str(), pMeta->m_depthOpaqueIndexCount);
+			return false;
+		}
+		pMeshOut->m_depthOpaqueIndexCount = pMeta->m_depthOpaqueIndexCount;
 
-		if (!AssetCompiler::LoadAssetPackFromZip(&zipRead, pPack))
+		byte * pDepthMtlMap;
+		i64 depthMtlMapSize;
+		if (!pPack->LookupFile(path, s_suffixDepthMtlMap, (void **)&pDepthMtlMap, &depthMtlMapSize))
+		{
+			WARN("Couldn't find depth-only material map for mesh %s in asset pack %s", path, pPack->m_path.c_str());
+			return false;
+		}
+		if (depthMtlMapSize > 0 &&
+			!DeserializeMaterialMap(pDepthMtlMap, int(depthMtlMapSize), pMeshOut->m_depthIndexCount, pMtlLib, &pMeshOut->m_depthMtlRanges))
 		{
-			mz_zip_writer_end(&zipRead);
-			mz_zip_writer_end(&zipWrite);
+			WARN("Couldn't deserialize depth-only material map for mesh %s in asset pack %s", path, pPack->m_path.c_str());
 			return false;
 		}
 
-		mz_zip_writer_end(&zipRead);
-		mz_zip_writer_end(&zipWrite);
+		LOG("Loaded %s from asset pack %s - %d verts%s, %d indices, %d materials",
+			path, pPack->m_path.c_str(), pMeshOut->m_vertCount,
+			(pMeshOut->m_vlayout == VLAYOUT_Split) ? " (split streams)" : "",
+			pMeshOut->m_indexCount, pMeshOut->m_mtlRanges.size());
+
+		return true;
+	}
+
+	bool DeserializeMaterialMap(
+		const byte * pMtlMap,
+		int mtlMapSize,
+		int indexCount,
+		MaterialLib * pMtlLib,
+		std::vector<Mesh::MtlRange> * pMtlRangesOut)
+	{
+		ASSERT_ERR(pMtlMap);
+		ASSERT_ERR(mtlMapSize > 0);
+		ASSERT_ERR(pMtlRangesOut);
+
+		DeserializeHelper dh(pMtlMap, mtlMapSize);
+		while (!dh.AtEOF())
+		{
+			Mesh::MtlRange range = {};
+
+			// Read data
+			const char * mtlName;
+			if (!dh.ReadString(&mtlName) ||
+				!dh.Read(&range.m_indexStart) ||
+				!dh.Read(&range.m_indexCount))
+			{
+				return false;
+			}
+
+			// Validate data
+			if (range.m_indexStart < 0 ||
+				range.m_indexCount <= 0 ||
+				range.m_indexStart + range.m_indexCount > indexCount)
+			{
+				WARN("Corrupt material map: invalid index start/count");
+				return false;
+			}
+
+			// Look up material by name
+			if (pMtlLib && *mtlName)
+			{
+				range.m_pMtl = pMtlLib->Lookup(mtlName);
+				ASSERT_WARN_MSG(range.m_pMtl, 
+					"Couldn't find material %s in material library", mtlName);
+			}
+
+			pMtlRangesOut->push_back(range);
+		}
+
+		return true;
+	}
+
+
+
+	// Helper function for quick and dirty apps - just compile and load a mesh in one step.
+	// It's compiled straight into an in-memory pack, with no .zip in between.
+
+	bool LoadOBJMesh(
+		const char * path,
+		Mesh * pMeshOut)
+	{
+		ASSERT_ERR(path);
+		ASSERT_ERR(pMeshOut);
+
+		// Compile the mesh to a pack in memory
+		comptr<AssetPack> pPack = new AssetPack;
+		pPack->m_path = "(in memory)";
+		AssetCompileInfo aci = { path, ACK_OBJMesh };
+		if (!AssetCompiler::CompileAssetsToPack(&aci, 1, pPack))
+			return false;
 
 		// And extract the mesh from it
 		return LoadMeshFromAssetPack(pPack, path, nullptr, pMeshOut);
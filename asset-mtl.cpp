@@ -4,6 +4,15 @@
 namespace Framework
 {
 	// Infrastructure for compiling Wavefront .mtl material libraries.
+	//  * Materials with a bump map get a tangent-space normal map generated from it, since
+	//      only the .mtl knows the bump scale.  It's stored under the material lib's own path,
+	//      and the material references it in place of the height map.  It gets the material
+	//      lib's max dimension and mip bias, and the bump map is listed in the material lib's
+	//      deps, so the normal map's regenerated when it changes.
+	//  * With ACF_MtlPackChannels, each material's spec, mask and height maps are packed
+	//      into the channels of one texture, stored the same way, with the same limits and
+	//      deps.  They're single-channel in practice, so this saves memory and fetches.  Spec
+	//      and height are then only available through the packed texture.
 
 	namespace OBJMtlLibCompiler
 	{
@@ -15,20 +24,51 @@ namespace Framework
 			std::string		m_texDiffuseColor;
 			std::string		m_texSpecColor;
 			std::string		m_texHeight;
+			std::string		m_texMask;
+			std::string		m_texNormal;			// Path of the generated normal map in the asset pack
+			std::string		m_texPacked;			// Path of the packed texture in the asset pack
+			int				m_packedChannels[PACKCH_Count];
 			rgb				m_rgbDiffuseColor;
 			rgb				m_rgbSpecColor;
 			float			m_specPower;
 			float			m_bumpScale;
+			bool			m_alphaTest;
 		};
 
 		struct Context
 		{
-			std::vector<Material>	m_mtls;
+			std::vector<Material>		m_mtls;
+			std::vector<std::string>	m_pathsDep;		// Source textures that generated textures came from
 		};
 
 		// Prototype various helper functions
 		bool ParseMTL(const char * path, Context * pCtxOut);
+		void GenerateNormalMaps(const AssetCompileInfo * pACI, Context * pCtx, AssetCompiler::AssetSink * pSinkOut);
+		void PackChannels(const AssetCompileInfo * pACI, Context * pCtx, AssetCompiler::AssetSink * pSinkOut);
 		void SerializeMtlLib(Context * pCtx, std::vector<byte> * pDataOut);
+
+		// Used by the mesh compiler, to find which material ranges need alpha testing
+		bool FindAlphaTestedMaterials(const char * path, std::unordered_set<std::string> * pMtlNamesOut);
+
+		// Used by the loader, for textures generated while compiling the material lib
+		Texture2D * LoadGeneratedTexture(AssetPack * pPack, TextureLib * pTexLib, const char * path);
+	}
+
+	namespace TextureCompiler
+	{
+		// Implemented in asset-texture.cpp
+		bool CompileNormalMapFromHeight(
+			const char * pathHeight,
+			const char * assetPath,
+			float bumpScale,
+			const AssetCompileInfo * pACIMtl,
+			AssetCompiler::AssetSink * pSinkOut);
+		bool CompilePackedTexture(
+			const char * const * aPathsSrc,
+			int channelCount,
+			const char * assetPath,
+			const AssetCompileInfo * pACIMtl,
+			AssetCompiler::AssetSink * pSinkOut);
 	}
 
 
@@ -37,12 +77,12 @@ namespace Framework
 
 	bool CompileOBJMtlLibAsset(
 		const AssetCompileInfo * pACI,
-		mz_zip_archive * pZipOut)
+		AssetCompiler::AssetSink * pSinkOut)
 	{
 		ASSERT_ERR(pACI);
 		ASSERT_ERR(pACI->m_pathSrc);
 		ASSERT_ERR(pACI->m_ack == ACK_OBJMtlLib);
-		ASSERT_ERR(pZipOut);
+		ASSERT_ERR(pSinkOut);
 
 		using namespace AssetCompiler;
 		using namespace OBJMtlLibCompiler;
@@ -52,12 +92,17 @@ namespace Framework
 		if (!ParseMTL(pACI->m_pathSrc, &ctx))
 			return false;
 
+		GenerateNormalMaps(pACI, &ctx, pSinkOut);
+		if (pACI->m_flags & ACF_MtlPackChannels)
+			PackChannels(pACI, &ctx, pSinkOut);
+
 		// Write the data out to the archive
 
 		std::vector<byte> serializedMtlLib;
 		SerializeMtlLib(&ctx, &serializedMtlLib);
 
-		return WriteAssetDataToZip(pACI->m_pathSrc, s_suffixMtlLib, &serializedMtlLib[0], serializedMtlLib.size(), pZipOut);
+		return pSinkOut->WriteAssetData(pACI->m_pathSrc, s_suffixMtlLib, &serializedMtlLib[0], serializedMtlLib.size()) &&
+			   WriteAssetDepsToSink(pACI->m_pathSrc, ctx.m_pathsDep, pSinkOut);
 	}
 
 
@@ -83,10 +128,15 @@ namespace Framework
 				std::string(),			// m_texDiffuseColor
 				std::string(),			// m_texSpecColor
 				std::string(),			// m_texHeight
+				std::string(),			// m_texMask
+				std::string(),			// m_texNormal
+				std::string(),			// m_texPacked
+				{ -1, -1, -1, },		// m_packedChannels
 				{ 1.0f, 1.0f, 1.0f, },	// m_rgbDiffuseColor
 				{ 0.0f, 0.0f, 0.0f, },	// m_rgbSpecColor
 				0.0f,					// m_specPower
 				1.0f,					// m_bumpScale
+				false,					// m_alphaTest
 			};
 
 			// Parse line-by-line
@@ -165,6 +215,26 @@ namespace Framework
 					makeLowercase(pMtlCur->m_texHeight);
 					replaceChars(pMtlCur->m_texHeight, '\\', '/');
 				}
+				else if (_stricmp(pToken, "map_d") == 0)
+				{
+					if (!pMtlCur)
+					{
+						WARN("%s: syntax error at line %d: material parameters specified before any \"newmtl\" command; ignoring",
+							path, tph.m_iLine);
+						continue;
+					}
+
+					// The alpha channel of the diffuse texture is used for testing, so the mask
+					// itself is only stored if channels are being packed.  It mainly tells us that
+					// this material needs alpha testing.
+					pMtlCur->m_texMask = tph.ExpectOneToken("texture name");
+					tph.ExpectEOL();
+
+					makeLowercase(pMtlCur->m_texMask);
+					replaceChars(pMtlCur->m_texMask, '\\', '/');
+
+					pMtlCur->m_alphaTest = true;
+				}
 				else if (_stricmp(pToken, "Kd") == 0)
 				{
 					char * tokens[3] = {};
@@ -214,6 +284,111 @@ namespace Framework
 			return true;
 		}
 
+		void GenerateNormalMaps(const AssetCompileInfo * pACI, Context * pCtx, AssetCompiler::AssetSink * pSinkOut)
+		{
+			ASSERT_ERR(pACI);
+			ASSERT_ERR(pCtx);
+			ASSERT_ERR(pSinkOut);
+
+			// Height maps are relative to the MTL's directory
+			std::string dirBase = findDirectory(pACI->m_pathSrc);
+
+			// Materials often share a bump map and scale, so only compile each combination once
+			std::unordered_map<std::string, bool> results;
+			for (int i = 0, cMtl = int(pCtx->m_mtls.size()); i < cMtl; ++i)
+			{
+				Material * pMtl = &pCtx->m_mtls[i];
+				if (pMtl->m_texHeight.empty())
+					continue;
+
+				char suffix[32];
+				sprintf_s(suffix, "@%g", pMtl->m_bumpScale);
+				std::string texNormal = std::string(pACI->m_pathSrc) + "/normal/" + pMtl->m_texHeight + suffix;
+
+				auto iter = results.find(texNormal);
+				if (iter == results.end())
+				{
+					// Depend on the height map even if it fails, so fixing it gets picked up
+					std::string pathHeight = dirBase + pMtl->m_texHeight;
+					pCtx->m_pathsDep.push_back(pathHeight);
+					bool result = TextureCompiler::CompileNormalMapFromHeight(
+									pathHeight.c_str(), texNormal.c_str(), pMtl->m_bumpScale, pACI, pSinkOut);
+					if (!result)
+					{
+						WARN("%s: couldn't generate normal map for material %s; falling back to height map",
+							pACI->m_pathSrc, pMtl->m_mtlName.c_str());
+					}
+					iter = results.insert(std::make_pair(texNormal, result)).first;
+				}
+
+				if (iter->second)
+					pMtl->m_texNormal = texNormal;
+			}
+		}
+
+		void PackChannels(const AssetCompileInfo * pACI, Context * pCtx, AssetCompiler::AssetSink * pSinkOut)
+		{
+			ASSERT_ERR(pACI);
+			ASSERT_ERR(pCtx);
+			ASSERT_ERR(pSinkOut);
+
+			// Source textures are relative to the MTL's directory
+			std::string dirBase = findDirectory(pACI->m_pathSrc);
+
+			// Materials that share the same set of sources share the packed texture too
+			std::unordered_map<std::string, std::string> packedBySources;
+			for (int i = 0, cMtl = int(pCtx->m_mtls.size()); i < cMtl; ++i)
+			{
+				Material * pMtl = &pCtx->m_mtls[i];
+				const std::string * apTexSrc[PACKCH_Count] = { &pMtl->m_texSpecColor, &pMtl->m_texMask, &pMtl->m_texHeight };
+
+				// Assign channels in order, skipping sources the material doesn't have
+				std::string pathsSrc[PACKCH_Count];
+				const char * aPathsSrc[PACKCH_Count] = {};
+				int packedChannels[PACKCH_Count];
+				int channelCount = 0;
+				std::string key;
+				for (int j = 0; j < PACKCH_Count; ++j)
+				{
+					key += *apTexSrc[j];
+					key += '|';
+					if (apTexSrc[j]->empty())
+					{
+						packedChannels[j] = -1;
+						continue;
+					}
+					pathsSrc[channelCount] = dirBase + *apTexSrc[j];
+					aPathsSrc[channelCount] = pathsSrc[channelCount].c_str();
+					packedChannels[j] = channelCount++;
+				}
+				if (channelCount == 0)
+					continue;
+
+				auto iter = packedBySources.find(key);
+				if (iter == packedBySources.end())
+				{
+					for (int j = 0; j < channelCount; ++j)
+						pCtx->m_pathsDep.push_back(pathsSrc[j]);
+
+					std::string texPacked = std::string(pACI->m_pathSrc) + "/packed/" + pMtl->m_mtlName;
+					if (!TextureCompiler::CompilePackedTexture(aPathsSrc, channelCount, texPacked.c_str(), pACI, pSinkOut))
+					{
+						WARN("%s: couldn't pack textures for material %s; leaving them separate",
+							pACI->m_pathSrc, pMtl->m_mtlName.c_str());
+						texPacked.clear();
+					}
+					iter = packedBySources.insert(std::make_pair(key, texPacked)).first;
+				}
+
+				if (!iter->second.empty())
+				{
+					pMtl->m_texPacked = iter->second;
+					for (int j = 0; j < PACKCH_Count; ++j)
+						pMtl->m_packedChannels[j] = packedChannels[j];
+				}
+			}
+		}
+
 		void SerializeMtlLib(Context * pCtx, std::vector<byte> * pDataOut)
 		{
 			ASSERT_ERR(pCtx);
@@ -227,12 +402,56 @@ namespace Framework
 				sh.WriteString(pMtl->m_texDiffuseColor);
 				sh.WriteString(pMtl->m_texSpecColor);
 				sh.WriteString(pMtl->m_texHeight);
+				sh.WriteString(pMtl->m_texNormal);
+				sh.WriteString(pMtl->m_texPacked);
+				for (int j = 0; j < PACKCH_Count; ++j)
+					sh.Write(pMtl->m_packedChannels[j]);
 				sh.Write(pMtl->m_rgbDiffuseColor);
 				sh.Write(pMtl->m_rgbSpecColor);
 				sh.Write(pMtl->m_specPower);
 				sh.Write(pMtl->m_bumpScale);
+				sh.Write(pMtl->m_alphaTest);
 			}
 		}
+
+		bool FindAlphaTestedMaterials(const char * path, std::unordered_set<std::string> * pMtlNamesOut)
+		{
+			ASSERT_ERR(path);
+			ASSERT_ERR(pMtlNamesOut);
+
+			Context ctx = {};
+			if (!ParseMTL(path, &ctx))
+				return false;
+
+			for (int i = 0, cMtl = int(ctx.m_mtls.size()); i < cMtl; ++i)
+			{
+				if (ctx.m_mtls[i].m_alphaTest)
+					pMtlNamesOut->insert(ctx.m_mtls[i].m_mtlName);
+			}
+
+			return true;
+		}
+
+		Texture2D * LoadGeneratedTexture(AssetPack * pPack, TextureLib * pTexLib, const char * path)
+		{
+			ASSERT_ERR(pPack);
+			ASSERT_ERR(pTexLib);
+			ASSERT_ERR(path);
+
+			// These aren't in the texture lib's asset list, so load them here.  Materials can
+			// share one, so check if it's already there.
+			if (Texture2D * pTex = pTexLib->Lookup(path))
+				return pTex;
+
+			Texture2D * pTex = &pTexLib->m_texs[path];
+			if (!LoadTexture2DFromAssetPack(pPack, path, pTex))
+			{
+				pTexLib->m_texs.erase(path);
+				return nullptr;
+			}
+
+			return pTex;
+		}
 	}
 
 
@@ -255,7 +474,7 @@ namespace Framework
 
 		// Look for the data in the asset pack
 		byte * pData;
-		int dataSize;
+		i64 dataSize;
 		if (!pPack->LookupFile(path, s_suffixMtlLib, (void **)&pData, &dataSize))
 		{
 			WARN("Couldn't find data for material lib %s in asset pack %s", path, pPack->m_path.c_str());
@@ -266,7 +485,7 @@ namespace Framework
 		std::string dirBase = findDirectory(path);
 
 		// Deserialize it
-		DeserializeHelper dh(pData, dataSize);
+		DeserializeHelper dh(pData, int(dataSize));
 		while (!dh.AtEOF())
 		{
 			Framework::Material mtl = {};
@@ -275,14 +494,22 @@ namespace Framework
 			const char * texDiffuseColorName;
 			const char * texSpecColorName;
 			const char * texHeightName;
+			const char * texNormalPath;
+			const char * texPackedPath;
 			if (!dh.ReadString(&mtl.m_mtlName) ||
 				!dh.ReadString(&texDiffuseColorName) ||
 				!dh.ReadString(&texSpecColorName) ||
 				!dh.ReadString(&texHeightName) ||
+				!dh.ReadString(&texNormalPath) ||
+				!dh.ReadString(&texPackedPath) ||
+				!dh.Read(&mtl.m_packedChannels[PACKCH_Spec]) ||
+				!dh.Read(&mtl.m_packedChannels[PACKCH_Mask]) ||
+				!dh.Read(&mtl.m_packedChannels[PACKCH_Height]) ||
 				!dh.Read(&mtl.m_rgbDiffuseColor) ||
 				!dh.Read(&mtl.m_rgbSpecColor) ||
 				!dh.Read(&mtl.m_specPower) ||
-				!dh.Read(&mtl.m_bumpScale))
+				!dh.Read(&mtl.m_bumpScale) ||
+				!dh.Read(&mtl.m_alphaTest))
 			{
 				return false;
 			}
@@ -295,6 +522,14 @@ namespace Framework
 				WARN("Corrupt material lib: numeric parameter out of range");
 				return false;
 			}
+			for (int j = 0; j < PACKCH_Count; ++j)
+			{
+				if (mtl.m_packedChannels[j] < -1 || mtl.m_packedChannels[j] >= PACKCH_Count)
+				{
+					WARN("Corrupt material lib: packed channel out of range");
+					return false;
+				}
+			}
 
 			// Look up textures by name
 			if (pTexLib)
@@ -305,13 +540,29 @@ namespace Framework
 					ASSERT_WARN_MSG(mtl.m_pTexDiffuseColor, 
 						"Material %s: couldn't find texture %s in texture library", mtl.m_mtlName, texDiffuseColorName);
 				}
-				if (*texSpecColorName)
+				if (*texPackedPath)
+				{
+					mtl.m_pTexPacked = LoadGeneratedTexture(pPack, pTexLib, texPackedPath);
+					if (!mtl.m_pTexPacked)
+					{
+						WARN("Material %s: couldn't load packed texture %s", mtl.m_mtlName, texPackedPath);
+						for (int j = 0; j < PACKCH_Count; ++j)
+							mtl.m_packedChannels[j] = -1;
+					}
+				}
+				if (*texSpecColorName && !mtl.m_pTexPacked)
 				{
 					mtl.m_pTexSpecColor = pTexLib->Lookup(dirBase + texSpecColorName);
 					ASSERT_WARN_MSG(mtl.m_pTexSpecColor, 
 						"Material %s: couldn't find texture %s in texture library", mtl.m_mtlName, texSpecColorName);
 				}
-				if (*texHeightName)
+				if (*texNormalPath)
+				{
+					mtl.m_pTexNormal = LoadGeneratedTexture(pPack, pTexLib, texNormalPath);
+					ASSERT_WARN_MSG(mtl.m_pTexNormal,
+						"Material %s: couldn't load normal map %s", mtl.m_mtlName, texNormalPath);
+				}
+				if (*texHeightName && !mtl.m_pTexNormal && !mtl.m_pTexPacked)
 				{
 					mtl.m_pTexHeight = pTexLib->Lookup(dirBase + texHeightName);
 					ASSERT_WARN_MSG(mtl.m_pTexHeight, 
@@ -0,0 +1,281 @@
+#include "framework.h"
+#include "asset-internal.h"
+
+#include <emmintrin.h>
+
+namespace Framework
+{
+	// PNG-style row filtering for pixel data in asset packs.
+	//  * Each row is stored as a filter byte followed by the row's bytes, predicted from the
+	//      pixel to the left, the one above, or both, and stored as the difference (mod 256).
+	//      Smooth images turn into mostly small numbers, which deflate much better than the
+	//      pixels themselves.
+	//  * The filter for each row is chosen adaptively, by the smallest sum of the residuals
+	//      taken as signed bytes, the same heuristic as libpng.
+	//  * Filtering is split across threads by rows.  Unfiltering has to go in row order,
+	//      since each row depends on the previous one, so the pack loader runs different
+	//      images in parallel instead.  4-byte pixels (RGBA8, R11G11B10) use SSE2; other
+	//      sizes fall back to scalar code.
+
+	namespace AssetCompiler
+	{
+		enum ROWFILTER
+		{
+			ROWFILTER_None,
+			ROWFILTER_Sub,			// Predict from the left
+			ROWFILTER_Up,			// Predict from above
+			ROWFILTER_Paeth,		// Predict from whichever of left, above and above-left is closest to left + above - above-left
+
+			ROWFILTER_Count
+		};
+
+		static inline byte PaethPredictor(int a, int b, int c)
+		{
+			int p = a + b - c;
+			int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+			if (pa <= pb && pa <= pc)
+				return byte(a);
+			return byte((pb <= pc) ? b : c);
+		}
+
+		// Filter one row with the given filter.  pRowAbove is null for the top row.
+		static void FilterRow(
+			ROWFILTER filter,
+			const byte * pRow,
+			const byte * pRowAbove,
+			int rowBytes,
+			int bytesPerPixel,
+			byte * pOut)
+		{
+			for (int i = 0; i < rowBytes; ++i)
+			{
+				int a = (i >= bytesPerPixel) ? pRow[i - bytesPerPixel] : 0;
+				int b = pRowAbove ? pRowAbove[i] : 0;
+				int c = (pRowAbove && i >= bytesPerPixel) ? pRowAbove[i - bytesPerPixel] : 0;
+
+				switch (filter)
+				{
+				case ROWFILTER_None:	pOut[i] = pRow[i];								break;
+				case ROWFILTER_Sub:		pOut[i] = byte(pRow[i] - a);					break;
+				case ROWFILTER_Up:		pOut[i] = byte(pRow[i] - b);					break;
+				default:				pOut[i] = byte(pRow[i] - PaethPredictor(a, b, c));	break;
+				}
+			}
+		}
+
+		static int ScoreFilteredRow(const byte * pFiltered, int rowBytes)
+		{
+			int score = 0;
+			for (int i = 0; i < rowBytes; ++i)
+				score += abs(int((signed char)pFiltered[i]));
+			return score;
+		}
+
+		void FilterRows(
+			const void * pPixels,
+			int2 dims,
+			int bytesPerPixel,
+			byte * pFilteredOut)
+		{
+			ASSERT_ERR(pPixels);
+			ASSERT_ERR(all(dims > 0));
+			ASSERT_ERR(bytesPerPixel > 0);
+			ASSERT_ERR(pFilteredOut);
+
+			int rowBytes = dims.x * bytesPerPixel;
+			const byte * pBytes = (const byte *)pPixels;
+
+			ParallelFor(dims.y, max(1, 65536 / rowBytes), [=](int yStart, int yEnd)
+			{
+				std::vector<byte> candidate(rowBytes);
+				for (int y = yStart; y < yEnd; ++y)
+				{
+					const byte * pRow = &pBytes[size_t(y) * rowBytes];
+					const byte * pRowAbove = (y > 0) ? pRow - rowBytes : nullptr;
+					byte * pOut = &pFilteredOut[size_t(y) * (rowBytes + 1)];
+
+					// Try each filter and keep the best
+					int scoreBest = INT_MAX;
+					for (int filter = 0; filter < ROWFILTER_Count; ++filter)
+					{
+						FilterRow(ROWFILTER(filter), pRow, pRowAbove, rowBytes, bytesPerPixel, &candidate[0]);
+						int score = ScoreFilteredRow(&candidate[0], rowBytes);
+						if (score < scoreBest)
+						{
+							scoreBest = score;
+							pOut[0] = byte(filter);
+							memcpy(&pOut[1], &candidate[0], rowBytes);
+						}
+					}
+				}
+			});
+		}
+
+
+
+		// Unfiltering, scalar version for any pixel size
+
+		static void UnfilterRowScalar(
+			ROWFILTER filter,
+			const byte * pFiltered,
+			const byte * pRowAbove,
+			int rowBytes,
+			int bytesPerPixel,
+			byte * pRow)
+		{
+			for (int i = 0; i < rowBytes; ++i)
+			{
+				int a = (i >= bytesPerPixel) ? pRow[i - bytesPerPixel] : 0;
+				int b = pRowAbove ? pRowAbove[i] : 0;
+				int c = (pRowAbove && i >= bytesPerPixel) ? pRowAbove[i - bytesPerPixel] : 0;
+
+				switch (filter)
+				{
+				case ROWFILTER_None:	pRow[i] = pFiltered[i];								break;
+				case ROWFILTER_Sub:		pRow[i] = byte(pFiltered[i] + a);					break;
+				case ROWFILTER_Up:		pRow[i] = byte(pFiltered[i] + b);					break;
+				default:				pRow[i] = byte(pFiltered[i] + PaethPredictor(a, b, c));	break;
+				}
+			}
+		}
+
+		// Unfiltering, SSE2 version for 4-byte pixels
+
+		static inline __m128i LoadPixel4(const byte * p)
+		{
+			int value;
+			memcpy(&value, p, sizeof(value));
+			return _mm_cvtsi32_si128(value);
+		}
+
+		static inline void StorePixel4(byte * p, __m128i v)
+		{
+			int value = _mm_cvtsi128_si32(v);
+			memcpy(p, &value, sizeof(value));
+		}
+
+		static void UnfilterRowSSE2(
+			ROWFILTER filter,
+			const byte * pFiltered,
+			const byte * pRowAbove,
+			int width,
+			byte * pRow)
+		{
+			int rowBytes = width * 4;
+			int x = 0;
+
+			switch (filter)
+			{
+			case ROWFILTER_None:
+				memcpy(pRow, pFiltered, rowBytes);
+				return;
+
+			case ROWFILTER_Sub:
+				{
+					// Prefix sum over 4 pixels at a time: add each pixel to the one after it, then
+					// each pair to the pair after it, then carry in the last pixel of the last group
+					__m128i carry = _mm_setzero_si128();
+					for (; x + 4 <= width; x += 4)
+					{
+						__m128i v = _mm_loadu_si128((const __m128i *)&pFiltered[x * 4]);
+						v = _mm_add_epi8(v, _mm_slli_si128(v, 4));
+						v = _mm_add_epi8(v, _mm_slli_si128(v, 8));
+						v = _mm_add_epi8(v, carry);
+						_mm_storeu_si128((__m128i *)&pRow[x * 4], v);
+						carry = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3));
+					}
+					for (; x < width; ++x)
+					{
+						carry = _mm_add_epi8(carry, LoadPixel4(&pFiltered[x * 4]));
+						StorePixel4(&pRow[x * 4], carry);
+					}
+				}
+				return;
+
+			case ROWFILTER_Up:
+				if (!pRowAbove)
+				{
+					memcpy(pRow, pFiltered, rowBytes);
+					return;
+				}
+				for (int i = 0; i + 16 <= rowBytes; i += 16, x += 4)
+				{
+					__m128i v = _mm_loadu_si128((const __m128i *)&pFiltered[i]);
+					__m128i b = _mm_loadu_si128((const __m128i *)&pRowAbove[i]);
+					_mm_storeu_si128((__m128i *)&pRow[i], _mm_add_epi8(v, b));
+				}
+				for (; x < width; ++x)
+					StorePixel4(&pRow[x * 4], _mm_add_epi8(LoadPixel4(&pFiltered[x * 4]), LoadPixel4(&pRowAbove[x * 4])));
+				return;
+
+			default:
+				{
+					// Paeth, one pixel at a time with the channels widened to 16 bits.
+					// pa = |b - c|, pb = |a - c|, pc = |a + b - 2c|, as p - a = b - c etc.
+					if (!pRowAbove)
+					{
+						// Above and above-left are zero, so the predictor is just the left pixel
+						UnfilterRowSSE2(ROWFILTER_Sub, pFiltered, nullptr, width, pRow);
+						return;
+					}
+
+					__m128i zero = _mm_setzero_si128();
+					__m128i a = zero, c = zero;
+					for (; x < width; ++x)
+					{
+						__m128i b = _mm_unpacklo_epi8(LoadPixel4(&pRowAbove[x * 4]), zero);
+						__m128i pa = _mm_sub_epi16(b, c);
+						__m128i pb = _mm_sub_epi16(a, c);
+						__m128i pc = _mm_add_epi16(pa, pb);
+						pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+						pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+						pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+
+						// Pick a if pa <= pb and pa <= pc, else b if pb <= pc, else c
+						__m128i useA = _mm_andnot_si128(_mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc)), _mm_set1_epi16(-1));
+						__m128i useB = _mm_andnot_si128(_mm_cmpgt_epi16(pb, pc), _mm_set1_epi16(-1));
+						__m128i pred = _mm_or_si128(_mm_and_si128(useB, b), _mm_andnot_si128(useB, c));
+						pred = _mm_or_si128(_mm_and_si128(useA, a), _mm_andnot_si128(useA, pred));
+
+						__m128i v = _mm_add_epi8(LoadPixel4(&pFiltered[x * 4]), _mm_packus_epi16(pred, zero));
+						StorePixel4(&pRow[x * 4], v);
+
+						a = _mm_unpacklo_epi8(v, zero);
+						c = b;
+					}
+				}
+				return;
+			}
+		}
+
+		void UnfilterRows(
+			const byte * pFiltered,
+			int2 dims,
+			int bytesPerPixel,
+			void * pPixelsOut)
+		{
+			ASSERT_ERR(pFiltered);
+			ASSERT_ERR(all(dims > 0));
+			ASSERT_ERR(bytesPerPixel > 0);
+			ASSERT_ERR(pPixelsOut);
+
+			int rowBytes = dims.x * bytesPerPixel;
+			byte * pBytes = (byte *)pPixelsOut;
+
+			for (int y = 0; y < dims.y; ++y)
+			{
+				const byte * pIn = &pFiltered[size_t(y) * (rowBytes + 1)];
+				byte * pRow = &pBytes[size_t(y) * rowBytes];
+				const byte * pRowAbove = (y > 0) ? pRow - rowBytes : nullptr;
+
+				// Treat unknown filters as none; the data's garbage anyway
+				ROWFILTER filter = (pIn[0] < ROWFILTER_Count) ? ROWFILTER(pIn[0]) : ROWFILTER_None;
+
+				if (bytesPerPixel == 4)
+					UnfilterRowSSE2(filter, &pIn[1], pRowAbove, dims.x, pRow);
+				else
+					UnfilterRowScalar(filter, &pIn[1], pRowAbove, rowBytes, bytesPerPixel, pRow);
+			}
+		}
+	}
+}
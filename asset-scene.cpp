@@ -0,0 +1,342 @@
+#include "framework.h"
+#include "asset-internal.h"
+#include <algorithm>
+
+namespace Framework
+{
+	// Infrastructure for compiling scenes: text files that place instances of mesh assets.
+	//  * Each line is an instance of a mesh, with an optional transform:
+	//      instance <mesh path> [scale x y z] [rotate <axis x y z> <degrees>] [translate x y z]
+	//      The transform is applied in the order scale, rotate, translate, regardless of the
+	//      order the keywords appear in.  Mesh paths are relative to the scene file.
+	//  * Meshes are referenced by path, not compiled in; they must be compiled into the same
+	//      asset pack separately.  Each unique mesh is stored once however many times it's placed.
+	//  * Instances are sorted by mesh, so each mesh's instances can be drawn with one draw.
+
+	namespace SceneCompiler
+	{
+		static const char * s_suffixMeta		= "/meta";
+		static const char * s_suffixMeshes		= "/meshes";
+		static const char * s_suffixInstances	= "/instances";
+
+		struct Instance
+		{
+			int				m_iMesh;
+			affine3			m_xfm;			// Local-to-world
+		};
+
+		struct Context
+		{
+			std::vector<std::string>	m_meshPaths;
+			std::vector<Instance>		m_instances;
+		};
+
+		struct Meta
+		{
+			int				m_meshCount;
+			int				m_instanceCount;
+		};
+
+		// Prototype various helper functions
+		bool ParseScene(const char * path, Context * pCtxOut);
+		void SerializeMeshPaths(const Context * pCtx, std::vector<byte> * pDataOut);
+	}
+
+
+
+	// Compiler entry point
+
+	bool CompileSceneAsset(
+		const AssetCompileInfo * pACI,
+		AssetCompiler::AssetSink * pSinkOut)
+	{
+		ASSERT_ERR(pACI);
+		ASSERT_ERR(pACI->m_pathSrc);
+		ASSERT_ERR(pACI->m_ack == ACK_Scene);
+		ASSERT_ERR(pSinkOut);
+
+		using namespace AssetCompiler;
+		using namespace SceneCompiler;
+
+		// Read the instances from the scene file
+		Context ctx = {};
+		if (!ParseScene(pACI->m_pathSrc, &ctx))
+			return false;
+
+		if (ctx.m_instances.empty())
+		{
+			WARN("%s: scene has no instances", pACI->m_pathSrc);
+			return false;
+		}
+
+		// Group the instances by mesh, keeping them in file order within each mesh
+		std::stable_sort(
+			ctx.m_instances.begin(), ctx.m_instances.end(),
+			[](const Instance & a, const Instance & b) { return a.m_iMesh < b.m_iMesh; });
+
+		// Fill out the metadata struct
+		Meta meta =
+		{
+			int(ctx.m_meshPaths.size()),
+			int(ctx.m_instances.size()),
+		};
+
+		// Write the data out to the archive
+
+		std::vector<byte> serializedMeshPaths;
+		SerializeMeshPaths(&ctx, &serializedMeshPaths);
+
+		return (pSinkOut->WriteAssetData(pACI->m_pathSrc, s_suffixMeta, &meta, sizeof(meta)) &&
+				pSinkOut->WriteAssetData(pACI->m_pathSrc, s_suffixMeshes, &serializedMeshPaths[0], serializedMeshPaths.size()) &&
+				pSinkOut->WriteAssetData(pACI->m_pathSrc, s_suffixInstances, &ctx.m_instances[0], ctx.m_instances.size() * sizeof(Instance)));
+	}
+
+
+
+	namespace SceneCompiler
+	{
+		bool ParseScene(const char * path, Context * pCtxOut)
+		{
+			ASSERT_ERR(path);
+			ASSERT_ERR(pCtxOut);
+
+			// Read the whole file into memory
+			std::vector<byte> data;
+			if (!LoadFile(path, &data, LFK_Text))
+				return false;
+
+			std::unordered_map<std::string, int> mapMeshPathToIndex;
+
+			// Parse line-by-line
+			TextParsingHelper tph((char *)&data[0], path);
+			while (tph.NextLine())
+			{
+				char * pToken = tph.NextToken();
+				if (_stricmp(pToken, "instance") != 0)
+				{
+					WARN("%s: syntax error at line %d: unknown command \"%s\"; ignoring", path, tph.m_iLine, pToken);
+					continue;
+				}
+
+				std::string meshPath = tph.ExpectOneToken("mesh path");
+				makeLowercase(meshPath);
+				replaceChars(meshPath, '\\', '/');
+
+				// Look up the mesh, or add it if we haven't seen it before
+				int iMesh;
+				auto iter = mapMeshPathToIndex.find(meshPath);
+				if (iter != mapMeshPathToIndex.end())
+				{
+					iMesh = iter->second;
+				}
+				else
+				{
+					iMesh = int(pCtxOut->m_meshPaths.size());
+					pCtxOut->m_meshPaths.push_back(meshPath);
+					mapMeshPathToIndex.insert(std::make_pair(meshPath, iMesh));
+				}
+
+				// Parse the optional transform keywords
+				float3 scale = { 1.0f, 1.0f, 1.0f };
+				quat rotation = { 1.0f, 0.0f, 0.0f, 0.0f };
+				float3 translation = { 0.0f, 0.0f, 0.0f };
+				while (char * pKeyword = tph.NextToken())
+				{
+					if (_stricmp(pKeyword, "scale") == 0)
+					{
+						char * tokens[3] = {};
+						tph.ExpectTokens(tokens, dim(tokens), "scale");
+						scale = float3(float(atof(tokens[0])), float(atof(tokens[1])), float(atof(tokens[2])));
+						if (any(scale == 0.0f))
+							WARN("%s: scale at line %d has a zero component", path, tph.m_iLine);
+					}
+					else if (_stricmp(pKeyword, "rotate") == 0)
+					{
+						char * tokens[4] = {};
+						tph.ExpectTokens(tokens, dim(tokens), "rotation axis and angle");
+						float3 axis = { float(atof(tokens[0])), float(atof(tokens[1])), float(atof(tokens[2])) };
+						float angle = float(atof(tokens[3])) * (3.14159265f / 180.0f);
+						if (lengthSquared(axis) == 0.0f)
+						{
+							WARN("%s: rotation axis at line %d is zero; ignoring", path, tph.m_iLine);
+							continue;
+						}
+						axis = normalize(axis) * sinf(0.5f * angle);
+						rotation = { cosf(0.5f * angle), axis.x, axis.y, axis.z };
+					}
+					else if (_stricmp(pKeyword, "translate") == 0)
+					{
+						char * tokens[3] = {};
+						tph.ExpectTokens(tokens, dim(tokens), "translation");
+						translation = float3(float(atof(tokens[0])), float(atof(tokens[1])), float(atof(tokens[2])));
+					}
+					else
+					{
+						WARN("%s: syntax error at line %d: unknown transform \"%s\"; ignoring rest of line",
+							path, tph.m_iLine, pKeyword);
+						break;
+					}
+				}
+
+				Instance inst =
+				{
+					iMesh,
+					affineMatrix(diagonalMatrix(scale.x, scale.y, scale.z), float3(0.0f)) *
+						affineMatrix(rotation, translation),
+				};
+				pCtxOut->m_instances.push_back(inst);
+			}
+
+			return true;
+		}
+
+		void SerializeMeshPaths(const Context * pCtx, std::vector<byte> * pDataOut)
+		{
+			ASSERT_ERR(pCtx);
+			ASSERT_ERR(pDataOut);
+
+			SerializeHelper sh(pDataOut);
+			for (int i = 0, cMesh = int(pCtx->m_meshPaths.size()); i < cMesh; ++i)
+				sh.WriteString(pCtx->m_meshPaths[i]);
+		}
+	}
+
+
+
+	// Load compiled data into a runtime game object
+
+	bool LoadSceneFromAssetPack(
+		AssetPack * pPack,
+		const char * path,
+		MaterialLib * pMtlLib,
+		Scene * pSceneOut)
+	{
+		ASSERT_ERR(pPack);
+		ASSERT_ERR(path);
+		ASSERT_ERR(pSceneOut);
+
+		using namespace SceneCompiler;
+
+		pSceneOut->m_pPack = pPack;
+
+		// Look for the data in the asset pack
+
+		Meta * pMeta;
+		i64 metaSize;
+		if (!pPack->LookupFile(path, s_suffixMeta, (void **)&pMeta, &metaSize))
+		{
+			WARN("Couldn't find metadata for scene %s in asset pack %s", path, pPack->m_path.c_str());
+			return false;
+		}
+		if (metaSize != sizeof(Meta))
+		{
+			WARN("Metadata for scene %s in asset pack %s is wrong size, %lld bytes (expected %d)",
+				path, pPack->m_path.c_str(), metaSize, sizeof(Meta));
+			return false;
+		}
+
+		byte * pMeshPaths;
+		i64 meshPathsSize;
+		if (!pPack->LookupFile(path, s_suffixMeshes, (void **)&pMeshPaths, &meshPathsSize))
+		{
+			WARN("Couldn't find mesh list for scene %s in asset pack %s", path, pPack->m_path.c_str());
+			return false;
+		}
+
+		Instance * pInstances;
+		i64 instancesSize;
+		if (!pPack->LookupFile(path, s_suffixInstances, (void **)&pInstances, &instancesSize))
+		{
+			WARN("Couldn't find instances for scene %s in asset pack %s", path, pPack->m_path.c_str());
+			return false;
+		}
+		if (pMeta->m_instanceCount <= 0 || instancesSize != pMeta->m_instanceCount * i64(sizeof(Instance)))
+		{
+			WARN("Instances for scene %s in asset pack %s are wrong size, %lld bytes",
+				path, pPack->m_path.c_str(), instancesSize);
+			return false;
+		}
+
+		// Load the meshes; their paths are relative to the scene's path within the zip
+		std::string dirBase = findDirectory(path);
+		pSceneOut->m_meshes.resize(pMeta->m_meshCount);
+		DeserializeHelper dh(pMeshPaths, int(meshPathsSize));
+		for (int iMesh = 0; iMesh < pMeta->m_meshCount; ++iMesh)
+		{
+			const char * meshPath;
+			if (!dh.ReadString(&meshPath))
+			{
+				WARN("Mesh list for scene %s in asset pack %s is corrupt", path, pPack->m_path.c_str());
+				return false;
+			}
+
+			if (!LoadMeshFromAssetPack(pPack, (dirBase + meshPath).c_str(), pMtlLib, &pSceneOut->m_meshes[iMesh]))
+			{
+				WARN("Scene %s: couldn't load mesh %s", path, meshPath);
+				return false;
+			}
+		}
+
+		// Find the range of instances for each mesh, and unpack the transforms into SoA form
+		int instanceCount = pMeta->m_instanceCount;
+		pSceneOut->m_instanceCount = instanceCount;
+		Scene::InstanceRange rangeEmpty = { 0, 0 };
+		pSceneOut->m_instanceRanges.assign(pMeta->m_meshCount, rangeEmpty);
+		for (int i = 0; i < ISTREAM_Count; ++i)
+			pSceneOut->m_aInstanceXfms[i].resize(instanceCount);
+		pSceneOut->m_instanceBoundsMins.resize(instanceCount);
+		pSceneOut->m_instanceBoundsMaxs.resize(instanceCount);
+		pSceneOut->m_bounds = box3(empty);
+
+		for (int iInst = 0; iInst < instanceCount; ++iInst)
+		{
+			const Instance & inst = pInstances[iInst];
+			if (inst.m_iMesh < 0 || inst.m_iMesh >= pMeta->m_meshCount ||
+				(iInst > 0 && inst.m_iMesh < pInstances[iInst - 1].m_iMesh))
+			{
+				WARN("Scene %s in asset pack %s has invalid mesh index %d for instance %d",
+					path, pPack->m_path.c_str(), inst.m_iMesh, iInst);
+				return false;
+			}
+
+			Scene::InstanceRange * pRange = &pSceneOut->m_instanceRanges[inst.m_iMesh];
+			if (pRange->m_instanceCount == 0)
+				pRange->m_instanceStart = iInst;
+			++pRange->m_instanceCount;
+
+			// Columns of the 3x4 matrix, for the vertex shader to dot with float4(pos, 1)
+			float3 axisX = xfmVector(float3(1.0f, 0.0f, 0.0f), inst.m_xfm);
+			float3 axisY = xfmVector(float3(0.0f, 1.0f, 0.0f), inst.m_xfm);
+			float3 axisZ = xfmVector(float3(0.0f, 0.0f, 1.0f), inst.m_xfm);
+			float3 translation = xfmPoint(float3(0.0f), inst.m_xfm);
+			pSceneOut->m_aInstanceXfms[ISTREAM_XfmX][iInst] = float4(axisX.x, axisY.x, axisZ.x, translation.x);
+			pSceneOut->m_aInstanceXfms[ISTREAM_XfmY][iInst] = float4(axisX.y, axisY.y, axisZ.y, translation.y);
+			pSceneOut->m_aInstanceXfms[ISTREAM_XfmZ][iInst] = float4(axisX.z, axisY.z, axisZ.z, translation.z);
+
+			// World-space bounds, from transforming the corners of the mesh's local bounds
+			const box3 & boundsLocal = pSceneOut->m_meshes[inst.m_iMesh].m_bounds;
+			box3 boundsWorld = box3(empty);
+			if (all(boundsLocal.mins <= boundsLocal.maxs))
+			{
+				for (int iCorner = 0; iCorner < 8; ++iCorner)
+				{
+					float3 corner =
+					{
+						(iCorner & 1) ? boundsLocal.maxs.x : boundsLocal.mins.x,
+						(iCorner & 2) ? boundsLocal.maxs.y : boundsLocal.mins.y,
+						(iCorner & 4) ? boundsLocal.maxs.z : boundsLocal.mins.z,
+					};
+					corner = xfmPoint(corner, inst.m_xfm);
+					boundsWorld.mins = min(boundsWorld.mins, corner);
+					boundsWorld.maxs = max(boundsWorld.maxs, corner);
+				}
+				pSceneOut->m_bounds.mins = min(pSceneOut->m_bounds.mins, boundsWorld.mins);
+				pSceneOut->m_bounds.maxs = max(pSceneOut->m_bounds.maxs, boundsWorld.maxs);
+			}
+			pSceneOut->m_instanceBoundsMins[iInst] = boundsWorld.mins;
+			pSceneOut->m_instanceBoundsMaxs[iInst] = boundsWorld.maxs;
+		}
+
+		return true;
+	}
+}
@@ -0,0 +1,917 @@
+#include "framework.h"
+#include "asset-internal.h"
+
+namespace Framework
+{
+	// Block compression for the texture compiler.
+	//  * Supports BC1 (opaque color), BC3 (color + alpha), BC4 (one channel), BC5 (two
+	//      channels) and BC7 (color + alpha, using only mode 6: one subset, RGBA endpoints
+	//      with 4-bit indices).
+	//  * Works in 8-bit encoded space, so sRGB data is compressed as sRGB, the same way
+	//      the hardware interpolates it.
+	//  * Fast quality fits endpoints to the bounding box of the block; high quality fits
+	//      them to the principal axis, then refines them by least squares against the
+	//      chosen indices, and for BC4/BC7 also searches the extra encoding options.
+	//  * Blocks are compressed in parallel, by rows of blocks.
+
+	namespace TextureCompiler
+	{
+		enum BCQUALITY
+		{
+			BCQUALITY_Fast,
+			BCQUALITY_High,
+		};
+
+		// Prototype various helper functions
+		bool IsSupportedBCFormat(DXGI_FORMAT format);
+		void CompressImageBC(
+			const byte4 * pPixels,
+			int2 dims,
+			DXGI_FORMAT format,
+			BCQUALITY quality,
+			std::vector<byte> * pBlocksOut);
+		void DecompressImageBC(
+			const byte * pBlocks,
+			int2 dims,
+			DXGI_FORMAT format,
+			std::vector<byte4> * pPixelsOut);
+		float CalculatePSNR(
+			const byte4 * pPixelsA,
+			const byte4 * pPixelsB,
+			int2 dims,
+			int numChannels);
+
+
+
+		// Helpers for working with one 4x4 block
+
+		static void GatherBlock(const byte4 * pPixels, int2 dims, int2 iBlock, byte4 blockOut[16])
+		{
+			// Clamp at the edges, for images that aren't a multiple of 4 in size
+			for (int y = 0; y < 4; ++y)
+			{
+				int ySrc = min(iBlock.y * 4 + y, dims.y - 1);
+				for (int x = 0; x < 4; ++x)
+				{
+					int xSrc = min(iBlock.x * 4 + x, dims.x - 1);
+					blockOut[y*4 + x] = pPixels[ySrc * dims.x + xSrc];
+				}
+			}
+		}
+
+		static void ScatterBlock(const byte4 block[16], int2 dims, int2 iBlock, byte4 * pPixelsOut)
+		{
+			for (int y = 0; y < 4; ++y)
+			{
+				int yDst = iBlock.y * 4 + y;
+				if (yDst >= dims.y)
+					break;
+				for (int x = 0; x < 4; ++x)
+				{
+					int xDst = iBlock.x * 4 + x;
+					if (xDst >= dims.x)
+						break;
+					pPixelsOut[yDst * dims.x + xDst] = block[y*4 + x];
+				}
+			}
+		}
+
+		// Find the direction of greatest variance of a set of points, by power iteration
+		// on their covariance matrix.  Also returns the mean.
+		template <int N>
+		static void FindPrincipalAxis(const float aPoints[16][N], float meanOut[N], float axisOut[N])
+		{
+			for (int c = 0; c < N; ++c)
+			{
+				meanOut[c] = 0.0f;
+				for (int i = 0; i < 16; ++i)
+					meanOut[c] += aPoints[i][c];
+				meanOut[c] *= (1.0f / 16.0f);
+			}
+
+			float cov[N][N] = {};
+			for (int i = 0; i < 16; ++i)
+			{
+				for (int r = 0; r < N; ++r)
+					for (int c = 0; c < N; ++c)
+						cov[r][c] += (aPoints[i][r] - meanOut[r]) * (aPoints[i][c] - meanOut[c]);
+			}
+
+			// Start from the bounding box diagonal, which is usually close
+			for (int c = 0; c < N; ++c)
+			{
+				float lo = aPoints[0][c], hi = aPoints[0][c];
+				for (int i = 1; i < 16; ++i)
+				{
+					lo = min(lo, aPoints[i][c]);
+					hi = max(hi, aPoints[i][c]);
+				}
+				axisOut[c] = hi - lo;
+			}
+
+			for (int iter = 0; iter < 8; ++iter)
+			{
+				float next[N] = {};
+				for (int r = 0; r < N; ++r)
+					for (int c = 0; c < N; ++c)
+						next[r] += cov[r][c] * axisOut[c];
+
+				float lenSq = 0.0f;
+				for (int c = 0; c < N; ++c)
+					lenSq += next[c] * next[c];
+				if (lenSq < 1e-12f)
+					break;
+				float invLen = 1.0f / sqrtf(lenSq);
+				for (int c = 0; c < N; ++c)
+					axisOut[c] = next[c] * invLen;
+			}
+		}
+
+		// Fit endpoints to a set of points: either the corners of the bounding box, or
+		// the extent of the points along their principal axis
+		template <int N>
+		static void FitEndpoints(const float aPoints[16][N], BCQUALITY quality, float e0Out[N], float e1Out[N])
+		{
+			if (quality == BCQUALITY_Fast)
+			{
+				for (int c = 0; c < N; ++c)
+				{
+					e0Out[c] = aPoints[0][c];
+					e1Out[c] = aPoints[0][c];
+					for (int i = 1; i < 16; ++i)
+					{
+						e0Out[c] = max(e0Out[c], aPoints[i][c]);
+						e1Out[c] = min(e1Out[c], aPoints[i][c]);
+					}
+				}
+				return;
+			}
+
+			float mean[N], axis[N];
+			FindPrincipalAxis<N>(aPoints, mean, axis);
+
+			float tMin = 0.0f, tMax = 0.0f;
+			for (int i = 0; i < 16; ++i)
+			{
+				float t = 0.0f;
+				for (int c = 0; c < N; ++c)
+					t += (aPoints[i][c] - mean[c]) * axis[c];
+				tMin = min(tMin, t);
+				tMax = max(tMax, t);
+			}
+
+			for (int c = 0; c < N; ++c)
+			{
+				e0Out[c] = clamp(mean[c] + axis[c] * tMax, 0.0f, 255.0f);
+				e1Out[c] = clamp(mean[c] + axis[c] * tMin, 0.0f, 255.0f);
+			}
+		}
+
+		// Least-squares fit of endpoints to the points, given each point's weight of e1
+		// (so it's a lerp from e0 to e1).  Returns false if the system is degenerate.
+		template <int N>
+		static bool RefineEndpoints(const float aPoints[16][N], const float aWeights[16], float e0Out[N], float e1Out[N])
+		{
+			float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+			float ax[N] = {}, bx[N] = {};
+			for (int i = 0; i < 16; ++i)
+			{
+				float b = aWeights[i];
+				float a = 1.0f - b;
+				aa += a * a;
+				ab += a * b;
+				bb += b * b;
+				for (int c = 0; c < N; ++c)
+				{
+					ax[c] += a * aPoints[i][c];
+					bx[c] += b * aPoints[i][c];
+				}
+			}
+
+			float det = aa * bb - ab * ab;
+			if (fabsf(det) < 1e-6f)
+				return false;
+
+			float invDet = 1.0f / det;
+			for (int c = 0; c < N; ++c)
+			{
+				e0Out[c] = clamp((ax[c] * bb - bx[c] * ab) * invDet, 0.0f, 255.0f);
+				e1Out[c] = clamp((bx[c] * aa - ax[c] * ab) * invDet, 0.0f, 255.0f);
+			}
+			return true;
+		}
+
+		// Writes bits LSB-first into a block
+		struct BitWriter
+		{
+			byte *	m_pBlock;
+			int		m_iBit;
+
+			void Write(uint value, int bitCount)
+			{
+				for (int i = 0; i < bitCount; ++i, ++m_iBit)
+				{
+					if (value & (1u << i))
+						m_pBlock[m_iBit >> 3] |= byte(1u << (m_iBit & 7));
+				}
+			}
+		};
+
+		struct BitReader
+		{
+			const byte *	m_pBlock;
+			int				m_iBit;
+
+			uint Read(int bitCount)
+			{
+				uint value = 0;
+				for (int i = 0; i < bitCount; ++i, ++m_iBit)
+				{
+					if (m_pBlock[m_iBit >> 3] & (1u << (m_iBit & 7)))
+						value |= (1u << i);
+				}
+				return value;
+			}
+		};
+
+
+
+		// BC1 color blocks
+
+		static inline uint PackRGB565(const float rgb[3])
+		{
+			uint r = uint(clamp(int(rgb[0] * (31.0f / 255.0f) + 0.5f), 0, 31));
+			uint g = uint(clamp(int(rgb[1] * (63.0f / 255.0f) + 0.5f), 0, 63));
+			uint b = uint(clamp(int(rgb[2] * (31.0f / 255.0f) + 0.5f), 0, 31));
+			return (r << 11) | (g << 5) | b;
+		}
+
+		static inline void UnpackRGB565(uint c, int rgbOut[3])
+		{
+			int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+			rgbOut[0] = (r << 3) | (r >> 2);
+			rgbOut[1] = (g << 2) | (g >> 4);
+			rgbOut[2] = (b << 3) | (b >> 2);
+		}
+
+		static void MakeBC1Palette(uint c0, uint c1, int paletteOut[4][3])
+		{
+			UnpackRGB565(c0, paletteOut[0]);
+			UnpackRGB565(c1, paletteOut[1]);
+			for (int c = 0; c < 3; ++c)
+			{
+				paletteOut[2][c] = (2 * paletteOut[0][c] + paletteOut[1][c] + 1) / 3;
+				paletteOut[3][c] = (paletteOut[0][c] + 2 * paletteOut[1][c] + 1) / 3;
+			}
+		}
+
+		// Choose the nearest palette entry for each pixel; returns the total squared error
+		static int FindBC1Indices(const float aPoints[16][3], uint c0, uint c1, int aIndicesOut[16])
+		{
+			int palette[4][3];
+			MakeBC1Palette(c0, c1, palette);
+
+			int errTotal = 0;
+			for (int i = 0; i < 16; ++i)
+			{
+				int errBest = INT_MAX;
+				for (int j = 0; j < 4; ++j)
+				{
+					int err = 0;
+					for (int c = 0; c < 3; ++c)
+					{
+						int d = int(aPoints[i][c]) - palette[j][c];
+						err += d * d;
+					}
+					if (err < errBest)
+					{
+						errBest = err;
+						aIndicesOut[i] = j;
+					}
+				}
+				errTotal += errBest;
+			}
+			return errTotal;
+		}
+
+		static void EncodeBC1Block(const byte4 block[16], BCQUALITY quality, byte * pOut)
+		{
+			static const float s_weightOfC1[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+			float aPoints[16][3];
+			for (int i = 0; i < 16; ++i)
+			{
+				aPoints[i][0] = block[i].x;
+				aPoints[i][1] = block[i].y;
+				aPoints[i][2] = block[i].z;
+			}
+
+			float e0[3], e1[3];
+			FitEndpoints<3>(aPoints, quality, e0, e1);
+
+			uint c0 = PackRGB565(e0), c1 = PackRGB565(e1);
+			int aIndices[16];
+			int err = FindBC1Indices(aPoints, c0, c1, aIndices);
+
+			if (quality == BCQUALITY_High)
+			{
+				for (int iter = 0; iter < 2 && err > 0; ++iter)
+				{
+					float aWeights[16];
+					for (int i = 0; i < 16; ++i)
+						aWeights[i] = s_weightOfC1[aIndices[i]];
+					if (!RefineEndpoints<3>(aPoints, aWeights, e0, e1))
+						break;
+
+					uint c0New = PackRGB565(e0), c1New = PackRGB565(e1);
+					int aIndicesNew[16];
+					int errNew = FindBC1Indices(aPoints, c0New, c1New, aIndicesNew);
+					if (errNew >= err)
+						break;
+					c0 = c0New;
+					c1 = c1New;
+					err = errNew;
+					memcpy(aIndices, aIndicesNew, sizeof(aIndices));
+				}
+			}
+
+			// Use four-color mode, which needs c0 > c1
+			if (c0 < c1)
+			{
+				std::swap(c0, c1);
+				static const int s_swapIndex[4] = { 1, 0, 3, 2 };
+				for (int i = 0; i < 16; ++i)
+					aIndices[i] = s_swapIndex[aIndices[i]];
+			}
+			else if (c0 == c1)
+			{
+				for (int i = 0; i < 16; ++i)
+					aIndices[i] = 0;
+			}
+
+			uint indexBits = 0;
+			for (int i = 0; i < 16; ++i)
+				indexBits |= uint(aIndices[i]) << (2 * i);
+
+			pOut[0] = byte(c0);
+			pOut[1] = byte(c0 >> 8);
+			pOut[2] = byte(c1);
+			pOut[3] = byte(c1 >> 8);
+			pOut[4] = byte(indexBits);
+			pOut[5] = byte(indexBits >> 8);
+			pOut[6] = byte(indexBits >> 16);
+			pOut[7] = byte(indexBits >> 24);
+		}
+
+		static void DecodeBC1Block(const byte * pIn, bool forceFourColor, byte4 blockOut[16])
+		{
+			uint c0 = pIn[0] | (uint(pIn[1]) << 8);
+			uint c1 = pIn[2] | (uint(pIn[3]) << 8);
+			uint indexBits = pIn[4] | (uint(pIn[5]) << 8) | (uint(pIn[6]) << 16) | (uint(pIn[7]) << 24);
+
+			int palette[4][3];
+			MakeBC1Palette(c0, c1, palette);
+			int alpha[4] = { 255, 255, 255, 255 };
+			if (c0 <= c1 && !forceFourColor)
+			{
+				// Three-color mode, with transparent black
+				for (int c = 0; c < 3; ++c)
+				{
+					palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+					palette[3][c] = 0;
+				}
+				alpha[3] = 0;
+			}
+
+			for (int i = 0; i < 16; ++i)
+			{
+				int j = (indexBits >> (2 * i)) & 3;
+				byte4 p = { byte(palette[j][0]), byte(palette[j][1]), byte(palette[j][2]), byte(alpha[j]) };
+				blockOut[i] = p;
+			}
+		}
+
+
+
+		// BC4 single-channel blocks (also used for BC3 alpha and the two halves of BC5)
+
+		static void MakeBC4Palette(int v0, int v1, int paletteOut[8])
+		{
+			paletteOut[0] = v0;
+			paletteOut[1] = v1;
+			if (v0 > v1)
+			{
+				for (int i = 2; i < 8; ++i)
+					paletteOut[i] = ((8 - i) * v0 + (i - 1) * v1 + 3) / 7;
+			}
+			else
+			{
+				for (int i = 2; i < 6; ++i)
+					paletteOut[i] = ((6 - i) * v0 + (i - 1) * v1 + 2) / 5;
+				paletteOut[6] = 0;
+				paletteOut[7] = 255;
+			}
+		}
+
+		static int FindBC4Indices(const int aValues[16], int v0, int v1, int aIndicesOut[16])
+		{
+			int palette[8];
+			MakeBC4Palette(v0, v1, palette);
+
+			int errTotal = 0;
+			for (int i = 0; i < 16; ++i)
+			{
+				int errBest = INT_MAX;
+				for (int j = 0; j < 8; ++j)
+				{
+					int d = aValues[i] - palette[j];
+					if (d * d < errBest)
+					{
+						errBest = d * d;
+						aIndicesOut[i] = j;
+					}
+				}
+				errTotal += errBest;
+			}
+			return errTotal;
+		}
+
+		static void EncodeBC4Block(const int aValues[16], BCQUALITY quality, byte * pOut)
+		{
+			int vMin = 255, vMax = 0;
+			int vMinInner = 255, vMaxInner = 0;		// Excluding 0 and 255, for six-value mode
+			for (int i = 0; i < 16; ++i)
+			{
+				vMin = min(vMin, aValues[i]);
+				vMax = max(vMax, aValues[i]);
+				if (aValues[i] > 0 && aValues[i] < 255)
+				{
+					vMinInner = min(vMinInner, aValues[i]);
+					vMaxInner = max(vMaxInner, aValues[i]);
+				}
+			}
+
+			// Eight-value mode needs v0 > v1
+			int v0 = vMax, v1 = vMin;
+			int aIndices[16];
+			int err = FindBC4Indices(aValues, v0, v1, aIndices);
+
+			if (quality == BCQUALITY_High && err > 0)
+			{
+				// Refine the eight-value endpoints
+				static const float s_weightOfV1[8] = { 0.0f, 1.0f, 1.0f/7.0f, 2.0f/7.0f, 3.0f/7.0f, 4.0f/7.0f, 5.0f/7.0f, 6.0f/7.0f };
+				float aPoints[16][1];
+				for (int i = 0; i < 16; ++i)
+					aPoints[i][0] = float(aValues[i]);
+				for (int iter = 0; iter < 2 && v0 > v1; ++iter)
+				{
+					float aWeights[16];
+					for (int i = 0; i < 16; ++i)
+						aWeights[i] = s_weightOfV1[aIndices[i]];
+					float e0[1], e1[1];
+					if (!RefineEndpoints<1>(aPoints, aWeights, e0, e1))
+						break;
+					int v0New = int(e0[0] + 0.5f), v1New = int(e1[0] + 0.5f);
+					if (v0New <= v1New)
+						break;
+					int aIndicesNew[16];
+					int errNew = FindBC4Indices(aValues, v0New, v1New, aIndicesNew);
+					if (errNew >= err)
+						break;
+					v0 = v0New;
+					v1 = v1New;
+					err = errNew;
+					memcpy(aIndices, aIndicesNew, sizeof(aIndices));
+				}
+
+				// Try six-value mode, which has exact 0 and 255, good for blocks that have both
+				// extremes and something in between
+				if (vMinInner <= vMaxInner)
+				{
+					int aIndicesNew[16];
+					int errNew = FindBC4Indices(aValues, vMinInner, vMaxInner, aIndicesNew);
+					if (errNew < err)
+					{
+						v0 = vMinInner;
+						v1 = vMaxInner;
+						err = errNew;
+						memcpy(aIndices, aIndicesNew, sizeof(aIndices));
+					}
+				}
+			}
+
+			memset(pOut, 0, 8);
+			pOut[0] = byte(v0);
+			pOut[1] = byte(v1);
+			BitWriter bw = { pOut, 16 };
+			for (int i = 0; i < 16; ++i)
+				bw.Write(uint(aIndices[i]), 3);
+		}
+
+		static void DecodeBC4Block(const byte * pIn, int aValuesOut[16])
+		{
+			int palette[8];
+			MakeBC4Palette(pIn[0], pIn[1], palette);
+			BitReader br = { pIn, 16 };
+			for (int i = 0; i < 16; ++i)
+				aValuesOut[i] = palette[br.Read(3)];
+		}
+
+
+
+		// BC7 blocks, mode 6 only
+
+		static const int s_bc7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+		// Quantize an endpoint to 7 bits per channel plus a shared p-bit
+		static void QuantizeBC7Endpoint(const float e[4], int pbit, int qOut[4])
+		{
+			for (int c = 0; c < 4; ++c)
+				qOut[c] = clamp(int((e[c] - float(pbit)) * 0.5f + 0.5f), 0, 127);
+		}
+
+		static int FindBC7Indices(const float aPoints[16][4], const int q0[4], int p0, const int q1[4], int p1, int aIndicesOut[16])
+		{
+			int palette[16][4];
+			for (int c = 0; c < 4; ++c)
+			{
+				int v0 = (q0[c] << 1) | p0;
+				int v1 = (q1[c] << 1) | p1;
+				for (int j = 0; j < 16; ++j)
+					palette[j][c] = ((64 - s_bc7Weights4[j]) * v0 + s_bc7Weights4[j] * v1 + 32) >> 6;
+			}
+
+			int errTotal = 0;
+			for (int i = 0; i < 16; ++i)
+			{
+				int errBest = INT_MAX;
+				for (int j = 0; j < 16; ++j)
+				{
+					int err = 0;
+					for (int c = 0; c < 4; ++c)
+					{
+						int d = int(aPoints[i][c]) - palette[j][c];
+						err += d * d;
+					}
+					if (err < errBest)
+					{
+						errBest = err;
+						aIndicesOut[i] = j;
+					}
+				}
+				errTotal += errBest;
+			}
+			return errTotal;
+		}
+
+		struct BC7Mode6Encoding
+		{
+			int		m_q0[4], m_q1[4];
+			int		m_p0, m_p1;
+			int		m_aIndices[16];
+			int		m_err;
+		};
+
+		// Quantize a pair of float endpoints, picking p-bits, and find the indices
+		static void QuantizeBC7Mode6(const float aPoints[16][4], const float e0[4], const float e1[4], BCQUALITY quality, BC7Mode6Encoding * pEncOut)
+		{
+			pEncOut->m_err = INT_MAX;
+
+			// Fast: pick each p-bit to best fit its endpoint.  High: try all four combinations.
+			for (int pCombo = 0; pCombo < 4; ++pCombo)
+			{
+				int p0 = pCombo & 1, p1 = pCombo >> 1;
+				int q0[4], q1[4];
+				QuantizeBC7Endpoint(e0, p0, q0);
+				QuantizeBC7Endpoint(e1, p1, q1);
+
+				if (quality == BCQUALITY_Fast)
+				{
+					// Skip combinations whose p-bits don't match the endpoints' rounding
+					float err0 = 0.0f, err0Alt = 0.0f, err1 = 0.0f, err1Alt = 0.0f;
+					int q0Alt[4], q1Alt[4];
+					QuantizeBC7Endpoint(e0, 1 - p0, q0Alt);
+					QuantizeBC7Endpoint(e1, 1 - p1, q1Alt);
+					for (int c = 0; c < 4; ++c)
+					{
+						err0 += square(e0[c] - float((q0[c] << 1) | p0));
+						err0Alt += square(e0[c] - float((q0Alt[c] << 1) | (1 - p0)));
+						err1 += square(e1[c] - float((q1[c] << 1) | p1));
+						err1Alt += square(e1[c] - float((q1Alt[c] << 1) | (1 - p1)));
+					}
+					if (err0 > err0Alt || err1 > err1Alt)
+						continue;
+				}
+
+				int aIndices[16];
+				int err = FindBC7Indices(aPoints, q0, p0, q1, p1, aIndices);
+				if (err < pEncOut->m_err)
+				{
+					memcpy(pEncOut->m_q0, q0, sizeof(q0));
+					memcpy(pEncOut->m_q1, q1, sizeof(q1));
+					pEncOut->m_p0 = p0;
+					pEncOut->m_p1 = p1;
+					memcpy(pEncOut->m_aIndices, aIndices, sizeof(aIndices));
+					pEncOut->m_err = err;
+				}
+			}
+		}
+
+		static void EncodeBC7Block(const byte4 block[16], BCQUALITY quality, byte * pOut)
+		{
+			float aPoints[16][4];
+			for (int i = 0; i < 16; ++i)
+			{
+				aPoints[i][0] = block[i].x;
+				aPoints[i][1] = block[i].y;
+				aPoints[i][2] = block[i].z;
+				aPoints[i][3] = block[i].w;
+			}
+
+			float e0[4], e1[4];
+			FitEndpoints<4>(aPoints, quality, e0, e1);
+
+			BC7Mode6Encoding enc;
+			QuantizeBC7Mode6(aPoints, e0, e1, quality, &enc);
+
+			if (quality == BCQUALITY_High)
+			{
+				for (int iter = 0; iter < 2 && enc.m_err > 0; ++iter)
+				{
+					float aWeights[16];
+					for (int i = 0; i < 16; ++i)
+						aWeights[i] = float(s_bc7Weights4[enc.m_aIndices[i]]) * (1.0f / 64.0f);
+					if (!RefineEndpoints<4>(aPoints, aWeights, e0, e1))
+						break;
+
+					BC7Mode6Encoding encNew;
+					QuantizeBC7Mode6(aPoints, e0, e1, quality, &encNew);
+					if (encNew.m_err >= enc.m_err)
+						break;
+					enc = encNew;
+				}
+			}
+
+			// The first index's top bit is implicitly zero, so swap the endpoints if needed
+			if (enc.m_aIndices[0] & 8)
+			{
+				for (int c = 0; c < 4; ++c)
+					std::swap(enc.m_q0[c], enc.m_q1[c]);
+				std::swap(enc.m_p0, enc.m_p1);
+				for (int i = 0; i < 16; ++i)
+					enc.m_aIndices[i] = 15 - enc.m_aIndices[i];
+			}
+
+			memset(pOut, 0, 16);
+			BitWriter bw = { pOut, 0 };
+			bw.Write(1 << 6, 7);				// Mode 6
+			for (int c = 0; c < 4; ++c)
+			{
+				bw.Write(uint(enc.m_q0[c]), 7);
+				bw.Write(uint(enc.m_q1[c]), 7);
+			}
+			bw.Write(uint(enc.m_p0), 1);
+			bw.Write(uint(enc.m_p1), 1);
+			bw.Write(uint(enc.m_aIndices[0]), 3);
+			for (int i = 1; i < 16; ++i)
+				bw.Write(uint(enc.m_aIndices[i]), 4);
+			ASSERT_ERR(bw.m_iBit == 128);
+		}
+
+		static bool DecodeBC7Block(const byte * pIn, byte4 blockOut[16])
+		{
+			BitReader br = { pIn, 0 };
+			if (br.Read(7) != (1 << 6))
+				return false;		// Only mode 6 is supported, since that's all we write
+
+			int v0[4], v1[4];
+			for (int c = 0; c < 4; ++c)
+			{
+				v0[c] = int(br.Read(7)) << 1;
+				v1[c] = int(br.Read(7)) << 1;
+			}
+			int p0 = int(br.Read(1)), p1 = int(br.Read(1));
+			for (int c = 0; c < 4; ++c)
+			{
+				v0[c] |= p0;
+				v1[c] |= p1;
+			}
+
+			for (int i = 0; i < 16; ++i)
+			{
+				int w = s_bc7Weights4[br.Read((i == 0) ? 3 : 4)];
+				byte4 p =
+				{
+					byte(((64 - w) * v0[0] + w * v1[0] + 32) >> 6),
+					byte(((64 - w) * v0[1] + w * v1[1] + 32) >> 6),
+					byte(((64 - w) * v0[2] + w * v1[2] + 32) >> 6),
+					byte(((64 - w) * v0[3] + w * v1[3] + 32) >> 6),
+				};
+				blockOut[i] = p;
+			}
+			return true;
+		}
+
+
+
+		// Whole-image functions
+
+		bool IsSupportedBCFormat(DXGI_FORMAT format)
+		{
+			switch (format)
+			{
+			case DXGI_FORMAT_BC1_UNORM:
+			case DXGI_FORMAT_BC1_UNORM_SRGB:
+			case DXGI_FORMAT_BC3_UNORM:
+			case DXGI_FORMAT_BC3_UNORM_SRGB:
+			case DXGI_FORMAT_BC4_UNORM:
+			case DXGI_FORMAT_BC5_UNORM:
+			case DXGI_FORMAT_BC7_UNORM:
+			case DXGI_FORMAT_BC7_UNORM_SRGB:
+				return true;
+
+			default:
+				return false;
+			}
+		}
+
+		static void EncodeBlock(const byte4 block[16], DXGI_FORMAT format, BCQUALITY quality, byte * pOut)
+		{
+			int aValues[16];
+			switch (format)
+			{
+			case DXGI_FORMAT_BC1_UNORM:
+			case DXGI_FORMAT_BC1_UNORM_SRGB:
+				EncodeBC1Block(block, quality, pOut);
+				break;
+
+			case DXGI_FORMAT_BC3_UNORM:
+			case DXGI_FORMAT_BC3_UNORM_SRGB:
+				for (int i = 0; i < 16; ++i)
+					aValues[i] = block[i].w;
+				EncodeBC4Block(aValues, quality, pOut);
+				EncodeBC1Block(block, quality, pOut + 8);
+				break;
+
+			case DXGI_FORMAT_BC4_UNORM:
+				for (int i = 0; i < 16; ++i)
+					aValues[i] = block[i].x;
+				EncodeBC4Block(aValues, quality, pOut);
+				break;
+
+			case DXGI_FORMAT_BC5_UNORM:
+				for (int i = 0; i < 16; ++i)
+					aValues[i] = block[i].x;
+				EncodeBC4Block(aValues, quality, pOut);
+				for (int i = 0; i < 16; ++i)
+					aValues[i] = block[i].y;
+				EncodeBC4Block(aValues, quality, pOut + 8);
+				break;
+
+			case DXGI_FORMAT_BC7_UNORM:
+			case DXGI_FORMAT_BC7_UNORM_SRGB:
+				EncodeBC7Block(block, quality, pOut);
+				break;
+
+			default:
+				ERR("Unsupported BC format %s", NameOfFormat(format));
+				break;
+			}
+		}
+
+		static void DecodeBlock(const byte * pIn, DXGI_FORMAT format, byte4 blockOut[16])
+		{
+			int aValues[16];
+			switch (format)
+			{
+			case DXGI_FORMAT_BC1_UNORM:
+			case DXGI_FORMAT_BC1_UNORM_SRGB:
+				DecodeBC1Block(pIn, false, blockOut);
+				break;
+
+			case DXGI_FORMAT_BC3_UNORM:
+			case DXGI_FORMAT_BC3_UNORM_SRGB:
+				DecodeBC1Block(pIn + 8, true, blockOut);
+				DecodeBC4Block(pIn, aValues);
+				for (int i = 0; i < 16; ++i)
+					blockOut[i].w = byte(aValues[i]);
+				break;
+
+			case DXGI_FORMAT_BC4_UNORM:
+				DecodeBC4Block(pIn, aValues);
+				for (int i = 0; i < 16; ++i)
+				{
+					byte4 p = { byte(aValues[i]), 0, 0, 255 };
+					blockOut[i] = p;
+				}
+				break;
+
+			case DXGI_FORMAT_BC5_UNORM:
+				DecodeBC4Block(pIn, aValues);
+				for (int i = 0; i < 16; ++i)
+				{
+					byte4 p = { byte(aValues[i]), 0, 0, 255 };
+					blockOut[i] = p;
+				}
+				DecodeBC4Block(pIn + 8, aValues);
+				for (int i = 0; i < 16; ++i)
+					blockOut[i].y = byte(aValues[i]);
+				break;
+
+			case DXGI_FORMAT_BC7_UNORM:
+			case DXGI_FORMAT_BC7_UNORM_SRGB:
+				if (!DecodeBC7Block(pIn, blockOut))
+					WARN("Unsupported BC7 block mode");
+				break;
+
+			default:
+				ERR("Unsupported BC format %s", NameOfFormat(format));
+				break;
+			}
+		}
+
+		void CompressImageBC(
+			const byte4 * pPixels,
+			int2 dims,
+			DXGI_FORMAT format,
+			BCQUALITY quality,
+			std::vector<byte> * pBlocksOut)
+		{
+			ASSERT_ERR(pPixels);
+			ASSERT_ERR(all(dims > 0));
+			ASSERT_ERR(IsSupportedBCFormat(format));
+			ASSERT_ERR(pBlocksOut);
+
+			int2 blockCount = (dims + 3) / 4;
+			int bytesPerBlock = BitsPerPixel(format) * 2;
+			pBlocksOut->resize(blockCount.x * blockCount.y * bytesPerBlock);
+			byte * pBlocks = &(*pBlocksOut)[0];
+
+			AssetCompiler::ParallelFor(blockCount.y, max(1, 256 / blockCount.x), [=](int yStart, int yEnd)
+			{
+				byte4 block[16];
+				for (int y = yStart; y < yEnd; ++y)
+				{
+					for (int x = 0; x < blockCount.x; ++x)
+					{
+						GatherBlock(pPixels, dims, int2(x, y), block);
+						EncodeBlock(block, format, quality, pBlocks + (y * blockCount.x + x) * bytesPerBlock);
+					}
+				}
+			});
+		}
+
+		void DecompressImageBC(
+			const byte * pBlocks,
+			int2 dims,
+			DXGI_FORMAT format,
+			std::vector<byte4> * pPixelsOut)
+		{
+			ASSERT_ERR(pBlocks);
+			ASSERT_ERR(all(dims > 0));
+			ASSERT_ERR(IsSupportedBCFormat(format));
+			ASSERT_ERR(pPixelsOut);
+
+			int2 blockCount = (dims + 3) / 4;
+			int bytesPerBlock = BitsPerPixel(format) * 2;
+			pPixelsOut->resize(dims.x * dims.y);
+
+			byte4 block[16];
+			for (int y = 0; y < blockCount.y; ++y)
+			{
+				for (int x = 0; x < blockCount.x; ++x)
+				{
+					DecodeBlock(pBlocks + (y * blockCount.x + x) * bytesPerBlock, format, block);
+					ScatterBlock(block, dims, int2(x, y), &(*pPixelsOut)[0]);
+				}
+			}
+		}
+
+		float CalculatePSNR(
+			const byte4 * pPixelsA,
+			const byte4 * pPixelsB,
+			int2 dims,
+			int numChannels)
+		{
+			ASSERT_ERR(pPixelsA);
+			ASSERT_ERR(pPixelsB);
+			ASSERT_ERR(all(dims > 0));
+			ASSERT_ERR(numChannels >= 1 && numChannels <= 4);
+
+			double errSum = 0.0;
+			for (int i = 0, c = dims.x * dims.y; i < c; ++i)
+			{
+				for (int j = 0; j < numChannels; ++j)
+				{
+					double d = double(pPixelsA[i][j]) - double(pPixelsB[i][j]);
+					errSum += d * d;
+				}
+			}
+
+			double mse = errSum / (double(dims.x) * double(dims.y) * numChannels);
+			if (mse == 0.0)
+				return 999.0f;
+			return float(10.0 * log10(255.0 * 255.0 / mse));
+		}
+	}
+}
@@ -10,20 +10,72 @@
 #include "stb_image_resize.h"
 #pragma warning(pop)
 
+#include <emmintrin.h>
+
+// F16C is available on every CPU with AVX2; MSVC only signals it through /arch:AVX2
+#if defined(__F16C__) || defined(__AVX2__)
+#	include <immintrin.h>
+#	define USE_F16C 1
+#else
+#	define USE_F16C 0
+#endif
+
 namespace Framework
 {
 	// Infrastructure for compiling textures.
-	//  * All textures are currently in RGBA8 sRGB format, top-down.
-	//  * Textures are either stored raw, or with mips.  Textures with mips are also
-	//      resampled up to the next pow2 size if necessary.
+	//  * Textures are stored top-down, in RGBA8 (sRGB for color, linear for masks and
+	//      normal maps), or BC-compressed if the ACF_TextureCompress flag is set.
+	//      Uncompressed images are row-filtered and deflated in the pack, and come back
+	//      as plain pixels when it's loaded; see asset-rowfilter.cpp.
+	//  * Textures are either stored raw, or with mips.  Non-pow2 textures with mips keep
+	//      their size, with each mip level's size rounded down, unless ACF_TexturePow2 asks
+	//      for them to be resampled up to the next pow2 size.
+	//  * Mips are generated in a cascade, each one downsampled from the previous, in linear
+	//      space with premultiplied alpha.  The filtering uses SSE2 and is split across
+	//      threads by rows.
+	//  * An asset's m_maxDim and m_mipBias drop top mips before anything is stored, so
+	//      lower-quality profiles get smaller textures from the same sources.  This applies
+	//      to 2D textures and cubemaps.
+	//  * BC compression is done per mip after filtering, split across threads by rows of
+	//      blocks; see asset-texture-bc.cpp.  Textures whose base level isn't a multiple
+	//      of 4 in size can't be BC-compressed and fall back to RGBA8.
 	//  * Enable the WRITE_BMP define to additionally write out all images as .bmps
 	//      in the archive, for debugging.
-	//  * !!!UNDONE: Premultiplied alpha
-	//  * !!!UNDONE: BCn compression
-	//  * !!!UNDONE: Other pixel formats: HDR textures, normal maps, etc.
-	//  * !!!UNDONE: Cubemaps, volume textures, sparse tiled textures, etc.
+	//  * Enable the LOG_BC_STATS define to log compression throughput and PSNR.
+	//  * Enable the CHECK_MIPS define to compare each generated mip against resampling the
+	//      base level directly with stb_image_resize, and warn if it falls below
+	//      s_mipCheckMinPSNR.  The two use different filters, so they won't match exactly.
+	//  * Normal maps can also be generated from height maps, for materials that have a bump
+	//      map (see asset-mtl.cpp).  The height gradient comes from a Scharr filter, and each
+	//      mip is filtered from the previous one's normals and renormalized.  They're stored
+	//      like any other normal map, so they get BC5 if compressed.
+	//  * Materials' single-channel textures (spec, mask, height) can also be packed into the
+	//      channels of one linear texture, again driven by asset-mtl.cpp.  It's BC4, BC5 or
+	//      BC1 (BC7 for high quality) depending how many channels are used.
+	//  * HDR sources (and anything flagged ACF_TextureHDR) are loaded as float, and mips are
+	//      generated the same way but without clamping to [0, 1] or premultiplying alpha.
+	//      They're stored as R16G16B16A16_FLOAT, or R11G11B10_FLOAT if compressed.  The
+	//      float conversions use SSE2, or F16C for halfs where the compiler targets it.
+	//  * Enable the LOG_FLOAT_STATS define to log float conversion throughput.
+	//  * !!!UNDONE: BC6H compression for HDR textures
+	//  * Virtual textures get the same mip chain, then each level is cut into tiles of
+	//      s_vtTileSize pixels plus a border of s_vtTileBorder on each side, copied from
+	//      the neighboring tiles (clamped at the image edges).  Tiles are stored as
+	//      separate entries so the pager can find each one directly; see vtexture.h.
+	//  * Cubemaps are built from an equirectangular (2:1) image, or a horizontal (4:3) or
+	//      vertical (3:4) cross, and always stored in float like HDR textures.  Mip 0 is the
+	//      environment itself; each mip below is GGX-prefiltered at increasing roughness,
+	//      importance sampling box-filtered mips of the environment to avoid aliasing.  An
+	//      SH9 projection of the irradiance is stored alongside.  Faces are in D3D order
+	//      (+X, -X, +Y, -Y, +Z, -Z), and the equirect's center column faces -Z.
+	//  * Volume textures are built from an image of square slices laid out in a row or
+	//      column, with mips downsampled in all three dimensions.  They're stored RGBA8 (or
+	//      float, for HDR sources), never BC-compressed.
 
 #define WRITE_BMP 0
+#define LOG_BC_STATS 0
+#define LOG_FLOAT_STATS 0
+#define CHECK_MIPS 0
 
 	namespace TextureCompiler
 	{
@@ -36,21 +88,228 @@ namespace Framework
 			DXGI_FORMAT		m_format;
 		};
 
+		static const char * s_suffixVTMeta = "/vtmeta";
+		static const int s_vtTileSize = 128;
+		static const int s_vtTileBorder = 4;		// Keeps stored tiles a multiple of 4, for BC
+
+		struct VTMeta
+		{
+			int2			m_dims;
+			int				m_mipLevels;
+			int				m_tileSize;
+			int				m_tileBorder;
+			DXGI_FORMAT		m_format;
+		};
+
+		static const char * s_suffixCubeMeta = "/cubemeta";
+		static const char * s_suffixCubeSH9 = "/sh9";
+		static const int s_cubeFaceCount = 6;
+		static const int s_ggxSampleCount = 128;
+
+		struct CubeMeta
+		{
+			int				m_cubeSize;
+			int				m_mipLevels;
+			DXGI_FORMAT		m_format;
+		};
+
+		// One mip level of a cubemap in linear float, while compiling
+		struct CubeLevel
+		{
+			int					m_size;
+			std::vector<float4>	m_faces[s_cubeFaceCount];
+		};
+
+		static const char * s_suffixVolumeMeta = "/volmeta";
+
+		struct VolumeMeta
+		{
+			int3			m_dims;
+			int				m_mipLevels;
+			DXGI_FORMAT		m_format;
+		};
+
+		// Filter kernels for downsampling by 2 (or slightly more, for odd sizes)
+		enum MIPFILTER
+		{
+			MIPFILTER_Box,				// 2 taps, or 3 when halving an odd size
+			MIPFILTER_Kaiser,			// 8 taps (more when halving an odd size), Kaiser-windowed sinc
+
+			MIPFILTER_Count
+		};
+
+		static const MIPFILTER s_mipFilter = MIPFILTER_Kaiser;
+#if CHECK_MIPS
+		static const float s_mipCheckMinPSNR = 30.0f;		// dB, against a direct resample of the base level
+#endif
+
+		// Compression quality tiers, as chosen by ACF_TextureHighQuality
+		enum BCQUALITY
+		{
+			BCQUALITY_Fast,
+			BCQUALITY_High,
+		};
+
 		// Prototype various helper functions
-		bool WriteImageToZip(
+		DXGI_FORMAT ChooseFormat(
+			const AssetCompileInfo * pACI,
+			const byte4 * pPixels,
+			int2 dims,
+			int2 dimsStored);
+		void ConvertPixelsToLinear(
+			const byte4 * pPixels,
+			int2 dims,
+			bool isSRGB,
+			float4 * pLinearOut);
+		void ConvertLinearToPixels(
+			const float4 * pLinear,
+			int2 dims,
+			bool isSRGB,
+			byte4 * pPixelsOut);
+		void ConvertLinearToHalf(
+			const float4 * pLinear,
+			int2 dims,
+			ushort * pHalfOut);
+		void ConvertLinearToR11G11B10(
+			const float4 * pLinear,
+			int2 dims,
+			uint * pPackedOut);
+		void DownsampleLinear(
+			const float4 * pSrc,
+			int2 dimsSrc,
+			MIPFILTER filter,
+			float4 * pDst,
+			int2 dimsDst,
+			float maxValue = 1.0f);
+		int CalculateMipsToDrop(
+			const AssetCompileInfo * pACI,
+			int2 dims);
+		void DownsamplePixelsToMip(
+			const byte4 * pPixels,
+			int2 dims,
+			int level,
+			bool isSRGB,
+			std::vector<byte4> * pPixelsOut);
+		bool IsFloatSource(const AssetCompileInfo * pACI);
+		bool CompileFloatTexture(
+			const AssetCompileInfo * pACI,
+			bool withMips,
+			AssetCompiler::AssetSink * pSinkOut);
+		bool WriteFloatImageToSink(
+			const char * assetPath,
+			int mipLevel,
+			const float4 * pLinear,
+			int2 dims,
+			DXGI_FORMAT format,
+			AssetCompiler::AssetSink * pSinkOut);
+		bool WriteFloatImageDataToSink(
+			const char * assetPath,
+			const char * suffix,
+			const float4 * pLinear,
+			int2 dims,
+			DXGI_FORMAT format,
+			AssetCompiler::AssetSink * pSinkOut);
+
+		// Cubemap helpers
+		float3 CubeTexelDirection(int face, float2 st);
+		void DirectionToCubeTexel(float3 dir, int * pFaceOut, float2 * pStOut);
+		float4 SampleCubeBilinear(const CubeLevel & level, float3 dir);
+		bool LoadCubeFaces(const char * path, CubeLevel * pLevelOut);
+		void PrefilterCubeGGX(
+			const std::vector<CubeLevel> & radiance,
+			float roughness,
+			CubeLevel * pLevelOut);
+		void ProjectCubeToSH9(
+			const CubeLevel & level,
+			rgb * aSH9Out);
+
+		// Volume texture helpers
+		void DownsampleVolume(
+			const float4 * pSrc,
+			int3 dimsSrc,
+			MIPFILTER filter,
+			float4 * pDst,
+			int3 dimsDst,
+			float maxValue);
+		void CopyTileWithBorder(
+			const byte4 * pPixels,
+			int2 dims,
+			int2 tile,
+			byte4 * pTileOut);
+		void CalculateNormalsFromHeights(
+			const float * pHeights,
+			int2 dims,
+			float bumpScale,
+			float4 * pNormalsOut);
+		void RenormalizeNormals(
+			float4 * pNormals,
+			int2 dims);
+
+		// Used by the material lib compiler
+		bool CompileNormalMapFromHeight(
+			const char * pathHeight,
+			const char * assetPath,
+			float bumpScale,
+			const AssetCompileInfo * pACIMtl,
+			AssetCompiler::AssetSink * pSinkOut);
+		bool CompilePackedTexture(
+			const char * const * aPathsSrc,
+			int channelCount,
+			const char * assetPath,
+			const AssetCompileInfo * pACIMtl,
+			AssetCompiler::AssetSink * pSinkOut);
+		DXGI_FORMAT ChoosePackedFormat(
+			int channelCount,
+			int flags,
+			int2 dims);
+
+		bool WriteImageToSink(
 			const char * assetPath,
 			int mipLevel,
 			const byte4 * pPixels,
 			int2 dims,
-			mz_zip_archive * pZipOut);
+			DXGI_FORMAT format,
+			BCQUALITY quality,
+			AssetCompiler::AssetSink * pSinkOut);
+		bool WriteImageDataToSink(
+			const char * assetPath,
+			const char * suffix,
+			const byte4 * pPixels,
+			int2 dims,
+			DXGI_FORMAT format,
+			BCQUALITY quality,
+			AssetCompiler::AssetSink * pSinkOut);
+
+		// Implemented in asset-texture-bc.cpp
+		bool IsSupportedBCFormat(DXGI_FORMAT format);
+		void CompressImageBC(
+			const byte4 * pPixels,
+			int2 dims,
+			DXGI_FORMAT format,
+			BCQUALITY quality,
+			std::vector<byte> * pBlocksOut);
+#if LOG_BC_STATS
+		void DecompressImageBC(
+			const byte * pBlocks,
+			int2 dims,
+			DXGI_FORMAT format,
+			std::vector<byte4> * pPixelsOut);
+#endif
+#if LOG_BC_STATS || CHECK_MIPS
+		float CalculatePSNR(
+			const byte4 * pPixelsA,
+			const byte4 * pPixelsB,
+			int2 dims,
+			int numChannels);
+#endif
 
 #if WRITE_BMP
-		bool WriteBMPToZip(
+		bool WriteBMPToSink(
 			const char * assetPath,
 			int mipLevel,
 			const byte4 * pPixels,
 			int2 dims,
-			mz_zip_archive * pZipOut);
+			AssetCompiler::AssetSink * pSinkOut);
 #endif
 	}
 
@@ -60,16 +319,19 @@ namespace Framework
 
 	bool CompileTextureRawAsset(
 		const AssetCompileInfo * pACI,
-		mz_zip_archive * pZipOut)
+		AssetCompiler::AssetSink * pSinkOut)
 	{
 		ASSERT_ERR(pACI);
 		ASSERT_ERR(pACI->m_pathSrc);
 		ASSERT_ERR(pACI->m_ack == ACK_TextureRaw);
-		ASSERT_ERR(pZipOut);
+		ASSERT_ERR(pSinkOut);
 
 		using namespace AssetCompiler;
 		using namespace TextureCompiler;
 
+		if (IsFloatSource(pACI))
+			return CompileFloatTexture(pACI, false, pSinkOut);
+
 		// Load the image
 		int2 dims;
 		int numComponents;
@@ -80,17 +342,29 @@ namespace Framework
 			return false;
 		}
 
+		// Downsample for the asset's max dimension and mip bias, if needed
+		std::vector<byte4> pixelsSmall;
+		byte4 * pPixelsStored = pPixels;
+		if (int mipsToDrop = CalculateMipsToDrop(pACI, dims))
+		{
+			bool isSRGB = !(pACI->m_flags & (ACF_TextureMask | ACF_TextureNormalMap));
+			DownsamplePixelsToMip(pPixels, dims, mipsToDrop, isSRGB, &pixelsSmall);
+			pPixelsStored = &pixelsSmall[0];
+			dims = CalculateMipDims(dims, mipsToDrop);
+		}
+
 		// Fill out the metadata struct
 		Meta meta =
 		{
 			dims,
 			1,		// mipLevels
-			DXGI_FORMAT_R8G8B8A8_UNORM_SRGB,
+			ChooseFormat(pACI, pPixelsStored, dims, dims),
 		};
+		BCQUALITY quality = (pACI->m_flags & ACF_TextureHighQuality) ? BCQUALITY_High : BCQUALITY_Fast;
 
 		// Write the data out to the archive
-		if (!WriteAssetDataToZip(pACI->m_pathSrc, s_suffixMeta, &meta, sizeof(meta), pZipOut) ||
-			!WriteImageToZip(pACI->m_pathSrc, 0, pPixels, dims, pZipOut))
+		if (!pSinkOut->WriteAssetData(pACI->m_pathSrc, s_suffixMeta, &meta, sizeof(meta)) ||
+			!WriteImageToSink(pACI->m_pathSrc, 0, pPixelsStored, dims, meta.m_format, quality, pSinkOut))
 		{
 			stbi_image_free(pPixels);
 			return false;
@@ -102,16 +376,19 @@ namespace Framework
 
 	bool CompileTextureWithMipsAsset(
 		const AssetCompileInfo * pACI,
-		mz_zip_archive * pZipOut)
+		AssetCompiler::AssetSink * pSinkOut)
 	{
 		ASSERT_ERR(pACI);
 		ASSERT_ERR(pACI->m_pathSrc);
 		ASSERT_ERR(pACI->m_ack == ACK_TextureWithMips);
-		ASSERT_ERR(pZipOut);
+		ASSERT_ERR(pSinkOut);
 
 		using namespace AssetCompiler;
 		using namespace TextureCompiler;
 
+		if (IsFloatSource(pACI))
+			return CompileFloatTexture(pACI, true, pSinkOut);
+
 		// Load the image
 		int2 dims;
 		int numComponents;
@@ -122,11 +399,12 @@ namespace Framework
 			return false;
 		}
 
-		// Resample the base mip up to pow2 if necessary
+		// Resample the base mip up to pow2 if requested; otherwise, non-pow2 textures keep
+		// their size and get a mip chain with each level's size rounded down
 		int2 dimsBase;
 		std::vector<byte4> pixelsBase;
 		byte4 * pPixelsBase;
-		if (!ispow2(dims.x) || !ispow2(dims.y))
+		if ((pACI->m_flags & ACF_TexturePow2) && (!ispow2(dims.x) || !ispow2(dims.y)))
 		{
 			dimsBase = { pow2_ceil(dims.x), pow2_ceil(dims.y) };
 			pixelsBase.resize(dimsBase.x * dimsBase.y);
@@ -143,263 +421,2166 @@ namespace Framework
 			pPixelsBase = pPixels;
 		}
 
+		// Drop top mips for the asset's max dimension and mip bias
+		bool isSRGB = !(pACI->m_flags & (ACF_TextureMask | ACF_TextureNormalMap));
+		if (int mipsToDrop = CalculateMipsToDrop(pACI, dimsBase))
+		{
+			std::vector<byte4> pixelsSmall;
+			DownsamplePixelsToMip(pPixelsBase, dimsBase, mipsToDrop, isSRGB, &pixelsSmall);
+			pixelsBase.swap(pixelsSmall);
+			pPixelsBase = &pixelsBase[0];
+			dimsBase = CalculateMipDims(dimsBase, mipsToDrop);
+		}
+
 		// Fill out the metadata struct
 		int mipLevels = log2_floor(maxComponent(dimsBase)) + 1;
 		Meta meta =
 		{
 			dimsBase,
 			mipLevels,
-			DXGI_FORMAT_R8G8B8A8_UNORM_SRGB,
+			ChooseFormat(pACI, pPixelsBase, dimsBase, dimsBase),
 		};
+		BCQUALITY quality = (pACI->m_flags & ACF_TextureHighQuality) ? BCQUALITY_High : BCQUALITY_Fast;
 
 		// Store the metadata and the base level pixels
-		if (!WriteAssetDataToZip(pACI->m_pathSrc, s_suffixMeta, &meta, sizeof(meta), pZipOut) ||
-			!WriteImageToZip(pACI->m_pathSrc, 0, pPixelsBase, dimsBase, pZipOut))
+		if (!pSinkOut->WriteAssetData(pACI->m_pathSrc, s_suffixMeta, &meta, sizeof(meta)) ||
+			!WriteImageToSink(pACI->m_pathSrc, 0, pPixelsBase, dimsBase, meta.m_format, quality, pSinkOut))
 		{
 			stbi_image_free(pPixels);
 			return false;
 		}
 
-		// Generate mip levels
+		// Generate mip levels, each from the previous one
+		std::vector<float4> linearPrev(dimsBase.x * dimsBase.y);
+		std::vector<float4> linearMip;
 		std::vector<byte4> pixelsMip;
+		ConvertPixelsToLinear(pPixelsBase, dimsBase, isSRGB, &linearPrev[0]);
+		int2 dimsPrev = dimsBase;
 		for (int level = 1; level < mipLevels; ++level)
 		{
 			int2 dimsMip = CalculateMipDims(dimsBase, level);
+			linearMip.resize(dimsMip.x * dimsMip.y);
 			pixelsMip.resize(dimsMip.x * dimsMip.y);
 			byte4 * pPixelsMip = &pixelsMip[0];
 
-			CHECK_ERR(stbir_resize_uint8_srgb(
-						(const byte *)pPixels, dims.x, dims.y, 0,
-						(byte *)pPixelsMip, dimsMip.x, dimsMip.y, 0,
-						4, 3, 0));
+			DownsampleLinear(&linearPrev[0], dimsPrev, s_mipFilter, &linearMip[0], dimsMip);
+			ConvertLinearToPixels(&linearMip[0], dimsMip, isSRGB, pPixelsMip);
+
+#if CHECK_MIPS
+			// Compare to resampling from the base level with stb_image_resize, as we used to
+			{
+				std::vector<byte4> pixelsRef(dimsMip.x * dimsMip.y);
+				CHECK_ERR(stbir_resize_uint8_srgb(
+							(const byte *)pPixelsBase, dimsBase.x, dimsBase.y, 0,
+							(byte *)&pixelsRef[0], dimsMip.x, dimsMip.y, 0,
+							4, 3, 0));
+				float psnr = CalculatePSNR(pPixelsMip, &pixelsRef[0], dimsMip, 4);
+				ASSERT_WARN_MSG(psnr >= s_mipCheckMinPSNR,
+					"%s mip %d: PSNR against a direct resample is %0.2f dB, below the %0.0f dB limit",
+					pACI->m_pathSrc, level, psnr, s_mipCheckMinPSNR);
+			}
+#endif
 
-			if (!WriteImageToZip(pACI->m_pathSrc, level, pPixelsMip, dimsMip, pZipOut))
+			if (!WriteImageToSink(pACI->m_pathSrc, level, pPixelsMip, dimsMip, meta.m_format, quality, pSinkOut))
 			{
 				stbi_image_free(pPixels);
 				return false;
 			}
+
+			linearPrev.swap(linearMip);
+			dimsPrev = dimsMip;
 		}
 
 		stbi_image_free(pPixels);
 		return true;
 	}
 
-
-
-	namespace TextureCompiler
+	bool CompileVirtualTextureAsset(
+		const AssetCompileInfo * pACI,
+		AssetCompiler::AssetSink * pSinkOut)
 	{
-		bool WriteImageToZip(
-			const char * assetPath,
-			int mipLevel,
-			const byte4 * pPixels,
-			int2 dims,
-			mz_zip_archive * pZipOut)
-		{
-			ASSERT_ERR(assetPath);
-			ASSERT_ERR(mipLevel >= 0);
-			ASSERT_ERR(pPixels);
-			ASSERT_ERR(all(dims > 0));
-			ASSERT_ERR(pZipOut);
-
-			// Compose the suffix
-			char suffix[16] = {};
-			sprintf_s(suffix, "/%d", mipLevel);
+		ASSERT_ERR(pACI);
+		ASSERT_ERR(pACI->m_pathSrc);
+		ASSERT_ERR(pACI->m_ack == ACK_VirtualTexture);
+		ASSERT_ERR(pSinkOut);
 
-#if WRITE_BMP
-			// Write a .bmp version of it, too, if we're doing that
-			if (!WriteBMPToZip(assetPath, mipLevel, pPixels, dims, pZipOut))
-				return false;
-#endif
+		using namespace AssetCompiler;
+		using namespace TextureCompiler;
 
-			// Write it to the .zip archive
-			int sizeBytes = dims.x * dims.y * sizeof(byte4);
-			return AssetCompiler::WriteAssetDataToZip(assetPath, suffix, pPixels, sizeBytes, pZipOut);
+		// Load the image
+		int2 dims;
+		int numComponents;
+		byte4 * pPixels = (byte4 *)stbi_load(pACI->m_pathSrc, &dims.x, &dims.y, &numComponents, 4);
+		if (!pPixels)
+		{
+			WARN("Couldn't load file %s: %s", pACI->m_pathSrc, stbi_failure_reason());
+			return false;
 		}
 
-#if WRITE_BMP
-		bool WriteBMPToZip(
-			const char * assetPath,
-			int mipLevel,
-			const byte4 * pPixels,
-			int2 dims,
-			mz_zip_archive * pZipOut)
+		// Fill out the metadata struct.  The mip chain stops at the first level that fits in
+		// a single tile, as there's nothing to gain from paging smaller levels.
+		int tileSizeWithBorder = s_vtTileSize + 2 * s_vtTileBorder;
+		VTMeta meta =
 		{
-			ASSERT_ERR(assetPath);
-			ASSERT_ERR(mipLevel >= 0);
-			ASSERT_ERR(pPixels);
-			ASSERT_ERR(all(dims > 0));
-			ASSERT_ERR(pZipOut);
-
-			std::vector<byte> buffer;
-			WriteBMPToMemory(pPixels, dims, &buffer);
-
-			// Compose the suffix
-			char suffix[16] = {};
-			sprintf_s(suffix, "/%d.bmp", mipLevel);
+			dims,
+			CalculateVTMipCount(dims, s_vtTileSize),
+			s_vtTileSize,
+			s_vtTileBorder,
+			ChooseFormat(pACI, pPixels, dims, int2(tileSizeWithBorder)),
+		};
+		BCQUALITY quality = (pACI->m_flags & ACF_TextureHighQuality) ? BCQUALITY_High : BCQUALITY_Fast;
+		bool isSRGB = !(pACI->m_flags & (ACF_TextureMask | ACF_TextureNormalMap));
 
-			// Write it to the .zip archive
-			return AssetCompiler::WriteAssetDataToZip(assetPath, suffix, &buffer[0], buffer.size(), pZipOut);
+		if (!pSinkOut->WriteAssetData(pACI->m_pathSrc, s_suffixVTMeta, &meta, sizeof(meta)))
+		{
+			stbi_image_free(pPixels);
+			return false;
 		}
-#endif // WRITE_BMP
-	}
 
+		// Generate each mip level from the previous one, as for regular textures, and cut
+		// each one into tiles
+		std::vector<float4> linearPrev;
+		std::vector<float4> linearMip(dims.x * dims.y);
+		std::vector<byte4> pixelsMip(pPixels, pPixels + dims.x * dims.y);
+		std::vector<byte4> pixelsTile(tileSizeWithBorder * tileSizeWithBorder);
+		stbi_image_free(pPixels);
+		ConvertPixelsToLinear(&pixelsMip[0], dims, isSRGB, &linearMip[0]);
+		int2 dimsPrev = dims;
+		for (int level = 0; level < meta.m_mipLevels; ++level)
+		{
+			int2 dimsMip = CalculateMipDims(dims, level);
+			if (level > 0)
+			{
+				linearPrev.swap(linearMip);
+				linearMip.resize(dimsMip.x * dimsMip.y);
+				pixelsMip.resize(dimsMip.x * dimsMip.y);
+				DownsampleLinear(&linearPrev[0], dimsPrev, s_mipFilter, &linearMip[0], dimsMip);
+				ConvertLinearToPixels(&linearMip[0], dimsMip, isSRGB, &pixelsMip[0]);
+				dimsPrev = dimsMip;
+			}
 
+			int2 tileCount = (dimsMip + (s_vtTileSize - 1)) / s_vtTileSize;
+			for (int y = 0; y < tileCount.y; ++y)
+			{
+				for (int x = 0; x < tileCount.x; ++x)
+				{
+					CopyTileWithBorder(&pixelsMip[0], dimsMip, int2(x, y), &pixelsTile[0]);
+
+					// Compose the suffix: mip level, then tile coordinates
+					char suffix[32] = {};
+					sprintf_s(suffix, "/%d/%d_%d", level, x, y);
+
+					if (!WriteImageDataToSink(
+							pACI->m_pathSrc, suffix, &pixelsTile[0],
+							int2(tileSizeWithBorder), meta.m_format, quality, pSinkOut))
+					{
+						return false;
+					}
+				}
+			}
+		}
 
-	// Load compiled data into a runtime game object
+		return true;
+	}
 
-	bool LoadTexture2DFromAssetPack(
-		AssetPack * pPack,
-		const char * path,
-		Texture2D * pTexOut)
+	bool CompileTextureCubeAsset(
+		const AssetCompileInfo * pACI,
+		AssetCompiler::AssetSink * pSinkOut)
 	{
-		ASSERT_ERR(pPack);
-		ASSERT_ERR(path);
-		ASSERT_ERR(pTexOut);
+		ASSERT_ERR(pACI);
+		ASSERT_ERR(pACI->m_pathSrc);
+		ASSERT_ERR(pACI->m_ack == ACK_TextureCube);
+		ASSERT_ERR(pSinkOut);
 
+		using namespace AssetCompiler;
 		using namespace TextureCompiler;
 
-		pTexOut->m_pPack = pPack;
+		// Load the image and resample it to six faces
+		std::vector<CubeLevel> radiance(1);
+		if (!LoadCubeFaces(pACI->m_pathSrc, &radiance[0]))
+			return false;
 
-		// Look for the metadata in the asset pack
-		Meta * pMeta;
-		int metaSize;
-		if (!pPack->LookupFile(path, s_suffixMeta, (void **)&pMeta, &metaSize))
+		// Box-filter mips of the environment, for the prefiltering to sample from
+		int cubeSize = radiance[0].m_size;
+		int mipLevels = CalculateMipCount(cubeSize);
+		int mipsToDrop = CalculateMipsToDrop(pACI, int2(cubeSize));
+		radiance.resize(mipLevels);
+		for (int level = 1; level < mipLevels; ++level)
 		{
-			WARN("Couldn't find metadata for texture %s in asset pack %s", path, pPack->m_path.c_str());
-			return false;
+			const CubeLevel & levelPrev = radiance[level - 1];
+			CubeLevel * pLevel = &radiance[level];
+			pLevel->m_size = CalculateMipDims(cubeSize, level);
+			for (int face = 0; face < s_cubeFaceCount; ++face)
+			{
+				pLevel->m_faces[face].resize(pLevel->m_size * pLevel->m_size);
+				DownsampleLinear(
+					&levelPrev.m_faces[face][0], int2(levelPrev.m_size), MIPFILTER_Box,
+					&pLevel->m_faces[face][0], int2(pLevel->m_size), FLT_MAX);
+			}
 		}
-		if (metaSize != sizeof(Meta))
+
+		// Drop top mips for the asset's max dimension and mip bias
+		if (mipsToDrop > 0)
 		{
-			WARN("Metadata for texture %s in asset pack %s is wrong size, %d bytes (expected %d)",
-				path, pPack->m_path.c_str(), metaSize, sizeof(Meta));
-			return false;
+			radiance.erase(radiance.begin(), radiance.begin() + mipsToDrop);
+			cubeSize = radiance[0].m_size;
+			mipLevels -= mipsToDrop;
 		}
-		pTexOut->m_dims = pMeta->m_dims;
-		pTexOut->m_mipLevels = pMeta->m_mipLevels;
-		pTexOut->m_format = pMeta->m_format;
 
-		// Look for the individual mipmaps
-		pTexOut->m_apPixels.resize(pTexOut->m_mipLevels);
-		for (int i = 0; i < pTexOut->m_mipLevels; ++i)
+		// Fill out the metadata struct.  Stored like HDR textures, even for LDR sources.
+		CubeMeta meta =
 		{
-			// Compose the suffix
-			char suffix[16] = {};
-			sprintf_s(suffix, "/%d", i);
+			cubeSize,
+			mipLevels,
+			(pACI->m_flags & ACF_TextureCompress) ? DXGI_FORMAT_R11G11B10_FLOAT : DXGI_FORMAT_R16G16B16A16_FLOAT,
+		};
+		if (!pSinkOut->WriteAssetData(pACI->m_pathSrc, s_suffixCubeMeta, &meta, sizeof(meta)))
+			return false;
 
-			int pixelsSize;
-			if (!pPack->LookupFile(path, suffix, &pTexOut->m_apPixels[i], &pixelsSize))
+		// Irradiance, as SH9
+		rgb sh9[9];
+		ProjectCubeToSH9(radiance[0], sh9);
+		if (!pSinkOut->WriteAssetData(pACI->m_pathSrc, s_suffixCubeSH9, sh9, sizeof(sh9)))
+			return false;
+
+		// Prefilter each level below the top with GGX, from mirror-like at the top to fully
+		// rough at the bottom
+		CubeLevel prefiltered;
+		for (int level = 0; level < mipLevels; ++level)
+		{
+			const CubeLevel * pLevel = &radiance[0];
+			if (level > 0)
 			{
-				WARN("Couldn't find mip level %d of texture %s in asset pack %s", i, path, pPack->m_path.c_str());
-				return false;
+				prefiltered.m_size = CalculateMipDims(cubeSize, level);
+				PrefilterCubeGGX(radiance, float(level) / float(mipLevels - 1), &prefiltered);
+				pLevel = &prefiltered;
 			}
-			int2 mipDims = CalculateMipDims(pMeta->m_dims, i);
-			int expectedPixelsSize = mipDims.x * mipDims.y * BitsPerPixel(pMeta->m_format) / 8;
-			if (pixelsSize != expectedPixelsSize)
+
+			for (int face = 0; face < s_cubeFaceCount; ++face)
 			{
-				WARN("Mip level %d of texture %s in asset pack %s is wrong size, %d bytes (expected %d)",
-					i, path, pPack->m_path.c_str(), pixelsSize, expectedPixelsSize);
-				return false;
+				// Compose the suffix: face, then mip level
+				char suffix[16] = {};
+				sprintf_s(suffix, "/%d/%d", face, level);
+
+				if (!WriteFloatImageDataToSink(
+						pACI->m_pathSrc, suffix, &pLevel->m_faces[face][0],
+						int2(pLevel->m_size), meta.m_format, pSinkOut))
+				{
+					return false;
+				}
 			}
 		}
 
-		LOG("Loaded %s from asset pack %s - %dx%d, %d mips, %s",
-			path, pPack->m_path.c_str(),
-			pTexOut->m_dims.x, pTexOut->m_dims.y,
-			pTexOut->m_mipLevels, NameOfFormat(pTexOut->m_format));
-
 		return true;
 	}
 
-
-
-	// Create a library of all the textures in an asset pack
-
-	bool LoadTextureLibFromAssetPack(
-		AssetPack * pPack,
-		const AssetCompileInfo * assets,
-		int numAssets,
-		TextureLib * pTexLibOut)
+	bool CompileTexture3DAsset(
+		const AssetCompileInfo * pACI,
+		AssetCompiler::AssetSink * pSinkOut)
 	{
-		ASSERT_ERR(pPack);
-		ASSERT_ERR(assets);
-		ASSERT_ERR(numAssets > 0);
-		ASSERT_ERR(pTexLibOut);
+		ASSERT_ERR(pACI);
+		ASSERT_ERR(pACI->m_pathSrc);
+		ASSERT_ERR(pACI->m_ack == ACK_Texture3D);
+		ASSERT_ERR(pSinkOut);
 
-		// Find all the texture assets
-		for (int i = 0; i < numAssets; ++i)
+		using namespace AssetCompiler;
+		using namespace TextureCompiler;
+
+		// Load the image, in linear float either way
+		bool isFloat = IsFloatSource(pACI);
+		bool isSRGB = !isFloat && !(pACI->m_flags & (ACF_TextureMask | ACF_TextureNormalMap));
+		int2 dimsImage;
+		int numComponents;
+		std::vector<float4> linearImage;
+		if (isFloat)
 		{
-			const AssetCompileInfo * pACI = &assets[i];
-			if (pACI->m_ack != ACK_TextureRaw &&
-				pACI->m_ack != ACK_TextureWithMips)
+			float4 * pLinear = (float4 *)stbi_loadf(pACI->m_pathSrc, &dimsImage.x, &dimsImage.y, &numComponents, 4);
+			if (!pLinear)
 			{
-				continue;
+				WARN("Couldn't load file %s: %s", pACI->m_pathSrc, stbi_failure_reason());
+				return false;
 			}
-
-			auto iterAndBool = pTexLibOut->m_texs.insert(std::make_pair(std::string(pACI->m_pathSrc), Texture2D()));
-
-			if (!LoadTexture2DFromAssetPack(pPack, pACI->m_pathSrc, &iterAndBool.first->second))
+			linearImage.assign(pLinear, pLinear + dimsImage.x * dimsImage.y);
+			stbi_image_free(pLinear);
+		}
+		else
+		{
+			byte4 * pPixels = (byte4 *)stbi_load(pACI->m_pathSrc, &dimsImage.x, &dimsImage.y, &numComponents, 4);
+			if (!pPixels)
 			{
-				pTexLibOut->m_texs.erase(iterAndBool.first);
+				WARN("Couldn't load file %s: %s", pACI->m_pathSrc, stbi_failure_reason());
 				return false;
 			}
+			linearImage.resize(dimsImage.x * dimsImage.y);
+			ConvertPixelsToLinear(pPixels, dimsImage, isSRGB, &linearImage[0]);
+			stbi_image_free(pPixels);
 		}
 
-		return true;
-	}
-
-
-
-	// Helper function for quick and dirty apps - just compile and load a texture in one step.
-	// Totally unnecessarily serializing, compressing, decompressing, and deserializing
-	// all the data here...but whatever.
-
-	bool LoadTexture2DRaw(
-		const char * path,
-		Texture2D * pTexOut)
-	{
-		ASSERT_ERR(path);
-		ASSERT_ERR(pTexOut);
-
-		// Set up an in-memory zip stream
-		mz_zip_archive zipWrite = {};
-		CHECK_ERR(mz_zip_writer_init_heap(&zipWrite, 0, 0));
-
-		// Compile the mesh to it
-		AssetCompileInfo aci = { path, ACK_TextureRaw };
-		if (!AssetCompiler::CompileFullAssetPackToZip(&aci, 1, &zipWrite))
+		// Work out the slice layout: square slices in a row, or in a column
+		int3 dims;
+		bool slicesInRow;
+		if (dimsImage.x > dimsImage.y && dimsImage.x % dimsImage.y == 0)
 		{
-			mz_zip_writer_end(&zipWrite);
-			return false;
+			dims = int3(dimsImage.y, dimsImage.y, dimsImage.x / dimsImage.y);
+			slicesInRow = true;
 		}
-
-		void * pData;
-		size_t sizeBytes;
-		if (!mz_zip_writer_finalize_heap_archive(&zipWrite, &pData, &sizeBytes))
+		else if (dimsImage.y % dimsImage.x == 0)
+		{
+			dims = int3(dimsImage.x, dimsImage.x, dimsImage.y / dimsImage.x);
+			slicesInRow = false;
+		}
+		else
 		{
-			WARN("Couldn't finalize archive");
-			mz_zip_writer_end(&zipWrite);
+			WARN("Volume texture %s is %dx%d; expected square slices in a row or column",
+				pACI->m_pathSrc, dimsImage.x, dimsImage.y);
 			return false;
 		}
 
-		// Turn around and load the pack right back in
-
-		mz_zip_archive zipRead = {};
-		CHECK_ERR(mz_zip_reader_init_mem(&zipRead, pData, sizeBytes, 0));
-
-		AssetPack * pPack = new AssetPack;
-		pPack->m_path = "(in memory)";
+		// A column of slices is already in the right order; a row needs rearranging
+		std::vector<float4> linearPrev;
+		if (slicesInRow)
+		{
+			linearPrev.resize(dims.x * dims.y * dims.z);
+			for (int z = 0; z < dims.z; ++z)
+			{
+				for (int y = 0; y < dims.y; ++y)
+				{
+					const float4 * pRowSrc = &linearImage[y * dimsImage.x + z * dims.x];
+					std::copy(pRowSrc, pRowSrc + dims.x, &linearPrev[(z * dims.y + y) * dims.x]);
+				}
+			}
+		}
+		else
+		{
+			linearPrev.swap(linearImage);
+		}
+
+		if (!isFloat && (pACI->m_flags & ACF_TextureCompress))
+			WARN("Volume texture %s can't be BC-compressed; storing it uncompressed", pACI->m_pathSrc);
+
+		// Fill out the metadata struct
+		int mipLevels = CalculateMipCount(dims);
+		VolumeMeta meta =
+		{
+			dims,
+			mipLevels,
+			isFloat ?
+				((pACI->m_flags & ACF_TextureCompress) ? DXGI_FORMAT_R11G11B10_FLOAT : DXGI_FORMAT_R16G16B16A16_FLOAT) :
+				(isSRGB ? DXGI_FORMAT_R8G8B8A8_UNORM_SRGB : DXGI_FORMAT_R8G8B8A8_UNORM),
+		};
+		if (!pSinkOut->WriteAssetData(pACI->m_pathSrc, s_suffixVolumeMeta, &meta, sizeof(meta)))
+			return false;
+
+		// Write out each mip level, generating each from the previous one.  The slices of a
+		// level are stored one after another, so they can be written as one tall image.
+		std::vector<float4> linearMip;
+		std::vector<byte4> pixelsMip;
+		int3 dimsPrev = dims;
+		for (int level = 0; level < mipLevels; ++level)
+		{
+			int3 dimsMip = CalculateMipDims(dims, level);
+			if (level > 0)
+			{
+				linearMip.resize(dimsMip.x * dimsMip.y * dimsMip.z);
+				DownsampleVolume(&linearPrev[0], dimsPrev, s_mipFilter, &linearMip[0], dimsMip, isFloat ? FLT_MAX : 1.0f);
+				linearPrev.swap(linearMip);
+				dimsPrev = dimsMip;
+			}
+
+			int2 dimsImageMip = int2(dimsMip.x, dimsMip.y * dimsMip.z);
+			if (isFloat)
+			{
+				if (!WriteFloatImageToSink(pACI->m_pathSrc, level, &linearPrev[0], dimsImageMip, meta.m_format, pSinkOut))
+					return false;
+			}
+			else
+			{
+				pixelsMip.resize(dimsImageMip.x * dimsImageMip.y);
+				ConvertLinearToPixels(&linearPrev[0], dimsImageMip, isSRGB, &pixelsMip[0]);
+				if (!WriteImageToSink(pACI->m_pathSrc, level, &pixelsMip[0], dimsImageMip, meta.m_format, BCQUALITY_Fast, pSinkOut))
+					return false;
+			}
+		}
+
+		return true;
+	}
+
+
+
+	namespace TextureCompiler
+	{
+		// sRGB <-> linear conversion tables.  Going to linear is exact, from a 256-entry table.
+		// Going back uses a table indexed by linear value, fine enough that it's never off by
+		// more than one code from the exact result.  There's also a pair of tables for plain
+		// UNORM data, so masks and normal maps can go through the same code.
+
+		static const int s_linearToSRGBTableSize = 16384;
+
+		struct SRGBTables
+		{
+			float	m_srgbToLinear[256];
+			byte	m_linearToSRGB[s_linearToSRGBTableSize];
+			float	m_unormToLinear[256];
+			byte	m_linearToUNORM[s_linearToSRGBTableSize];
+
+			SRGBTables()
+			{
+				for (int i = 0; i < 256; ++i)
+				{
+					float srgb = float(i) / 255.0f;
+					m_srgbToLinear[i] = (srgb <= 0.04045f) ? srgb / 12.92f : powf((srgb + 0.055f) / 1.055f, 2.4f);
+					m_unormToLinear[i] = srgb;
+				}
+				for (int i = 0; i < s_linearToSRGBTableSize; ++i)
+				{
+					float linear = float(i) / float(s_linearToSRGBTableSize - 1);
+					float srgb = (linear <= 0.0031308f) ? linear * 12.92f : 1.055f * powf(linear, 1.0f / 2.4f) - 0.055f;
+					m_linearToSRGB[i] = byte(clamp(int(srgb * 255.0f + 0.5f), 0, 255));
+					m_linearToUNORM[i] = byte(clamp(int(linear * 255.0f + 0.5f), 0, 255));
+				}
+			}
+		};
+
+		static const SRGBTables & GetSRGBTables()
+		{
+			static const SRGBTables s_tables;
+			return s_tables;
+		}
+
+		// Rows are handed out to threads in chunks of at least this many pixels
+		static const int s_pixelsPerTask = 16384;
+
+		static int RowsPerTask(int width)
+		{
+			return max(1, s_pixelsPerTask / width);
+		}
+
+		void ConvertPixelsToLinear(
+			const byte4 * pPixels,
+			int2 dims,
+			bool isSRGB,
+			float4 * pLinearOut)
+		{
+			ASSERT_ERR(pPixels);
+			ASSERT_ERR(all(dims > 0));
+			ASSERT_ERR(pLinearOut);
+
+			const SRGBTables & tables = GetSRGBTables();
+			const float * srgbToLinear = isSRGB ? tables.m_srgbToLinear : tables.m_unormToLinear;
+
+			AssetCompiler::ParallelFor(dims.y, RowsPerTask(dims.x), [=](int yStart, int yEnd)
+			{
+				const __m128 scaleAlpha = _mm_set1_ps(1.0f / 255.0f);
+				for (int i = yStart * dims.x, iEnd = yEnd * dims.x; i < iEnd; ++i)
+				{
+					byte4 p = pPixels[i];
+					__m128 alpha = _mm_mul_ps(_mm_set1_ps(float(p.w)), scaleAlpha);
+					__m128 rgb = _mm_setr_ps(srgbToLinear[p.x], srgbToLinear[p.y], srgbToLinear[p.z], 1.0f);
+
+					// Premultiply, so the filters weight color by coverage
+					_mm_storeu_ps(&pLinearOut[i].x, _mm_mul_ps(rgb, alpha));
+				}
+			});
+		}
+
+		void ConvertLinearToPixels(
+			const float4 * pLinear,
+			int2 dims,
+			bool isSRGB,
+			byte4 * pPixelsOut)
+		{
+			ASSERT_ERR(pLinear);
+			ASSERT_ERR(all(dims > 0));
+			ASSERT_ERR(pPixelsOut);
+
+			const SRGBTables & tables = GetSRGBTables();
+			const byte * linearToSRGB = isSRGB ? tables.m_linearToSRGB : tables.m_linearToUNORM;
+
+			AssetCompiler::ParallelFor(dims.y, RowsPerTask(dims.x), [=](int yStart, int yEnd)
+			{
+				const __m128 zero = _mm_setzero_ps();
+				const __m128 one = _mm_set1_ps(1.0f);
+				const __m128 scale = _mm_setr_ps(
+										float(s_linearToSRGBTableSize - 1),
+										float(s_linearToSRGBTableSize - 1),
+										float(s_linearToSRGBTableSize - 1),
+										255.0f);
+				const __m128 half = _mm_set1_ps(0.5f);
+				for (int i = yStart * dims.x, iEnd = yEnd * dims.x; i < iEnd; ++i)
+				{
+					__m128 v = _mm_loadu_ps(&pLinear[i].x);
+					__m128 alpha = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3));
+
+					// Un-premultiply, leaving color black where alpha is zero
+					__m128 mask = _mm_cmpgt_ps(alpha, zero);
+					__m128 color = _mm_and_ps(_mm_div_ps(v, _mm_max_ps(alpha, _mm_set1_ps(1e-20f))), mask);
+
+					// Put alpha back in the w component, then clamp and scale to table indices
+					color = _mm_shuffle_ps(color, _mm_unpackhi_ps(color, alpha), _MM_SHUFFLE(1, 0, 1, 0));
+					color = _mm_min_ps(_mm_max_ps(color, zero), one);
+					__m128i indices = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(color, scale), half));
+
+					alignas(16) int aIndices[4];
+					_mm_store_si128((__m128i *)aIndices, indices);
+					byte4 pixel =
+					{
+						linearToSRGB[aIndices[0]],
+						linearToSRGB[aIndices[1]],
+						linearToSRGB[aIndices[2]],
+						byte(aIndices[3]),
+					};
+					pPixelsOut[i] = pixel;
+				}
+			});
+		}
+
+		// Convert non-negative, finite floats to a float format with a 5-bit exponent and the
+		// given number of mantissa bits, rounding to nearest even.  This covers the magnitude
+		// of a half as well as the channels of R11G11B10_FLOAT.  Results are in the low bits
+		// of each lane.
+		static __m128i FloatToSmallFloatSSE2(__m128 absf, int mantissaBits)
+		{
+			int shift = 23 - mantissaBits;
+			__m128i shiftCount = _mm_cvtsi32_si128(shift);
+			__m128i absInt = _mm_castps_si128(absf);
+
+			// Below the smallest normal, adding a magic number lines the mantissa up so
+			// the float hardware does the rounding
+			__m128i subnormMagic = _mm_set1_epi32(((127 - 15) + shift + 1) << 23);
+			__m128i subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(absf, _mm_castsi128_ps(subnormMagic))), subnormMagic);
+
+			// Otherwise, rebias the exponent and round the mantissa by hand
+			__m128i mantissaOdd = _mm_and_si128(_mm_srl_epi32(absInt, shiftCount), _mm_set1_epi32(1));
+			__m128i rounded = _mm_add_epi32(absInt, _mm_set1_epi32(((1 << (shift - 1)) - 1) - ((127 - 15) << 23)));
+			__m128i normal = _mm_srl_epi32(_mm_add_epi32(rounded, mantissaOdd), shiftCount);
+
+			__m128i isSubnormal = _mm_cmpgt_epi32(_mm_set1_epi32((127 - 14) << 23), absInt);
+			return _mm_or_si128(_mm_and_si128(isSubnormal, subnormal), _mm_andnot_si128(isSubnormal, normal));
+		}
+
+		// Largest finite value with a 5-bit exponent and the given number of mantissa bits
+		static float MaxSmallFloat(int mantissaBits)
+		{
+			return (2.0f - 1.0f / float(1 << mantissaBits)) * 32768.0f;
+		}
+
+		void ConvertLinearToHalf(
+			const float4 * pLinear,
+			int2 dims,
+			ushort * pHalfOut)
+		{
+			ASSERT_ERR(pLinear);
+			ASSERT_ERR(all(dims > 0));
+			ASSERT_ERR(pHalfOut);
+
+			// Out-of-range values clamp to the largest finite half, and NaNs go to zero, so
+			// filtering never spreads infinities around
+			AssetCompiler::ParallelFor(dims.y, RowsPerTask(dims.x), [=](int yStart, int yEnd)
+			{
+				const __m128 maxHalf = _mm_set1_ps(MaxSmallFloat(10));
+				const __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+				for (int i = yStart * dims.x, iEnd = yEnd * dims.x; i < iEnd; ++i)
+				{
+					__m128 v = _mm_loadu_ps(&pLinear[i].x);
+					v = _mm_and_ps(v, _mm_cmpord_ps(v, v));
+					__m128 sign = _mm_and_ps(v, signMask);
+					__m128 absf = _mm_min_ps(_mm_andnot_ps(signMask, v), maxHalf);
+#if USE_F16C
+					__m128i half = _mm_cvtps_ph(_mm_or_ps(absf, sign), _MM_FROUND_TO_NEAREST_INT);
+#else
+					__m128i half = _mm_or_si128(
+										FloatToSmallFloatSSE2(absf, 10),
+										_mm_srli_epi32(_mm_castps_si128(sign), 16));
+
+					// Narrow to 16 bits per lane; sign-extending first keeps packs from saturating
+					half = _mm_srai_epi32(_mm_slli_epi32(half, 16), 16);
+					half = _mm_packs_epi32(half, half);
+#endif
+					_mm_storel_epi64((__m128i *)&pHalfOut[i * 4], half);
+				}
+			});
+		}
+
+		void ConvertLinearToR11G11B10(
+			const float4 * pLinear,
+			int2 dims,
+			uint * pPackedOut)
+		{
+			ASSERT_ERR(pLinear);
+			ASSERT_ERR(all(dims > 0));
+			ASSERT_ERR(pPackedOut);
+
+			// Four pixels at a time, transposed so each channel gets its own vector.  There's
+			// no sign bit, so negatives and NaNs go to zero, and out-of-range values clamp.
+			AssetCompiler::ParallelFor(dims.y, RowsPerTask(dims.x), [=](int yStart, int yEnd)
+			{
+				const __m128 zero = _mm_setzero_ps();
+				const __m128 max11 = _mm_set1_ps(MaxSmallFloat(6));
+				const __m128 max10 = _mm_set1_ps(MaxSmallFloat(5));
+				for (int i = yStart * dims.x, iEnd = yEnd * dims.x; i < iEnd; i += 4)
+				{
+					float4 pixels[4];
+					int count = min(4, iEnd - i);
+					for (int j = 0; j < 4; ++j)
+						pixels[j] = pLinear[i + min(j, count - 1)];
+
+					__m128 r = _mm_loadu_ps(&pixels[0].x);
+					__m128 g = _mm_loadu_ps(&pixels[1].x);
+					__m128 b = _mm_loadu_ps(&pixels[2].x);
+					__m128 a = _mm_loadu_ps(&pixels[3].x);
+					_MM_TRANSPOSE4_PS(r, g, b, a);
+
+					// max_ps returns the second operand if either is NaN
+					r = _mm_min_ps(_mm_max_ps(r, zero), max11);
+					g = _mm_min_ps(_mm_max_ps(g, zero), max11);
+					b = _mm_min_ps(_mm_max_ps(b, zero), max10);
+
+					__m128i packed = _mm_or_si128(
+										_mm_or_si128(
+											FloatToSmallFloatSSE2(r, 6),
+											_mm_slli_epi32(FloatToSmallFloatSSE2(g, 6), 11)),
+										_mm_slli_epi32(FloatToSmallFloatSSE2(b, 5), 22));
+
+					alignas(16) uint aPacked[4];
+					_mm_store_si128((__m128i *)aPacked, packed);
+					for (int j = 0; j < count; ++j)
+						pPackedOut[i + j] = aPacked[j];
+				}
+			});
+		}
+
+		// Taps for producing one destination pixel from a row or column of source pixels
+		static const int s_tapCountMax = 16;
+
+		struct MipTaps
+		{
+			int		m_tapCount;
+			int		m_aiSrc[s_tapCountMax];
+			float	m_weights[s_tapCountMax];
+		};
+
+		static float BesselI0(float x)
+		{
+			// Power series; converges quickly for the small arguments used here
+			float sum = 1.0f, term = 1.0f;
+			for (int k = 1; k < 20; ++k)
+			{
+				term *= (0.5f * x / float(k)) * (0.5f * x / float(k));
+				sum += term;
+			}
+			return sum;
+		}
+
+		// Half-band sinc windowed by a Kaiser window, as a function of distance from the
+		// destination pixel center, measured in destination pixels
+		static const float s_kaiserRadius = 2.0f;
+
+		static float EvalKaiser(float t)
+		{
+			static const float s_beta = 4.0f;
+			float r = t / s_kaiserRadius;
+			if (r <= -1.0f || r >= 1.0f)
+				return 0.0f;
+			float sinc = (t == 0.0f) ? 1.0f : sinf(3.14159265f * t) / (3.14159265f * t);
+			return sinc * BesselI0(s_beta * sqrtf(1.0f - r*r)) / BesselI0(s_beta);
+		}
+
+		// Build the taps for each destination pixel along one axis.  The filter is stretched
+		// over the exact ratio of source to destination size, so odd sizes (which round down)
+		// get proper polyphase weights, and even sizes come out as the usual 2:1 kernel.  If
+		// the axis isn't being shrunk, the taps degenerate to a copy.
+		static void CalculateMipTaps(
+			int countSrc,
+			int countDst,
+			MIPFILTER filter,
+			std::vector<MipTaps> * pTapsOut)
+		{
+			ASSERT_ERR(countSrc > 0);
+			ASSERT_ERR(countDst == max(countSrc / 2, 1));
+			ASSERT_ERR(filter >= 0 && filter < MIPFILTER_Count);
+			ASSERT_ERR(pTapsOut);
+
+			pTapsOut->resize(countDst);
+
+			if (countDst == countSrc)
+			{
+				for (int i = 0; i < countDst; ++i)
+				{
+					MipTaps * pTaps = &(*pTapsOut)[i];
+					pTaps->m_tapCount = 1;
+					pTaps->m_aiSrc[0] = i;
+					pTaps->m_weights[0] = 1.0f;
+				}
+				return;
+			}
+
+			float scale = float(countSrc) / float(countDst);		// Source pixels per destination pixel
+			float radius = (filter == MIPFILTER_Box) ? 0.5f * scale : s_kaiserRadius * scale;
+
+			for (int i = 0; i < countDst; ++i)
+			{
+				MipTaps * pTaps = &(*pTapsOut)[i];
+				pTaps->m_tapCount = 0;
+
+				float center = (float(i) + 0.5f) * scale;
+				int jStart = int(floorf(center - radius));
+				int jEnd = int(ceilf(center + radius));
+				float sum = 0.0f;
+				for (int j = jStart; j < jEnd; ++j)
+				{
+					float weight;
+					if (filter == MIPFILTER_Box)
+					{
+						// Coverage of the source pixel by the destination pixel's footprint
+						weight = max(0.0f, min(float(j + 1), center + radius) - max(float(j), center - radius));
+					}
+					else
+					{
+						weight = EvalKaiser((float(j) + 0.5f - center) / scale);
+					}
+					if (weight == 0.0f)
+						continue;
+
+					// Clamp at the edges, merging taps that land on the same source pixel
+					int jClamped = clamp(j, 0, countSrc - 1);
+					int iTap = pTaps->m_tapCount - 1;
+					if (iTap < 0 || pTaps->m_aiSrc[iTap] != jClamped)
+					{
+						ASSERT_ERR(pTaps->m_tapCount < s_tapCountMax);
+						iTap = pTaps->m_tapCount++;
+						pTaps->m_aiSrc[iTap] = jClamped;
+						pTaps->m_weights[iTap] = 0.0f;
+					}
+					pTaps->m_weights[iTap] += weight;
+					sum += weight;
+				}
+
+				ASSERT_ERR(sum > 0.0f);
+				for (int k = 0; k < pTaps->m_tapCount; ++k)
+					pTaps->m_weights[k] /= sum;
+			}
+		}
+
+		void DownsampleLinear(
+			const float4 * pSrc,
+			int2 dimsSrc,
+			MIPFILTER filter,
+			float4 * pDst,
+			int2 dimsDst,
+			float maxValue /* = 1.0f */)
+		{
+			ASSERT_ERR(pSrc);
+			ASSERT_ERR(all(dimsSrc > 0));
+			ASSERT_ERR(pDst);
+			ASSERT_ERR(all(dimsDst > 0));
+			ASSERT_ERR(maxValue > 0.0f);
+
+			std::vector<MipTaps> tapsX, tapsY;
+			CalculateMipTaps(dimsSrc.x, dimsDst.x, filter, &tapsX);
+			CalculateMipTaps(dimsSrc.y, dimsDst.y, filter, &tapsY);
+			const MipTaps * pTapsX = &tapsX[0];
+			const MipTaps * pTapsY = &tapsY[0];
+
+			// Separable: filter horizontally into a temp buffer, then vertically into the destination
+			std::vector<float4> temp(dimsDst.x * dimsSrc.y);
+			float4 * pTemp = &temp[0];
+
+			AssetCompiler::ParallelFor(dimsSrc.y, RowsPerTask(dimsSrc.x), [=](int yStart, int yEnd)
+			{
+				for (int y = yStart; y < yEnd; ++y)
+				{
+					const float4 * pRowSrc = pSrc + y * dimsSrc.x;
+					float4 * pRowTemp = pTemp + y * dimsDst.x;
+					for (int x = 0; x < dimsDst.x; ++x)
+					{
+						const MipTaps & taps = pTapsX[x];
+						__m128 sum = _mm_setzero_ps();
+						for (int k = 0; k < taps.m_tapCount; ++k)
+							sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(&pRowSrc[taps.m_aiSrc[k]].x), _mm_set1_ps(taps.m_weights[k])));
+						_mm_storeu_ps(&pRowTemp[x].x, sum);
+					}
+				}
+			});
+
+			// Vertical pass works a whole row at a time, reading the rows under each tap
+			AssetCompiler::ParallelFor(dimsDst.y, RowsPerTask(dimsDst.x), [=](int yStart, int yEnd)
+			{
+				const __m128 zero = _mm_setzero_ps();
+				const __m128 maxv = _mm_set1_ps(maxValue);
+				for (int y = yStart; y < yEnd; ++y)
+				{
+					const MipTaps & taps = pTapsY[y];
+
+					float4 * pRowDst = pDst + y * dimsDst.x;
+					for (int x = 0; x < dimsDst.x; ++x)
+					{
+						__m128 sum = _mm_setzero_ps();
+						for (int k = 0; k < taps.m_tapCount; ++k)
+							sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(&pTemp[taps.m_aiSrc[k] * dimsDst.x + x].x), _mm_set1_ps(taps.m_weights[k])));
+
+						// The Kaiser kernel has negative lobes, so it can overshoot
+						sum = _mm_min_ps(_mm_max_ps(sum, zero), maxv);
+						_mm_storeu_ps(&pRowDst[x].x, sum);
+					}
+				}
+			});
+		}
+
+		void CopyTileWithBorder(
+			const byte4 * pPixels,
+			int2 dims,
+			int2 tile,
+			byte4 * pTileOut)
+		{
+			ASSERT_ERR(pPixels);
+			ASSERT_ERR(all(dims > 0));
+			ASSERT_ERR(pTileOut);
+
+			// Copy the tile plus its border, clamping at the image edges.  Tiles past the
+			// edge of the image (in the last row/column) get the edge pixels repeated.
+			int tileSizeWithBorder = s_vtTileSize + 2 * s_vtTileBorder;
+			int2 origin = tile * s_vtTileSize - s_vtTileBorder;
+			for (int y = 0; y < tileSizeWithBorder; ++y)
+			{
+				int ySrc = clamp(origin.y + y, 0, dims.y - 1);
+				const byte4 * pRowSrc = pPixels + ySrc * dims.x;
+				byte4 * pRowDst = pTileOut + y * tileSizeWithBorder;
+				for (int x = 0; x < tileSizeWithBorder; ++x)
+				{
+					pRowDst[x] = pRowSrc[clamp(origin.x + x, 0, dims.x - 1)];
+				}
+			}
+		}
+
+		void CalculateNormalsFromHeights(
+			const float * pHeights,
+			int2 dims,
+			float bumpScale,
+			float4 * pNormalsOut)
+		{
+			ASSERT_ERR(pHeights);
+			ASSERT_ERR(all(dims > 0));
+			ASSERT_ERR(pNormalsOut);
+
+			// Take the height gradient with a Scharr filter, wrapping around the edges since
+			// height maps usually tile.  Heights run from 0 to bumpScale, measured in texels.
+			// Normals point along +u and +v for x and y, and are encoded to [0, 1].
+			AssetCompiler::ParallelFor(dims.y, RowsPerTask(dims.x), [=](int yStart, int yEnd)
+			{
+				for (int y = yStart; y < yEnd; ++y)
+				{
+					const float * pRowUp = pHeights + ((y + dims.y - 1) % dims.y) * dims.x;
+					const float * pRow = pHeights + y * dims.x;
+					const float * pRowDown = pHeights + ((y + 1) % dims.y) * dims.x;
+					for (int x = 0; x < dims.x; ++x)
+					{
+						int xLeft = (x + dims.x - 1) % dims.x;
+						int xRight = (x + 1) % dims.x;
+						float dhdx = (3.0f * (pRowUp[xRight] - pRowUp[xLeft]) +
+									  10.0f * (pRow[xRight] - pRow[xLeft]) +
+									  3.0f * (pRowDown[xRight] - pRowDown[xLeft])) * (1.0f / 32.0f);
+						float dhdy = (3.0f * (pRowDown[xLeft] - pRowUp[xLeft]) +
+									  10.0f * (pRowDown[x] - pRowUp[x]) +
+									  3.0f * (pRowDown[xRight] - pRowUp[xRight])) * (1.0f / 32.0f);
+						float3 normal = normalize(float3(-bumpScale * dhdx, -bumpScale * dhdy, 1.0f));
+						pNormalsOut[y * dims.x + x] = float4(normal * 0.5f + 0.5f, 1.0f);
+					}
+				}
+			});
+		}
+
+		void RenormalizeNormals(
+			float4 * pNormals,
+			int2 dims)
+		{
+			ASSERT_ERR(pNormals);
+			ASSERT_ERR(all(dims > 0));
+
+			// Filtering shortens the normals where they vary, so put them back to unit length
+			for (int i = 0, c = dims.x * dims.y; i < c; ++i)
+			{
+				float3 normal = pNormals[i].xyz * 2.0f - 1.0f;
+				float length = sqrtf(dot(normal, normal));
+				normal = (length > 1e-6f) ? normal / length : float3(0.0f, 0.0f, 1.0f);
+				pNormals[i] = float4(normal * 0.5f + 0.5f, 1.0f);
+			}
+		}
+
+		bool CompileNormalMapFromHeight(
+			const char * pathHeight,
+			const char * assetPath,
+			float bumpScale,
+			const AssetCompileInfo * pACIMtl,
+			AssetCompiler::AssetSink * pSinkOut)
+		{
+			ASSERT_ERR(pathHeight);
+			ASSERT_ERR(assetPath);
+			ASSERT_ERR(bumpScale >= 0.0f);
+			ASSERT_ERR(pACIMtl);
+			ASSERT_ERR(pSinkOut);
+
+			using namespace AssetCompiler;
+
+			// Load the height map, taking heights from the red channel
+			int2 dims;
+			int numComponents;
+			byte4 * pPixels = (byte4 *)stbi_load(pathHeight, &dims.x, &dims.y, &numComponents, 4);
+			if (!pPixels)
+			{
+				WARN("Couldn't load file %s: %s", pathHeight, stbi_failure_reason());
+				return false;
+			}
+			std::vector<float> heights(dims.x * dims.y);
+			for (int i = 0, c = dims.x * dims.y; i < c; ++i)
+				heights[i] = float(pPixels[i].x) * (1.0f / 255.0f);
+			stbi_image_free(pPixels);
+
+			// It's stored like any other normal map, with the material lib's limits on its size
+			AssetCompileInfo aci =
+			{
+				pathHeight,
+				ACK_TextureWithMips,
+				(pACIMtl->m_flags & (ACF_TextureCompress | ACF_TextureHighQuality)) | ACF_TextureNormalMap,
+				pACIMtl->m_maxDim,
+				pACIMtl->m_mipBias,
+			};
+			int mipsToDrop = CalculateMipsToDrop(&aci, dims);
+			int2 dimsBase = CalculateMipDims(dims, mipsToDrop);
+			int mipLevels = log2_floor(maxComponent(dimsBase)) + 1;
+			BCQUALITY quality = (aci.m_flags & ACF_TextureHighQuality) ? BCQUALITY_High : BCQUALITY_Fast;
+
+			// Generate mip levels, each from the previous one's normals, and store them from the
+			// top kept mip down.  Dropped mips are still generated, so the kept ones are filtered
+			// down from the full-resolution normals.
+			std::vector<float4> linearPrev(dims.x * dims.y);
+			std::vector<float4> linearMip;
+			std::vector<byte4> pixelsMip;
+			CalculateNormalsFromHeights(&heights[0], dims, bumpScale, &linearPrev[0]);
+			Meta meta = {};
+			int2 dimsPrev = dims;
+			for (int level = 0; level < mipsToDrop + mipLevels; ++level)
+			{
+				int2 dimsMip = CalculateMipDims(dims, level);
+				if (level > 0)
+				{
+					linearMip.resize(dimsMip.x * dimsMip.y);
+					DownsampleLinear(&linearPrev[0], dimsPrev, s_mipFilter, &linearMip[0], dimsMip);
+					RenormalizeNormals(&linearMip[0], dimsMip);
+					linearPrev.swap(linearMip);
+					dimsPrev = dimsMip;
+				}
+				if (level < mipsToDrop)
+					continue;
+
+				pixelsMip.resize(dimsMip.x * dimsMip.y);
+				ConvertLinearToPixels(&linearPrev[0], dimsMip, false, &pixelsMip[0]);
+
+				// Store the metadata along with the top mip
+				if (level == mipsToDrop)
+				{
+					meta.m_dims = dimsBase;
+					meta.m_mipLevels = mipLevels;
+					meta.m_format = ChooseFormat(&aci, &pixelsMip[0], dimsBase, dimsBase);
+					if (!pSinkOut->WriteAssetData(assetPath, s_suffixMeta, &meta, sizeof(meta)))
+						return false;
+				}
+
+				if (!WriteImageToSink(assetPath, level - mipsToDrop, &pixelsMip[0], dimsMip, meta.m_format, quality, pSinkOut))
+					return false;
+			}
+
+			return true;
+		}
+
+		bool CompilePackedTexture(
+			const char * const * aPathsSrc,
+			int channelCount,
+			const char * assetPath,
+			const AssetCompileInfo * pACIMtl,
+			AssetCompiler::AssetSink * pSinkOut)
+		{
+			ASSERT_ERR(aPathsSrc);
+			ASSERT_ERR(channelCount > 0 && channelCount <= 3);
+			ASSERT_ERR(assetPath);
+			ASSERT_ERR(pACIMtl);
+			ASSERT_ERR(pSinkOut);
+
+			using namespace AssetCompiler;
+
+			// Load the sources, keeping just the red channel of each
+			std::vector<byte> channels[3];
+			int2 channelDims[3];
+			int2 dims = int2(0);
+			for (int iChannel = 0; iChannel < channelCount; ++iChannel)
+			{
+				int2 dimsSrc;
+				int numComponents;
+				byte4 * pPixels = (byte4 *)stbi_load(aPathsSrc[iChannel], &dimsSrc.x, &dimsSrc.y, &numComponents, 4);
+				if (!pPixels)
+				{
+					WARN("Couldn't load file %s: %s", aPathsSrc[iChannel], stbi_failure_reason());
+					return false;
+				}
+				channels[iChannel].resize(dimsSrc.x * dimsSrc.y);
+				for (int i = 0, c = dimsSrc.x * dimsSrc.y; i < c; ++i)
+					channels[iChannel][i] = pPixels[i].x;
+				stbi_image_free(pPixels);
+
+				channelDims[iChannel] = dimsSrc;
+				dims = max(dims, dimsSrc);
+			}
+
+			// Sources don't have to agree on size; smaller ones are resampled up to the largest.
+			// Unused channels are left at zero, and alpha at one so it doesn't affect filtering.
+			std::vector<byte4> pixelsBase(dims.x * dims.y, byte4(0, 0, 0, 255));
+			std::vector<byte> channelResized;
+			for (int iChannel = 0; iChannel < channelCount; ++iChannel)
+			{
+				const byte * pChannel = &channels[iChannel][0];
+				if (any(channelDims[iChannel] != dims))
+				{
+					channelResized.resize(dims.x * dims.y);
+					CHECK_ERR(stbir_resize_uint8(
+								pChannel, channelDims[iChannel].x, channelDims[iChannel].y, 0,
+								&channelResized[0], dims.x, dims.y, 0,
+								1));
+					pChannel = &channelResized[0];
+				}
+				for (int i = 0, c = dims.x * dims.y; i < c; ++i)
+					pixelsBase[i][iChannel] = pChannel[i];
+			}
+
+			// Drop top mips for the material lib's max dimension and mip bias
+			if (int mipsToDrop = CalculateMipsToDrop(pACIMtl, dims))
+			{
+				std::vector<byte4> pixelsSmall;
+				DownsamplePixelsToMip(&pixelsBase[0], dims, mipsToDrop, false, &pixelsSmall);
+				pixelsBase.swap(pixelsSmall);
+				dims = CalculateMipDims(dims, mipsToDrop);
+			}
+
+			// Fill out the metadata struct
+			int mipLevels = log2_floor(maxComponent(dims)) + 1;
+			Meta meta =
+			{
+				dims,
+				mipLevels,
+				ChoosePackedFormat(channelCount, pACIMtl->m_flags, dims),
+			};
+			BCQUALITY quality = (pACIMtl->m_flags & ACF_TextureHighQuality) ? BCQUALITY_High : BCQUALITY_Fast;
+
+			// Store the metadata and the base level pixels
+			if (!pSinkOut->WriteAssetData(assetPath, s_suffixMeta, &meta, sizeof(meta)) ||
+				!WriteImageToSink(assetPath, 0, &pixelsBase[0], dims, meta.m_format, quality, pSinkOut))
+			{
+				return false;
+			}
+
+			// Generate mip levels, each from the previous one, all in linear space
+			std::vector<float4> linearPrev(dims.x * dims.y);
+			std::vector<float4> linearMip;
+			std::vector<byte4> pixelsMip;
+			ConvertPixelsToLinear(&pixelsBase[0], dims, false, &linearPrev[0]);
+			int2 dimsPrev = dims;
+			for (int level = 1; level < mipLevels; ++level)
+			{
+				int2 dimsMip = CalculateMipDims(dims, level);
+				linearMip.resize(dimsMip.x * dimsMip.y);
+				pixelsMip.resize(dimsMip.x * dimsMip.y);
+
+				DownsampleLinear(&linearPrev[0], dimsPrev, s_mipFilter, &linearMip[0], dimsMip);
+				ConvertLinearToPixels(&linearMip[0], dimsMip, false, &pixelsMip[0]);
+
+				if (!WriteImageToSink(assetPath, level, &pixelsMip[0], dimsMip, meta.m_format, quality, pSinkOut))
+					return false;
+
+				linearPrev.swap(linearMip);
+				dimsPrev = dimsMip;
+			}
+
+			return true;
+		}
+
+		DXGI_FORMAT ChoosePackedFormat(
+			int channelCount,
+			int flags,
+			int2 dims)
+		{
+			ASSERT_ERR(channelCount > 0 && channelCount <= 3);
+			ASSERT_ERR(all(dims > 0));
+
+			// Packed channels are always linear, and alpha is unused, so BC1 can hold three
+			if ((flags & ACF_TextureCompress) && dims.x % 4 == 0 && dims.y % 4 == 0)
+			{
+				switch (channelCount)
+				{
+				case 1:		return DXGI_FORMAT_BC4_UNORM;
+				case 2:		return DXGI_FORMAT_BC5_UNORM;
+				default:	return (flags & ACF_TextureHighQuality) ? DXGI_FORMAT_BC7_UNORM : DXGI_FORMAT_BC1_UNORM;
+				}
+			}
+
+			return DXGI_FORMAT_R8G8B8A8_UNORM;
+		}
+
+		int CalculateMipsToDrop(
+			const AssetCompileInfo * pACI,
+			int2 dims)
+		{
+			ASSERT_ERR(pACI);
+			ASSERT_ERR(pACI->m_maxDim >= 0);
+			ASSERT_ERR(pACI->m_mipBias >= 0);
+
+			// Drop mips until the top one fits in the max dimension, then the bias on top of
+			// that, but always keep the 1x1 mip
+			int mipsToDrop = 0;
+			if (pACI->m_maxDim > 0)
+			{
+				while (maxComponent(CalculateMipDims(dims, mipsToDrop)) > pACI->m_maxDim)
+					++mipsToDrop;
+			}
+			mipsToDrop += pACI->m_mipBias;
+			return min(mipsToDrop, log2_floor(maxComponent(dims)));
+		}
+
+		void DownsamplePixelsToMip(
+			const byte4 * pPixels,
+			int2 dims,
+			int level,
+			bool isSRGB,
+			std::vector<byte4> * pPixelsOut)
+		{
+			ASSERT_ERR(pPixels);
+			ASSERT_ERR(level > 0);
+			ASSERT_ERR(pPixelsOut);
+
+			// Same cascade as the mip chain, but only the last level is kept
+			std::vector<float4> linearPrev(dims.x * dims.y);
+			std::vector<float4> linearMip;
+			ConvertPixelsToLinear(pPixels, dims, isSRGB, &linearPrev[0]);
+			int2 dimsPrev = dims;
+			for (int i = 1; i <= level; ++i)
+			{
+				int2 dimsMip = CalculateMipDims(dims, i);
+				linearMip.resize(dimsMip.x * dimsMip.y);
+				DownsampleLinear(&linearPrev[0], dimsPrev, s_mipFilter, &linearMip[0], dimsMip);
+				linearPrev.swap(linearMip);
+				dimsPrev = dimsMip;
+			}
+
+			pPixelsOut->resize(dimsPrev.x * dimsPrev.y);
+			ConvertLinearToPixels(&linearPrev[0], dimsPrev, isSRGB, &(*pPixelsOut)[0]);
+		}
+
+		bool IsFloatSource(const AssetCompileInfo * pACI)
+		{
+			ASSERT_ERR(pACI);
+			return (pACI->m_flags & ACF_TextureHDR) || stbi_is_hdr(pACI->m_pathSrc);
+		}
+
+		bool CompileFloatTexture(
+			const AssetCompileInfo * pACI,
+			bool withMips,
+			AssetCompiler::AssetSink * pSinkOut)
+		{
+			ASSERT_ERR(pACI);
+			ASSERT_ERR(pACI->m_pathSrc);
+			ASSERT_ERR(pSinkOut);
+
+			using namespace AssetCompiler;
+
+			if (pACI->m_flags & (ACF_TextureMask | ACF_TextureNormalMap))
+				WARN("Texture %s is HDR; ignoring mask/normal map flags", pACI->m_pathSrc);
+
+			// Load the image as float.  LDR sources get converted to linear by stb_image.
+			int2 dims;
+			int numComponents;
+			float4 * pLinear = (float4 *)stbi_loadf(pACI->m_pathSrc, &dims.x, &dims.y, &numComponents, 4);
+			if (!pLinear)
+			{
+				WARN("Couldn't load file %s: %s", pACI->m_pathSrc, stbi_failure_reason());
+				return false;
+			}
+			std::vector<float4> linearPrev(pLinear, pLinear + dims.x * dims.y);
+			stbi_image_free(pLinear);
+
+			// Resample the base mip up to pow2 if requested, as for LDR textures
+			if (withMips && (pACI->m_flags & ACF_TexturePow2) && (!ispow2(dims.x) || !ispow2(dims.y)))
+			{
+				int2 dimsBase = { pow2_ceil(dims.x), pow2_ceil(dims.y) };
+				std::vector<float4> linearBase(dimsBase.x * dimsBase.y);
+				CHECK_ERR(stbir_resize_float(
+							&linearPrev[0].x, dims.x, dims.y, 0,
+							&linearBase[0].x, dimsBase.x, dimsBase.y, 0,
+							4));
+				linearPrev.swap(linearBase);
+				dims = dimsBase;
+			}
+
+			// Drop top mips for the asset's max dimension and mip bias
+			int mipsToDrop = CalculateMipsToDrop(pACI, dims);
+			for (int i = 0; i < mipsToDrop; ++i)
+			{
+				int2 dimsMip = CalculateMipDims(dims, 1);
+				std::vector<float4> linearMip(dimsMip.x * dimsMip.y);
+				DownsampleLinear(&linearPrev[0], dims, s_mipFilter, &linearMip[0], dimsMip, FLT_MAX);
+				linearPrev.swap(linearMip);
+				dims = dimsMip;
+			}
+
+			// Fill out the metadata struct.  There's no BC6H encoder yet, so "compressed" HDR
+			// textures use R11G11B10_FLOAT, which is half the size but drops alpha.
+			Meta meta =
+			{
+				dims,
+				withMips ? log2_floor(maxComponent(dims)) + 1 : 1,
+				(pACI->m_flags & ACF_TextureCompress) ? DXGI_FORMAT_R11G11B10_FLOAT : DXGI_FORMAT_R16G16B16A16_FLOAT,
+			};
+
+			// Store the metadata and the base level pixels
+			if (!pSinkOut->WriteAssetData(pACI->m_pathSrc, s_suffixMeta, &meta, sizeof(meta)) ||
+				!WriteFloatImageToSink(pACI->m_pathSrc, 0, &linearPrev[0], dims, meta.m_format, pSinkOut))
+			{
+				return false;
+			}
+
+			// Generate mip levels, each from the previous one.  Values are only clamped to
+			// be non-negative, as the Kaiser kernel can overshoot.
+			std::vector<float4> linearMip;
+			int2 dimsPrev = dims;
+			for (int level = 1; level < meta.m_mipLevels; ++level)
+			{
+				int2 dimsMip = CalculateMipDims(dims, level);
+				linearMip.resize(dimsMip.x * dimsMip.y);
+
+				DownsampleLinear(&linearPrev[0], dimsPrev, s_mipFilter, &linearMip[0], dimsMip, FLT_MAX);
+
+				if (!WriteFloatImageToSink(pACI->m_pathSrc, level, &linearMip[0], dimsMip, meta.m_format, pSinkOut))
+					return false;
+
+				linearPrev.swap(linearMip);
+				dimsPrev = dimsMip;
+			}
+
+			return true;
+		}
+
+		float3 CubeTexelDirection(int face, float2 st)
+		{
+			ASSERT_ERR(face >= 0 && face < s_cubeFaceCount);
+
+			// st runs from -1 to 1 across the face, left to right and top to bottom
+			switch (face)
+			{
+			case 0:		return normalize(float3(1.0f, -st.y, -st.x));
+			case 1:		return normalize(float3(-1.0f, -st.y, st.x));
+			case 2:		return normalize(float3(st.x, 1.0f, st.y));
+			case 3:		return normalize(float3(st.x, -1.0f, -st.y));
+			case 4:		return normalize(float3(st.x, -st.y, 1.0f));
+			default:	return normalize(float3(-st.x, -st.y, -1.0f));
+			}
+		}
+
+		void DirectionToCubeTexel(float3 dir, int * pFaceOut, float2 * pStOut)
+		{
+			ASSERT_ERR(pFaceOut);
+			ASSERT_ERR(pStOut);
+
+			// Pick the face by the major axis, then project onto it
+			float3 a = abs(dir);
+			if (a.x >= a.y && a.x >= a.z)
+			{
+				*pFaceOut = (dir.x > 0.0f) ? 0 : 1;
+				*pStOut = float2((dir.x > 0.0f) ? -dir.z : dir.z, -dir.y) / a.x;
+			}
+			else if (a.y >= a.z)
+			{
+				*pFaceOut = (dir.y > 0.0f) ? 2 : 3;
+				*pStOut = float2(dir.x, (dir.y > 0.0f) ? dir.z : -dir.z) / a.y;
+			}
+			else
+			{
+				*pFaceOut = (dir.z > 0.0f) ? 4 : 5;
+				*pStOut = float2((dir.z > 0.0f) ? dir.x : -dir.x, -dir.y) / a.z;
+			}
+		}
+
+		float4 SampleCubeBilinear(const CubeLevel & level, float3 dir)
+		{
+			int face;
+			float2 st;
+			DirectionToCubeTexel(dir, &face, &st);
+
+			// Filtering is clamped within the face; it doesn't reach across seams
+			float2 pos = (st * 0.5f + 0.5f) * float(level.m_size) - 0.5f;
+			int2 posFloor = int2(int(floorf(pos.x)), int(floorf(pos.y)));
+			float2 frac = pos - float2(float(posFloor.x), float(posFloor.y));
+			int x0 = clamp(posFloor.x, 0, level.m_size - 1), x1 = clamp(posFloor.x + 1, 0, level.m_size - 1);
+			int y0 = clamp(posFloor.y, 0, level.m_size - 1), y1 = clamp(posFloor.y + 1, 0, level.m_size - 1);
+
+			const float4 * pFace = &level.m_faces[face][0];
+			float4 top = lerp(pFace[y0 * level.m_size + x0], pFace[y0 * level.m_size + x1], frac.x);
+			float4 bottom = lerp(pFace[y1 * level.m_size + x0], pFace[y1 * level.m_size + x1], frac.x);
+			return lerp(top, bottom, frac.y);
+		}
+
+		bool LoadCubeFaces(const char * path, CubeLevel * pLevelOut)
+		{
+			ASSERT_ERR(path);
+			ASSERT_ERR(pLevelOut);
+
+			int2 dims;
+			int numComponents;
+			float4 * pLinear = (float4 *)stbi_loadf(path, &dims.x, &dims.y, &numComponents, 4);
+			if (!pLinear)
+			{
+				WARN("Couldn't load file %s: %s", path, stbi_failure_reason());
+				return false;
+			}
+
+			// Face positions in a horizontal cross, in units of the face size
+			static const int2 s_crossOffsets[s_cubeFaceCount] =
+			{
+				int2(2, 1), int2(0, 1), int2(1, 0), int2(1, 2), int2(1, 1), int2(3, 1),
+			};
+
+			bool isEquirect = (dims.x == 2 * dims.y);
+			bool isHCross = (dims.x * 3 == dims.y * 4);
+			bool isVCross = (dims.x * 4 == dims.y * 3);
+			if (!isEquirect && !isHCross && !isVCross)
+			{
+				WARN("Cubemap %s is %dx%d; expected 2:1 equirect, or a 4:3 or 3:4 cross", path, dims.x, dims.y);
+				stbi_image_free(pLinear);
+				return false;
+			}
+
+			int cubeSize = isVCross ? dims.x / 3 : dims.x / 4;
+			pLevelOut->m_size = cubeSize;
+			for (int face = 0; face < s_cubeFaceCount; ++face)
+				pLevelOut->m_faces[face].resize(cubeSize * cubeSize);
+
+			AssetCompiler::ParallelFor(s_cubeFaceCount * cubeSize, RowsPerTask(cubeSize), [=](int rowStart, int rowEnd)
+			{
+				for (int row = rowStart; row < rowEnd; ++row)
+				{
+					int face = row / cubeSize;
+					int y = row % cubeSize;
+					float4 * pRowDst = &pLevelOut->m_faces[face][y * cubeSize];
+					for (int x = 0; x < cubeSize; ++x)
+					{
+						if (isEquirect)
+						{
+							// Average a 2x2 grid of samples per texel, to cut down on aliasing
+							float4 sum = float4(0.0f);
+							for (int j = 0; j < 4; ++j)
+							{
+								float2 st = float2(
+												(float(x) + 0.25f + 0.5f * float(j & 1)) / float(cubeSize),
+												(float(y) + 0.25f + 0.5f * float(j >> 1)) / float(cubeSize)) * 2.0f - 1.0f;
+								float3 dir = CubeTexelDirection(face, st);
+								float u = atan2f(dir.x, -dir.z) * (0.5f / 3.14159265f) + 0.5f;
+								float v = acosf(clamp(dir.y, -1.0f, 1.0f)) * (1.0f / 3.14159265f);
+
+								// Bilinear, wrapping horizontally and clamping vertically
+								float2 pos = float2(u * float(dims.x), v * float(dims.y)) - 0.5f;
+								int2 posFloor = int2(int(floorf(pos.x)), int(floorf(pos.y)));
+								float2 frac = pos - float2(float(posFloor.x), float(posFloor.y));
+								int x0 = (posFloor.x % dims.x + dims.x) % dims.x, x1 = (x0 + 1) % dims.x;
+								int y0 = clamp(posFloor.y, 0, dims.y - 1), y1 = clamp(posFloor.y + 1, 0, dims.y - 1);
+								float4 top = lerp(pLinear[y0 * dims.x + x0], pLinear[y0 * dims.x + x1], frac.x);
+								float4 bottom = lerp(pLinear[y1 * dims.x + x0], pLinear[y1 * dims.x + x1], frac.x);
+								sum += lerp(top, bottom, frac.y);
+							}
+							pRowDst[x] = sum * 0.25f;
+						}
+						else
+						{
+							// A vertical cross is the same, except -Z sits below -Y, upside down
+							int2 posSrc = s_crossOffsets[face] * cubeSize + int2(x, y);
+							if (isVCross && face == 5)
+								posSrc = int2(cubeSize, 3 * cubeSize) + int2(cubeSize - 1 - x, cubeSize - 1 - y);
+							pRowDst[x] = pLinear[posSrc.y * dims.x + posSrc.x];
+						}
+					}
+				}
+			});
+
+			stbi_image_free(pLinear);
+			return true;
+		}
+
+		// Hammersley point set, for low-discrepancy importance sampling
+		static float2 Hammersley(uint i, uint count)
+		{
+			uint bits = i;
+			bits = (bits << 16) | (bits >> 16);
+			bits = ((bits & 0x55555555u) << 1) | ((bits & 0xaaaaaaaau) >> 1);
+			bits = ((bits & 0x33333333u) << 2) | ((bits & 0xccccccccu) >> 2);
+			bits = ((bits & 0x0f0f0f0fu) << 4) | ((bits & 0xf0f0f0f0u) >> 4);
+			bits = ((bits & 0x00ff00ffu) << 8) | ((bits & 0xff00ff00u) >> 8);
+			return float2(float(i) / float(count), float(bits) * 2.3283064365386963e-10f);
+		}
+
+		void PrefilterCubeGGX(
+			const std::vector<CubeLevel> & radiance,
+			float roughness,
+			CubeLevel * pLevelOut)
+		{
+			ASSERT_ERR(!radiance.empty());
+			ASSERT_ERR(roughness > 0.0f && roughness <= 1.0f);
+			ASSERT_ERR(pLevelOut);
+			ASSERT_ERR(pLevelOut->m_size > 0);
+
+			// With the usual assumption that N = V = R, the sample directions relative to N are
+			// the same for every texel, so they're worked out once.  Each one reads the mip of
+			// the environment whose texels match its share of solid angle.
+			struct Sample
+			{
+				float3	m_dir;			// In tangent space, around +Z
+				float	m_weight;		// N.L
+				float	m_lod;
+			};
+			std::vector<Sample> samples;
+			samples.reserve(s_ggxSampleCount);
+
+			float alpha = roughness * roughness;
+			float alphaSq = alpha * alpha;
+			float solidAngleTexel = 4.0f * 3.14159265f / (6.0f * float(square(radiance[0].m_size)));
+			float lodMax = float(radiance.size() - 1);
+			for (int i = 0; i < s_ggxSampleCount; ++i)
+			{
+				float2 xi = Hammersley(uint(i), uint(s_ggxSampleCount));
+				float phi = 2.0f * 3.14159265f * xi.x;
+				float cosTheta = sqrtf((1.0f - xi.y) / (1.0f + (alphaSq - 1.0f) * xi.y));
+				float sinTheta = sqrtf(1.0f - cosTheta * cosTheta);
+				float3 h = float3(sinTheta * cosf(phi), sinTheta * sinf(phi), cosTheta);
+
+				// Reflect V = +Z about H
+				float3 l = float3(2.0f * cosTheta * h.x, 2.0f * cosTheta * h.y, 2.0f * cosTheta * cosTheta - 1.0f);
+				if (l.z <= 0.0f)
+					continue;
+
+				// pdf of L is D * N.H / (4 * V.H), which is D / 4 when N = V
+				float d = alphaSq / (3.14159265f * square(cosTheta * cosTheta * (alphaSq - 1.0f) + 1.0f));
+				float solidAngleSample = 1.0f / (float(s_ggxSampleCount) * d * 0.25f + 1e-6f);
+				float lod = clamp(0.5f * log2f(solidAngleSample / solidAngleTexel) + 1.0f, 0.0f, lodMax);
+
+				Sample sample = { l, l.z, lod };
+				samples.push_back(sample);
+			}
+
+			const Sample * pSamples = &samples[0];
+			int sampleCount = int(samples.size());
+			int size = pLevelOut->m_size;
+			for (int face = 0; face < s_cubeFaceCount; ++face)
+				pLevelOut->m_faces[face].resize(size * size);
+
+			// Split across faces and rows together, so small levels still use all the threads
+			AssetCompiler::ParallelFor(s_cubeFaceCount * size, max(1, RowsPerTask(size * sampleCount)), [=, &radiance](int rowStart, int rowEnd)
+			{
+				for (int row = rowStart; row < rowEnd; ++row)
+				{
+					int face = row / size;
+					int y = row % size;
+					float4 * pRowDst = &pLevelOut->m_faces[face][y * size];
+					for (int x = 0; x < size; ++x)
+					{
+						float2 st = float2((float(x) + 0.5f) / float(size), (float(y) + 0.5f) / float(size)) * 2.0f - 1.0f;
+						float3 n = CubeTexelDirection(face, st);
+						float3 up = (fabsf(n.z) < 0.999f) ? float3(0.0f, 0.0f, 1.0f) : float3(1.0f, 0.0f, 0.0f);
+						float3 t = normalize(cross(up, n));
+						float3 b = cross(n, t);
+
+						float4 sum = float4(0.0f);
+						float weightSum = 0.0f;
+						for (int i = 0; i < sampleCount; ++i)
+						{
+							const Sample & sample = pSamples[i];
+							float3 l = t * sample.m_dir.x + b * sample.m_dir.y + n * sample.m_dir.z;
+
+							// Trilinear between the two nearest mips
+							int lod0 = int(sample.m_lod);
+							int lod1 = min(lod0 + 1, int(radiance.size()) - 1);
+							float4 value = lerp(
+											SampleCubeBilinear(radiance[lod0], l),
+											SampleCubeBilinear(radiance[lod1], l),
+											sample.m_lod - float(lod0));
+
+							sum += value * sample.m_weight;
+							weightSum += sample.m_weight;
+						}
+						pRowDst[x] = sum / weightSum;
+					}
+				}
+			});
+		}
+
+		void ProjectCubeToSH9(
+			const CubeLevel & level,
+			rgb * aSH9Out)
+		{
+			ASSERT_ERR(level.m_size > 0);
+			ASSERT_ERR(aSH9Out);
+
+			// Accumulate per row, then sum the rows, so the threads don't have to share
+			int size = level.m_size;
+			std::vector<rgb> rowSums(s_cubeFaceCount * size * 9, rgb(0.0f));
+			std::vector<float> rowWeights(s_cubeFaceCount * size, 0.0f);
+			rgb * pRowSums = &rowSums[0];
+			float * pRowWeights = &rowWeights[0];
+
+			AssetCompiler::ParallelFor(s_cubeFaceCount * size, RowsPerTask(size), [=, &level](int rowStart, int rowEnd)
+			{
+				float texelSize = 2.0f / float(size);
+				for (int row = rowStart; row < rowEnd; ++row)
+				{
+					int face = row / size;
+					int y = row % size;
+					rgb * pSums = pRowSums + row * 9;
+					for (int x = 0; x < size; ++x)
+					{
+						float2 st = float2((float(x) + 0.5f) * texelSize - 1.0f, (float(y) + 0.5f) * texelSize - 1.0f);
+						float3 d = CubeTexelDirection(face, st);
+
+						// Solid angle of the texel, projected onto the unit sphere
+						float weight = square(texelSize) / powf(1.0f + dot(st, st), 1.5f);
+						rgb value = level.m_faces[face][y * size + x].xyz * weight;
+
+						pSums[0] += value * 0.282095f;
+						pSums[1] += value * (0.488603f * d.y);
+						pSums[2] += value * (0.488603f * d.z);
+						pSums[3] += value * (0.488603f * d.x);
+						pSums[4] += value * (1.092548f * d.x * d.y);
+						pSums[5] += value * (1.092548f * d.y * d.z);
+						pSums[6] += value * (0.315392f * (3.0f * d.z * d.z - 1.0f));
+						pSums[7] += value * (1.092548f * d.x * d.z);
+						pSums[8] += value * (0.546274f * (d.x * d.x - d.y * d.y));
+						pRowWeights[row] += weight;
+					}
+				}
+			});
+
+			rgb sums[9] = {};
+			float weightSum = 0.0f;
+			for (int row = 0, c = s_cubeFaceCount * size; row < c; ++row)
+			{
+				for (int i = 0; i < 9; ++i)
+					sums[i] += rowSums[row * 9 + i];
+				weightSum += rowWeights[row];
+			}
+
+			// Normalize the solid angles to sum to exactly 4*pi, then convolve with the clamped
+			// cosine lobe, giving irradiance
+			static const float s_bandScales[9] =
+			{
+				3.14159265f,
+				2.09439510f, 2.09439510f, 2.09439510f,
+				0.78539816f, 0.78539816f, 0.78539816f, 0.78539816f, 0.78539816f,
+			};
+			float normalize = 4.0f * 3.14159265f / weightSum;
+			for (int i = 0; i < 9; ++i)
+				aSH9Out[i] = sums[i] * (normalize * s_bandScales[i]);
+		}
+
+		void DownsampleVolume(
+			const float4 * pSrc,
+			int3 dimsSrc,
+			MIPFILTER filter,
+			float4 * pDst,
+			int3 dimsDst,
+			float maxValue)
+		{
+			ASSERT_ERR(pSrc);
+			ASSERT_ERR(all(dimsSrc > 0));
+			ASSERT_ERR(pDst);
+			ASSERT_ERR(all(dimsDst > 0));
+
+			// Filter each slice in 2D, then combine slices with a box filter
+			int sliceSizeSrc = dimsSrc.x * dimsSrc.y;
+			int sliceSizeDst = dimsDst.x * dimsDst.y;
+			std::vector<float4> temp(sliceSizeDst * dimsSrc.z);
+			for (int z = 0; z < dimsSrc.z; ++z)
+			{
+				DownsampleLinear(
+					pSrc + z * sliceSizeSrc, int2(dimsSrc.x, dimsSrc.y), filter,
+					&temp[z * sliceSizeDst], int2(dimsDst.x, dimsDst.y), maxValue);
+			}
+
+			std::vector<MipTaps> tapsZ;
+			CalculateMipTaps(dimsSrc.z, dimsDst.z, MIPFILTER_Box, &tapsZ);
+			for (int z = 0; z < dimsDst.z; ++z)
+			{
+				const MipTaps & taps = tapsZ[z];
+				float4 * pSliceDst = pDst + z * sliceSizeDst;
+				for (int i = 0; i < sliceSizeDst; ++i)
+				{
+					float4 sum = float4(0.0f);
+					for (int k = 0; k < taps.m_tapCount; ++k)
+						sum += temp[taps.m_aiSrc[k] * sliceSizeDst + i] * taps.m_weights[k];
+					pSliceDst[i] = sum;
+				}
+			}
+		}
+
+		DXGI_FORMAT ChooseFormat(
+			const AssetCompileInfo * pACI,
+			const byte4 * pPixels,
+			int2 dims,
+			int2 dimsStored)
+		{
+			ASSERT_ERR(pACI);
+			ASSERT_ERR(pPixels);
+			ASSERT_ERR(all(dims > 0));
+			ASSERT_ERR(all(dimsStored > 0));
+
+			int flags = pACI->m_flags;
+			if ((flags & ACF_TextureMask) && (flags & ACF_TextureNormalMap))
+			{
+				WARN("Texture %s is flagged as both a mask and a normal map; treating it as a normal map", pACI->m_pathSrc);
+				flags &= ~ACF_TextureMask;
+			}
+			bool isSRGB = !(flags & (ACF_TextureMask | ACF_TextureNormalMap));
+
+			if (flags & ACF_TextureCompress)
+			{
+				// The largest image stored (the top level, or a tile) has to be made of whole blocks
+				if (dimsStored.x % 4 != 0 || dimsStored.y % 4 != 0)
+				{
+					WARN("Texture %s is %dx%d, not a multiple of 4; storing it uncompressed", pACI->m_pathSrc, dimsStored.x, dimsStored.y);
+				}
+				else if (flags & ACF_TextureMask)
+				{
+					return DXGI_FORMAT_BC4_UNORM;
+				}
+				else if (flags & ACF_TextureNormalMap)
+				{
+					return DXGI_FORMAT_BC5_UNORM;
+				}
+				else if (flags & ACF_TextureHighQuality)
+				{
+					return DXGI_FORMAT_BC7_UNORM_SRGB;
+				}
+				else
+				{
+					// Use BC1 if the image is fully opaque, otherwise BC3 to keep the alpha
+					for (int i = 0, c = dims.x * dims.y; i < c; ++i)
+					{
+						if (pPixels[i].w != 255)
+							return DXGI_FORMAT_BC3_UNORM_SRGB;
+					}
+					return DXGI_FORMAT_BC1_UNORM_SRGB;
+				}
+			}
+
+			return isSRGB ? DXGI_FORMAT_R8G8B8A8_UNORM_SRGB : DXGI_FORMAT_R8G8B8A8_UNORM;
+		}
+
+		bool WriteImageToSink(
+			const char * assetPath,
+			int mipLevel,
+			const byte4 * pPixels,
+			int2 dims,
+			DXGI_FORMAT format,
+			BCQUALITY quality,
+			AssetCompiler::AssetSink * pSinkOut)
+		{
+			ASSERT_ERR(assetPath);
+			ASSERT_ERR(mipLevel >= 0);
+			ASSERT_ERR(pPixels);
+			ASSERT_ERR(all(dims > 0));
+			ASSERT_ERR(pSinkOut);
+
+			// Compose the suffix
+			char suffix[16] = {};
+			sprintf_s(suffix, "/%d", mipLevel);
+
+#if WRITE_BMP
+			// Write a .bmp version of it, too, if we're doing that
+			if (!WriteBMPToSink(assetPath, mipLevel, pPixels, dims, pSinkOut))
+				return false;
+#endif
+
+			return WriteImageDataToSink(assetPath, suffix, pPixels, dims, format, quality, pSinkOut);
+		}
+
+		bool WriteImageDataToSink(
+			const char * assetPath,
+			const char * suffix,
+			const byte4 * pPixels,
+			int2 dims,
+			DXGI_FORMAT format,
+			BCQUALITY quality,
+			AssetCompiler::AssetSink * pSinkOut)
+		{
+			ASSERT_ERR(assetPath);
+			ASSERT_ERR(suffix);
+			ASSERT_ERR(pPixels);
+			ASSERT_ERR(all(dims > 0));
+			ASSERT_ERR(pSinkOut);
+
+			// Write it to the pack, compressing it first if necessary
+			if (!IsSupportedBCFormat(format))
+			{
+				ASSERT_ERR(BitsPerPixel(format) == 8 * sizeof(byte4));
+				return pSinkOut->WriteImageRows(assetPath, suffix, pPixels, dims, sizeof(byte4));
+			}
+
+#if LOG_BC_STATS
+			LARGE_INTEGER freq, timeStart, timeEnd;
+			QueryPerformanceFrequency(&freq);
+			QueryPerformanceCounter(&timeStart);
+#endif
+
+			std::vector<byte> blocks;
+			CompressImageBC(pPixels, dims, format, quality, &blocks);
+			ASSERT_ERR(int(blocks.size()) == CalculateMipSizeInBytes(dims, 0, format));
+
+#if LOG_BC_STATS
+			QueryPerformanceCounter(&timeEnd);
+			{
+				float seconds = float(timeEnd.QuadPart - timeStart.QuadPart) / float(freq.QuadPart);
+				int numChannels = (format == DXGI_FORMAT_BC4_UNORM) ? 1 :
+								  (format == DXGI_FORMAT_BC5_UNORM) ? 2 :
+								  (format == DXGI_FORMAT_BC1_UNORM_SRGB) ? 3 : 4;
+				std::vector<byte4> decoded;
+				DecompressImageBC(&blocks[0], dims, format, &decoded);
+				LOG("%s%s: %s, %dx%d in %0.2f ms (%0.1f Mpix/s), PSNR %0.2f dB",
+					assetPath, suffix, NameOfFormat(format), dims.x, dims.y,
+					seconds * 1000.0f, float(dims.x * dims.y) * 1e-6f / max(seconds, 1e-9f),
+					CalculatePSNR(pPixels, &decoded[0], dims, numChannels));
+			}
+#endif
+
+			return pSinkOut->WriteAssetData(assetPath, suffix, &blocks[0], blocks.size());
+		}
+
+		bool WriteFloatImageToSink(
+			const char * assetPath,
+			int mipLevel,
+			const float4 * pLinear,
+			int2 dims,
+			DXGI_FORMAT format,
+			AssetCompiler::AssetSink * pSinkOut)
+		{
+			ASSERT_ERR(assetPath);
+			ASSERT_ERR(mipLevel >= 0);
+			ASSERT_ERR(pLinear);
+			ASSERT_ERR(all(dims > 0));
+			ASSERT_ERR(pSinkOut);
+
+			// Compose the suffix
+			char suffix[16] = {};
+			sprintf_s(suffix, "/%d", mipLevel);
+
+			return WriteFloatImageDataToSink(assetPath, suffix, pLinear, dims, format, pSinkOut);
+		}
+
+		bool WriteFloatImageDataToSink(
+			const char * assetPath,
+			const char * suffix,
+			const float4 * pLinear,
+			int2 dims,
+			DXGI_FORMAT format,
+			AssetCompiler::AssetSink * pSinkOut)
+		{
+			ASSERT_ERR(assetPath);
+			ASSERT_ERR(suffix);
+			ASSERT_ERR(pLinear);
+			ASSERT_ERR(all(dims > 0));
+			ASSERT_ERR(format == DXGI_FORMAT_R16G16B16A16_FLOAT || format == DXGI_FORMAT_R11G11B10_FLOAT);
+			ASSERT_ERR(pSinkOut);
+
+#if LOG_FLOAT_STATS
+			LARGE_INTEGER freq, timeStart, timeEnd;
+			QueryPerformanceFrequency(&freq);
+			QueryPerformanceCounter(&timeStart);
+#endif
+
+			std::vector<byte> data(CalculateMipSizeInBytes(dims, 0, format));
+			if (format == DXGI_FORMAT_R16G16B16A16_FLOAT)
+				ConvertLinearToHalf(pLinear, dims, (ushort *)&data[0]);
+			else
+				ConvertLinearToR11G11B10(pLinear, dims, (uint *)&data[0]);
+
+#if LOG_FLOAT_STATS
+			QueryPerformanceCounter(&timeEnd);
+			{
+				float seconds = float(timeEnd.QuadPart - timeStart.QuadPart) / float(freq.QuadPart);
+				LOG("%s%s: %s, %dx%d converted in %0.2f ms (%0.1f Mpix/s)%s",
+					assetPath, suffix, NameOfFormat(format), dims.x, dims.y,
+					seconds * 1000.0f, float(dims.x * dims.y) * 1e-6f / max(seconds, 1e-9f),
+					(USE_F16C && format == DXGI_FORMAT_R16G16B16A16_FLOAT) ? ", F16C" : "");
+			}
+#endif
+
+			return pSinkOut->WriteImageRows(assetPath, suffix, &data[0], dims, BitsPerPixel(format) / 8);
+		}
+
+#if WRITE_BMP
+		bool WriteBMPToSink(
+			const char * assetPath,
+			int mipLevel,
+			const byte4 * pPixels,
+			int2 dims,
+			AssetCompiler::AssetSink * pSinkOut)
+		{
+			ASSERT_ERR(assetPath);
+			ASSERT_ERR(mipLevel >= 0);
+			ASSERT_ERR(pPixels);
+			ASSERT_ERR(all(dims > 0));
+			ASSERT_ERR(pSinkOut);
+
+			std::vector<byte> buffer;
+			WriteBMPToMemory(pPixels, dims, &buffer);
+
+			// Compose the suffix
+			char suffix[16] = {};
+			sprintf_s(suffix, "/%d.bmp", mipLevel);
+
+			// Write it to the pack
+			return pSinkOut->WriteAssetData(assetPath, suffix, &buffer[0], buffer.size());
+		}
+#endif // WRITE_BMP
+	}
+
+
+
+	// Load compiled data into a runtime game object
+
+	bool LoadTexture2DFromAssetPack(
+		AssetPack * pPack,
+		const char * path,
+		Texture2D * pTexOut)
+	{
+		ASSERT_ERR(pPack);
+		ASSERT_ERR(path);
+		ASSERT_ERR(pTexOut);
+
+		using namespace TextureCompiler;
+
+		pTexOut->m_pPack = pPack;
+
+		// Look for the metadata in the asset pack
+		Meta * pMeta;
+		i64 metaSize;
+		if (!pPack->LookupFile(path, s_suffixMeta, (void **)&pMeta, &metaSize))
+		{
+			WARN("Couldn't find metadata for texture %s in asset pack %s", path, pPack->m_path.c_str());
+			return false;
+		}
+		if (metaSize != sizeof(Meta))
+		{
+			WARN("Metadata for texture %s in asset pack %s is wrong size, %lld bytes (expected %d)",
+				path, pPack->m_path.c_str(), metaSize, sizeof(Meta));
+			return false;
+		}
+		pTexOut->m_dims = pMeta->m_dims;
+		pTexOut->m_mipLevels = pMeta->m_mipLevels;
+		pTexOut->m_format = pMeta->m_format;
+
+		// Look for the individual mipmaps
+		pTexOut->m_apPixels.resize(pTexOut->m_mipLevels);
+		for (int i = 0; i < pTexOut->m_mipLevels; ++i)
+		{
+			// Compose the suffix
+			char suffix[16] = {};
+			sprintf_s(suffix, "/%d", i);
+
+			i64 pixelsSize;
+			if (!pPack->LookupFile(path, suffix, &pTexOut->m_apPixels[i], &pixelsSize))
+			{
+				WARN("Couldn't find mip level %d of texture %s in asset pack %s", i, path, pPack->m_path.c_str());
+				return false;
+			}
+			int expectedPixelsSize = CalculateMipSizeInBytes(pMeta->m_dims, i, pMeta->m_format);
+			if (pixelsSize != expectedPixelsSize)
+			{
+				WARN("Mip level %d of texture %s in asset pack %s is wrong size, %lld bytes (expected %d)",
+					i, path, pPack->m_path.c_str(), pixelsSize, expectedPixelsSize);
+				return false;
+			}
+		}
+
+		LOG("Loaded %s from asset pack %s - %dx%d, %d mips, %s",
+			path, pPack->m_path.c_str(),
+			pTexOut->m_dims.x, pTexOut->m_dims.y,
+			pTexOut->m_mipLevels, NameOfFormat(pTexOut->m_format));
+
+		return true;
+	}
+
+	bool LoadTextureCubeFromAssetPack(
+		AssetPack * pPack,
+		const char * path,
+		TextureCube * pTexOut,
+		rgb * aIrradianceSH9Out /* = nullptr */)
+	{
+		ASSERT_ERR(pPack);
+		ASSERT_ERR(path);
+		ASSERT_ERR(pTexOut);
+
+		using namespace TextureCompiler;
+
+		pTexOut->m_pPack = pPack;
+
+		// Look for the metadata in the asset pack
+		CubeMeta * pMeta;
+		i64 metaSize;
+		if (!pPack->LookupFile(path, s_suffixCubeMeta, (void **)&pMeta, &metaSize))
+		{
+			WARN("Couldn't find metadata for cubemap %s in asset pack %s", path, pPack->m_path.c_str());
+			return false;
+		}
+		if (metaSize != sizeof(CubeMeta))
+		{
+			WARN("Metadata for cubemap %s in asset pack %s is wrong size, %lld bytes (expected %d)",
+				path, pPack->m_path.c_str(), metaSize, sizeof(CubeMeta));
+			return false;
+		}
+		pTexOut->m_cubeSize = pMeta->m_cubeSize;
+		pTexOut->m_mipLevels = pMeta->m_mipLevels;
+		pTexOut->m_format = pMeta->m_format;
+
+		// Look for the individual faces and mipmaps
+		pTexOut->m_apPixels.resize(s_cubeFaceCount * pTexOut->m_mipLevels);
+		for (int face = 0; face < s_cubeFaceCount; ++face)
+		{
+			for (int level = 0; level < pTexOut->m_mipLevels; ++level)
+			{
+				// Compose the suffix
+				char suffix[16] = {};
+				sprintf_s(suffix, "/%d/%d", face, level);
+
+				i64 pixelsSize;
+				if (!pPack->LookupFile(path, suffix, &pTexOut->m_apPixels[face * pTexOut->m_mipLevels + level], &pixelsSize))
+				{
+					WARN("Couldn't find face %d, mip level %d of cubemap %s in asset pack %s", face, level, path, pPack->m_path.c_str());
+					return false;
+				}
+				int expectedPixelsSize = CalculateMipSizeInBytes(pMeta->m_cubeSize, level, pMeta->m_format);
+				if (pixelsSize != expectedPixelsSize)
+				{
+					WARN("Face %d, mip level %d of cubemap %s in asset pack %s is wrong size, %lld bytes (expected %d)",
+						face, level, path, pPack->m_path.c_str(), pixelsSize, expectedPixelsSize);
+					return false;
+				}
+			}
+		}
+
+		// Look for the irradiance, if wanted
+		if (aIrradianceSH9Out)
+		{
+			rgb * pSH9;
+			i64 sh9Size;
+			if (!pPack->LookupFile(path, s_suffixCubeSH9, (void **)&pSH9, &sh9Size) ||
+				sh9Size != 9 * sizeof(rgb))
+			{
+				WARN("Couldn't find irradiance SH for cubemap %s in asset pack %s", path, pPack->m_path.c_str());
+				return false;
+			}
+			memcpy(aIrradianceSH9Out, pSH9, 9 * sizeof(rgb));
+		}
+
+		LOG("Loaded %s from asset pack %s - %d cube, %d mips, %s",
+			path, pPack->m_path.c_str(),
+			pTexOut->m_cubeSize, pTexOut->m_mipLevels, NameOfFormat(pTexOut->m_format));
+
+		return true;
+	}
+
+	bool LoadTexture3DFromAssetPack(
+		AssetPack * pPack,
+		const char * path,
+		Texture3D * pTexOut)
+	{
+		ASSERT_ERR(pPack);
+		ASSERT_ERR(path);
+		ASSERT_ERR(pTexOut);
+
+		using namespace TextureCompiler;
+
+		pTexOut->m_pPack = pPack;
+
+		// Look for the metadata in the asset pack
+		VolumeMeta * pMeta;
+		i64 metaSize;
+		if (!pPack->LookupFile(path, s_suffixVolumeMeta, (void **)&pMeta, &metaSize))
+		{
+			WARN("Couldn't find metadata for volume texture %s in asset pack %s", path, pPack->m_path.c_str());
+			return false;
+		}
+		if (metaSize != sizeof(VolumeMeta))
+		{
+			WARN("Metadata for volume texture %s in asset pack %s is wrong size, %lld bytes (expected %d)",
+				path, pPack->m_path.c_str(), metaSize, sizeof(VolumeMeta));
+			return false;
+		}
+		pTexOut->m_dims = pMeta->m_dims;
+		pTexOut->m_mipLevels = pMeta->m_mipLevels;
+		pTexOut->m_format = pMeta->m_format;
+
+		// Look for the individual mipmaps
+		pTexOut->m_apPixels.resize(pTexOut->m_mipLevels);
+		for (int i = 0; i < pTexOut->m_mipLevels; ++i)
+		{
+			// Compose the suffix
+			char suffix[16] = {};
+			sprintf_s(suffix, "/%d", i);
+
+			i64 pixelsSize;
+			if (!pPack->LookupFile(path, suffix, &pTexOut->m_apPixels[i], &pixelsSize))
+			{
+				WARN("Couldn't find mip level %d of volume texture %s in asset pack %s", i, path, pPack->m_path.c_str());
+				return false;
+			}
+			int expectedPixelsSize = CalculateMipSizeInBytes(pMeta->m_dims, i, pMeta->m_format);
+			if (pixelsSize != expectedPixelsSize)
+			{
+				WARN("Mip level %d of volume texture %s in asset pack %s is wrong size, %lld bytes (expected %d)",
+					i, path, pPack->m_path.c_str(), pixelsSize, expectedPixelsSize);
+				return false;
+			}
+		}
+
+		LOG("Loaded %s from asset pack %s - %dx%dx%d, %d mips, %s",
+			path, pPack->m_path.c_str(),
+			pTexOut->m_dims.x, pTexOut->m_dims.y, pTexOut->m_dims.z,
+			pTexOut->m_mipLevels, NameOfFormat(pTexOut->m_format));
+
+		return true;
+	}
+
+	bool LoadVirtualTextureFromAssetPack(
+		AssetPack * pPack,
+		const char * path,
+		VirtualTexture * pVTexOut)
+	{
+		ASSERT_ERR(pPack);
+		ASSERT_ERR(path);
+		ASSERT_ERR(pVTexOut);
+
+		using namespace TextureCompiler;
+
+		pVTexOut->m_pPack = pPack;
 
-		if (!AssetCompiler::LoadAssetPackFromZip(&zipRead, pPack))
+		// Look for the metadata in the asset pack
+		VTMeta * pMeta;
+		i64 metaSize;
+		if (!pPack->LookupFile(path, s_suffixVTMeta, (void **)&pMeta, &metaSize))
+		{
+			WARN("Couldn't find metadata for virtual texture %s in asset pack %s", path, pPack->m_path.c_str());
+			return false;
+		}
+		if (metaSize != sizeof(VTMeta))
 		{
-			mz_zip_writer_end(&zipRead);
-			mz_zip_writer_end(&zipWrite);
+			WARN("Metadata for virtual texture %s in asset pack %s is wrong size, %lld bytes (expected %d)",
+				path, pPack->m_path.c_str(), metaSize, sizeof(VTMeta));
 			return false;
 		}
+		VTLayout * pLayout = &pVTexOut->m_layout;
+		pLayout->m_dims = pMeta->m_dims;
+		pLayout->m_mipLevels = pMeta->m_mipLevels;
+		pLayout->m_tileSize = pMeta->m_tileSize;
+		pLayout->m_tileBorder = pMeta->m_tileBorder;
+		pLayout->m_format = pMeta->m_format;
+
+		// Look for the individual tiles
+		int expectedTileSize = CalculateMipSizeInBytes(int2(pLayout->TileSizeWithBorder()), 0, pLayout->m_format);
+		pVTexOut->m_apTiles.resize(pLayout->TotalTileCount());
+		for (int level = 0; level < pLayout->m_mipLevels; ++level)
+		{
+			int2 tileCount = pLayout->TileCount(level);
+			for (int y = 0; y < tileCount.y; ++y)
+			{
+				for (int x = 0; x < tileCount.x; ++x)
+				{
+					// Compose the suffix
+					char suffix[32] = {};
+					sprintf_s(suffix, "/%d/%d_%d", level, x, y);
+
+					void ** ppTile = &pVTexOut->m_apTiles[pLayout->TileIndex(MakeVTileID(level, x, y))];
+					i64 tileSize;
+					if (!pPack->LookupFile(path, suffix, ppTile, &tileSize))
+					{
+						WARN("Couldn't find tile (%d, %d) of mip level %d of virtual texture %s in asset pack %s",
+							x, y, level, path, pPack->m_path.c_str());
+						return false;
+					}
+					if (tileSize != expectedTileSize)
+					{
+						WARN("Tile (%d, %d) of mip level %d of virtual texture %s in asset pack %s is wrong size, %lld bytes (expected %d)",
+							x, y, level, path, pPack->m_path.c_str(), tileSize, expectedTileSize);
+						return false;
+					}
+				}
+			}
+		}
+
+		LOG("Loaded %s from asset pack %s - %dx%d virtual, %d mips, %d tiles, %s",
+			path, pPack->m_path.c_str(),
+			pLayout->m_dims.x, pLayout->m_dims.y,
+			pLayout->m_mipLevels, pLayout->TotalTileCount(), NameOfFormat(pLayout->m_format));
+
+		return true;
+	}
+
+
+
+	// Create a library of all the textures in an asset pack
+
+	bool LoadTextureLibFromAssetPack(
+		AssetPack * pPack,
+		const AssetCompileInfo * assets,
+		int numAssets,
+		TextureLib * pTexLibOut)
+	{
+		ASSERT_ERR(pPack);
+		ASSERT_ERR(assets);
+		ASSERT_ERR(numAssets > 0);
+		ASSERT_ERR(pTexLibOut);
+
+		// Find all the texture assets
+		for (int i = 0; i < numAssets; ++i)
+		{
+			const AssetCompileInfo * pACI = &assets[i];
+			if (pACI->m_ack != ACK_TextureRaw &&
+				pACI->m_ack != ACK_TextureWithMips)
+			{
+				continue;
+			}
+
+			auto iterAndBool = pTexLibOut->m_texs.insert(std::make_pair(std::string(pACI->m_pathSrc), Texture2D()));
+
+			if (!LoadTexture2DFromAssetPack(pPack, pACI->m_pathSrc, &iterAndBool.first->second))
+			{
+				pTexLibOut->m_texs.erase(iterAndBool.first);
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+
+
+	// Helper function for quick and dirty apps - just compile and load a texture in one step.
+	// It's compiled straight into an in-memory pack, with no .zip in between.
+
+	bool LoadTexture2DRaw(
+		const char * path,
+		Texture2D * pTexOut)
+	{
+		ASSERT_ERR(path);
+		ASSERT_ERR(pTexOut);
 
-		mz_zip_writer_end(&zipRead);
-		mz_zip_writer_end(&zipWrite);
+		// Compile the texture to a pack in memory
+		comptr<AssetPack> pPack = new AssetPack;
+		pPack->m_path = "(in memory)";
+		AssetCompileInfo aci = { path, ACK_TextureRaw };
+		if (!AssetCompiler::CompileAssetsToPack(&aci, 1, pPack))
+			return false;
 
-		// And extract the mesh from it
+		// And extract the texture from it
 		return LoadTexture2DFromAssetPack(pPack, path, pTexOut);
 	}
 }
@@ -1,19 +1,25 @@
 #include "framework.h"
 #include "asset-internal.h"
 #include <algorithm>
+#include <thread>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 
+// Enable to log the size of each codec's files when compiling a pack, and how long
+// extracting and decoding take when loading one
+#define LOG_PACK_STATS 0
+
 namespace Framework
 {
 	// AssetPack implementation
 
 	AssetPack::AssetPack()
+	:	m_accessStartTimestamp(0)
 	{
 	}
 
-	bool AssetPack::LookupFile(const char * path, const char * suffix, void ** ppDataOut, int * pSizeOut)
+	bool AssetPack::LookupFile(const char * path, const char * suffix, void ** ppDataOut, i64 * pSizeOut)
 	{
 		ASSERT_ERR(path);
 
@@ -26,10 +32,24 @@ namespace Framework
 			return false;
 
 		int iFile = iter->second;
-		const FileInfo & fileinfo = m_files[iFile];
+		FileInfo & fileinfo = m_files[iFile];
+
+		// Note the first lookup of each file, if recording
+		if (m_accessStartTimestamp != 0 && fileinfo.m_accessTimestamp == 0)
+		{
+			QueryPerformanceCounter((LARGE_INTEGER *)&fileinfo.m_accessTimestamp);
+			m_accessOrder.push_back(iFile);
+		}
 
 		if (ppDataOut)
-			*ppDataOut = (fileinfo.m_size > 0) ? &m_data[fileinfo.m_offset] : nullptr;
+		{
+			if (fileinfo.m_size == 0)
+				*ppDataOut = nullptr;
+			else if (fileinfo.m_pSharedData)
+				*ppDataOut = const_cast<byte *>(fileinfo.m_pSharedData);
+			else
+				*ppDataOut = &m_data[fileinfo.m_offset];
+		}
 		if (pSizeOut)
 			*pSizeOut = fileinfo.m_size;
 
@@ -48,6 +68,71 @@ namespace Framework
 		m_directory.clear();
 		m_manifest.clear();
 		m_path.clear();
+		m_packsShared.clear();
+		m_accessOrder.clear();
+		m_accessStartTimestamp = 0;
+	}
+
+	void AssetPack::StartRecordingAccesses()
+	{
+		for (int i = 0, c = int(m_files.size()); i < c; ++i)
+			m_files[i].m_accessTimestamp = 0;
+		m_accessOrder.clear();
+		QueryPerformanceCounter((LARGE_INTEGER *)&m_accessStartTimestamp);
+	}
+
+	// The profile is a text file with a line per file, in the order they were first looked
+	// up: milliseconds since recording started, a space, then the file's path in the pack.
+	bool AssetPack::SaveAccessProfile(const char * profilePath) const
+	{
+		ASSERT_ERR(profilePath);
+		ASSERT_WARN_MSG(m_accessStartTimestamp != 0, "Saving access profile for asset pack %s, but it isn't recording", m_path.c_str());
+
+		FILE * pFile = nullptr;
+		if (fopen_s(&pFile, profilePath, "wt") != 0 || !pFile)
+		{
+			WARN("Couldn't open %s for writing", profilePath);
+			return false;
+		}
+
+		i64 frequency;
+		QueryPerformanceFrequency((LARGE_INTEGER *)&frequency);
+
+		fprintf(pFile, "# Access profile for asset pack %s: ms since recording started, then path\n", m_path.c_str());
+		for (int i = 0, c = int(m_accessOrder.size()); i < c; ++i)
+		{
+			const FileInfo & fileinfo = m_files[m_accessOrder[i]];
+			double ms = 1000.0 * double(fileinfo.m_accessTimestamp - m_accessStartTimestamp) / double(frequency);
+			fprintf(pFile, "%0.3f %s\n", ms, fileinfo.m_path.c_str());
+		}
+
+		bool success = (ferror(pFile) == 0);
+		fclose(pFile);
+		if (!success)
+		{
+			WARN("Couldn't write access profile %s", profilePath);
+			return false;
+		}
+
+		LOG("Saved access profile for asset pack %s to %s - %d of %d files looked up",
+			m_path.c_str(), profilePath, int(m_accessOrder.size()), int(m_files.size()));
+		return true;
+	}
+
+
+
+	// AssetContentStore implementation
+
+	AssetContentStore::AssetContentStore()
+	:	m_bytesShared(0)
+	{
+	}
+
+	void AssetContentStore::Reset()
+	{
+		m_blobs.clear();
+		m_packs.clear();
+		m_bytesShared = 0;
 	}
 
 
@@ -56,30 +141,66 @@ namespace Framework
 	{
 		static const char * s_pathVersionInfo = "version";
 		static const char * s_pathManifest = "manifest";
+		static const char * s_suffixSettings = "/settings";
+		static const char * s_suffixDeps = "/deps";
+
+		// Settings each asset was compiled with, stored alongside its data so that changing
+		// them makes it out of date
+		struct AssetSettings
+		{
+			ACK		m_ack;
+			int		m_flags;
+			int		m_maxDim;
+			int		m_mipBias;
+		};
 	}
 
 	// Prototype individual compilation functions for different asset types
 
 	bool CompileOBJMeshAsset(
 		const AssetCompileInfo * pACI,
-		mz_zip_archive * pZipOut);
+		AssetCompiler::AssetSink * pSinkOut);
 	bool CompileOBJMtlLibAsset(
 		const AssetCompileInfo * pACI,
-		mz_zip_archive * pZipOut);
+		AssetCompiler::AssetSink * pSinkOut);
 	bool CompileTextureRawAsset(
 		const AssetCompileInfo * pACI,
-		mz_zip_archive * pZipOut);
+		AssetCompiler::AssetSink * pSinkOut);
 	bool CompileTextureWithMipsAsset(
 		const AssetCompileInfo * pACI,
-		mz_zip_archive * pZipOut);
+		AssetCompiler::AssetSink * pSinkOut);
+	bool CompileGLBMeshAsset(
+		const AssetCompileInfo * pACI,
+		AssetCompiler::AssetSink * pSinkOut);
+	bool CompilePLYMeshAsset(
+		const AssetCompileInfo * pACI,
+		AssetCompiler::AssetSink * pSinkOut);
+	bool CompileSceneAsset(
+		const AssetCompileInfo * pACI,
+		AssetCompiler::AssetSink * pSinkOut);
+	bool CompileVirtualTextureAsset(
+		const AssetCompileInfo * pACI,
+		AssetCompiler::AssetSink * pSinkOut);
+	bool CompileTextureCubeAsset(
+		const AssetCompileInfo * pACI,
+		AssetCompiler::AssetSink * pSinkOut);
+	bool CompileTexture3DAsset(
+		const AssetCompileInfo * pACI,
+		AssetCompiler::AssetSink * pSinkOut);
 
-	typedef bool (*AssetCompileFunc)(const AssetCompileInfo *, mz_zip_archive *);
+	typedef bool (*AssetCompileFunc)(const AssetCompileInfo *, AssetCompiler::AssetSink *);
 	static const AssetCompileFunc s_assetCompileFuncs[] =
 	{
 		&CompileOBJMeshAsset,				// ACK_OBJMesh
 		&CompileOBJMtlLibAsset,				// ACK_OBJMtlLib
 		&CompileTextureRawAsset,			// ACK_TextureRaw
 		&CompileTextureWithMipsAsset,		// ACK_TextureWithMips
+		&CompileGLBMeshAsset,				// ACK_GLBMesh
+		&CompilePLYMeshAsset,				// ACK_PLYMesh
+		&CompileSceneAsset,					// ACK_Scene
+		&CompileVirtualTextureAsset,		// ACK_VirtualTexture
+		&CompileTextureCubeAsset,			// ACK_TextureCube
+		&CompileTexture3DAsset,				// ACK_Texture3D
 	};
 	cassert(dim(s_assetCompileFuncs) == ACK_Count);
 
@@ -89,9 +210,33 @@ namespace Framework
 		"OBJ material library",				// ACK_OBJMtlLib
 		"raw texture",						// ACK_TextureRaw
 		"mipmapped texture",				// ACK_TextureWithMips
+		"glTF binary mesh",					// ACK_GLBMesh
+		"PLY binary mesh",					// ACK_PLYMesh
+		"scene",							// ACK_Scene
+		"virtual texture",					// ACK_VirtualTexture
+		"cubemap",							// ACK_TextureCube
+		"volume texture",					// ACK_Texture3D
 	};
 	cassert(dim(s_ackNames) == ACK_Count);
 
+	// Codec for each kind of asset's files.  Auto picks whichever should load fastest, file by
+	// file; anything else forces it for that kind of asset (except for images' pixel data,
+	// which is always row-filtered and deflated).
+	static const AssetCompiler::PACKCODEC s_ackCodecs[] =
+	{
+		AssetCompiler::PACKCODEC_Auto,		// ACK_OBJMesh
+		AssetCompiler::PACKCODEC_Auto,		// ACK_OBJMtlLib
+		AssetCompiler::PACKCODEC_Auto,		// ACK_TextureRaw
+		AssetCompiler::PACKCODEC_Auto,		// ACK_TextureWithMips
+		AssetCompiler::PACKCODEC_Auto,		// ACK_GLBMesh
+		AssetCompiler::PACKCODEC_Auto,		// ACK_PLYMesh
+		AssetCompiler::PACKCODEC_Auto,		// ACK_Scene
+		AssetCompiler::PACKCODEC_Auto,		// ACK_VirtualTexture
+		AssetCompiler::PACKCODEC_Auto,		// ACK_TextureCube
+		AssetCompiler::PACKCODEC_Auto,		// ACK_Texture3D
+	};
+	cassert(dim(s_ackCodecs) == ACK_Count);
+
 
 
 	// Load an asset pack file, checking that all its assets are present and up to date,
@@ -100,56 +245,147 @@ namespace Framework
 		const char * packPath,
 		const AssetCompileInfo * assets,
 		int numAssets,
-		AssetPack * pPackOut)
+		AssetPack * pPackOut,
+		AssetContentStore * pStore /* = nullptr */)
 	{
 		ASSERT_ERR(packPath);
 		ASSERT_ERR(assets);
 		ASSERT_ERR(numAssets > 0);
 		ASSERT_ERR(pPackOut);
 
-		using namespace AssetCompiler;
+		if (!AssetCompiler::CompileAssetPackIfOutOfDate(packPath, assets, numAssets))
+			return false;
+
+		// It ought to exist and be up-to-date now, so load it
+		return LoadAssetPack(packPath, pPackOut, pStore);
+	}
 
-		// Does the asset pack already exist?
-		struct _stat packStat;
-		if (_stat(packPath, &packStat) == 0)
+	// Path of the sibling pack for a profile: the profile name goes before the extension
+	static std::string MakeProfilePackPath(const char * packPath, const AssetProfile * pProfile)
+	{
+		std::string path = packPath;
+		if (!pProfile->m_name || !*pProfile->m_name)
+			return path;
+
+		size_t iSlash = path.find_last_of("/\\");
+		size_t iDot = path.find_last_of('.');
+		if (iDot == std::string::npos || (iSlash != std::string::npos && iDot < iSlash))
+			iDot = path.length();
+		path.insert(iDot, std::string("-") + pProfile->m_name);
+		return path;
+	}
+
+	static void ApplyAssetProfile(
+		const AssetCompileInfo * assets,
+		int numAssets,
+		const AssetProfile * pProfile,
+		std::vector<AssetCompileInfo> * pAssetsOut)
+	{
+		pAssetsOut->assign(assets, assets + numAssets);
+		for (int i = 0; i < numAssets; ++i)
 		{
-			// Check if any assets are out of date
-			std::vector<int> assetsToUpdate;
-			if (!FindOutOfDateAssets(packPath, assets, numAssets, &assetsToUpdate))
-			{
-				LOG("Asset pack %s exists but seems to be corrupt; recompiling it from sources.", packPath);
-				if (!CompileFullAssetPackToFile(packPath, assets, numAssets))
-					return false;
-			}
-			else if (assetsToUpdate.empty())
-			{
-				LOG("Asset pack %s is up to date.", packPath);
-			}
-			else
-			{
-				LOG("Asset pack %s is out of date; updating.", packPath);
-				if (!UpdateAssetPack(packPath, assets, numAssets, assetsToUpdate))
-					return false;
-			}
+			AssetCompileInfo * pACI = &(*pAssetsOut)[i];
+			pACI->m_flags |= pProfile->m_flagsAdd;
+			if (pProfile->m_maxDim > 0)
+				pACI->m_maxDim = (pACI->m_maxDim > 0) ? min(pACI->m_maxDim, pProfile->m_maxDim) : pProfile->m_maxDim;
+			pACI->m_mipBias += pProfile->m_mipBias;
 		}
-		else
+	}
+
+	// Check and compile the pack for each profile, then load the first one whose
+	// uncompressed data fits in the memory budget.
+	bool LoadAssetPackForBudget(
+		const char * packPath,
+		const AssetCompileInfo * assets,
+		int numAssets,
+		const AssetProfile * profiles,
+		int numProfiles,
+		i64 budgetBytes,
+		AssetPack * pPackOut,
+		AssetContentStore * pStore /* = nullptr */)
+	{
+		ASSERT_ERR(packPath);
+		ASSERT_ERR(assets);
+		ASSERT_ERR(numAssets > 0);
+		ASSERT_ERR(profiles);
+		ASSERT_ERR(numProfiles > 0);
+		ASSERT_ERR(pPackOut);
+
+		using namespace AssetCompiler;
+
+		// All the profiles are kept up to date, not just the chosen one, so the same content
+		// build can be shipped to every tier
+		std::vector<AssetCompileInfo> assetsProfile;
+		std::string pathChosen;
+		for (int iProfile = 0; iProfile < numProfiles; ++iProfile)
 		{
-			LOG("Asset pack %s doesn't exist; compiling it from sources.", packPath);
-			if (!CompileFullAssetPackToFile(packPath, assets, numAssets))
+			std::string path = MakeProfilePackPath(packPath, &profiles[iProfile]);
+			ApplyAssetProfile(assets, numAssets, &profiles[iProfile], &assetsProfile);
+			if (!CompileAssetPackIfOutOfDate(path.c_str(), &assetsProfile[0], numAssets))
+				return false;
+
+			i64 bytes;
+			if (!GetAssetPackDataSize(path.c_str(), &bytes))
 				return false;
+
+			if (pathChosen.empty() && (bytes <= budgetBytes || iProfile == numProfiles - 1))
+			{
+				LOG("Chose asset pack %s - %dMB uncompressed, for a budget of %dMB",
+					path.c_str(), int(bytes / 1048576), int(budgetBytes / 1048576));
+				pathChosen = path;
+			}
 		}
 
-		// It ought to exist and be up-to-date now, so load it
-		return LoadAssetPack(packPath, pPackOut);
+		return LoadAssetPack(pathChosen.c_str(), pPackOut, pStore);
+	}
+
+	static PACKINTEGRITY s_packIntegrity = PACKINTEGRITY_Trust;
+
+	void SetAssetPackIntegrity(PACKINTEGRITY integrity)
+	{
+		ASSERT_ERR(integrity >= 0 && integrity < PACKINTEGRITY_Count);
+		s_packIntegrity = integrity;
+	}
+
+	// The stamp for PACKINTEGRITY_VerifyOnChange: the pack's modification time and size
+	static const char * s_suffixVerified = ".verified";
+
+	static bool MakePackStamp(const char * packPath, char (&stampOut)[64])
+	{
+		struct _stat64 packStat;
+		if (_stat64(packPath, &packStat) != 0)
+			return false;
+		sprintf_s(stampOut, "%lld %lld\n", i64(packStat.st_mtime), i64(packStat.st_size));
+		return true;
+	}
+
+	static bool PackStampMatches(const char * stampPath, const char * stamp)
+	{
+		FILE * pFile = nullptr;
+		if (fopen_s(&pFile, stampPath, "rt") != 0 || !pFile)
+			return false;
+		char stampOld[64] = {};
+		bool matches = (fgets(stampOld, int(dim(stampOld)), pFile) && strcmp(stampOld, stamp) == 0);
+		fclose(pFile);
+		return matches;
 	}
 
 	// Just load an asset pack file.
 	bool LoadAssetPack(
 		const char * packPath,
-		AssetPack * pPackOut)
+		AssetPack * pPackOut,
+		AssetContentStore * pStore /* = nullptr */)
 	{
 		ASSERT_ERR(packPath);
 		ASSERT_ERR(pPackOut);
+
+		// Decide whether to check CRCs.  The stamp's taken before loading, so if the pack
+		// changes in the meantime, it'll just be checked again next time.
+		std::string stampPath = std::string(packPath) + s_suffixVerified;
+		char stamp[64] = {};
+		bool verify = (s_packIntegrity == PACKINTEGRITY_VerifyAlways);
+		if (s_packIntegrity == PACKINTEGRITY_VerifyOnChange)
+			verify = !MakePackStamp(packPath, stamp) || !PackStampMatches(stampPath.c_str(), stamp);
 		
 		// Load the archive directory
 		mz_zip_archive zip = {};
@@ -161,7 +397,7 @@ namespace Framework
 
 		pPackOut->m_path = packPath;
 
-		if (!AssetCompiler::LoadAssetPackFromZip(&zip, pPackOut))
+		if (!AssetCompiler::LoadAssetPackFromZip(&zip, pPackOut, pStore, verify))
 		{
 			mz_zip_reader_end(&zip);
 			return false;
@@ -169,182 +405,1422 @@ namespace Framework
 
 		mz_zip_reader_end(&zip);
 
+		if (verify && s_packIntegrity == PACKINTEGRITY_VerifyOnChange && stamp[0])
+		{
+			// Not being able to write the stamp only costs checking it again next time,
+			// so say so once rather than on every load
+			static bool s_warnedStamp = false;
+			FILE * pFile = nullptr;
+			if (fopen_s(&pFile, stampPath.c_str(), "wt") == 0 && pFile)
+			{
+				fputs(stamp, pFile);
+				fclose(pFile);
+			}
+			else if (!s_warnedStamp)
+			{
+				LOG("Couldn't write %s; asset pack %s will be checked again on the next load", stampPath.c_str(), packPath);
+				s_warnedStamp = true;
+			}
+		}
+
 		LOG("Loaded asset pack %s - %dMB uncompressed", packPath, pPackOut->m_data.size() / 1048576);
 		return true;
 	}
 
-
-
-	namespace AssetCompiler
+	// Rewrite an asset pack with its files in the order of an access profile.
+	bool ReorderAssetPack(
+		const char * packPath,
+		const char * profilePath)
 	{
-		// Load an asset pack file from a zip stream (can be in memory or a file).
-		bool LoadAssetPackFromZip(
-			mz_zip_archive * pZip,
-			AssetPack * pPackOut)
-		{
-			ASSERT_ERR(pZip);
-			ASSERT_ERR(pPackOut);
+		ASSERT_ERR(packPath);
+		ASSERT_ERR(profilePath);
 
-			const char * packPath = pPackOut->m_path.c_str();
-		
-			int numFiles = int(mz_zip_reader_get_num_files(pZip));
-			pPackOut->m_files.resize(numFiles);
-			pPackOut->m_directory.clear();
-			pPackOut->m_directory.reserve(numFiles);
+		std::vector<byte> profile;
+		if (!LoadFile(profilePath, &profile, LFK_Text))
+		{
+			WARN("Couldn't load access profile %s", profilePath);
+			return false;
+		}
 
-			// Run through all the files, build the file list and directory and sum up their sizes
-			int bytesTotal = 0;
-			for (int i = 0; i < numFiles; ++i)
+		// Parse out the paths; see AssetPack::SaveAccessProfile for the format.  The lines are
+		// already in access order, so the times aren't needed.
+		std::vector<std::string> pathsInOrder;
+		char * pCur = (char *)&profile[0];
+		for (int iLine = 1; *pCur; ++iLine)
+		{
+			size_t lineLength = strcspn(pCur, "\r\n");
+			char * pNext = pCur + lineLength;
+			if (*pNext == '\r')
+				++pNext;
+			if (*pNext == '\n')
+				++pNext;
+			pCur[lineLength] = 0;
+
+			if (*pCur && *pCur != '#')
 			{
-				mz_zip_archive_file_stat fileStat;
-				if (!mz_zip_reader_file_stat(pZip, i, &fileStat))
+				char * pPath;
+				strtod(pCur, &pPath);
+				if (pPath == pCur || *pPath != ' ' || !pPath[1])
 				{
-					WARN("Couldn't read directory entry %d of %d from asset pack %s", i, numFiles, packPath);
+					WARN("%s(%d): couldn't parse access profile line", profilePath, iLine);
 					return false;
 				}
+				pathsInOrder.push_back(std::string(pPath + 1));
+			}
 
-				AssetPack::FileInfo * pFileInfo = &pPackOut->m_files[i];
-				pFileInfo->m_path = fileStat.m_filename;
-				pFileInfo->m_offset = bytesTotal;
-				pFileInfo->m_size = int(fileStat.m_uncomp_size);
+			pCur = pNext;
+		}
 
-				pPackOut->m_directory.insert(std::make_pair(pFileInfo->m_path, i));
+		return AssetCompiler::RewriteAssetPackInOrder(packPath, pathsInOrder);
+	}
 
-				bytesTotal += int(fileStat.m_uncomp_size);
-			}
 
-			// Allocate memory to store the decompressed data
-			pPackOut->m_data.resize(bytesTotal);
 
-			// Decompress all the files
-			for (int i = 0; i < numFiles; ++i)
+	namespace AssetCompiler
+	{
+		// Check that an asset pack's assets are all present and up to date, and compile
+		// any that aren't (or the whole pack, if it doesn't exist yet).
+		bool CompileAssetPackIfOutOfDate(
+			const char * packPath,
+			const AssetCompileInfo * assets,
+			int numAssets)
+		{
+			ASSERT_ERR(packPath);
+			ASSERT_ERR(assets);
+			ASSERT_ERR(numAssets > 0);
+
+			// Does the asset pack already exist?
+			struct _stat packStat;
+			if (_stat(packPath, &packStat) == 0)
 			{
-				AssetPack::FileInfo * pFileInfo = &pPackOut->m_files[i];
+				// Check if any assets are out of date
+				std::vector<int> assetsToUpdate;
+				if (!FindOutOfDateAssets(packPath, assets, numAssets, &assetsToUpdate))
+				{
+					LOG("Asset pack %s exists but seems to be corrupt; recompiling it from sources.", packPath);
+					if (!CompileFullAssetPackToFile(packPath, assets, numAssets))
+						return false;
+				}
+				else if (assetsToUpdate.empty())
+				{
+					LOG("Asset pack %s is up to date.", packPath);
+				}
+				else
+				{
+					LOG("Asset pack %s is out of date; updating.", packPath);
+					if (!UpdateAssetPack(packPath, assets, numAssets, assetsToUpdate))
+						return false;
+				}
+			}
+			else
+			{
+				LOG("Asset pack %s doesn't exist; compiling it from sources.", packPath);
+				if (!CompileFullAssetPackToFile(packPath, assets, numAssets))
+					return false;
+			}
 
-				// Skip zero size files (trailing ones will cause an std::vector assert)
-				if (pFileInfo->m_size == 0)
-					continue;
+			return true;
+		}
+
+		// State kept while a pack is written, until EndPackWrite.  It belongs to whatever's
+		// writing the pack and goes along with the zip to its ZipAssetSink, so separate packs
+		// can be written at once on different threads.  Zips written without any get no
+		// deduplication or dictionary.
+		//  * Each file written is hashed, and if it's identical to one already in the pack, it's
+		//      written as a zero-size alias entry whose comment is s_aliasPrefix followed by the
+		//      path of the original.
+		//  * Small files are held back, and at the end they're used to train the pack's
+		//      dictionary and then written out, compressed against it.
+
+		static const char s_aliasPrefix[] = "alias:";
+		static const char * s_pathDictionary = "dictionary";
+		static const size_t s_sizeSmallFile = 4096;			// Files smaller than this go in the dictionary
+		static const size_t s_sizeDictionaryMax = 32768;
+
+		struct DedupEntry
+		{
+			size_t			m_size;
+			mz_uint32		m_crc32;
+			std::string		m_path;
+		};
 
-				if (!mz_zip_reader_extract_to_mem(
-						pZip, i,
-						&pPackOut->m_data[pFileInfo->m_offset],
-						pFileInfo->m_size, 0))
+		struct PendingFile
+		{
+			std::string			m_path;
+			std::vector<byte>	m_data;
+			PACKCODEC			m_codec;
+		};
+
+		struct CodecStats
+		{
+			int		m_fileCount;
+			i64		m_bytes;
+			i64		m_bytesStored;			// Including .zip headers
+		};
+
+		struct PackWriteState
+		{
+			std::unordered_multimap<u64, DedupEntry>	m_entries;		// Keyed by HashContents
+			int											m_aliasCount;
+			i64											m_bytesSaved;
+			PACKCODEC									m_codecDefault;	// For the kind of asset being compiled
+			std::vector<PendingFile>					m_pending;		// Small files waiting for the dictionary
+			std::vector<byte>							m_dictionary;
+			bool										m_dictionaryDone;
+			CodecStats									m_stats[PACKCODEC_Count];
+
+			PackWriteState()
+			:	m_aliasCount(0),
+				m_bytesSaved(0),
+				m_codecDefault(PACKCODEC_Auto),
+				m_dictionaryDone(false)
+			{
+				for (int i = 0; i < PACKCODEC_Count; ++i)
 				{
-					WARN("Couldn't extract file %s (index %d of %d) from asset pack %s",
-						pFileInfo->m_path.c_str(), i, numFiles, packPath);
-					return false;
+					CodecStats stats = {};
+					m_stats[i] = stats;
 				}
 			}
+		};
 
-			// Extract the version info
-			VersionInfo * pVerInfo;
-			int verInfoSize;
-			if (!pPackOut->LookupFile(s_pathVersionInfo, nullptr, (void **)&pVerInfo, &verInfoSize))
+		// 64-bit hash of a file's contents, a word at a time.  Files are only considered
+		// identical if their size and CRC-32 match as well.
+		static u64 HashContents(const void * pData, size_t sizeBytes)
+		{
+			const byte * pBytes = (const byte *)pData;
+			u64 hash = 0x9e3779b97f4a7c15ull ^ sizeBytes;
+			size_t i = 0;
+			for (; i + sizeof(u64) <= sizeBytes; i += sizeof(u64))
 			{
-				WARN("Couldn't find version info in asset pack %s", packPath);
-				return false;
+				u64 word;
+				memcpy(&word, &pBytes[i], sizeof(word));
+				hash = (hash ^ word) * 0xff51afd7ed558ccdull;
+				hash ^= hash >> 32;
 			}
-			if (verInfoSize != sizeof(VersionInfo))
+			for (; i < sizeBytes; ++i)
+				hash = (hash ^ pBytes[i]) * 0x100000001b3ull;
+			return hash ^ (hash >> 29);
+		}
+
+		// If a directory entry is an alias of an identical file, return the path it points to
+		static const char * FindAliasTarget(const mz_zip_archive_file_stat & fileStat)
+		{
+			size_t prefixLength = dim(s_aliasPrefix) - 1;
+			if (fileStat.m_uncomp_size != 0 ||
+				fileStat.m_comment_size <= prefixLength ||
+				strncmp(fileStat.m_comment, s_aliasPrefix, prefixLength) != 0)
 			{
-				WARN("Version info in asset pack %s is wrong size, %d bytes (expected %d)",
-					packPath, verInfoSize, sizeof(VersionInfo));
-				return false;
+				return nullptr;
 			}
+			return fileStat.m_comment + prefixLength;
+		}
 
-			// Check that all the versions are correct
-			if (pVerInfo->m_packver != PACKVER_Current)
+		// Files encoded with something the .zip format doesn't know about say so in their
+		// comment, along with the size and CRC-32 of the decoded data, so the content store
+		// can match them without decoding them first.
+		//  * Images written with WriteImageRowsToZip are row-filtered (see asset-rowfilter.cpp)
+		//      and deflated: s_rowFilterPrefix followed by "<bytes per pixel>:<width>:<crc>".
+		//  * LZ-compressed files (see asset-codec.cpp) are stored: s_lzPrefix followed by
+		//      "<size>:<crc>", or s_lzDictPrefix if they were compressed against the pack's
+		//      dictionary.
+
+		static const char s_rowFilterPrefix[] = "rows:";
+		static const char s_lzPrefix[] = "lz:";
+		static const char s_lzDictPrefix[] = "lzd:";
+
+		enum ENCODING
+		{
+			ENCODING_None,
+			ENCODING_Rows,
+			ENCODING_LZ,
+			ENCODING_LZDict,
+
+			ENCODING_Count
+		};
+
+		struct EncodedFileInfo
+		{
+			ENCODING		m_encoding;
+			int				m_iFile;
+			size_t			m_size;					// Decoded
+			mz_uint32		m_crc32;				// Of the decoded data
+			mz_uint32		m_crc32Zip;				// Of the data as extracted from the .zip
+			size_t			m_sizeEncoded;			// As extracted from the .zip
+			int2			m_dims;					// For row-filtered images
+			int				m_bytesPerPixel;
+			size_t			m_offsetEncoded;		// Into the scratch buffer, while loading
+			bool			m_deflated;
+			size_t			m_sizeCompressed;		// Deflated size in the .zip
+			size_t			m_offsetCompressed;		// Into the compressed scratch buffer, while loading
+		};
+
+		static bool CommentHasPrefix(const mz_zip_archive_file_stat & fileStat, const char * prefix, size_t prefixLength)
+		{
+			return (fileStat.m_comment_size > prefixLength &&
+					strncmp(fileStat.m_comment, prefix, prefixLength) == 0);
+		}
+
+		// Work out how a directory entry is encoded.  Anything not recognized is taken as is.
+		static void FindEncoding(
+			const mz_zip_archive_file_stat & fileStat,
+			EncodedFileInfo * pInfoOut)
+		{
+			pInfoOut->m_encoding = ENCODING_None;
+			pInfoOut->m_iFile = int(fileStat.m_file_index);
+			pInfoOut->m_size = size_t(fileStat.m_uncomp_size);
+			pInfoOut->m_crc32 = fileStat.m_crc32;
+			pInfoOut->m_crc32Zip = fileStat.m_crc32;
+			pInfoOut->m_sizeEncoded = size_t(fileStat.m_uncomp_size);
+			pInfoOut->m_dims = int2(0);
+			pInfoOut->m_bytesPerPixel = 0;
+			pInfoOut->m_offsetEncoded = 0;
+			pInfoOut->m_deflated = (fileStat.m_method == MZ_DEFLATED);
+			pInfoOut->m_sizeCompressed = size_t(fileStat.m_comp_size);
+			pInfoOut->m_offsetCompressed = 0;
+
+			char * pEnd;
+			if (CommentHasPrefix(fileStat, s_rowFilterPrefix, dim(s_rowFilterPrefix) - 1))
 			{
-				WARN("Asset pack %s has wrong pack version %d (expected %d)", packPath, pVerInfo->m_packver, PACKVER_Current);
-				return false;
+				int bytesPerPixel = int(strtol(fileStat.m_comment + dim(s_rowFilterPrefix) - 1, &pEnd, 10));
+				if (*pEnd != ':')
+					return;
+				int width = int(strtol(pEnd + 1, &pEnd, 10));
+				if (*pEnd != ':' || bytesPerPixel <= 0 || width <= 0)
+					return;
+				mz_uint32 crc = mz_uint32(strtoul(pEnd + 1, &pEnd, 16));
+				if (*pEnd != 0)
+					return;
+
+				mz_uint64 rowBytesFiltered = mz_uint64(width) * bytesPerPixel + 1;
+				if (fileStat.m_uncomp_size % rowBytesFiltered != 0)
+					return;
+
+				pInfoOut->m_encoding = ENCODING_Rows;
+				pInfoOut->m_dims = int2(width, int(fileStat.m_uncomp_size / rowBytesFiltered));
+				pInfoOut->m_bytesPerPixel = bytesPerPixel;
+				pInfoOut->m_size = size_t(pInfoOut->m_dims.x) * pInfoOut->m_dims.y * bytesPerPixel;
+				pInfoOut->m_crc32 = crc;
 			}
-			if (pVerInfo->m_meshver != MESHVER_Current)
+			else if (CommentHasPrefix(fileStat, s_lzPrefix, dim(s_lzPrefix) - 1) ||
+					 CommentHasPrefix(fileStat, s_lzDictPrefix, dim(s_lzDictPrefix) - 1))
 			{
-				WARN("Asset pack %s has wrong mesh version %d (expected %d)", packPath, pVerInfo->m_meshver, MESHVER_Current);
-				return false;
+				bool useDict = CommentHasPrefix(fileStat, s_lzDictPrefix, dim(s_lzDictPrefix) - 1);
+				size_t prefixLength = useDict ? dim(s_lzDictPrefix) - 1 : dim(s_lzPrefix) - 1;
+				size_t size = size_t(strtoull(fileStat.m_comment + prefixLength, &pEnd, 10));
+				if (*pEnd != ':')
+					return;
+				mz_uint32 crc = mz_uint32(strtoul(pEnd + 1, &pEnd, 16));
+				if (*pEnd != 0 || fileStat.m_uncomp_size == 0)
+					return;
+
+				pInfoOut->m_encoding = useDict ? ENCODING_LZDict : ENCODING_LZ;
+				pInfoOut->m_size = size;
+				pInfoOut->m_crc32 = crc;
 			}
-			if (pVerInfo->m_mtlver != MTLVER_Current)
+		}
+
+		// Decode a file's data as extracted from the .zip
+		static bool DecodeFile(
+			const EncodedFileInfo & info,
+			const byte * pEncoded,
+			const std::vector<byte> & dict,
+			void * pDataOut)
+		{
+			switch (info.m_encoding)
 			{
-				WARN("Asset pack %s has wrong material version %d (expected %d)", packPath, pVerInfo->m_mtlver, MTLVER_Current);
+			case ENCODING_Rows:
+				UnfilterRows(pEncoded, info.m_dims, info.m_bytesPerPixel, pDataOut);
+				return true;
+
+			case ENCODING_LZ:
+				return DecompressLZ(pEncoded, info.m_sizeEncoded, nullptr, 0, pDataOut, info.m_size);
+
+			case ENCODING_LZDict:
+				return !dict.empty() &&
+						DecompressLZ(pEncoded, info.m_sizeEncoded, &dict[0], dict.size(), pDataOut, info.m_size);
+
+			default:
+				memcpy(pDataOut, pEncoded, info.m_size);
+				return true;
+			}
+		}
+
+		// Extract a file from a .zip and decode it, following it if it's an alias
+		static bool ExtractFileFromZip(
+			mz_zip_archive * pZip,
+			int iFile,
+			const std::vector<byte> & dict,
+			std::vector<byte> * pDataOut,
+			EncodedFileInfo * pInfoOut = nullptr)
+		{
+			mz_zip_archive_file_stat fileStat;
+			if (!mz_zip_reader_file_stat(pZip, iFile, &fileStat))
 				return false;
+
+			if (const char * aliasTarget = FindAliasTarget(fileStat))
+			{
+				iFile = mz_zip_reader_locate_file(pZip, aliasTarget, nullptr, 0);
+				if (iFile < 0 || !mz_zip_reader_file_stat(pZip, iFile, &fileStat))
+				{
+					WARN("File %s is an alias of %s, which is missing", fileStat.m_filename, aliasTarget);
+					return false;
+				}
 			}
-			if (pVerInfo->m_texver != TEXVER_Current)
+
+			EncodedFileInfo info;
+			FindEncoding(fileStat, &info);
+			if (pInfoOut)
+				*pInfoOut = info;
+
+			pDataOut->resize(info.m_size);
+			if (info.m_size == 0)
+				return true;
+
+			if (info.m_encoding == ENCODING_None)
+				return (mz_zip_reader_extract_to_mem(pZip, iFile, &(*pDataOut)[0], info.m_size, 0) != 0);
+
+			std::vector<byte> encoded(info.m_sizeEncoded);
+			return (mz_zip_reader_extract_to_mem(pZip, iFile, &encoded[0], encoded.size(), 0) &&
+					DecodeFile(info, &encoded[0], dict, &(*pDataOut)[0]));
+		}
+
+		// Load a pack's dictionary, if it has one
+		static bool LoadDictionaryFromZip(
+			mz_zip_archive * pZip,
+			std::vector<byte> * pDictOut)
+		{
+			pDictOut->clear();
+			int iFile = mz_zip_reader_locate_file(pZip, s_pathDictionary, nullptr, 0);
+			if (iFile < 0)
+				return true;
+			return ExtractFileFromZip(pZip, iFile, std::vector<byte>(), pDictOut);
+		}
+
+		// Look for a file with the same contents in a content store.  Candidates are found by
+		// the decoded size and CRC-32 from the directory, then the file is extracted, decoded
+		// and compared in full.
+		static const byte * FindSharedData(
+			AssetContentStore * pStore,
+			mz_zip_archive * pZip,
+			const EncodedFileInfo & info,
+			const std::vector<byte> & dict)
+		{
+			u64 key = (u64(info.m_size) << 32) | info.m_crc32;
+			auto range = pStore->m_blobs.equal_range(key);
+			if (range.first == range.second)
+				return nullptr;
+
+			std::vector<byte> data;
+			if (!ExtractFileFromZip(pZip, info.m_iFile, dict, &data))
+				return nullptr;
+
+			for (auto iter = range.first; iter != range.second; ++iter)
 			{
-				WARN("Asset pack %s has wrong texture version %d (expected %d)", packPath, pVerInfo->m_texver, TEXVER_Current);
-				return false;
+				const AssetContentStore::Blob & blob = iter->second;
+				if (size_t(blob.m_size) == data.size() && memcmp(blob.m_pData, &data[0], data.size()) == 0)
+					return blob.m_pData;
 			}
 
-			// Extract the manifest
-			const char * pManifest;
-			int manifestSize;
+			return nullptr;
+		}
+
+		// Get the total decoded size of a pack's files, from its directory.
+		bool GetAssetPackDataSize(
+			const char * packPath,
+			i64 * pBytesOut)
+		{
+			ASSERT_ERR(packPath);
+			ASSERT_ERR(pBytesOut);
+
+			mz_zip_archive zip = {};
+			if (!mz_zip_reader_init_file(&zip, packPath, 0))
+			{
+				WARN("Couldn't load asset pack %s", packPath);
+				return false;
+			}
+
+			i64 bytesTotal = 0;
+			for (int i = 0, numFiles = int(mz_zip_reader_get_num_files(&zip)); i < numFiles; ++i)
+			{
+				mz_zip_archive_file_stat fileStat;
+				if (!mz_zip_reader_file_stat(&zip, i, &fileStat))
+				{
+					WARN("Couldn't read directory entry %d of %d from asset pack %s", i, numFiles, packPath);
+					mz_zip_reader_end(&zip);
+					return false;
+				}
+				EncodedFileInfo encodedFile;
+				FindEncoding(fileStat, &encodedFile);
+				bytesTotal += i64(encodedFile.m_size);
+			}
+
+			mz_zip_reader_end(&zip);
+			*pBytesOut = bytesTotal;
+			return true;
+		}
+
+		// Load an asset pack file from a zip stream (can be in memory or a file).
+		bool LoadAssetPackFromZip(
+			mz_zip_archive * pZip,
+			AssetPack * pPackOut,
+			AssetContentStore * pStore /* = nullptr */,
+			bool verifyCrcs /* = false */)
+		{
+			ASSERT_ERR(pZip);
+			ASSERT_ERR(pPackOut);
+
+			const char * packPath = pPackOut->m_path.c_str();
+		
+			int numFiles = int(mz_zip_reader_get_num_files(pZip));
+			pPackOut->m_files.resize(numFiles);
+			pPackOut->m_directory.clear();
+			pPackOut->m_directory.reserve(numFiles);
+			pPackOut->m_packsShared.clear();
+
+			// Load the dictionary first, since any file might need it
+			std::vector<byte> dict;
+			if (!LoadDictionaryFromZip(pZip, &dict))
+			{
+				WARN("Couldn't extract dictionary from asset pack %s", packPath);
+				return false;
+			}
+
+			// Run through all the files, build the file list and directory and sum up their sizes.
+			// Aliases are resolved once all the paths are known, and files found in the content
+			// store don't need space of their own.  Encoded files take their decoded size, and
+			// are extracted to a scratch buffer first.  Deflated files are read from the .zip
+			// as is, to be inflated in parallel along with the decoding.
+			std::vector<std::pair<int, std::string>> aliases;
+			std::vector<EncodedFileInfo> encodedFiles;
+			std::vector<int> iEncodedOfFile(numFiles, -1);
+			std::vector<mz_uint32> crcs(numFiles);
+			i64 bytesTotal = 0;
+			size_t bytesEncoded = 0;
+			size_t bytesCompressed = 0;
+			int filesShared = 0;
+			i64 bytesShared = 0;
+#if LOG_PACK_STATS
+			i64 bytesStored = 0;
+			int encodingCounts[ENCODING_Count] = {};
+#endif
+			for (int i = 0; i < numFiles; ++i)
+			{
+				mz_zip_archive_file_stat fileStat;
+				if (!mz_zip_reader_file_stat(pZip, i, &fileStat))
+				{
+					WARN("Couldn't read directory entry %d of %d from asset pack %s", i, numFiles, packPath);
+					return false;
+				}
+
+				EncodedFileInfo encodedFile;
+				FindEncoding(fileStat, &encodedFile);
+
+				AssetPack::FileInfo * pFileInfo = &pPackOut->m_files[i];
+				pFileInfo->m_path = fileStat.m_filename;
+				pFileInfo->m_offset = bytesTotal;
+				pFileInfo->m_size = i64(encodedFile.m_size);
+				pFileInfo->m_pSharedData = nullptr;
+				pFileInfo->m_accessTimestamp = 0;
+				crcs[i] = encodedFile.m_crc32;
+
+				pPackOut->m_directory.insert(std::make_pair(pFileInfo->m_path, i));
+
+#if LOG_PACK_STATS
+				bytesStored += i64(fileStat.m_comp_size);
+#endif
+
+				if (const char * aliasTarget = FindAliasTarget(fileStat))
+				{
+					aliases.push_back(std::make_pair(i, std::string(aliasTarget)));
+					continue;
+				}
+
+#if LOG_PACK_STATS
+				++encodingCounts[encodedFile.m_encoding];
+#endif
+
+				if (pStore && pFileInfo->m_size > 0)
+				{
+					if (const byte * pShared = FindSharedData(pStore, pZip, encodedFile, dict))
+					{
+						pFileInfo->m_pSharedData = pShared;
+						++filesShared;
+						bytesShared += pFileInfo->m_size;
+						continue;
+					}
+				}
+
+				if ((encodedFile.m_encoding != ENCODING_None || encodedFile.m_deflated) && pFileInfo->m_size > 0)
+				{
+					if (encodedFile.m_encoding != ENCODING_None)
+					{
+						encodedFile.m_offsetEncoded = bytesEncoded;
+						bytesEncoded += encodedFile.m_sizeEncoded;
+					}
+					if (encodedFile.m_deflated)
+					{
+						encodedFile.m_offsetCompressed = bytesCompressed;
+						bytesCompressed += encodedFile.m_sizeCompressed;
+					}
+					iEncodedOfFile[i] = int(encodedFiles.size());
+					encodedFiles.push_back(encodedFile);
+				}
+
+				bytesTotal += pFileInfo->m_size;
+			}
+
+			// Allocate memory to store the decompressed data
+			pPackOut->m_data.resize(size_t(bytesTotal));
+			std::vector<byte> encoded(bytesEncoded);
+			std::vector<byte> compressed(bytesCompressed);
+
+#if LOG_PACK_STATS
+			LARGE_INTEGER freq, timeStart, timeExtracted, timeDecoded, timeVerified;
+			QueryPerformanceFrequency(&freq);
+			QueryPerformanceCounter(&timeStart);
+#endif
+
+			// Decompress all the files
+			for (int i = 0; i < numFiles; ++i)
+			{
+				AssetPack::FileInfo * pFileInfo = &pPackOut->m_files[i];
+
+				// Skip zero size files (trailing ones will cause an std::vector assert),
+				// and ones shared from other packs
+				if (pFileInfo->m_size == 0 || pFileInfo->m_pSharedData)
+					continue;
+
+				void * pDest = &pPackOut->m_data[pFileInfo->m_offset];
+				size_t sizeDest = size_t(pFileInfo->m_size);
+				mz_uint flags = 0;
+				if (iEncodedOfFile[i] >= 0)
+				{
+					const EncodedFileInfo & encodedFile = encodedFiles[iEncodedOfFile[i]];
+					if (encodedFile.m_deflated)
+					{
+						pDest = &compressed[encodedFile.m_offsetCompressed];
+						sizeDest = encodedFile.m_sizeCompressed;
+						flags = MZ_ZIP_FLAG_COMPRESSED_DATA;
+					}
+					else
+					{
+						pDest = &encoded[encodedFile.m_offsetEncoded];
+						sizeDest = encodedFile.m_sizeEncoded;
+					}
+				}
+
+				if (sizeDest > 0 && !mz_zip_reader_extract_to_mem(pZip, i, pDest, sizeDest, flags))
+				{
+					WARN("Couldn't extract file %s (index %d of %d) from asset pack %s",
+						pFileInfo->m_path.c_str(), i, numFiles, packPath);
+					return false;
+				}
+			}
+
+#if LOG_PACK_STATS
+			QueryPerformanceCounter(&timeExtracted);
+#endif
+
+			// Inflate and decode the files.  Row-filtered images have to go in row order, so
+			// this parallelizes over files rather than within them.  Deflated data goes through
+			// the fast inflater, falling back to miniz for anything it doesn't take.  If CRCs are
+			// being checked, the data's checked after inflating, while it's still in cache.
+			std::vector<byte> decodeFailed(encodedFiles.size(), 0);
+			std::vector<byte> crcFailed(encodedFiles.size(), 0);
+#if LOG_PACK_STATS
+			std::vector<byte> inflateFellBack(encodedFiles.size(), 0);
+#endif
+			ParallelFor(int(encodedFiles.size()), 1, [&](int iStart, int iEnd)
+			{
+				for (int iEncoded = iStart; iEncoded < iEnd; ++iEncoded)
+				{
+					const EncodedFileInfo & encodedFile = encodedFiles[iEncoded];
+					const AssetPack::FileInfo & fileinfo = pPackOut->m_files[encodedFile.m_iFile];
+					byte * pDecoded = &pPackOut->m_data[fileinfo.m_offset];
+					byte * pEncoded = (encodedFile.m_encoding == ENCODING_None) ? pDecoded : &encoded[encodedFile.m_offsetEncoded];
+
+					if (encodedFile.m_deflated && encodedFile.m_sizeEncoded > 0)
+					{
+						const byte * pCompressed = &compressed[encodedFile.m_offsetCompressed];
+						if (!InflateFast(pCompressed, encodedFile.m_sizeCompressed, pEncoded, encodedFile.m_sizeEncoded))
+						{
+#if LOG_PACK_STATS
+							inflateFellBack[iEncoded] = 1;
+#endif
+							if (tinfl_decompress_mem_to_mem(
+									pEncoded, encodedFile.m_sizeEncoded,
+									pCompressed, encodedFile.m_sizeCompressed, 0) != encodedFile.m_sizeEncoded)
+							{
+								decodeFailed[iEncoded] = 1;
+								continue;
+							}
+						}
+					}
+
+					if (verifyCrcs && encodedFile.m_sizeEncoded > 0 &&
+						UpdateCrc32(MZ_CRC32_INIT, pEncoded, encodedFile.m_sizeEncoded) != encodedFile.m_crc32Zip)
+					{
+						crcFailed[iEncoded] = 1;
+						continue;
+					}
+
+					if (encodedFile.m_encoding != ENCODING_None &&
+						!DecodeFile(encodedFile, pEncoded, dict, pDecoded))
+					{
+						decodeFailed[iEncoded] = 1;
+					}
+				}
+			});
+			for (int i = 0, c = int(encodedFiles.size()); i < c; ++i)
+			{
+				if (crcFailed[i])
+				{
+					WARN("File %s in asset pack %s failed its CRC check; the pack is corrupt",
+						pPackOut->m_files[encodedFiles[i].m_iFile].m_path.c_str(), packPath);
+					return false;
+				}
+				if (decodeFailed[i])
+				{
+					WARN("Couldn't decode file %s from asset pack %s",
+						pPackOut->m_files[encodedFiles[i].m_iFile].m_path.c_str(), packPath);
+					return false;
+				}
+			}
+
+#if LOG_PACK_STATS
+			QueryPerformanceCounter(&timeDecoded);
+#endif
+
+			// Check the files that were stored as is.  Big ones are split across threads by
+			// ComputeCrc32, and the rest go across threads a file at a time.
+			if (verifyCrcs)
+			{
+				static const i64 s_sizeCrcSplit = 4 * 1024 * 1024;
+				std::vector<int> filesSmall;
+				for (int i = 0; i < numFiles; ++i)
+				{
+					const AssetPack::FileInfo & fileinfo = pPackOut->m_files[i];
+					if (fileinfo.m_size == 0 || fileinfo.m_pSharedData || iEncodedOfFile[i] >= 0)
+						continue;
+
+					if (fileinfo.m_size < s_sizeCrcSplit)
+						filesSmall.push_back(i);
+					else if (ComputeCrc32(&pPackOut->m_data[fileinfo.m_offset], size_t(fileinfo.m_size)) != crcs[i])
+					{
+						WARN("File %s in asset pack %s failed its CRC check; the pack is corrupt",
+							fileinfo.m_path.c_str(), packPath);
+						return false;
+					}
+				}
+
+				std::vector<byte> smallFailed(filesSmall.size(), 0);
+				ParallelFor(int(filesSmall.size()), 16, [&](int iStart, int iEnd)
+				{
+					for (int iSmall = iStart; iSmall < iEnd; ++iSmall)
+					{
+						int i = filesSmall[iSmall];
+						const AssetPack::FileInfo & fileinfo = pPackOut->m_files[i];
+						if (UpdateCrc32(MZ_CRC32_INIT, &pPackOut->m_data[fileinfo.m_offset], size_t(fileinfo.m_size)) != crcs[i])
+							smallFailed[iSmall] = 1;
+					}
+				});
+				for (int iSmall = 0, c = int(filesSmall.size()); iSmall < c; ++iSmall)
+				{
+					if (smallFailed[iSmall])
+					{
+						WARN("File %s in asset pack %s failed its CRC check; the pack is corrupt",
+							pPackOut->m_files[filesSmall[iSmall]].m_path.c_str(), packPath);
+						return false;
+					}
+				}
+			}
+
+#if LOG_PACK_STATS
+			QueryPerformanceCounter(&timeVerified);
+			float msExtract = 1000.0f * float(timeExtracted.QuadPart - timeStart.QuadPart) / float(freq.QuadPart);
+			float msDecode = 1000.0f * float(timeDecoded.QuadPart - timeExtracted.QuadPart) / float(freq.QuadPart);
+			int filesInflated = 0, filesFellBack = 0;
+			for (int i = 0, c = int(encodedFiles.size()); i < c; ++i)
+			{
+				filesInflated += encodedFiles[i].m_deflated;
+				filesFellBack += inflateFellBack[i];
+			}
+			LOG("Asset pack %s: %dKB stored, %dKB loaded; %d stored or deflated files extracted in %0.2f ms, "
+				"%d inflated (%d by miniz), %d filtered images, %d LZ and %d LZ-with-dictionary files decoded in %0.2f ms",
+				packPath, int(bytesStored / 1024), int(bytesTotal / 1024),
+				encodingCounts[ENCODING_None], msExtract,
+				filesInflated, filesFellBack,
+				encodingCounts[ENCODING_Rows], encodingCounts[ENCODING_LZ], encodingCounts[ENCODING_LZDict], msDecode);
+			if (verifyCrcs)
+			{
+				float msVerify = 1000.0f * float(timeVerified.QuadPart - timeDecoded.QuadPart) / float(freq.QuadPart);
+				LOG("Asset pack %s: CRCs checked, in %0.2f ms for stored files and along with decoding for the rest",
+					packPath, msVerify);
+			}
+
+			// Compare the fast inflater to miniz on this pack's data, one thread each
+			if (filesInflated > 0)
+			{
+				size_t bytesInflated = 0, sizeMax = 0;
+				for (const EncodedFileInfo & encodedFile : encodedFiles)
+				{
+					if (!encodedFile.m_deflated)
+						continue;
+					bytesInflated += encodedFile.m_sizeEncoded;
+					sizeMax = max(sizeMax, encodedFile.m_sizeEncoded);
+				}
+				std::vector<byte> inflated(sizeMax);
+
+				LARGE_INTEGER timeInflateStart, timeInflateFast, timeInflateMiniz;
+				QueryPerformanceCounter(&timeInflateStart);
+				for (const EncodedFileInfo & encodedFile : encodedFiles)
+				{
+					if (encodedFile.m_deflated)
+						InflateFast(&compressed[encodedFile.m_offsetCompressed], encodedFile.m_sizeCompressed, &inflated[0], encodedFile.m_sizeEncoded);
+				}
+				QueryPerformanceCounter(&timeInflateFast);
+				for (const EncodedFileInfo & encodedFile : encodedFiles)
+				{
+					if (encodedFile.m_deflated)
+						tinfl_decompress_mem_to_mem(&inflated[0], encodedFile.m_sizeEncoded, &compressed[encodedFile.m_offsetCompressed], encodedFile.m_sizeCompressed, 0);
+				}
+				QueryPerformanceCounter(&timeInflateMiniz);
+				float msFast = 1000.0f * float(timeInflateFast.QuadPart - timeInflateStart.QuadPart) / float(freq.QuadPart);
+				float msMiniz = 1000.0f * float(timeInflateMiniz.QuadPart - timeInflateFast.QuadPart) / float(freq.QuadPart);
+				LOG("Asset pack %s: inflated %dKB in %0.2f ms (%0.0f MB/s), vs %0.2f ms (%0.0f MB/s) for miniz",
+					packPath, int(bytesInflated / 1024),
+					msFast, float(bytesInflated) / (1000.0f * max(msFast, 1e-3f)),
+					msMiniz, float(bytesInflated) / (1000.0f * max(msMiniz, 1e-3f)));
+			}
+
+			// Compare the fast CRC to miniz's on all this pack's data, one thread each
+			if (bytesTotal > 0)
+			{
+				const byte * pData = &pPackOut->m_data[0];
+				size_t sizeData = pPackOut->m_data.size();
+				LARGE_INTEGER timeCrcStart, timeCrcFast, timeCrcMiniz;
+				QueryPerformanceCounter(&timeCrcStart);
+				mz_uint32 crcFast = UpdateCrc32(MZ_CRC32_INIT, pData, sizeData);
+				QueryPerformanceCounter(&timeCrcFast);
+				mz_uint32 crcMiniz = mz_uint32(mz_crc32(MZ_CRC32_INIT, pData, sizeData));
+				QueryPerformanceCounter(&timeCrcMiniz);
+				ASSERT_WARN_MSG(crcFast == crcMiniz, "Fast CRC %08x doesn't match miniz's %08x", crcFast, crcMiniz);
+				float msFast = 1000.0f * float(timeCrcFast.QuadPart - timeCrcStart.QuadPart) / float(freq.QuadPart);
+				float msMiniz = 1000.0f * float(timeCrcMiniz.QuadPart - timeCrcFast.QuadPart) / float(freq.QuadPart);
+				LOG("Asset pack %s: CRC of %dKB in %0.2f ms (%0.0f MB/s), vs %0.2f ms (%0.0f MB/s) for miniz",
+					packPath, int(sizeData / 1024),
+					msFast, float(sizeData) / (1000.0f * max(msFast, 1e-3f)),
+					msMiniz, float(sizeData) / (1000.0f * max(msMiniz, 1e-3f)));
+			}
+#endif
+
+			// Offer this pack's files to the content store.  If any were shared, hang onto the packs
+			// already in the store, since they own the shared data.
+			if (pStore)
+			{
+				for (int i = 0; i < numFiles; ++i)
+				{
+					const AssetPack::FileInfo & fileinfo = pPackOut->m_files[i];
+					if (fileinfo.m_size == 0 || fileinfo.m_pSharedData)
+						continue;
+
+					u64 key = (u64(fileinfo.m_size) << 32) | crcs[i];
+					AssetContentStore::Blob blob = { &pPackOut->m_data[fileinfo.m_offset], fileinfo.m_size };
+					pStore->m_blobs.insert(std::make_pair(key, blob));
+				}
+
+				if (filesShared > 0)
+					pPackOut->m_packsShared = pStore->m_packs;
+				pStore->m_packs.push_back(pPackOut);
+				pStore->m_bytesShared += bytesShared;
+			}
+
+			// Point aliases at the files they duplicate
+			for (int i = 0, c = int(aliases.size()); i < c; ++i)
+			{
+				AssetPack::FileInfo * pFileInfo = &pPackOut->m_files[aliases[i].first];
+				auto iter = pPackOut->m_directory.find(aliases[i].second);
+				if (iter == pPackOut->m_directory.end())
+				{
+					WARN("File %s in asset pack %s is an alias of %s, which is missing",
+						pFileInfo->m_path.c_str(), packPath, aliases[i].second.c_str());
+					return false;
+				}
+
+				const AssetPack::FileInfo & fileinfoTarget = pPackOut->m_files[iter->second];
+				pFileInfo->m_offset = fileinfoTarget.m_offset;
+				pFileInfo->m_size = fileinfoTarget.m_size;
+				pFileInfo->m_pSharedData = fileinfoTarget.m_pSharedData;
+			}
+
+			if (!aliases.empty() || filesShared > 0)
+			{
+				LOG("Asset pack %s has %d deduplicated files, and shares %d files (%dKB) with other packs",
+					packPath, int(aliases.size()), filesShared, int(bytesShared / 1024));
+			}
+
+			// Extract the version info
+			VersionInfo * pVerInfo;
+			i64 verInfoSize;
+			if (!pPackOut->LookupFile(s_pathVersionInfo, nullptr, (void **)&pVerInfo, &verInfoSize))
+			{
+				WARN("Couldn't find version info in asset pack %s", packPath);
+				return false;
+			}
+			if (verInfoSize != sizeof(VersionInfo))
+			{
+				WARN("Version info in asset pack %s is wrong size, %lld bytes (expected %d)",
+					packPath, verInfoSize, sizeof(VersionInfo));
+				return false;
+			}
+
+			// Check that all the versions are correct
+			if (pVerInfo->m_packver != PACKVER_Current)
+			{
+				WARN("Asset pack %s has wrong pack version %d (expected %d)", packPath, pVerInfo->m_packver, PACKVER_Current);
+				return false;
+			}
+			if (pVerInfo->m_meshver != MESHVER_Current)
+			{
+				WARN("Asset pack %s has wrong mesh version %d (expected %d)", packPath, pVerInfo->m_meshver, MESHVER_Current);
+				return false;
+			}
+			if (pVerInfo->m_mtlver != MTLVER_Current)
+			{
+				WARN("Asset pack %s has wrong material version %d (expected %d)", packPath, pVerInfo->m_mtlver, MTLVER_Current);
+				return false;
+			}
+			if (pVerInfo->m_texver != TEXVER_Current)
+			{
+				WARN("Asset pack %s has wrong texture version %d (expected %d)", packPath, pVerInfo->m_texver, TEXVER_Current);
+				return false;
+			}
+			if (pVerInfo->m_scenever != SCENEVER_Current)
+			{
+				WARN("Asset pack %s has wrong scene version %d (expected %d)", packPath, pVerInfo->m_scenever, SCENEVER_Current);
+				return false;
+			}
+
+			// Extract the manifest
+			const char * pManifest;
+			i64 manifestSize;
 			if (!pPackOut->LookupFile(s_pathManifest, nullptr, (void **)&pManifest, &manifestSize))
 			{
-				WARN("Couldn't find manifest in asset pack %s", packPath);
+				WARN("Couldn't find manifest in asset pack %s", packPath);
+				return false;
+			}
+			ParseManifest(pManifest, int(manifestSize), packPath, &pPackOut->m_manifest);
+
+			return true;
+		}
+
+		// Check that filenames are printable-ASCII-only, lowercase, and there are no backslashes
+		// (this should really be generalized to allow UTF-8 printable chars)
+		bool NormalizePath(char * path)
+		{
+			ASSERT_ERR(path);
+
+			for (char * pCh = path; *pCh; ++pCh)
+			{
+				if (*pCh < 32 || *pCh > 126)
+				{
+					WARN("Invalid character %c in path %s", *pCh, path);
+					return false;
+				}
+				else if (*pCh >= 'A' && *pCh <= 'Z')
+				{
+					*pCh += 32;		// Convert to lowercase
+				}
+				else if (*pCh == '\\')
+				{
+					*pCh = '/';		// Normalize paths to forward slashes
+				}
+			}
+
+			return true;
+		}
+
+		// Compose an asset's path in the .zip, detecting if it's too long
+		static bool ComposeZipPath(
+			const char * assetPath,
+			const char * assetSuffix,
+			char (&zipPath)[MZ_ZIP_MAX_ARCHIVE_FILENAME_SIZE + 1])
+		{
+			if (!assetSuffix)
+				assetSuffix = "";
+
+			if (_snprintf_s(zipPath, _TRUNCATE, "%s%s", assetPath, assetSuffix) < 0)
+			{
+				WARN("File path %s%s is too long for .zip format", assetPath, assetSuffix);
+				return false;
+			}
+
+			return NormalizePath(zipPath);
+		}
+
+		// Add a file to a .zip, or an alias if an identical one is already there.  Files are
+		// compared as they'll be when loaded, however they end up encoded.  Images are row-
+		// filtered and deflated if their dimensions are given; anything else is encoded with
+		// the given codec, or the one for the kind of asset being compiled.  If a source zip is
+		// given, the file is copied from there as-is rather than encoded again.
+		static bool AddFileToZip(
+			const char * zipPath,
+			const void * pData,
+			size_t sizeBytes,
+			PACKCODEC codec,
+			mz_zip_archive * pZipOut,
+			PackWriteState * pPackState,
+			int2 imageDims = int2(0),
+			int bytesPerPixel = 0,
+			mz_zip_archive * pZipSrc = nullptr,
+			int iFileSrc = -1)
+		{
+			PackWriteState * pState = (sizeBytes > 0) ? pPackState : nullptr;
+			if (pState && codec == PACKCODEC_Auto)
+				codec = pState->m_codecDefault;
+
+			// Hold back small files until the dictionary's been trained on them
+			if (pState && !pState->m_dictionaryDone && !pZipSrc && bytesPerPixel == 0 &&
+				sizeBytes < s_sizeSmallFile && (codec == PACKCODEC_Auto || codec == PACKCODEC_LZDict))
+			{
+				PendingFile file = { zipPath, std::vector<byte>((const byte *)pData, (const byte *)pData + sizeBytes), codec };
+				pState->m_pending.push_back(std::move(file));
+				return true;
+			}
+
+			mz_uint32 crc = ComputeCrc32(pData, sizeBytes);
+
+			// If an identical file is already in the pack, write an alias to it instead
+			u64 hash = 0;
+			if (pState)
+			{
+				hash = HashContents(pData, sizeBytes);
+
+				auto range = pState->m_entries.equal_range(hash);
+				for (auto iter = range.first; iter != range.second; ++iter)
+				{
+					const DedupEntry & entry = iter->second;
+					if (entry.m_size != sizeBytes || entry.m_crc32 != crc)
+						continue;
+
+					// Not worth it for tiny files, if the alias would be bigger than the data
+					char commentAlias[MZ_ZIP_MAX_ARCHIVE_FILE_COMMENT_SIZE] = {};
+					int commentLength = _snprintf_s(commentAlias, _TRUNCATE, "%s%s", s_aliasPrefix, entry.m_path.c_str());
+					if (commentLength < 0 || size_t(commentLength) >= sizeBytes)
+						break;
+
+					if (!mz_zip_writer_add_mem_ex(
+							pZipOut, zipPath, nullptr, 0,
+							commentAlias, mz_uint16(commentLength),
+							MZ_NO_COMPRESSION, 0, 0))
+					{
+						WARN("Couldn't add alias %s of %s to archive", zipPath, entry.m_path.c_str());
+						return false;
+					}
+
+					++pState->m_aliasCount;
+					pState->m_bytesSaved += i64(sizeBytes) - commentLength;
+					return true;
+				}
+			}
+
+			mz_uint64 archiveSizeBefore = pZipOut->m_archive_size;
+			PACKCODEC codecUsed = PACKCODEC_Store;
+			bool added;
+			if (pZipSrc)
+			{
+				added = mz_zip_writer_add_from_zip_reader(pZipOut, pZipSrc, iFileSrc);
+			}
+			else
+			{
+				// Encode the data, and note how in the comment if it's anything .zip doesn't know.
+				// Deflating is done here too, rather than by miniz, so big files go in parallel.
+				static const std::vector<byte> s_dictNone;
+				std::vector<byte> encoded;
+				char comment[MZ_ZIP_MAX_ARCHIVE_FILE_COMMENT_SIZE] = {};
+				mz_uint levelAndFlags = MZ_NO_COMPRESSION;
+				size_t sizeUncompressed = sizeBytes;
+				mz_uint32 crcUncompressed = crc;
+				if (bytesPerPixel > 0)
+				{
+					ASSERT_ERR(size_t(imageDims.x) * imageDims.y * bytesPerPixel == sizeBytes);
+					std::vector<byte> filtered(size_t(imageDims.y) * (imageDims.x * bytesPerPixel + 1));
+					FilterRows(pData, imageDims, bytesPerPixel, &filtered[0]);
+					sprintf_s(comment, "%s%d:%d:%08x", s_rowFilterPrefix, bytesPerPixel, imageDims.x, crc);
+
+					// The .zip's own size and CRC are of the filtered rows
+					sizeUncompressed = filtered.size();
+					crcUncompressed = ComputeCrc32(&filtered[0], filtered.size());
+					codecUsed = EncodeFileForPack(&filtered[0], filtered.size(), PACKCODEC_Deflate, s_dictNone, &encoded);
+					if (codecUsed == PACKCODEC_Store)
+						encoded.swap(filtered);
+					else
+						levelAndFlags = MZ_ZIP_FLAG_COMPRESSED_DATA;
+				}
+				else
+				{
+					codecUsed = EncodeFileForPack(pData, sizeBytes, codec, pState ? pState->m_dictionary : s_dictNone, &encoded);
+					if (codecUsed == PACKCODEC_LZ || codecUsed == PACKCODEC_LZDict)
+					{
+						sprintf_s(comment, "%s%llu:%08x",
+							(codecUsed == PACKCODEC_LZ) ? s_lzPrefix : s_lzDictPrefix, u64(sizeBytes), crc);
+					}
+					else if (codecUsed != PACKCODEC_Store)
+					{
+						levelAndFlags = MZ_ZIP_FLAG_COMPRESSED_DATA;
+					}
+				}
+
+				// The .zip's CRC is of whatever it stores, which for our own codecs is the
+				// encoded data.  It's passed in either way, so miniz doesn't recompute it.
+				if (codecUsed == PACKCODEC_LZ || codecUsed == PACKCODEC_LZDict)
+					crcUncompressed = ComputeCrc32(&encoded[0], encoded.size());
+
+				bool isPrecompressed = (levelAndFlags & MZ_ZIP_FLAG_COMPRESSED_DATA) != 0;
+				added = mz_zip_writer_add_mem_ex(
+							pZipOut, zipPath,
+							encoded.empty() ? pData : &encoded[0],
+							encoded.empty() ? sizeBytes : encoded.size(),
+							comment, mz_uint16(strlen(comment)),
+							levelAndFlags | MZ_ZIP_FLAG_PRECOMPUTED_CRC32,
+							isPrecompressed ? sizeUncompressed : 0,
+							crcUncompressed);
+			}
+			if (!added)
+			{
+				WARN("Couldn't add file %s to archive", zipPath);
+				return false;
+			}
+
+			if (pState)
+			{
+				DedupEntry entry = { sizeBytes, crc, zipPath };
+				pState->m_entries.insert(std::make_pair(hash, entry));
+
+				if (!pZipSrc)
+				{
+					CodecStats * pStats = &pState->m_stats[codecUsed];
+					++pStats->m_fileCount;
+					pStats->m_bytes += i64(sizeBytes);
+					pStats->m_bytesStored += i64(pZipOut->m_archive_size - archiveSizeBefore);
+				}
+			}
+
+			return true;
+		}
+
+		// Train the dictionary on the small files held back for it, and write them out along with
+		// it; or if the pack's being abandoned, just drop them.  Then log what was saved.
+		static bool EndPackWrite(mz_zip_archive * pZip, PackWriteState * pState, bool flush)
+		{
+			ASSERT_ERR(pZip);
+			ASSERT_ERR(pState);
+
+			bool success = true;
+			if (flush)
+			{
+				std::vector<const std::vector<byte> *> samples;
+				for (int i = 0, c = int(pState->m_pending.size()); i < c; ++i)
+					samples.push_back(&pState->m_pending[i].m_data);
+				TrainDictionary(samples, s_sizeDictionaryMax, &pState->m_dictionary);
+				pState->m_dictionaryDone = true;
+
+				if (!pState->m_dictionary.empty())
+				{
+					success = AddFileToZip(
+								s_pathDictionary, &pState->m_dictionary[0], pState->m_dictionary.size(),
+								PACKCODEC_Store, pZip, pState);
+				}
+
+				for (int i = 0, c = int(pState->m_pending.size()); i < c && success; ++i)
+				{
+					const PendingFile & file = pState->m_pending[i];
+					success = AddFileToZip(file.m_path.c_str(), &file.m_data[0], file.m_data.size(), file.m_codec, pZip, pState);
+				}
+			}
+
+			if (pState->m_aliasCount > 0)
+			{
+				LOG("Deduplicated %d files in asset pack, saving %dKB",
+					pState->m_aliasCount, int(pState->m_bytesSaved / 1024));
+			}
+
+#if LOG_PACK_STATS
+			static const char * s_codecNames[] = { "auto", "store", "deflate (fast)", "deflate", "deflate (max)", "LZ", "LZ with dictionary" };
+			cassert(dim(s_codecNames) == PACKCODEC_Count);
+			LOG("Asset pack dictionary: %d bytes, from %d small files", int(pState->m_dictionary.size()), int(pState->m_pending.size()));
+			for (int i = 0; i < PACKCODEC_Count; ++i)
+			{
+				const CodecStats & stats = pState->m_stats[i];
+				if (stats.m_fileCount > 0)
+				{
+					LOG("    %-20s %6d files, %8dKB -> %8dKB",
+						s_codecNames[i], stats.m_fileCount, int(stats.m_bytes / 1024), int(stats.m_bytesStored / 1024));
+				}
+			}
+#endif
+
+			return success;
+		}
+
+		// Write a memory buffer out to an asset pack .zip file.
+		bool WriteAssetDataToZip(
+			const char * assetPath,
+			const char * assetSuffix,
+			const void * pData,
+			size_t sizeBytes,
+			mz_zip_archive * pZipOut)
+		{
+			ZipAssetSink sink(pZipOut);
+			return sink.WriteAssetData(assetPath, assetSuffix, pData, sizeBytes);
+		}
+
+		// Write an image out to an asset pack .zip file, row-filtered and deflated.
+		bool WriteImageRowsToZip(
+			const char * assetPath,
+			const char * assetSuffix,
+			const void * pPixels,
+			int2 dims,
+			int bytesPerPixel,
+			mz_zip_archive * pZipOut)
+		{
+			ZipAssetSink sink(pZipOut);
+			return sink.WriteImageRows(assetPath, assetSuffix, pPixels, dims, bytesPerPixel);
+		}
+
+		ZipAssetSink::ZipAssetSink(mz_zip_archive * pZip, PackWriteState * pState)
+		:	m_pZip(pZip),
+			m_pState(pState)
+		{
+			ASSERT_ERR(pZip);
+		}
+
+		bool ZipAssetSink::WriteAssetData(const char * assetPath, const char * assetSuffix, const void * pData, size_t sizeBytes)
+		{
+			ASSERT_ERR(assetPath);
+			ASSERT_ERR(sizeBytes >= 0);
+			ASSERT_ERR(pData || sizeBytes == 0);
+
+			char zipPath[MZ_ZIP_MAX_ARCHIVE_FILENAME_SIZE + 1] = {};
+			CHECK_WARN(ComposeZipPath(assetPath, assetSuffix, zipPath));
+
+			return AddFileToZip(zipPath, pData, sizeBytes, PACKCODEC_Auto, m_pZip, m_pState);
+		}
+
+		bool ZipAssetSink::WriteImageRows(const char * assetPath, const char * assetSuffix, const void * pPixels, int2 dims, int bytesPerPixel)
+		{
+			ASSERT_ERR(assetPath);
+			ASSERT_ERR(pPixels);
+			ASSERT_ERR(all(dims > 0));
+			ASSERT_ERR(bytesPerPixel > 0);
+
+			char zipPath[MZ_ZIP_MAX_ARCHIVE_FILENAME_SIZE + 1] = {};
+			CHECK_WARN(ComposeZipPath(assetPath, assetSuffix, zipPath));
+
+			size_t sizeBytes = size_t(dims.x) * dims.y * bytesPerPixel;
+			return AddFileToZip(zipPath, pPixels, sizeBytes, PACKCODEC_Deflate, m_pZip, m_pState, dims, bytesPerPixel);
+		}
+
+		MemoryAssetSink::MemoryAssetSink(AssetPack * pPack)
+		:	m_pPack(pPack)
+		{
+			ASSERT_ERR(pPack);
+		}
+
+		// The data's copied once, onto the end of the pack's, and the files are visible to
+		// LookupFile right away.  A file written twice keeps its first contents, as when a
+		// .zip with duplicate entries is loaded.
+		bool MemoryAssetSink::WriteAssetData(const char * assetPath, const char * assetSuffix, const void * pData, size_t sizeBytes)
+		{
+			ASSERT_ERR(assetPath);
+			ASSERT_ERR(pData || sizeBytes == 0);
+
+			char zipPath[MZ_ZIP_MAX_ARCHIVE_FILENAME_SIZE + 1] = {};
+			CHECK_WARN(ComposeZipPath(assetPath, assetSuffix, zipPath));
+
+			AssetPack::FileInfo fileinfo;
+			fileinfo.m_path = zipPath;
+			fileinfo.m_offset = i64(m_pPack->m_data.size());
+			fileinfo.m_size = i64(sizeBytes);
+			fileinfo.m_pSharedData = nullptr;
+			fileinfo.m_accessTimestamp = 0;
+
+			if (!m_pPack->m_directory.insert(std::make_pair(fileinfo.m_path, int(m_pPack->m_files.size()))).second)
+			{
+				WARN("File %s was written to in-memory asset pack %s more than once", zipPath, m_pPack->m_path.c_str());
+				return true;
+			}
+
+			m_pPack->m_files.push_back(fileinfo);
+			if (sizeBytes > 0)
+				m_pPack->m_data.insert(m_pPack->m_data.end(), (const byte *)pData, (const byte *)pData + sizeBytes);
+			return true;
+		}
+
+		bool MemoryAssetSink::WriteImageRows(const char * assetPath, const char * assetSuffix, const void * pPixels, int2 dims, int bytesPerPixel)
+		{
+			ASSERT_ERR(pPixels);
+			ASSERT_ERR(all(dims > 0));
+			ASSERT_ERR(bytesPerPixel > 0);
+
+			return WriteAssetData(assetPath, assetSuffix, pPixels, size_t(dims.x) * dims.y * bytesPerPixel);
+		}
+
+		// Copy a file from one asset pack .zip to another, following it if it's an alias, so
+		// that it's deduplicated against what's in the new pack rather than the old one.
+		// Encoded files are copied without re-encoding them, unless they were aliases or were
+		// compressed against the old pack's dictionary.
+		static bool CopyAssetDataBetweenZips(
+			mz_zip_archive * pZipSrc,
+			int iFile,
+			const std::vector<byte> & dictSrc,
+			mz_zip_archive * pZipOut,
+			PackWriteState * pState)
+		{
+			mz_zip_archive_file_stat fileStat;
+			if (!mz_zip_reader_file_stat(pZipSrc, iFile, &fileStat))
+				return false;
+
+			std::vector<byte> data;
+			EncodedFileInfo info;
+			if (!ExtractFileFromZip(pZipSrc, iFile, dictSrc, &data, &info))
+				return false;
+
+			bool copyAsIs = !FindAliasTarget(fileStat) && info.m_encoding != ENCODING_LZDict;
+			return AddFileToZip(
+					fileStat.m_filename, data.empty() ? nullptr : &data[0], data.size(),
+					PACKCODEC_Auto, pZipOut, pState,
+					info.m_dims, info.m_bytesPerPixel,
+					copyAsIs ? pZipSrc : nullptr, iFile);
+		}
+
+		static AssetSettings GetAssetSettings(const AssetCompileInfo * pACI)
+		{
+			AssetSettings settings =
+			{
+				pACI->m_ack,
+				pACI->m_flags,
+				pACI->m_maxDim,
+				pACI->m_mipBias,
+			};
+			return settings;
+		}
+
+		static bool WriteAssetSettingsToSink(
+			const AssetCompileInfo * pACI,
+			AssetSink * pSinkOut)
+		{
+			AssetSettings settings = GetAssetSettings(pACI);
+			return pSinkOut->WriteAssetData(pACI->m_pathSrc, s_suffixSettings, &settings, sizeof(settings));
+		}
+
+		bool WritePackInfoToSink(
+			const std::string & manifest,
+			AssetSink * pSinkOut)
+		{
+			ASSERT_ERR(pSinkOut);
+
+			VersionInfo version =
+			{
+				PACKVER_Current,
+				MESHVER_Current,
+				MTLVER_Current,
+				TEXVER_Current,
+				SCENEVER_Current,
+			};
+			return pSinkOut->WriteAssetData(s_pathVersionInfo, nullptr, &version, sizeof(version)) &&
+				   pSinkOut->WriteAssetData(s_pathManifest, nullptr, &manifest[0], manifest.length());
+		}
+
+		// Check whether an asset in a pack was compiled with the same settings it has now
+		static bool AssetSettingsMatch(
+			mz_zip_archive * pZip,
+			const std::vector<byte> & dict,
+			const AssetCompileInfo * pACI)
+		{
+			char zipPath[MZ_ZIP_MAX_ARCHIVE_FILENAME_SIZE + 1] = {};
+			if (_snprintf_s(zipPath, _TRUNCATE, "%s%s", pACI->m_pathSrc, s_suffixSettings) < 0 ||
+				!NormalizePath(zipPath))
+			{
+				return false;
+			}
+
+			int fileIndex = mz_zip_reader_locate_file(pZip, zipPath, nullptr, 0);
+			std::vector<byte> settingsStored;
+			if (fileIndex < 0 ||
+				!ExtractFileFromZip(pZip, fileIndex, dict, &settingsStored) ||
+				settingsStored.size() != sizeof(AssetSettings))
+			{
 				return false;
 			}
-			ParseManifest(pManifest, manifestSize, packPath, &pPackOut->m_manifest);
 
-			return true;
+			AssetSettings settings = GetAssetSettings(pACI);
+			return (memcmp(&settings, &settingsStored[0], sizeof(settings)) == 0);
 		}
 
-		// Check that filenames are printable-ASCII-only, lowercase, and there are no backslashes
-		// (this should really be generalized to allow UTF-8 printable chars)
-		bool NormalizePath(char * path)
+		// The deps file is a manifest of source paths, sorted so it comes out the same every time
+		bool WriteAssetDepsToSink(
+			const char * assetPath,
+			const std::vector<std::string> & pathsDep,
+			AssetSink * pSinkOut)
 		{
-			ASSERT_ERR(path);
+			ASSERT_ERR(assetPath);
+			ASSERT_ERR(pSinkOut);
 
-			for (char * pCh = path; *pCh; ++pCh)
+			if (pathsDep.empty())
+				return true;
+
+			std::vector<std::string> pathsSorted(pathsDep);
+			std::sort(pathsSorted.begin(), pathsSorted.end());
+			pathsSorted.erase(std::unique(pathsSorted.begin(), pathsSorted.end()), pathsSorted.end());
+
+			std::string deps;
+			for (int i = 0, c = int(pathsSorted.size()); i < c; ++i)
 			{
-				if (*pCh < 32 || *pCh > 126)
-				{
-					WARN("Invalid character %c in path %s", *pCh, path);
-					return false;
-				}
-				else if (*pCh >= 'A' && *pCh <= 'Z')
-				{
-					*pCh += 32;		// Convert to lowercase
-				}
-				else if (*pCh == '\\')
-				{
-					*pCh = '/';		// Normalize paths to forward slashes
-				}
+				deps += pathsSorted[i];
+				deps += '\n';
 			}
 
-			return true;
+			return pSinkOut->WriteAssetData(assetPath, s_suffixDeps, &deps[0], deps.length());
 		}
 
-		// Write a memory buffer out to an asset pack .zip file.
-		bool WriteAssetDataToZip(
-			const char * assetPath,
-			const char * assetSuffix,
-			const void * pData,
-			size_t sizeBytes,
-			mz_zip_archive * pZipOut)
+		// Check whether any of the other source files an asset was compiled from are newer
+		// than the pack.  As with the asset's own source, ones that don't exist are OK.
+		static bool AssetDepsChanged(
+			mz_zip_archive * pZip,
+			const std::vector<byte> & dict,
+			const AssetCompileInfo * pACI,
+			time_t packTime)
 		{
-			ASSERT_ERR(assetPath);
-			ASSERT_ERR(sizeBytes >= 0);
-			ASSERT_ERR(pData || sizeBytes == 0);
-			ASSERT_ERR(pZipOut);
-
-			if (!assetSuffix)
-				assetSuffix = "";
-
-			// Compose the path, but detect if it's too long
 			char zipPath[MZ_ZIP_MAX_ARCHIVE_FILENAME_SIZE + 1] = {};
-			if (_snprintf_s(zipPath, _TRUNCATE, "%s%s", assetPath, assetSuffix) < 0)
+			if (_snprintf_s(zipPath, _TRUNCATE, "%s%s", pACI->m_pathSrc, s_suffixDeps) < 0 ||
+				!NormalizePath(zipPath))
 			{
-				WARN("File path %s%s is too long for .zip format", assetPath, assetSuffix);
-				return false;
+				return true;
 			}
 
-			CHECK_WARN(NormalizePath(zipPath));
+			// Most assets don't have any
+			int fileIndex = mz_zip_reader_locate_file(pZip, zipPath, nullptr, 0);
+			if (fileIndex < 0)
+				return false;
+
+			std::vector<byte> depsData;
+			if (!ExtractFileFromZip(pZip, fileIndex, dict, &depsData) || depsData.empty())
+				return true;
 
-			if (!mz_zip_writer_add_mem(pZipOut, zipPath, pData, sizeBytes, MZ_NO_COMPRESSION))
+			std::unordered_set<std::string> pathsDep;
+			ParseManifest((const char *)&depsData[0], int(depsData.size()), zipPath, &pathsDep);
+			for (auto iter = pathsDep.begin(), end = pathsDep.end(); iter != end; ++iter)
 			{
-				WARN("Couldn't add file %s to archive", zipPath);
-				return false;
+				struct _stat depStat;
+				if (_stat(iter->c_str(), &depStat) == 0 &&
+					depStat.st_mtime > packTime)
+				{
+					return true;
+				}
 			}
 
-			return true;
+			return false;
 		}
 
 		// Parse an asset pack manifest (newline-delimited list of names) into a set structure.
@@ -414,6 +1890,9 @@ namespace Framework
 
 			std::string manifest;
 
+			PackWriteState packState;
+			ZipAssetSink sink(pZipOut, &packState);
+
 			int numErrors = 0;
 			for (int iAsset = 0; iAsset < numAssets; ++iAsset)
 			{
@@ -424,7 +1903,9 @@ namespace Framework
 				LOG("[%d/%d] Compiling %s asset %s...", iAsset+1, numAssets, s_ackNames[ack], pACI->m_pathSrc);
 
 				// Compile the asset
-				if (s_assetCompileFuncs[ack](pACI, pZipOut))
+				packState.m_codecDefault = s_ackCodecs[ack];
+				if (s_assetCompileFuncs[ack](pACI, &sink) &&
+					WriteAssetSettingsToSink(pACI, &sink))
 				{
 					// Write asset name to the manifest
 					manifest += pACI->m_pathSrc;
@@ -442,20 +1923,52 @@ namespace Framework
 				WARN("Failed to compile %d of %d assets", numErrors, numAssets);
 			}
 
-			// Write version info
-			VersionInfo version =
+			packState.m_codecDefault = PACKCODEC_Auto;
+
+			// Write version info and manifest
+			bool success = WritePackInfoToSink(manifest, &sink);
+
+			// Write the dictionary and the small files waiting for it
+			success = EndPackWrite(pZipOut, &packState, success) && success;
+			return success && (numErrors == 0);
+		}
+
+		// Compile assets straight into an AssetPack in memory.
+		bool CompileAssetsToPack(
+			const AssetCompileInfo * assets,
+			int numAssets,
+			AssetPack * pPackOut)
+		{
+			ASSERT_ERR(assets);
+			ASSERT_ERR(numAssets > 0);
+			ASSERT_ERR(pPackOut);
+
+			MemoryAssetSink sink(pPackOut);
+
+			int numErrors = 0;
+			for (int iAsset = 0; iAsset < numAssets; ++iAsset)
 			{
-				PACKVER_Current,
-				MESHVER_Current,
-				MTLVER_Current,
-				TEXVER_Current,
-			};
-			if (!WriteAssetDataToZip(s_pathVersionInfo, nullptr, &version, sizeof(version), pZipOut))
-				return false;
+				const AssetCompileInfo * pACI = &assets[iAsset];
+				ACK ack = pACI->m_ack;
+				ASSERT_ERR(ack >= 0 && ack < ACK_Count);
 
-			// Write manifest
-			if (!WriteAssetDataToZip(s_pathManifest, nullptr, &manifest[0], manifest.length(), pZipOut))
-				return false;
+				LOG("[%d/%d] Compiling %s asset %s in memory...", iAsset+1, numAssets, s_ackNames[ack], pACI->m_pathSrc);
+
+				if (s_assetCompileFuncs[ack](pACI, &sink))
+				{
+					pPackOut->m_manifest.insert(std::string(pACI->m_pathSrc));
+				}
+				else
+				{
+					WARN("Couldn't compile asset %s", pACI->m_pathSrc);
+					++numErrors;
+				}
+			}
+
+			if (numErrors > 0)
+			{
+				WARN("Failed to compile %d of %d assets", numErrors, numAssets);
+			}
 
 			return (numErrors == 0);
 		}
@@ -481,6 +1994,15 @@ namespace Framework
 				return false;
 			}
 
+			// Load the dictionary, as the version info and manifest may be compressed against it
+			std::vector<byte> dict;
+			if (!LoadDictionaryFromZip(&zip, &dict))
+			{
+				WARN("Couldn't extract dictionary from asset pack %s", packPath);
+				mz_zip_reader_end(&zip);
+				return false;
+			}
+
 			// Extract the version info
 			VersionInfo ver;
 			int fileIndex = mz_zip_reader_locate_file(&zip, s_pathVersionInfo, nullptr, 0);
@@ -490,12 +2012,15 @@ namespace Framework
 				mz_zip_reader_end(&zip);
 				return false;
 			}
-			if (!mz_zip_reader_extract_to_mem(&zip, fileIndex, &ver, sizeof(ver), 0))
+			std::vector<byte> verData;
+			if (!ExtractFileFromZip(&zip, fileIndex, dict, &verData) || verData.size() < sizeof(ver.m_packver))
 			{
 				WARN("Couldn't extract version info from asset pack %s", packPath);
 				mz_zip_reader_end(&zip);
 				return false;
 			}
+			memset(&ver, 0, sizeof(ver));
+			memcpy(&ver, &verData[0], min(verData.size(), sizeof(ver)));
 
 			// If the pack version is wrong, we have to recompile the whole thing
 			if (ver.m_packver != PACKVER_Current)
@@ -515,19 +2040,15 @@ namespace Framework
 				mz_zip_reader_end(&zip);
 				return false;
 			}
-			size_t manifestSize;
-			char * pManifest = (char *)mz_zip_reader_extract_to_heap(&zip, fileIndex, &manifestSize, 0);
-			if (!pManifest)
+			std::vector<byte> manifestData;
+			if (!ExtractFileFromZip(&zip, fileIndex, dict, &manifestData) || manifestData.empty())
 			{
 				WARN("Couldn't extract manifest from asset pack %s", packPath);
 				mz_zip_reader_end(&zip);
 				return false;
 			}
 			std::unordered_set<std::string> manifest;
-			ParseManifest(pManifest, int(manifestSize), packPath, &manifest);
-			mz_free(pManifest);
-
-			mz_zip_reader_end(&zip);
+			ParseManifest((const char *)&manifestData[0], int(manifestData.size()), packPath, &manifest);
 
 			// Get the mod date of the asset pack
 			struct _stat packStat;
@@ -541,6 +2062,8 @@ namespace Framework
 				switch (pACI->m_ack)
 				{
 				case ACK_OBJMesh:
+				case ACK_GLBMesh:
+				case ACK_PLYMesh:
 					if (ver.m_meshver != MESHVER_Current)
 					{
 						pAssetsToUpdateOut->push_back(i);
@@ -558,6 +2081,9 @@ namespace Framework
 
 				case ACK_TextureRaw:
 				case ACK_TextureWithMips:
+				case ACK_VirtualTexture:
+				case ACK_TextureCube:
+				case ACK_Texture3D:
 					if (ver.m_texver != TEXVER_Current)
 					{
 						pAssetsToUpdateOut->push_back(i);
@@ -565,6 +2091,14 @@ namespace Framework
 					}
 					break;
 
+				case ACK_Scene:
+					if (ver.m_scenever != SCENEVER_Current)
+					{
+						pAssetsToUpdateOut->push_back(i);
+						continue;
+					}
+					break;
+
 				default:
 					ERR("Missing case for ACK %d", pACI->m_ack);
 					break;
@@ -577,6 +2111,13 @@ namespace Framework
 					continue;
 				}
 
+				// Check it was compiled with the same flags and settings
+				if (!AssetSettingsMatch(&zip, dict, pACI))
+				{
+					pAssetsToUpdateOut->push_back(i);
+					continue;
+				}
+
 				// Check mod time of the source file against that of the pack
 				// If the source file doesn't exist, that's OK!  Asset packs can be
 				// distributed in lieu of source files.
@@ -587,11 +2128,36 @@ namespace Framework
 					pAssetsToUpdateOut->push_back(i);
 					continue;
 				}
+
+				// Same for any other source files it was compiled from
+				if (AssetDepsChanged(&zip, dict, pACI, packStat.st_mtime))
+				{
+					pAssetsToUpdateOut->push_back(i);
+					continue;
+				}
 			}
 
+			mz_zip_reader_end(&zip);
 			return true;
 		}
 
+		// Generate a temporary filename in a pack's directory, to write a new version of the
+		// pack to before moving it over the old one
+		static void MakeTempPathForPack(const char * packPath, char (&tempPathOut)[MAX_PATH])
+		{
+			char outDir[MAX_PATH] = {};
+			if (const char * pLastSlash = max(strrchr(packPath, '/'), strrchr(packPath, '\\')))
+			{
+				ASSERT_ERR(pLastSlash - packPath < MAX_PATH);
+				memcpy(outDir, packPath, pLastSlash - packPath);
+			}
+			else
+			{
+				outDir[0] = '.';
+			}
+			CHECK_ERR(GetTempFileName(outDir, nullptr, 0, tempPathOut) != 0);
+		}
+
 		// Update an asset pack in-place by recompiling some assets,
 		// preserving any other data already in the pack for the others.
 		bool UpdateAssetPack(
@@ -613,19 +2179,18 @@ namespace Framework
 			}
 			int numSrcFiles = int(mz_zip_reader_get_num_files(&zipSrc));
 
-			// Generate a temporary filename for the new archive
-			char outDir[MAX_PATH] = {};
-			if (const char * pLastSlash = max(strrchr(packPath, '/'), strrchr(packPath, '\\')))
-			{
-				ASSERT_ERR(pLastSlash - packPath < MAX_PATH);
-				memcpy(outDir, packPath, pLastSlash - packPath);
-			}
-			else
+			// Files compressed against the old dictionary will need it to be copied
+			std::vector<byte> dictSrc;
+			if (!LoadDictionaryFromZip(&zipSrc, &dictSrc))
 			{
-				outDir[0] = '.';
+				WARN("Couldn't extract dictionary from asset pack %s", packPath);
+				mz_zip_reader_end(&zipSrc);
+				return false;
 			}
+
+			// Generate a temporary filename for the new archive
 			char tempPath[MAX_PATH];
-			CHECK_ERR(GetTempFileName(outDir, nullptr, 0, tempPath) != 0);
+			MakeTempPathForPack(packPath, tempPath);
 
 			// Open the temporary file for writing
 			mz_zip_archive zipDest = {};
@@ -640,11 +2205,16 @@ namespace Framework
 			int numErrors = 0;
 			int numAssetsToUpdate = int(assetsToUpdate.size());
 
+			PackWriteState packState;
+			ZipAssetSink sink(&zipDest, &packState);
+
 			// Iterate over assets, tracking position in both original asset list and
 			// list of assets that need updates (a sorted subset of the original ones)
 			for (int iAsset = 0, iAssetToUpdate = 0; iAsset < numAssets; ++iAsset)
 			{
 				const AssetCompileInfo * pACI = &assets[iAsset];
+				ASSERT_ERR(pACI->m_ack >= 0 && pACI->m_ack < ACK_Count);
+				packState.m_codecDefault = s_ackCodecs[pACI->m_ack];
 
 				// Does this asset need recompiling?
 				while (iAssetToUpdate < numAssetsToUpdate && assetsToUpdate[iAssetToUpdate] < iAsset)
@@ -653,13 +2223,13 @@ namespace Framework
 				if (iAssetToUpdate < numAssetsToUpdate && assetsToUpdate[iAssetToUpdate] == iAsset)
 				{
 					ACK ack = pACI->m_ack;
-					ASSERT_ERR(ack >= 0 && ack < ACK_Count);
 			
 					LOG("[%d/%d] Compiling %s asset %s...",
 						iAssetToUpdate+1, numAssetsToUpdate, s_ackNames[ack], pACI->m_pathSrc);
 
 					// Compile the asset
-					if (s_assetCompileFuncs[ack](pACI, &zipDest))
+					if (s_assetCompileFuncs[ack](pACI, &sink) &&
+						WriteAssetSettingsToSink(pACI, &sink))
 					{
 						// Write asset name to the manifest
 						manifest += pACI->m_pathSrc;
@@ -681,10 +2251,11 @@ namespace Framework
 						mz_zip_reader_get_filename(&zipSrc, i, filename, sizeof(filename));
 						if (_strnicmp(filename, pACI->m_pathSrc, strlen(pACI->m_pathSrc)) == 0)
 						{
-							if (!mz_zip_writer_add_from_zip_reader(&zipDest, &zipSrc, i))
+							if (!CopyAssetDataBetweenZips(&zipSrc, i, dictSrc, &zipDest, &packState))
 							{
 								WARN("Couldn't copy file %s from asset pack %s to temporary archive %s",
 									filename, packPath, tempPath);
+								EndPackWrite(&zipDest, &packState, false);
 								mz_zip_reader_end(&zipSrc);
 								mz_zip_writer_end(&zipDest);
 								DeleteFile(tempPath);
@@ -706,29 +2277,206 @@ namespace Framework
 				WARN("Failed to compile %d of %d assets", numErrors, numAssetsToUpdate);
 			}
 
-			// Write version info
-			VersionInfo version =
-			{
-				PACKVER_Current,
-				MESHVER_Current,
-				MTLVER_Current,
-				TEXVER_Current,
-			};
-			if (!WriteAssetDataToZip(s_pathVersionInfo, nullptr, &version, sizeof(version), &zipDest))
+			packState.m_codecDefault = PACKCODEC_Auto;
+
+			// Write version info and manifest
+			bool success = WritePackInfoToSink(manifest, &sink);
+
+			// Write the dictionary and the small files waiting for it
+			success = EndPackWrite(&zipDest, &packState, success) && success;
+			if (!success)
 			{
 				mz_zip_writer_end(&zipDest);
 				DeleteFile(tempPath);
 				return false;
 			}
 
-			// Write manifest
-			if (!WriteAssetDataToZip(s_pathManifest, nullptr, &manifest[0], manifest.length(), &zipDest))
+			if (!mz_zip_writer_finalize_archive(&zipDest))
 			{
+				WARN("Couldn't finalize temporary archive %s", tempPath);
 				mz_zip_writer_end(&zipDest);
 				DeleteFile(tempPath);
 				return false;
 			}
 
+			mz_zip_writer_end(&zipDest);
+
+			// Move the new version of the asset pack over the old one
+			if (!MoveFileEx(tempPath, packPath, MOVEFILE_COPY_ALLOWED | MOVEFILE_REPLACE_EXISTING))
+			{
+				WARN("Couldn't rename temporary file %s over asset pack %s", tempPath, packPath);
+				return false;
+			}
+
+			return (numErrors == 0);
+		}
+
+		// Add a file to a pack's new order, if it isn't there already.  An alias's data is in
+		// its target, so that goes first.
+		static void PlaceFileInOrder(
+			mz_zip_archive * pZip,
+			const char * path,
+			std::vector<bool> * pPlaced,
+			std::vector<int> * pOrder)
+		{
+			int iFile = mz_zip_reader_locate_file(pZip, path, nullptr, 0);
+			if (iFile < 0 || (*pPlaced)[iFile])
+				return;
+			(*pPlaced)[iFile] = true;
+
+			mz_zip_archive_file_stat fileStat;
+			if (mz_zip_reader_file_stat(pZip, iFile, &fileStat))
+			{
+				if (const char * aliasTarget = FindAliasTarget(fileStat))
+					PlaceFileInOrder(pZip, aliasTarget, pPlaced, pOrder);
+			}
+
+			pOrder->push_back(iFile);
+		}
+
+#if LOG_PACK_STATS
+		// Read the given files straight from disk in order, bypassing the file cache as on a cold
+		// start, and time it.  Reads are rounded out to whole sectors, as unbuffered I/O requires.
+		static float TimeColdReads(
+			const char * packPath,
+			std::vector<std::string> const & paths,
+			int * pSeeksOut)
+		{
+			static const u64 s_sectorSize = 4096;
+			static const DWORD s_readSizeMax = 1024 * 1024;
+
+			*pSeeksOut = 0;
+
+			// Find each file's extent: a 30-byte local header, the name, an extra field that isn't
+			// in the directory (at most the 20-byte Zip64 one miniz writes), then the data.
+			std::vector<std::pair<u64, u64>> extents;
+			mz_zip_archive zip = {};
+			if (!mz_zip_reader_init_file(&zip, packPath, 0))
+				return 0.0f;
+			for (int i = 0, c = int(paths.size()); i < c; ++i)
+			{
+				mz_zip_archive_file_stat fileStat;
+				int iFile = mz_zip_reader_locate_file(&zip, paths[i].c_str(), nullptr, 0);
+				if (iFile < 0 || !mz_zip_reader_file_stat(&zip, iFile, &fileStat))
+					continue;
+				u64 start = fileStat.m_local_header_ofs;
+				u64 end = start + 30 + strlen(fileStat.m_filename) + 20 + fileStat.m_comp_size;
+				extents.push_back(std::make_pair(start & ~(s_sectorSize - 1), (end + s_sectorSize - 1) & ~(s_sectorSize - 1)));
+			}
+			mz_zip_reader_end(&zip);
+
+			HANDLE hFile = CreateFile(packPath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, nullptr);
+			if (hFile == INVALID_HANDLE_VALUE)
+				return 0.0f;
+			void * pBuffer = VirtualAlloc(nullptr, s_readSizeMax, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+
+			LARGE_INTEGER freq, timeStart, timeEnd;
+			QueryPerformanceFrequency(&freq);
+			QueryPerformanceCounter(&timeStart);
+			u64 posCur = 0;
+			for (int i = 0, c = int(extents.size()); i < c; ++i)
+			{
+				// Carry on from the last read if this file starts in the sector it ended in
+				u64 pos = extents[i].first;
+				if (pos <= posCur && pos + s_sectorSize >= posCur)
+					pos = posCur;
+				else
+					++*pSeeksOut;
+
+				while (pos < extents[i].second)
+				{
+					LARGE_INTEGER offset;
+					offset.QuadPart = LONGLONG(pos);
+					DWORD bytesRead = 0;
+					SetFilePointerEx(hFile, offset, nullptr, FILE_BEGIN);
+					if (!ReadFile(hFile, pBuffer, DWORD(min(u64(s_readSizeMax), extents[i].second - pos)), &bytesRead, nullptr) || bytesRead == 0)
+						break;
+					pos += bytesRead;
+				}
+				posCur = pos;
+			}
+			QueryPerformanceCounter(&timeEnd);
+
+			VirtualFree(pBuffer, 0, MEM_RELEASE);
+			CloseHandle(hFile);
+			return 1000.0f * float(timeEnd.QuadPart - timeStart.QuadPart) / float(freq.QuadPart);
+		}
+#endif
+
+		// Rewrite an asset pack in-place with the given files first, in that order.
+		bool RewriteAssetPackInOrder(
+			const char * packPath,
+			std::vector<std::string> const & pathsFirst)
+		{
+			ASSERT_ERR(packPath);
+
+			mz_zip_archive zipSrc = {};
+			if (!mz_zip_reader_init_file(&zipSrc, packPath, 0))
+			{
+				WARN("Couldn't load asset pack %s", packPath);
+				return false;
+			}
+			int numSrcFiles = int(mz_zip_reader_get_num_files(&zipSrc));
+
+			// Every load reads the pack's own files, so they go at the very front.  Then the
+			// profiled files, in the order they were used, then everything else.
+			std::vector<bool> placed(numSrcFiles, false);
+			std::vector<int> order;
+			order.reserve(numSrcFiles);
+			PlaceFileInOrder(&zipSrc, s_pathDictionary, &placed, &order);
+			PlaceFileInOrder(&zipSrc, s_pathVersionInfo, &placed, &order);
+			PlaceFileInOrder(&zipSrc, s_pathManifest, &placed, &order);
+			for (int i = 0, c = int(pathsFirst.size()); i < c; ++i)
+				PlaceFileInOrder(&zipSrc, pathsFirst[i].c_str(), &placed, &order);
+			int numPlacedFirst = int(order.size());
+			for (int i = 0; i < numSrcFiles; ++i)
+			{
+				if (!placed[i])
+					order.push_back(i);
+			}
+
+			bool inOrder = true;
+			for (int i = 0; i < numSrcFiles && inOrder; ++i)
+				inOrder = (order[i] == i);
+			if (inOrder)
+			{
+				LOG("Asset pack %s is already in access order", packPath);
+				mz_zip_reader_end(&zipSrc);
+				return true;
+			}
+
+			// Copy the files over to a temporary archive in their new order
+			char tempPath[MAX_PATH];
+			MakeTempPathForPack(packPath, tempPath);
+
+			mz_zip_archive zipDest = {};
+			if (!mz_zip_writer_init_file(&zipDest, tempPath, 0))
+			{
+				WARN("Couldn't open temporary file %s for writing", tempPath);
+				mz_zip_reader_end(&zipSrc);
+				return false;
+			}
+
+			i64 bytesFirst = 0;
+			for (int i = 0; i < numSrcFiles; ++i)
+			{
+				if (!mz_zip_writer_add_from_zip_reader(&zipDest, &zipSrc, order[i]))
+				{
+					char filename[MZ_ZIP_MAX_ARCHIVE_FILENAME_SIZE];
+					mz_zip_reader_get_filename(&zipSrc, order[i], filename, sizeof(filename));
+					WARN("Couldn't copy file %s from asset pack %s to temporary archive %s",
+						filename, packPath, tempPath);
+					mz_zip_reader_end(&zipSrc);
+					mz_zip_writer_end(&zipDest);
+					DeleteFile(tempPath);
+					return false;
+				}
+				if (i == numPlacedFirst - 1)
+					bytesFirst = i64(zipDest.m_archive_size);
+			}
+
+			mz_zip_reader_end(&zipSrc);
+
 			if (!mz_zip_writer_finalize_archive(&zipDest))
 			{
 				WARN("Couldn't finalize temporary archive %s", tempPath);
@@ -739,6 +2487,18 @@ namespace Framework
 
 			mz_zip_writer_end(&zipDest);
 
+			LOG("Reordered asset pack %s - %d of %d files moved to the front in access order, in the first %dKB",
+				packPath, numPlacedFirst, numSrcFiles, int(bytesFirst / 1024));
+
+#if LOG_PACK_STATS
+			// Compare cold reads of the profiled files from the old and new layouts
+			int seeksBefore, seeksAfter;
+			float msBefore = TimeColdReads(packPath, pathsFirst, &seeksBefore);
+			float msAfter = TimeColdReads(tempPath, pathsFirst, &seeksAfter);
+			LOG("Asset pack %s: cold reads of %d profiled files took %0.2f ms with %d seeks before reordering, %0.2f ms with %d seeks after",
+				packPath, int(pathsFirst.size()), msBefore, seeksBefore, msAfter, seeksAfter);
+#endif
+
 			// Move the new version of the asset pack over the old one
 			if (!MoveFileEx(tempPath, packPath, MOVEFILE_COPY_ALLOWED | MOVEFILE_REPLACE_EXISTING))
 			{
@@ -746,7 +2506,43 @@ namespace Framework
 				return false;
 			}
 
-			return (numErrors == 0);
+			return true;
+		}
+
+		// Split [0, count) into chunks of at least grainSize and run them across all cores.
+		void ParallelFor(
+			int count,
+			int grainSize,
+			const std::function<void (int iStart, int iEnd)> & func)
+		{
+			ASSERT_ERR(count >= 0);
+			ASSERT_ERR(grainSize > 0);
+
+			if (count == 0)
+				return;
+
+			int numThreads = max(1, int(std::thread::hardware_concurrency()));
+			int numChunks = min(numThreads, (count + grainSize - 1) / grainSize);
+			if (numChunks <= 1)
+			{
+				func(0, count);
+				return;
+			}
+
+			// Run the first chunk on this thread, and the rest on helper threads
+			std::vector<std::thread> threads;
+			threads.reserve(numChunks - 1);
+			for (int iChunk = 1; iChunk < numChunks; ++iChunk)
+			{
+				int iStart = int(i64(count) * iChunk / numChunks);
+				int iEnd = int(i64(count) * (iChunk + 1) / numChunks);
+				threads.push_back(std::thread(func, iStart, iEnd));
+			}
+
+			func(0, int(count / numChunks));
+
+			for (int i = 0, c = int(threads.size()); i < c; ++i)
+				threads[i].join();
 		}
 	}
 }
@@ -8,8 +8,10 @@ namespace Framework
 		struct FileInfo
 		{
 			std::string		m_path;			// Archive internal path
-			int				m_offset;		// Starting offset into m_data
-			int				m_size;			// Size in bytes
+			i64				m_offset;		// Starting offset into m_data
+			i64				m_size;			// Size in bytes
+			const byte *	m_pSharedData;	// Identical data in another pack, if shared through an AssetContentStore
+			i64				m_accessTimestamp;	// QPC time of the first lookup while recording accesses, or 0
 		};
 
 		std::vector<byte>						m_data;				// Entire uncompressed archive
@@ -17,27 +19,93 @@ namespace Framework
 		std::unordered_map<std::string, int>	m_directory;		// Mapping from internal path to index in m_files
 		std::unordered_set<std::string>			m_manifest;			// List of asset names in the pack
 		std::string								m_path;				// File path where the asset pack was loaded from
+		std::vector<comptr<AssetPack>>			m_packsShared;		// Other packs that shared files point into
+		std::vector<int>						m_accessOrder;		// Files in the order they were first looked up, while recording
+		i64										m_accessStartTimestamp;	// QPC time recording started, or 0 if not recording
 
 		AssetPack();
-		bool LookupFile(const char * path, const char * suffix, void ** pDataOut, int * pSizeOut);
+		bool LookupFile(const char * path, const char * suffix, void ** pDataOut, i64 * pSizeOut);
 		bool HasAsset(const char * path);
 		void Reset();
+
+		// Record the order and time of each file's first lookup from now on, and save them as
+		// an access profile, for ReorderAssetPack to lay the pack out by.
+		void StartRecordingAccesses();
+		bool SaveAccessProfile(const char * profilePath) const;
+	};
+
+	// Lets asset packs loaded through it share files with identical contents, so data used by
+	// several packs (such as a texture used in several levels) is only kept in memory once.
+	// Files are looked up by size and CRC-32, then compared byte for byte.  Packs loaded
+	// through the store must be heap-allocated, as the store keeps references to them.
+	class AssetContentStore
+	{
+	public:
+		struct Blob
+		{
+			const byte *	m_pData;		// Points into the m_data of the pack that loaded it first
+			i64				m_size;
+		};
+
+		std::unordered_multimap<u64, Blob>	m_blobs;			// Keyed by (size << 32) | CRC-32
+		std::vector<comptr<AssetPack>>		m_packs;			// Packs that the blobs point into
+		i64									m_bytesShared;		// Total not loaded thanks to sharing
+
+		AssetContentStore();
+		void Reset();
 	};
 
 	enum ACK					// Asset Compile Kind
 	{
 		ACK_OBJMesh,			// .obj mesh, compiled to vtx/idx buffers and mtl map
 		ACK_OBJMtlLib,			// .mtl material library that goes alongside an .obj
-		ACK_TextureRaw,			// Single RGBA8 image
-		ACK_TextureWithMips,	// RGBA8 image, resampled up to pow2 and mips generated
+		ACK_TextureRaw,			// Single image, RGBA8 or BC-compressed
+		ACK_TextureWithMips,	// Image with mips generated, RGBA8 or BC-compressed
+		ACK_GLBMesh,			// Binary glTF 2.0 mesh, compiled the same way as ACK_OBJMesh
+		ACK_PLYMesh,			// Binary PLY mesh, compiled the same way as ACK_OBJMesh
+		ACK_Scene,				// Text list of mesh instances and their transforms
+		ACK_VirtualTexture,		// Image with mips generated, cut into tiles for virtual texturing
+		ACK_TextureCube,		// Equirect or cross image, with GGX-prefiltered mips and SH9 irradiance
+		ACK_Texture3D,			// Image of square slices in a row or column, with 3D mips generated
 
 		ACK_Count
 	};
 
+	enum ACF					// Asset Compile Flags
+	{
+		ACF_SplitVertexStreams	= 0x01,		// Mesh: store positions in their own vertex stream
+		ACF_VertexNoNormals		= 0x02,		// Mesh: leave normals out of the vertex format
+		ACF_VertexNoUVs			= 0x04,		// Mesh: leave UVs out of the vertex format
+		ACF_VertexTangents		= 0x08,		// Mesh: generate tangents and include them in the vertex format
+		ACF_TextureCompress		= 0x10,		// Texture: BC-compress (BC1/BC3 for color, BC4 for masks, BC5 for normal maps); MTL lib: same, for generated normal maps
+		ACF_TextureMask			= 0x20,		// Texture: single-channel linear data, from the red channel
+		ACF_TextureNormalMap	= 0x40,		// Texture: two-channel linear data, from the red and green channels
+		ACF_TextureHighQuality	= 0x80,		// Texture/MTL lib: slower, higher-quality compression; color textures use BC7
+		ACF_TexturePow2			= 0x100,	// Texture: resample non-pow2 textures up to pow2 before making mips
+		ACF_MtlPackChannels		= 0x200,	// MTL lib: pack each material's spec, mask and height maps into one texture
+		ACF_TextureHDR			= 0x400,	// Texture: load as float and store as FP16 (R11G11B10 if compressed); automatic for .hdr
+
+		ACF_Default				= 0x00,
+	};
+
 	struct AssetCompileInfo
 	{
 		const char *	m_pathSrc;
 		ACK				m_ack;
+		int				m_flags;		// Combination of ACF flags
+		int				m_maxDim;		// Texture: drop top mips until it fits in this size; 0 for no limit
+		int				m_mipBias;		// Texture: drop this many more top mips
+	};
+
+	// A quality tier for an asset pack, applied on top of each asset's own settings.  Each
+	// profile is compiled to a sibling pack with the profile name inserted before the
+	// extension, e.g. "assets-low.zip"; a profile with no name is the pack path itself.
+	struct AssetProfile
+	{
+		const char *	m_name;
+		int				m_maxDim;		// Clamps each texture's m_maxDim; 0 for no limit
+		int				m_mipBias;		// Added to each texture's m_mipBias
+		int				m_flagsAdd;		// ACF flags added to every asset, e.g. ACF_TextureCompress
 	};
 
 	// Load an asset pack file, checking that all its assets are present and up to date,
@@ -46,10 +114,50 @@ namespace Framework
 		const char * packPath,
 		const AssetCompileInfo * assets,
 		int numAssets,
-		AssetPack * pPackOut);
+		AssetPack * pPackOut,
+		AssetContentStore * pStore = nullptr);
+
+	// Check and compile the pack for each profile as above, then load the first one whose
+	// uncompressed data fits in the memory budget.  Profiles are listed from highest quality
+	// to lowest; if none of them fits, the last one is loaded.
+	bool LoadAssetPackForBudget(
+		const char * packPath,
+		const AssetCompileInfo * assets,
+		int numAssets,
+		const AssetProfile * profiles,
+		int numProfiles,
+		i64 budgetBytes,
+		AssetPack * pPackOut,
+		AssetContentStore * pStore = nullptr);
+
+	// How much checking packs get when they're loaded.  The default is Trust, so loading never
+	// writes anything.  With VerifyOnChange, a pack that passes is stamped by writing its
+	// modification time and size to a sidecar file, the pack's path plus ".verified", and
+	// isn't checked again until it changes.
+	enum PACKINTEGRITY
+	{
+		PACKINTEGRITY_Trust,			// Don't check CRCs (default)
+		PACKINTEGRITY_VerifyOnChange,	// Check CRCs on the first load after the pack changes
+		PACKINTEGRITY_VerifyAlways,		// Check CRCs on every load
+
+		PACKINTEGRITY_Count
+	};
+
+	// Set how packs are checked by all loads from here on, e.g. VerifyAlways on build machines
+	// and Trust for shipped builds that can count on the installer to check the files.
+	void SetAssetPackIntegrity(PACKINTEGRITY integrity);
 
 	// Just load an asset pack file.
 	bool LoadAssetPack(
 		const char * packPath,
-		AssetPack * pPackOut);
+		AssetPack * pPackOut,
+		AssetContentStore * pStore = nullptr);
+
+	// Rewrite an asset pack with its files in the order of an access profile saved by
+	// AssetPack::SaveAccessProfile, so a run like the profiled one reads it front to back.
+	// Files the profile doesn't mention go after, in their existing order.  Compiling lays
+	// the pack out in compile order again, so run this after any assets are recompiled.
+	bool ReorderAssetPack(
+		const char * packPath,
+		const char * profilePath);
 }
@@ -2,7 +2,10 @@
 
 #include <util.h>
 
+#include <condition_variable>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -39,9 +42,13 @@ namespace Framework
 #include "gpuprofiler.h"
 #include "material.h"
 #include "mesh.h"
+#include "mtlbatch.h"
 #include "rendertarget.h"
+#include "scene.h"
 #include "shadow.h"
+#include "texstream.h"
 #include "texture.h"
 #include "timer.h"
+#include "vtexture.h"
 
 #include "asset.h"
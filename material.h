@@ -5,18 +5,31 @@ namespace Framework
 	class Texture2D;
 	class TextureLib;
 
+	// Channels of a material's packed texture, if it has one
+	enum PACKCH
+	{
+		PACKCH_Spec,
+		PACKCH_Mask,
+		PACKCH_Height,
+
+		PACKCH_Count
+	};
+
 	// Very simple, hard-coded set of parameters for now
 	struct Material
 	{
 		const char *	m_mtlName;
 		Texture2D *		m_pTexDiffuseColor;
-		Texture2D *		m_pTexSpecColor;
-		Texture2D *		m_pTexHeight;
+		Texture2D *		m_pTexSpecColor;	// Only looked up if there's no m_pTexPacked
+		Texture2D *		m_pTexHeight;		// Only looked up if there's no m_pTexNormal
+		Texture2D *		m_pTexNormal;		// Generated from the height map at compile time
+		Texture2D *		m_pTexPacked;		// Spec, mask and height packed together at compile time
+		int				m_packedChannels[PACKCH_Count];	// Channel of m_pTexPacked holding each, or -1
 		rgb				m_rgbDiffuseColor;
 		rgb				m_rgbSpecColor;
 		float			m_specPower;
 		float			m_bumpScale;
-		bool			m_alphaTest;
+		bool			m_alphaTest;		// Set if the .mtl has a map_d (alpha/dissolve texture)
 	};
 
 	class MaterialLib
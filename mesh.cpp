@@ -2,52 +2,279 @@
 
 namespace Framework
 {
+	// Vertex format helpers
+
+	template <int vattribs>
+	static VertexFormat MakeVertexFormat()
+	{
+		typedef VertexLayout<vattribs> Layout;
+		VertexFormat format =
+		{
+			vattribs,
+			(vattribs & VATTR_Normal) ? Layout::s_offsetNormal : -1,
+			(vattribs & VATTR_UV) ? Layout::s_offsetUV : -1,
+			(vattribs & VATTR_Tangent) ? Layout::s_offsetTangent : -1,
+			Layout::s_strideBytes,
+		};
+		return format;
+	}
+
+	const VertexFormat & GetVertexFormat(int vattribs)
+	{
+		ASSERT_ERR(vattribs >= 0 && vattribs <= VATTR_All);
+
+		static const VertexFormat s_formats[] =
+		{
+			MakeVertexFormat<0>(),
+			MakeVertexFormat<1>(),
+			MakeVertexFormat<2>(),
+			MakeVertexFormat<3>(),
+			MakeVertexFormat<4>(),
+			MakeVertexFormat<5>(),
+			MakeVertexFormat<6>(),
+			MakeVertexFormat<7>(),
+		};
+		cassert(dim(s_formats) == VATTR_All + 1);
+
+		return s_formats[vattribs];
+	}
+
+
+
+	// Vertex stream layout helpers
+
+	int StrideOfVertexStream(VLAYOUT vlayout, int vattribs, int iStream)
+	{
+		ASSERT_ERR(vlayout >= 0 && vlayout < VLAYOUT_Count);
+		ASSERT_ERR(iStream >= 0 && iStream < VSTREAM_Count);
+
+		int strideBytes = GetVertexFormat(vattribs).m_strideBytes;
+
+		if (vlayout == VLAYOUT_Interleaved)
+			return (iStream == VSTREAM_Pos) ? strideBytes : 0;
+
+		// Split: the attribute stream is everything after the position (and absent if that's nothing)
+		if (iStream == VSTREAM_Pos)
+			return sizeof(float3);
+		return strideBytes - int(sizeof(float3));
+	}
+
+	int SelectVertexStreams(VLAYOUT vlayout, int streamMask, int aiStreamForSlotOut[VSTREAM_Count])
+	{
+		ASSERT_ERR(vlayout >= 0 && vlayout < VLAYOUT_Count);
+		ASSERT_ERR(aiStreamForSlotOut);
+
+		for (int i = 0; i < VSTREAM_Count; ++i)
+			aiStreamForSlotOut[i] = -1;
+
+		if (vlayout == VLAYOUT_Interleaved)
+		{
+			// Everything lives in stream 0, so it's needed no matter which attributes are asked for
+			if (streamMask & VSTREAMMASK_All)
+			{
+				aiStreamForSlotOut[0] = VSTREAM_Pos;
+				return 1;
+			}
+			return 0;
+		}
+
+		// Split: each requested stream goes in the slot matching its index, so that input
+		// layouts for different subsets of streams agree on where each attribute comes from
+		int slotsUsed = 0;
+		for (int iStream = 0; iStream < VSTREAM_Count; ++iStream)
+		{
+			if (streamMask & (1 << iStream))
+			{
+				aiStreamForSlotOut[iStream] = iStream;
+				slotsUsed = iStream + 1;
+			}
+		}
+		return slotsUsed;
+	}
+
+	void GetInputElementDescs(
+		VLAYOUT vlayout,
+		int vattribs,
+		int streamMask,
+		std::vector<D3D11_INPUT_ELEMENT_DESC> * pDescsOut)
+	{
+		ASSERT_ERR(vlayout >= 0 && vlayout < VLAYOUT_Count);
+		ASSERT_ERR(pDescsOut);
+
+		pDescsOut->clear();
+
+		const VertexFormat & format = GetVertexFormat(vattribs);
+
+		// Interleaved: everything is in slot 0, at its offset in the whole vertex.
+		// Split: attributes are in the attribs slot, at their offset after the position.
+		UINT attribSlot = (vlayout == VLAYOUT_Interleaved) ? 0 : VSTREAM_Attribs;
+		int attribOffsetBias = (vlayout == VLAYOUT_Interleaved) ? 0 : int(sizeof(float3));
+
+		if (streamMask & VSTREAMMASK_Pos)
+		{
+			D3D11_INPUT_ELEMENT_DESC desc = { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, VSTREAM_Pos, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 };
+			pDescsOut->push_back(desc);
+		}
+
+		if (streamMask & VSTREAMMASK_Attribs)
+		{
+			if (format.m_offsetNormal >= 0)
+			{
+				D3D11_INPUT_ELEMENT_DESC desc = { "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, attribSlot, UINT(format.m_offsetNormal - attribOffsetBias), D3D11_INPUT_PER_VERTEX_DATA, 0 };
+				pDescsOut->push_back(desc);
+			}
+			if (format.m_offsetUV >= 0)
+			{
+				D3D11_INPUT_ELEMENT_DESC desc = { "UV", 0, DXGI_FORMAT_R32G32_FLOAT, attribSlot, UINT(format.m_offsetUV - attribOffsetBias), D3D11_INPUT_PER_VERTEX_DATA, 0 };
+				pDescsOut->push_back(desc);
+			}
+			if (format.m_offsetTangent >= 0)
+			{
+				D3D11_INPUT_ELEMENT_DESC desc = { "TANGENT", 0, DXGI_FORMAT_R32G32B32_FLOAT, attribSlot, UINT(format.m_offsetTangent - attribOffsetBias), D3D11_INPUT_PER_VERTEX_DATA, 0 };
+				pDescsOut->push_back(desc);
+			}
+		}
+	}
+
+
+
+	// Mesh implementation
+
 	Mesh::Mesh()
-	:	m_pVerts(nullptr),
+	:	m_vlayout(VLAYOUT_Interleaved),
+		m_vattribs(VATTR_Default),
 		m_pIndices(nullptr),
 		m_vertCount(0),
 		m_indexCount(0),
-		m_vtxStrideBytes(0),
+		m_pDepthIndices(nullptr),
+		m_depthIndexCount(0),
+		m_depthOpaqueIndexCount(0),
 		m_primtopo(D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED),
 		m_bounds(empty)
 	{
+		for (int i = 0; i < VSTREAM_Count; ++i)
+		{
+			m_apVerts[i] = nullptr;
+			m_aVtxStrideBytes[i] = 0;
+		}
 	}
 
-	void Mesh::Draw(ID3D11DeviceContext * pCtx)
+	void Mesh::Bind(ID3D11DeviceContext * pCtx, int streamMask /* = VSTREAMMASK_All */)
 	{
 		ASSERT_ERR(pCtx);
 
-		UINT zero = 0;
-		pCtx->IASetVertexBuffers(0, 1, &m_pVtxBuffer, (UINT *)&m_vtxStrideBytes, &zero);
+		BindVertexBuffers(pCtx, streamMask);
 		pCtx->IASetIndexBuffer(m_pIdxBuffer, DXGI_FORMAT_R32_UINT, 0);
+	}
+
+	void Mesh::BindVertexBuffers(ID3D11DeviceContext * pCtx, int streamMask)
+	{
+		ASSERT_ERR(pCtx);
+
+		int aiStreamForSlot[VSTREAM_Count];
+		int slotsUsed = SelectVertexStreams(m_vlayout, streamMask, aiStreamForSlot);
+		ASSERT_ERR(slotsUsed > 0);
+
+		ID3D11Buffer * apBuffers[VSTREAM_Count] = {};
+		UINT aStrides[VSTREAM_Count] = {};
+		UINT aOffsets[VSTREAM_Count] = {};
+		for (int iSlot = 0; iSlot < slotsUsed; ++iSlot)
+		{
+			int iStream = aiStreamForSlot[iSlot];
+			if (iStream < 0)
+				continue;
+			apBuffers[iSlot] = m_apVtxBuffers[iStream];
+			aStrides[iSlot] = UINT(m_aVtxStrideBytes[iStream]);
+		}
+
+		pCtx->IASetVertexBuffers(0, slotsUsed, apBuffers, aStrides, aOffsets);
 		pCtx->IASetPrimitiveTopology(m_primtopo);
-		pCtx->DrawIndexed(m_indexCount, 0, 0);
 	}
 
-	void Mesh::DrawMtlRange(ID3D11DeviceContext * pCtx, int iMtlRange)
+	void Mesh::Draw(
+		ID3D11DeviceContext * pCtx,
+		int streamMask /* = VSTREAMMASK_All */,
+		int instanceCount /* = 1 */,
+		int instanceStart /* = 0 */)
+	{
+		ASSERT_ERR(pCtx);
+		ASSERT_ERR(instanceCount >= 0 && instanceStart >= 0);
+
+		Bind(pCtx, streamMask);
+		pCtx->DrawIndexedInstanced(m_indexCount, instanceCount, 0, 0, instanceStart);
+	}
+
+	void Mesh::DrawMtlRange(
+		ID3D11DeviceContext * pCtx,
+		int iMtlRange,
+		int streamMask /* = VSTREAMMASK_All */,
+		int instanceCount /* = 1 */,
+		int instanceStart /* = 0 */)
 	{
 		ASSERT_ERR(pCtx);
 		ASSERT_ERR(iMtlRange >= 0 && iMtlRange < int(m_mtlRanges.size()));
+		ASSERT_ERR(instanceCount >= 0 && instanceStart >= 0);
 
 		const MtlRange * pRange = &m_mtlRanges[iMtlRange];
 
-		UINT zero = 0;
-		pCtx->IASetVertexBuffers(0, 1, &m_pVtxBuffer, (UINT *)&m_vtxStrideBytes, &zero);
-		pCtx->IASetIndexBuffer(m_pIdxBuffer, DXGI_FORMAT_R32_UINT, 0);
-		pCtx->IASetPrimitiveTopology(m_primtopo);
-		pCtx->DrawIndexed(pRange->m_indexCount, pRange->m_indexStart, 0);
+		Bind(pCtx, streamMask);
+		pCtx->DrawIndexedInstanced(pRange->m_indexCount, instanceCount, pRange->m_indexStart, 0, instanceStart);
+	}
+
+	void Mesh::DrawDepthOpaque(
+		ID3D11DeviceContext * pCtx,
+		int instanceCount /* = 1 */,
+		int instanceStart /* = 0 */)
+	{
+		ASSERT_ERR(pCtx);
+		ASSERT_ERR(instanceCount >= 0 && instanceStart >= 0);
+
+		if (m_depthOpaqueIndexCount == 0)
+			return;
+
+		BindVertexBuffers(pCtx, VSTREAMMASK_Pos);
+		pCtx->IASetIndexBuffer(m_pDepthIdxBuffer, DXGI_FORMAT_R32_UINT, 0);
+		pCtx->DrawIndexedInstanced(m_depthOpaqueIndexCount, instanceCount, 0, 0, instanceStart);
+	}
+
+	void Mesh::DrawDepthAlphaTestRange(
+		ID3D11DeviceContext * pCtx,
+		int iDepthMtlRange,
+		int instanceCount /* = 1 */,
+		int instanceStart /* = 0 */)
+	{
+		ASSERT_ERR(pCtx);
+		ASSERT_ERR(iDepthMtlRange >= 0 && iDepthMtlRange < int(m_depthMtlRanges.size()));
+		ASSERT_ERR(instanceCount >= 0 && instanceStart >= 0);
+
+		const MtlRange * pRange = &m_depthMtlRanges[iDepthMtlRange];
+
+		BindVertexBuffers(pCtx, VSTREAMMASK_All);
+		pCtx->IASetIndexBuffer(m_pDepthIdxBuffer, DXGI_FORMAT_R32_UINT, 0);
+		pCtx->DrawIndexedInstanced(pRange->m_indexCount, instanceCount, pRange->m_indexStart, 0, instanceStart);
 	}
 
 	void Mesh::Reset()
 	{
 		m_pPack.release();
-		m_pVerts = nullptr;
+		m_vlayout = VLAYOUT_Interleaved;
+		m_vattribs = VATTR_Default;
+		for (int i = 0; i < VSTREAM_Count; ++i)
+		{
+			m_apVerts[i] = nullptr;
+			m_apVtxBuffers[i].release();
+			m_aVtxStrideBytes[i] = 0;
+		}
 		m_pIndices = nullptr;
 		m_vertCount = 0;
 		m_indexCount = 0;
-		m_pVtxBuffer.release();
+		m_mtlRanges.clear();
+		m_pDepthIndices = nullptr;
+		m_depthIndexCount = 0;
+		m_depthOpaqueIndexCount = 0;
+		m_depthMtlRanges.clear();
 		m_pIdxBuffer.release();
-		m_vtxStrideBytes = 0;
+		m_pDepthIdxBuffer.release();
 		m_primtopo = D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED;
 		m_bounds = box3(empty);
 	}
@@ -56,20 +283,32 @@ namespace Framework
 	{
 		ASSERT_ERR(pDevice);
 
-		m_pVtxBuffer.release();
+		for (int i = 0; i < VSTREAM_Count; ++i)
+			m_apVtxBuffers[i].release();
 		m_pIdxBuffer.release();
+		m_pDepthIdxBuffer.release();
 
-		D3D11_BUFFER_DESC vtxBufferDesc =
+		for (int i = 0; i < VSTREAM_Count; ++i)
 		{
-			sizeof(Vertex) * m_vertCount,
-			D3D11_USAGE_IMMUTABLE,
-			D3D11_BIND_VERTEX_BUFFER,
-			0,	// no cpu access
-			0,	// no misc flags
-			0,	// structured buffer stride
-		};
-		D3D11_SUBRESOURCE_DATA vtxBufferData = { m_pVerts, 0, 0 };
-		CHECK_D3D(pDevice->CreateBuffer(&vtxBufferDesc, &vtxBufferData, &m_pVtxBuffer));
+			int strideBytes = StrideOfVertexStream(m_vlayout, m_vattribs, i);
+			m_aVtxStrideBytes[i] = strideBytes;
+			if (strideBytes == 0)
+				continue;
+
+			ASSERT_ERR(m_apVerts[i]);
+
+			D3D11_BUFFER_DESC vtxBufferDesc =
+			{
+				UINT(strideBytes * m_vertCount),
+				D3D11_USAGE_IMMUTABLE,
+				D3D11_BIND_VERTEX_BUFFER,
+				0,	// no cpu access
+				0,	// no misc flags
+				0,	// structured buffer stride
+			};
+			D3D11_SUBRESOURCE_DATA vtxBufferData = { m_apVerts[i], 0, 0 };
+			CHECK_D3D(pDevice->CreateBuffer(&vtxBufferDesc, &vtxBufferData, &m_apVtxBuffers[i]));
+		}
 
 		D3D11_BUFFER_DESC idxBufferDesc =
 		{
@@ -83,7 +322,14 @@ namespace Framework
 		D3D11_SUBRESOURCE_DATA idxBufferData = { m_pIndices, 0, 0 };
 		CHECK_D3D(pDevice->CreateBuffer(&idxBufferDesc, &idxBufferData, &m_pIdxBuffer));
 
-		m_vtxStrideBytes = sizeof(Vertex);
+		if (m_depthIndexCount > 0)
+		{
+			ASSERT_ERR(m_pDepthIndices);
+			idxBufferDesc.ByteWidth = sizeof(int) * m_depthIndexCount;
+			D3D11_SUBRESOURCE_DATA depthIdxBufferData = { m_pDepthIndices, 0, 0 };
+			CHECK_D3D(pDevice->CreateBuffer(&idxBufferDesc, &depthIdxBufferData, &m_pDepthIdxBuffer));
+		}
+
 		m_primtopo = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
 	}
 }
@@ -1,24 +1,99 @@
 #pragma once
 
-// Vertex tangents are disabled for now...but they can be turned back on here
-#define VERTEX_TANGENT 0
-
 namespace Framework
 {
 	struct Material;
 	class MaterialLib;
 
-	// Hard-coded vertex struct for now
+	// Vertex with every attribute we know about.  The mesh compiler works in this format,
+	// then packs just the attributes each asset asks for into the vertex buffer.
 	struct Vertex
 	{
 		float3	m_pos;
 		float3	m_normal;
 		float2	m_uv;
-#if VERTEX_TANGENT
 		float3	m_tangent;
-#endif
 	};
 
+	// Optional vertex attributes; positions are always present
+	enum VATTR
+	{
+		VATTR_Normal		= 0x01,
+		VATTR_UV			= 0x02,
+		VATTR_Tangent		= 0x04,
+
+		VATTR_All			= 0x07,
+		VATTR_Default		= VATTR_Normal | VATTR_UV,
+	};
+
+	// Compile-time vertex layout for a given set of attributes.  Attributes are packed
+	// after the position in a fixed order: normal, UV, tangent.  Offsets of absent
+	// attributes are where they would go, but take up no space.
+	template <int vattribs>
+	struct VertexLayout
+	{
+		static const int s_offsetPos		= 0;
+		static const int s_offsetNormal		= s_offsetPos + int(sizeof(float3));
+		static const int s_offsetUV			= s_offsetNormal + ((vattribs & VATTR_Normal) ? int(sizeof(float3)) : 0);
+		static const int s_offsetTangent	= s_offsetUV + ((vattribs & VATTR_UV) ? int(sizeof(float2)) : 0);
+		static const int s_strideBytes		= s_offsetTangent + ((vattribs & VATTR_Tangent) ? int(sizeof(float3)) : 0);
+	};
+
+	// Runtime descriptor of the same layout, for when vattribs isn't known at compile time
+	struct VertexFormat
+	{
+		int		m_vattribs;
+		int		m_offsetNormal;			// Byte offsets within an interleaved vertex; -1 if absent
+		int		m_offsetUV;
+		int		m_offsetTangent;
+		int		m_strideBytes;
+	};
+
+	const VertexFormat & GetVertexFormat(int vattribs);
+
+	// Vertex data is stored either interleaved in a single stream, or split into a
+	// position-only stream and a stream with the other attributes.  The split layout lets
+	// depth-only passes fetch just 12 bytes per vertex instead of the whole vertex.
+	enum VLAYOUT
+	{
+		VLAYOUT_Interleaved,	// Stream 0: all attributes
+		VLAYOUT_Split,			// Stream 0: float3 position; stream 1: all other attributes
+
+		VLAYOUT_Count
+	};
+
+	enum VSTREAM
+	{
+		VSTREAM_Pos,			// Positions (whole Vertex structs, if interleaved)
+		VSTREAM_Attribs,		// Other attributes (not present if interleaved)
+
+		VSTREAM_Count
+	};
+
+	// Masks for requesting the streams a pass needs
+	enum VSTREAMMASK
+	{
+		VSTREAMMASK_Pos		= (1 << VSTREAM_Pos),
+		VSTREAMMASK_Attribs	= (1 << VSTREAM_Attribs),
+		VSTREAMMASK_All		= VSTREAMMASK_Pos | VSTREAMMASK_Attribs,
+	};
+
+	// Vertex stream layout helpers.  These are CPU-only, so they can be exercised without a device.
+
+	// Size of one vertex in the given stream, or 0 if the layout doesn't have that stream
+	int StrideOfVertexStream(VLAYOUT vlayout, int vattribs, int iStream);
+
+	// Figure out which of the layout's streams to bind to each IA slot to supply the
+	// attributes in streamMask.  Unused slots get -1.  Returns the number of slots used.
+	int SelectVertexStreams(VLAYOUT vlayout, int streamMask, int aiStreamForSlotOut[VSTREAM_Count]);
+
+	// Build the input layout elements that match SelectVertexStreams for the same arguments
+	void GetInputElementDescs(
+		VLAYOUT vlayout,
+		int vattribs,
+		int streamMask,
+		std::vector<D3D11_INPUT_ELEMENT_DESC> * pDescsOut);
+
 	class Mesh
 	{
 	public:
@@ -26,7 +101,9 @@ namespace Framework
 		comptr<AssetPack>			m_pPack;
 
 		// Pointers to vertex and index data in the asset pack
-		Vertex *					m_pVerts;
+		VLAYOUT						m_vlayout;
+		int							m_vattribs;					// Combination of VATTR flags
+		void *						m_apVerts[VSTREAM_Count];	// Null for streams not in the layout
 		int *						m_pIndices;
 		int							m_vertCount;
 		int							m_indexCount;
@@ -39,22 +116,52 @@ namespace Framework
 		};
 		std::vector<MtlRange>		m_mtlRanges;
 
+		// Depth-only index buffer.  The first m_depthOpaqueIndexCount indices draw all the
+		// opaque materials at once, with positions welded across UV/normal seams; after that
+		// come the alpha-tested materials, listed in m_depthMtlRanges.
+		int *						m_pDepthIndices;
+		int							m_depthIndexCount;
+		int							m_depthOpaqueIndexCount;
+		std::vector<MtlRange>		m_depthMtlRanges;
+
 		// GPU resources
-		comptr<ID3D11Buffer>		m_pVtxBuffer;
+		comptr<ID3D11Buffer>		m_apVtxBuffers[VSTREAM_Count];
 		comptr<ID3D11Buffer>		m_pIdxBuffer;
+		comptr<ID3D11Buffer>		m_pDepthIdxBuffer;
 
 		// Rendering info
-		int							m_vtxStrideBytes;
+		int							m_aVtxStrideBytes[VSTREAM_Count];
 		D3D11_PRIMITIVE_TOPOLOGY	m_primtopo;
 		box3						m_bounds;			// Bounding box in local space
 
 				Mesh();
-		void	Draw(ID3D11DeviceContext * pCtx);
-		void	DrawMtlRange(ID3D11DeviceContext * pCtx, int iMtlRange);
 		void	Reset();
 
-		// Creates the vertex and index buffers on the GPU from m_pVerts and m_pIndices
+		// The draw functions can also draw several instances at once; the caller is responsible
+		// for binding any per-instance streams (see Scene)
+		void	Draw(ID3D11DeviceContext * pCtx, int streamMask = VSTREAMMASK_All,
+					 int instanceCount = 1, int instanceStart = 0);
+		void	DrawMtlRange(ID3D11DeviceContext * pCtx, int iMtlRange, int streamMask = VSTREAMMASK_All,
+					 int instanceCount = 1, int instanceStart = 0);
+
+		// Depth-only drawing: all the opaque geometry in one draw using just the position stream,
+		// and the alpha-tested ranges one at a time using all streams (they need UVs)
+		void	DrawDepthOpaque(ID3D11DeviceContext * pCtx, int instanceCount = 1, int instanceStart = 0);
+		void	DrawDepthAlphaTestRange(ID3D11DeviceContext * pCtx, int iDepthMtlRange,
+					 int instanceCount = 1, int instanceStart = 0);
+
+		// Binds just the vertex buffers needed for the streams in streamMask, plus the index buffer
+		void	Bind(ID3D11DeviceContext * pCtx, int streamMask = VSTREAMMASK_All);
+
+		// Input layout elements for drawing this mesh with the given streams
+		void	GetInputElementDescs(int streamMask, std::vector<D3D11_INPUT_ELEMENT_DESC> * pDescsOut) const
+					{ Framework::GetInputElementDescs(m_vlayout, m_vattribs, streamMask, pDescsOut); }
+
+		// Creates the vertex and index buffers on the GPU from m_apVerts, m_pIndices and m_pDepthIndices
 		void	UploadToGPU(ID3D11Device * pDevice);
+
+	protected:
+		void	BindVertexBuffers(ID3D11DeviceContext * pCtx, int streamMask);
 	};
 
 	// Load a mesh from an asset pack and resolve material references
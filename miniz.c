@@ -140,7 +140,8 @@
      possibility that the archive's central directory could be lost with this method if anything goes wrong, though.
 
      - ZIP archive support limitations:
-     No zip64 or spanning support. Extraction functions can only handle unencrypted, stored or deflated files.
+     No spanning support. Extraction functions can only handle unencrypted, stored or deflated files.
+     NRR: zip64 support added (reading and writing): archives, files and offsets past 4GB, and more than 65535 files.
      Requires streams capable of seeking.
 
    * This is a header file library, like stb_image.c. To get only a header file, either cut and paste the
@@ -559,7 +560,8 @@ typedef enum
   MZ_ZIP_FLAG_CASE_SENSITIVE                = 0x0100,
   MZ_ZIP_FLAG_IGNORE_PATH                   = 0x0200,
   MZ_ZIP_FLAG_COMPRESSED_DATA               = 0x0400,
-  MZ_ZIP_FLAG_DO_NOT_SORT_CENTRAL_DIRECTORY = 0x0800
+  MZ_ZIP_FLAG_DO_NOT_SORT_CENTRAL_DIRECTORY = 0x0800,
+  MZ_ZIP_FLAG_PRECOMPUTED_CRC32             = 0x1000  // NRR: uncomp_crc32 holds the CRC of data that isn't already compressed, so it needn't be computed again
 } mz_zip_flags;
 
 // ZIP archive reading
@@ -959,6 +961,7 @@ typedef unsigned char mz_validate_uint64[sizeof(mz_uint64)==8 ? 1 : -1];
   #define MZ_READ_LE16(p) ((mz_uint32)(((const mz_uint8 *)(p))[0]) | ((mz_uint32)(((const mz_uint8 *)(p))[1]) << 8U))
   #define MZ_READ_LE32(p) ((mz_uint32)(((const mz_uint8 *)(p))[0]) | ((mz_uint32)(((const mz_uint8 *)(p))[1]) << 8U) | ((mz_uint32)(((const mz_uint8 *)(p))[2]) << 16U) | ((mz_uint32)(((const mz_uint8 *)(p))[3]) << 24U))
 #endif
+#define MZ_READ_LE64(p) (((mz_uint64)MZ_READ_LE32(p)) | (((mz_uint64)MZ_READ_LE32((const mz_uint8 *)(p) + sizeof(mz_uint32))) << 32U))
 
 #ifdef _MSC_VER
   #define MZ_FORCEINLINE __forceinline
@@ -2964,6 +2967,15 @@ enum
   // End of central directory offsets
   MZ_ZIP_ECDH_SIG_OFS = 0, MZ_ZIP_ECDH_NUM_THIS_DISK_OFS = 4, MZ_ZIP_ECDH_NUM_DISK_CDIR_OFS = 6, MZ_ZIP_ECDH_CDIR_NUM_ENTRIES_ON_DISK_OFS = 8,
   MZ_ZIP_ECDH_CDIR_TOTAL_ENTRIES_OFS = 10, MZ_ZIP_ECDH_CDIR_SIZE_OFS = 12, MZ_ZIP_ECDH_CDIR_OFS_OFS = 16, MZ_ZIP_ECDH_COMMENT_SIZE_OFS = 20,
+  // NRR: zip64 records, and the zip64 extended information extra field
+  MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIG = 0x06064b50, MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIG = 0x07064b50,
+  MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE = 56, MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE = 20,
+  MZ_ZIP64_ECDH_SIG_OFS = 0, MZ_ZIP64_ECDH_SIZE_OF_RECORD_OFS = 4, MZ_ZIP64_ECDH_VERSION_MADE_BY_OFS = 12, MZ_ZIP64_ECDH_VERSION_NEEDED_OFS = 14,
+  MZ_ZIP64_ECDH_NUM_THIS_DISK_OFS = 16, MZ_ZIP64_ECDH_NUM_DISK_CDIR_OFS = 20, MZ_ZIP64_ECDH_CDIR_NUM_ENTRIES_ON_DISK_OFS = 24,
+  MZ_ZIP64_ECDH_CDIR_TOTAL_ENTRIES_OFS = 32, MZ_ZIP64_ECDH_CDIR_SIZE_OFS = 40, MZ_ZIP64_ECDH_CDIR_OFS_OFS = 48,
+  MZ_ZIP64_ECDL_SIG_OFS = 0, MZ_ZIP64_ECDL_NUM_DISK_CDIR_OFS = 4, MZ_ZIP64_ECDL_REL_OFS_TO_ZIP64_ECDR_OFS = 8, MZ_ZIP64_ECDL_TOTAL_NUMBER_OF_DISKS_OFS = 16,
+  MZ_ZIP64_EXTENDED_INFORMATION_FIELD_HEADER_ID = 0x0001, MZ_ZIP64_VERSION_NEEDED = 45,
+  MZ_ZIP64_MAX_EXTRA_FIELD_SIZE = 4 + 3 * sizeof(mz_uint64),
 };
 
 typedef struct
@@ -3165,6 +3177,56 @@ static void mz_zip_reader_sort_central_dir_offsets_by_filename(mz_zip_archive *p
   }
 }
 
+// NRR: get a central directory record's sizes and local header offset, from its zip64 extended information extra field if they don't fit in 32 bits.
+// The record, including its filename and extra field, must already have been bounds checked.
+static mz_bool mz_zip_reader_get_cdh_sizes(const mz_uint8 *pCentral_header, mz_uint64 *pComp_size, mz_uint64 *pUncomp_size, mz_uint64 *pLocal_header_ofs)
+{
+  mz_uint64 comp_size = MZ_READ_LE32(pCentral_header + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS);
+  mz_uint64 uncomp_size = MZ_READ_LE32(pCentral_header + MZ_ZIP_CDH_DECOMPRESSED_SIZE_OFS);
+  mz_uint64 local_header_ofs = MZ_READ_LE32(pCentral_header + MZ_ZIP_CDH_LOCAL_HEADER_OFS);
+  if ((comp_size == 0xFFFFFFFF) || (uncomp_size == 0xFFFFFFFF) || (local_header_ofs == 0xFFFFFFFF))
+  {
+    const mz_uint8 *pExtra = pCentral_header + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + MZ_READ_LE16(pCentral_header + MZ_ZIP_CDH_FILENAME_LEN_OFS);
+    mz_uint extra_remaining = MZ_READ_LE16(pCentral_header + MZ_ZIP_CDH_EXTRA_LEN_OFS);
+    mz_bool found = MZ_FALSE;
+    while ((!found) && (extra_remaining >= 4))
+    {
+      mz_uint field_id = MZ_READ_LE16(pExtra), field_size = MZ_READ_LE16(pExtra + 2);
+      if (field_size + 4 > extra_remaining)
+        return MZ_FALSE;
+      if (field_id == MZ_ZIP64_EXTENDED_INFORMATION_FIELD_HEADER_ID)
+      {
+        // Only the fields that overflowed are present, in this order
+        const mz_uint8 *pField = pExtra + 4;
+        mz_uint field_remaining = field_size;
+        if (uncomp_size == 0xFFFFFFFF)
+        {
+          if (field_remaining < sizeof(mz_uint64)) return MZ_FALSE;
+          uncomp_size = MZ_READ_LE64(pField); pField += sizeof(mz_uint64); field_remaining -= sizeof(mz_uint64);
+        }
+        if (comp_size == 0xFFFFFFFF)
+        {
+          if (field_remaining < sizeof(mz_uint64)) return MZ_FALSE;
+          comp_size = MZ_READ_LE64(pField); pField += sizeof(mz_uint64); field_remaining -= sizeof(mz_uint64);
+        }
+        if (local_header_ofs == 0xFFFFFFFF)
+        {
+          if (field_remaining < sizeof(mz_uint64)) return MZ_FALSE;
+          local_header_ofs = MZ_READ_LE64(pField);
+        }
+        found = MZ_TRUE;
+      }
+      pExtra += 4 + field_size; extra_remaining -= 4 + field_size;
+    }
+    if (!found)
+      return MZ_FALSE;
+  }
+  if (pComp_size) *pComp_size = comp_size;
+  if (pUncomp_size) *pUncomp_size = uncomp_size;
+  if (pLocal_header_ofs) *pLocal_header_ofs = local_header_ofs;
+  return MZ_TRUE;
+}
+
 static mz_bool mz_zip_reader_read_central_dir(mz_zip_archive *pZip, mz_uint32 flags)
 {
   mz_uint cdir_size, num_this_disk, cdir_disk_index;
@@ -3204,13 +3266,43 @@ static mz_bool mz_zip_reader_read_central_dir(mz_zip_archive *pZip, mz_uint32 fl
 
   num_this_disk = MZ_READ_LE16(pBuf + MZ_ZIP_ECDH_NUM_THIS_DISK_OFS);
   cdir_disk_index = MZ_READ_LE16(pBuf + MZ_ZIP_ECDH_NUM_DISK_CDIR_OFS);
+  cdir_size = MZ_READ_LE32(pBuf + MZ_ZIP_ECDH_CDIR_SIZE_OFS);
+  cdir_ofs = MZ_READ_LE32(pBuf + MZ_ZIP_ECDH_CDIR_OFS_OFS);
+
+  // NRR: if there's a zip64 end of central directory locator right before the record, the counts, size and offset come from the zip64 record instead.
+  if (cur_file_ofs >= MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE)
+  {
+    if (pZip->m_pRead(pZip->m_pIO_opaque, cur_file_ofs - MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE, pBuf, MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE) != MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE)
+      return MZ_FALSE;
+    if (MZ_READ_LE32(pBuf + MZ_ZIP64_ECDL_SIG_OFS) == MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIG)
+    {
+      mz_uint64 zip64_ecdr_ofs = MZ_READ_LE64(pBuf + MZ_ZIP64_ECDL_REL_OFS_TO_ZIP64_ECDR_OFS);
+      mz_uint64 total_files, cdir_size64;
+      if ((zip64_ecdr_ofs > pZip->m_archive_size - MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE) ||
+          (pZip->m_pRead(pZip->m_pIO_opaque, zip64_ecdr_ofs, pBuf, MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE) != MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE) ||
+          (MZ_READ_LE32(pBuf + MZ_ZIP64_ECDH_SIG_OFS) != MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIG))
+        return MZ_FALSE;
+
+      // The file index and central directory offsets are 32-bit
+      total_files = MZ_READ_LE64(pBuf + MZ_ZIP64_ECDH_CDIR_TOTAL_ENTRIES_OFS);
+      cdir_size64 = MZ_READ_LE64(pBuf + MZ_ZIP64_ECDH_CDIR_SIZE_OFS);
+      if ((total_files != MZ_READ_LE64(pBuf + MZ_ZIP64_ECDH_CDIR_NUM_ENTRIES_ON_DISK_OFS)) || (total_files > 0xFFFFFFFF) || (cdir_size64 > 0xFFFFFFFF))
+        return MZ_FALSE;
+
+      pZip->m_total_files = (mz_uint)total_files;
+      num_this_disk = MZ_READ_LE32(pBuf + MZ_ZIP64_ECDH_NUM_THIS_DISK_OFS);
+      cdir_disk_index = MZ_READ_LE32(pBuf + MZ_ZIP64_ECDH_NUM_DISK_CDIR_OFS);
+      cdir_size = (mz_uint)cdir_size64;
+      cdir_ofs = MZ_READ_LE64(pBuf + MZ_ZIP64_ECDH_CDIR_OFS_OFS);
+    }
+  }
+
   if (((num_this_disk | cdir_disk_index) != 0) && ((num_this_disk != 1) || (cdir_disk_index != 1)))
     return MZ_FALSE;
 
-  if ((cdir_size = MZ_READ_LE32(pBuf + MZ_ZIP_ECDH_CDIR_SIZE_OFS)) < pZip->m_total_files * MZ_ZIP_CENTRAL_DIR_HEADER_SIZE)
+  if (cdir_size < (mz_uint64)pZip->m_total_files * MZ_ZIP_CENTRAL_DIR_HEADER_SIZE)
     return MZ_FALSE;
 
-  cdir_ofs = MZ_READ_LE32(pBuf + MZ_ZIP_ECDH_CDIR_OFS_OFS);
   if ((cdir_ofs + (mz_uint64)cdir_size) > pZip->m_archive_size)
     return MZ_FALSE;
 
@@ -3234,26 +3326,28 @@ static mz_bool mz_zip_reader_read_central_dir(mz_zip_archive *pZip, mz_uint32 fl
     if (pZip->m_pRead(pZip->m_pIO_opaque, cdir_ofs, pZip->m_pState->m_central_dir.m_p, cdir_size) != cdir_size)
       return MZ_FALSE;
 
-    // Now create an index into the central directory file records, do some basic sanity checking on each record, and check for zip64 entries (which are not yet supported).
+    // Now create an index into the central directory file records, and do some basic sanity checking on each record.
     p = (const mz_uint8 *)pZip->m_pState->m_central_dir.m_p;
     for (n = cdir_size, i = 0; i < pZip->m_total_files; ++i)
     {
-      mz_uint total_header_size, comp_size, decomp_size, disk_index;
+      mz_uint total_header_size, disk_index;
+      mz_uint64 comp_size, decomp_size, local_header_ofs;
       if ((n < MZ_ZIP_CENTRAL_DIR_HEADER_SIZE) || (MZ_READ_LE32(p) != MZ_ZIP_CENTRAL_DIR_HEADER_SIG))
         return MZ_FALSE;
       MZ_ZIP_ARRAY_ELEMENT(&pZip->m_pState->m_central_dir_offsets, mz_uint32, i) = (mz_uint32)(p - (const mz_uint8 *)pZip->m_pState->m_central_dir.m_p);
       if (sort_central_dir)
         MZ_ZIP_ARRAY_ELEMENT(&pZip->m_pState->m_sorted_central_dir_offsets, mz_uint32, i) = i;
-      comp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS);
-      decomp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_DECOMPRESSED_SIZE_OFS);
-      if (((!MZ_READ_LE32(p + MZ_ZIP_CDH_METHOD_OFS)) && (decomp_size != comp_size)) || (decomp_size && !comp_size) || (decomp_size == 0xFFFFFFFF) || (comp_size == 0xFFFFFFFF))
+      if ((total_header_size = MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + MZ_READ_LE16(p + MZ_ZIP_CDH_FILENAME_LEN_OFS) + MZ_READ_LE16(p + MZ_ZIP_CDH_EXTRA_LEN_OFS) + MZ_READ_LE16(p + MZ_ZIP_CDH_COMMENT_LEN_OFS)) > n)
+        return MZ_FALSE;
+      // NRR: sizes and offset may come from a zip64 extra field
+      if (!mz_zip_reader_get_cdh_sizes(p, &comp_size, &decomp_size, &local_header_ofs))
+        return MZ_FALSE;
+      if (((!MZ_READ_LE32(p + MZ_ZIP_CDH_METHOD_OFS)) && (decomp_size != comp_size)) || (decomp_size && !comp_size))
         return MZ_FALSE;
       disk_index = MZ_READ_LE16(p + MZ_ZIP_CDH_DISK_START_OFS);
       if ((disk_index != num_this_disk) && (disk_index != 1))
         return MZ_FALSE;
-      if (((mz_uint64)MZ_READ_LE32(p + MZ_ZIP_CDH_LOCAL_HEADER_OFS) + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + comp_size) > pZip->m_archive_size)
-        return MZ_FALSE;
-      if ((total_header_size = MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + MZ_READ_LE16(p + MZ_ZIP_CDH_FILENAME_LEN_OFS) + MZ_READ_LE16(p + MZ_ZIP_CDH_EXTRA_LEN_OFS) + MZ_READ_LE16(p + MZ_ZIP_CDH_COMMENT_LEN_OFS)) > n)
+      if ((local_header_ofs + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + comp_size) > pZip->m_archive_size)
         return MZ_FALSE;
       n -= total_header_size; p += total_header_size;
     }
@@ -3414,11 +3508,10 @@ mz_bool mz_zip_reader_file_stat(mz_zip_archive *pZip, mz_uint file_index, mz_zip
   pStat->m_time = mz_zip_dos_to_time_t(MZ_READ_LE16(p + MZ_ZIP_CDH_FILE_TIME_OFS), MZ_READ_LE16(p + MZ_ZIP_CDH_FILE_DATE_OFS));
 #endif
   pStat->m_crc32 = MZ_READ_LE32(p + MZ_ZIP_CDH_CRC32_OFS);
-  pStat->m_comp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS);
-  pStat->m_uncomp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_DECOMPRESSED_SIZE_OFS);
+  if (!mz_zip_reader_get_cdh_sizes(p, &pStat->m_comp_size, &pStat->m_uncomp_size, &pStat->m_local_header_ofs))
+    return MZ_FALSE;
   pStat->m_internal_attr = MZ_READ_LE16(p + MZ_ZIP_CDH_INTERNAL_ATTR_OFS);
   pStat->m_external_attr = MZ_READ_LE32(p + MZ_ZIP_CDH_EXTERNAL_ATTR_OFS);
-  pStat->m_local_header_ofs = MZ_READ_LE32(p + MZ_ZIP_CDH_LOCAL_HEADER_OFS);
 
   // Copy as much of the filename and comment as possible.
   n = MZ_READ_LE16(p + MZ_ZIP_CDH_FILENAME_LEN_OFS); n = MZ_MIN(n, MZ_ZIP_MAX_ARCHIVE_FILENAME_SIZE - 1);
@@ -3693,8 +3786,8 @@ void *mz_zip_reader_extract_to_heap(mz_zip_archive *pZip, mz_uint file_index, si
   if (!p)
     return NULL;
 
-  comp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS);
-  uncomp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_DECOMPRESSED_SIZE_OFS);
+  if (!mz_zip_reader_get_cdh_sizes(p, &comp_size, &uncomp_size, NULL))
+    return NULL;
 
   alloc_size = (flags & MZ_ZIP_FLAG_COMPRESSED_DATA) ? comp_size : uncomp_size;
 #ifdef _MSC_VER
@@ -3970,6 +4063,26 @@ static void mz_write_le16(mz_uint8 *p, mz_uint16 v) { p[0] = (mz_uint8)v; p[1] =
 static void mz_write_le32(mz_uint8 *p, mz_uint32 v) { p[0] = (mz_uint8)v; p[1] = (mz_uint8)(v >> 8); p[2] = (mz_uint8)(v >> 16); p[3] = (mz_uint8)(v >> 24); }
 #define MZ_WRITE_LE16(p, v) mz_write_le16((mz_uint8 *)(p), (mz_uint16)(v))
 #define MZ_WRITE_LE32(p, v) mz_write_le32((mz_uint8 *)(p), (mz_uint32)(v))
+#define MZ_WRITE_LE64(p, v) (mz_write_le32((mz_uint8 *)(p), (mz_uint32)(v)), mz_write_le32((mz_uint8 *)(p) + sizeof(mz_uint32), (mz_uint32)((mz_uint64)(v) >> 32U)))
+
+// NRR: whether an entry needs zip64: if either of its sizes or its local header offset doesn't fit in 32 bits.  Its local header,
+// data descriptor and central directory record all go by this, so they always agree.
+static mz_bool mz_zip_writer_needs_zip64(mz_uint64 uncomp_size, mz_uint64 comp_size, mz_uint64 local_header_ofs)
+{
+  return (uncomp_size >= 0xFFFFFFFF) || (comp_size >= 0xFFFFFFFF) || (local_header_ofs >= 0xFFFFFFFF);
+}
+
+// NRR: write a zip64 extended information extra field holding whichever of the values are given, returning its size
+static mz_uint32 mz_zip_writer_create_zip64_extra_data(mz_uint8 *pDst, const mz_uint64 *pUncomp_size, const mz_uint64 *pComp_size, const mz_uint64 *pLocal_header_ofs)
+{
+  mz_uint8 *pField = pDst + 4;
+  if (pUncomp_size) { MZ_WRITE_LE64(pField, *pUncomp_size); pField += sizeof(mz_uint64); }
+  if (pComp_size) { MZ_WRITE_LE64(pField, *pComp_size); pField += sizeof(mz_uint64); }
+  if (pLocal_header_ofs) { MZ_WRITE_LE64(pField, *pLocal_header_ofs); pField += sizeof(mz_uint64); }
+  MZ_WRITE_LE16(pDst, MZ_ZIP64_EXTENDED_INFORMATION_FIELD_HEADER_ID);
+  MZ_WRITE_LE16(pDst + 2, pField - pDst - 4);
+  return (mz_uint32)(pField - pDst);
+}
 
 mz_bool mz_zip_writer_init(mz_zip_archive *pZip, mz_uint64 existing_size)
 {
@@ -4090,7 +4203,7 @@ mz_bool mz_zip_writer_init_from_reader(mz_zip_archive *pZip, const char *pFilena
   if ((!pZip) || (!pZip->m_pState) || (pZip->m_zip_mode != MZ_ZIP_MODE_READING))
     return MZ_FALSE;
   // No sense in trying to write to an archive that's already at the support max size
-  if ((pZip->m_total_files == 0xFFFF) || ((pZip->m_archive_size + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + MZ_ZIP_LOCAL_DIR_HEADER_SIZE) > 0xFFFFFFFF))
+  if (pZip->m_total_files == 0xFFFFFFFF)
     return MZ_FALSE;
 
   pState = pZip->m_pState;
@@ -4156,19 +4269,20 @@ static mz_bool mz_zip_writer_add_put_buf_callback(const void* pBuf, int len, voi
   return MZ_TRUE;
 }
 
-static mz_bool mz_zip_writer_create_local_dir_header(mz_zip_archive *pZip, mz_uint8 *pDst, mz_uint16 filename_size, mz_uint16 extra_size, mz_uint64 uncomp_size, mz_uint64 comp_size, mz_uint32 uncomp_crc32, mz_uint16 method, mz_uint16 bit_flags, mz_uint16 dos_time, mz_uint16 dos_date)
+// NRR: if zip64 is set, the sizes go in a zip64 extra field written by the caller, which must be counted in extra_size
+static mz_bool mz_zip_writer_create_local_dir_header(mz_zip_archive *pZip, mz_uint8 *pDst, mz_uint16 filename_size, mz_uint16 extra_size, mz_uint64 uncomp_size, mz_uint64 comp_size, mz_uint32 uncomp_crc32, mz_uint16 method, mz_uint16 bit_flags, mz_uint16 dos_time, mz_uint16 dos_date, mz_bool zip64)
 {
   (void)pZip;
   memset(pDst, 0, MZ_ZIP_LOCAL_DIR_HEADER_SIZE);
   MZ_WRITE_LE32(pDst + MZ_ZIP_LDH_SIG_OFS, MZ_ZIP_LOCAL_DIR_HEADER_SIG);
-  MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_VERSION_NEEDED_OFS, method ? 20 : 0);
+  MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_VERSION_NEEDED_OFS, zip64 ? MZ_ZIP64_VERSION_NEEDED : method ? 20 : 0);
   MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_BIT_FLAG_OFS, bit_flags);
   MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_METHOD_OFS, method);
   MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_FILE_TIME_OFS, dos_time);
   MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_FILE_DATE_OFS, dos_date);
   MZ_WRITE_LE32(pDst + MZ_ZIP_LDH_CRC32_OFS, uncomp_crc32);
-  MZ_WRITE_LE32(pDst + MZ_ZIP_LDH_COMPRESSED_SIZE_OFS, comp_size);
-  MZ_WRITE_LE32(pDst + MZ_ZIP_LDH_DECOMPRESSED_SIZE_OFS, uncomp_size);
+  MZ_WRITE_LE32(pDst + MZ_ZIP_LDH_COMPRESSED_SIZE_OFS, zip64 ? 0xFFFFFFFF : comp_size);
+  MZ_WRITE_LE32(pDst + MZ_ZIP_LDH_DECOMPRESSED_SIZE_OFS, zip64 ? 0xFFFFFFFF : uncomp_size);
   MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_FILENAME_LEN_OFS, filename_size);
   MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_EXTRA_LEN_OFS, extra_size);
   return MZ_TRUE;
@@ -4176,22 +4290,24 @@ static mz_bool mz_zip_writer_create_local_dir_header(mz_zip_archive *pZip, mz_ui
 
 static mz_bool mz_zip_writer_create_central_dir_header(mz_zip_archive *pZip, mz_uint8 *pDst, mz_uint16 filename_size, mz_uint16 extra_size, mz_uint16 comment_size, mz_uint64 uncomp_size, mz_uint64 comp_size, mz_uint32 uncomp_crc32, mz_uint16 method, mz_uint16 bit_flags, mz_uint16 dos_time, mz_uint16 dos_date, mz_uint64 local_header_ofs, mz_uint32 ext_attributes)
 {
+  // NRR: values that don't fit in 32 bits go in a zip64 extra field, written by mz_zip_writer_add_to_central_dir()
+  mz_bool zip64 = mz_zip_writer_needs_zip64(uncomp_size, comp_size, local_header_ofs);
   (void)pZip;
   memset(pDst, 0, MZ_ZIP_CENTRAL_DIR_HEADER_SIZE);
   MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_SIG_OFS, MZ_ZIP_CENTRAL_DIR_HEADER_SIG);
-  MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_VERSION_NEEDED_OFS, method ? 20 : 0);
+  MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_VERSION_NEEDED_OFS, zip64 ? MZ_ZIP64_VERSION_NEEDED : method ? 20 : 0);
   MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_BIT_FLAG_OFS, bit_flags);
   MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_METHOD_OFS, method);
   MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_FILE_TIME_OFS, dos_time);
   MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_FILE_DATE_OFS, dos_date);
   MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_CRC32_OFS, uncomp_crc32);
-  MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS, comp_size);
-  MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_DECOMPRESSED_SIZE_OFS, uncomp_size);
+  MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS, MZ_MIN(comp_size, 0xFFFFFFFF));
+  MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_DECOMPRESSED_SIZE_OFS, MZ_MIN(uncomp_size, 0xFFFFFFFF));
   MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_FILENAME_LEN_OFS, filename_size);
   MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_EXTRA_LEN_OFS, extra_size);
   MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_COMMENT_LEN_OFS, comment_size);
   MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_EXTERNAL_ATTR_OFS, ext_attributes);
-  MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_LOCAL_HEADER_OFS, local_header_ofs);
+  MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_LOCAL_HEADER_OFS, MZ_MIN(local_header_ofs, 0xFFFFFFFF));
   return MZ_TRUE;
 }
 
@@ -4201,16 +4317,30 @@ static mz_bool mz_zip_writer_add_to_central_dir(mz_zip_archive *pZip, const char
   mz_uint32 central_dir_ofs = (mz_uint32)pState->m_central_dir.m_size;
   size_t orig_central_dir_size = pState->m_central_dir.m_size;
   mz_uint8 central_dir_header[MZ_ZIP_CENTRAL_DIR_HEADER_SIZE];
+  mz_uint8 zip64_extra[MZ_ZIP64_MAX_EXTRA_FIELD_SIZE];
+  mz_uint32 zip64_extra_size = 0;
 
-  // No zip64 support yet
-  if ((local_header_ofs > 0xFFFFFFFF) || (((mz_uint64)pState->m_central_dir.m_size + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + filename_size + extra_size + comment_size) > 0xFFFFFFFF))
+  // NRR: the zip64 extra field, if needed, goes before any other extra data
+  if (mz_zip_writer_needs_zip64(uncomp_size, comp_size, local_header_ofs))
+  {
+    zip64_extra_size = mz_zip_writer_create_zip64_extra_data(zip64_extra,
+                          (uncomp_size >= 0xFFFFFFFF) ? &uncomp_size : NULL,
+                          (comp_size >= 0xFFFFFFFF) ? &comp_size : NULL,
+                          (local_header_ofs >= 0xFFFFFFFF) ? &local_header_ofs : NULL);
+  }
+  if ((mz_uint32)extra_size + zip64_extra_size > 0xFFFF)
     return MZ_FALSE;
 
-  if (!mz_zip_writer_create_central_dir_header(pZip, central_dir_header, filename_size, extra_size, comment_size, uncomp_size, comp_size, uncomp_crc32, method, bit_flags, dos_time, dos_date, local_header_ofs, ext_attributes))
+  // The central directory offsets are 32-bit
+  if (((mz_uint64)pState->m_central_dir.m_size + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + filename_size + zip64_extra_size + extra_size + comment_size) > 0xFFFFFFFF)
+    return MZ_FALSE;
+
+  if (!mz_zip_writer_create_central_dir_header(pZip, central_dir_header, filename_size, (mz_uint16)(zip64_extra_size + extra_size), comment_size, uncomp_size, comp_size, uncomp_crc32, method, bit_flags, dos_time, dos_date, local_header_ofs, ext_attributes))
     return MZ_FALSE;
 
   if ((!mz_zip_array_push_back(pZip, &pState->m_central_dir, central_dir_header, MZ_ZIP_CENTRAL_DIR_HEADER_SIZE)) ||
       (!mz_zip_array_push_back(pZip, &pState->m_central_dir, pFilename, filename_size)) ||
+      (!mz_zip_array_push_back(pZip, &pState->m_central_dir, zip64_extra, zip64_extra_size)) ||
       (!mz_zip_array_push_back(pZip, &pState->m_central_dir, pExtra, extra_size)) ||
       (!mz_zip_array_push_back(pZip, &pState->m_central_dir, pComment, comment_size)) ||
       (!mz_zip_array_push_back(pZip, &pState->m_central_dir_offsets, &central_dir_ofs, 1)))
@@ -4268,7 +4398,8 @@ mz_bool mz_zip_writer_add_mem_ex(mz_zip_archive *pZip, const char *pArchive_name
   size_t archive_name_size;
   mz_uint8 local_dir_header[MZ_ZIP_LOCAL_DIR_HEADER_SIZE];
   tdefl_compressor *pComp = NULL;
-  mz_bool store_data_uncompressed;
+  mz_bool store_data_uncompressed, local_zip64;
+  mz_uint32 local_zip64_extra_size;
   mz_zip_internal_state *pState;
 
   if ((int)level_and_flags < 0)
@@ -4276,16 +4407,14 @@ mz_bool mz_zip_writer_add_mem_ex(mz_zip_archive *pZip, const char *pArchive_name
   level = level_and_flags & 0xF;
   store_data_uncompressed = ((!level) || (level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA));
 
-  if ((!pZip) || (!pZip->m_pState) || (pZip->m_zip_mode != MZ_ZIP_MODE_WRITING) || ((buf_size) && (!pBuf)) || (!pArchive_name) || ((comment_size) && (!pComment)) || (pZip->m_total_files == 0xFFFF) || (level > MZ_UBER_COMPRESSION))
+  if ((!pZip) || (!pZip->m_pState) || (pZip->m_zip_mode != MZ_ZIP_MODE_WRITING) || ((buf_size) && (!pBuf)) || (!pArchive_name) || ((comment_size) && (!pComment)) || (pZip->m_total_files == 0xFFFFFFFF) || (level > MZ_UBER_COMPRESSION))
     return MZ_FALSE;
 
   pState = pZip->m_pState;
 
   if ((!(level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA)) && (uncomp_size))
     return MZ_FALSE;
-  // No zip64 support yet
-  if ((buf_size > 0xFFFFFFFF) || (uncomp_size > 0xFFFFFFFF))
-    return MZ_FALSE;
+
   if (!mz_zip_writer_validate_archive_name(pArchive_name))
     return MZ_FALSE;
 
@@ -4302,9 +4431,15 @@ mz_bool mz_zip_writer_add_mem_ex(mz_zip_archive *pZip, const char *pArchive_name
 
   num_alignment_padding_bytes = mz_zip_writer_compute_padding_needed_for_file_alignment(pZip);
 
-  // no zip64 support yet
-  if ((pZip->m_total_files == 0xFFFF) || ((pZip->m_archive_size + num_alignment_padding_bytes + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + comment_size + archive_name_size) > 0xFFFFFFFF))
-    return MZ_FALSE;
+  // NRR: the local header's zip64 extra field has to be reserved before the data's written, so decide now whether the entry needs
+  // zip64.  Data compressed here could end up either side of 4GB if it's close to that to start with, so then it's stored instead.
+  if ((!store_data_uncompressed) && (buf_size < 0xFFFFFFFF) && ((mz_uint64)buf_size + (buf_size >> 4) + 1024 >= 0xFFFFFFFF))
+  {
+    level = 0;
+    store_data_uncompressed = MZ_TRUE;
+  }
+  local_zip64 = mz_zip_writer_needs_zip64(MZ_MAX((mz_uint64)buf_size, uncomp_size), buf_size, local_dir_header_ofs + num_alignment_padding_bytes);
+  local_zip64_extra_size = local_zip64 ? 4 + 2 * sizeof(mz_uint64) : 0;
 
   if ((archive_name_size) && (pArchive_name[archive_name_size - 1] == '/'))
   {
@@ -4341,10 +4476,14 @@ mz_bool mz_zip_writer_add_mem_ex(mz_zip_archive *pZip, const char *pArchive_name
     return MZ_FALSE;
   }
   cur_archive_file_ofs += archive_name_size;
+  // NRR: skip over the zip64 extra field, if any; it's written with the local header below
+  cur_archive_file_ofs += local_zip64_extra_size;
 
   if (!(level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA))
   {
-    uncomp_crc32 = (mz_uint32)mz_crc32(MZ_CRC32_INIT, (const mz_uint8*)pBuf, buf_size);
+    // NRR: the caller may have computed the CRC already, faster than mz_crc32 does
+    if (!(level_and_flags & MZ_ZIP_FLAG_PRECOMPUTED_CRC32))
+      uncomp_crc32 = (mz_uint32)mz_crc32(MZ_CRC32_INIT, (const mz_uint8*)pBuf, buf_size);
     uncomp_size = buf_size;
     if (uncomp_size <= 3)
     {
@@ -4391,16 +4530,24 @@ mz_bool mz_zip_writer_add_mem_ex(mz_zip_archive *pZip, const char *pArchive_name
   pZip->m_pFree(pZip->m_pAlloc_opaque, pComp);
   pComp = NULL;
 
-  // no zip64 support yet
-  if ((comp_size > 0xFFFFFFFF) || (cur_archive_file_ofs > 0xFFFFFFFF))
+  // NRR: the final sizes have to agree with the zip64 decision made up front, when space for the extra field was reserved
+  if (local_zip64 != mz_zip_writer_needs_zip64(uncomp_size, comp_size, local_dir_header_ofs))
     return MZ_FALSE;
 
-  if (!mz_zip_writer_create_local_dir_header(pZip, local_dir_header, (mz_uint16)archive_name_size, 0, uncomp_size, comp_size, uncomp_crc32, method, 0, dos_time, dos_date))
+  if (!mz_zip_writer_create_local_dir_header(pZip, local_dir_header, (mz_uint16)archive_name_size, (mz_uint16)local_zip64_extra_size, uncomp_size, comp_size, uncomp_crc32, method, 0, dos_time, dos_date, local_zip64))
     return MZ_FALSE;
 
   if (pZip->m_pWrite(pZip->m_pIO_opaque, local_dir_header_ofs, local_dir_header, sizeof(local_dir_header)) != sizeof(local_dir_header))
     return MZ_FALSE;
 
+  if (local_zip64)
+  {
+    mz_uint8 local_zip64_extra[MZ_ZIP64_MAX_EXTRA_FIELD_SIZE];
+    mz_zip_writer_create_zip64_extra_data(local_zip64_extra, &uncomp_size, &comp_size, NULL);
+    if (pZip->m_pWrite(pZip->m_pIO_opaque, local_dir_header_ofs + sizeof(local_dir_header) + archive_name_size, local_zip64_extra, local_zip64_extra_size) != local_zip64_extra_size)
+      return MZ_FALSE;
+  }
+
   if (!mz_zip_writer_add_to_central_dir(pZip, pArchive_name, (mz_uint16)archive_name_size, NULL, 0, pComment, comment_size, uncomp_size, comp_size, uncomp_crc32, method, 0, dos_time, dos_date, local_dir_header_ofs, ext_attributes))
     return MZ_FALSE;
 
@@ -4419,12 +4566,14 @@ mz_bool mz_zip_writer_add_file(mz_zip_archive *pZip, const char *pArchive_name,
   size_t archive_name_size;
   mz_uint8 local_dir_header[MZ_ZIP_LOCAL_DIR_HEADER_SIZE];
   MZ_FILE *pSrc_file = NULL;
+  mz_bool local_zip64;
+  mz_uint32 local_zip64_extra_size;
 
   if ((int)level_and_flags < 0)
     level_and_flags = MZ_DEFAULT_LEVEL;
   level = level_and_flags & 0xF;
 
-  if ((!pZip) || (!pZip->m_pState) || (pZip->m_zip_mode != MZ_ZIP_MODE_WRITING) || (!pArchive_name) || ((comment_size) && (!pComment)) || (level > MZ_UBER_COMPRESSION))
+  if ((!pZip) || (!pZip->m_pState) || (pZip->m_zip_mode != MZ_ZIP_MODE_WRITING) || (!pArchive_name) || ((comment_size) && (!pComment)) || (pZip->m_total_files == 0xFFFFFFFF) || (level > MZ_UBER_COMPRESSION))
     return MZ_FALSE;
   if (level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA)
     return MZ_FALSE;
@@ -4437,10 +4586,6 @@ mz_bool mz_zip_writer_add_file(mz_zip_archive *pZip, const char *pArchive_name,
 
   num_alignment_padding_bytes = mz_zip_writer_compute_padding_needed_for_file_alignment(pZip);
 
-  // no zip64 support yet
-  if ((pZip->m_total_files == 0xFFFF) || ((pZip->m_archive_size + num_alignment_padding_bytes + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + comment_size + archive_name_size) > 0xFFFFFFFF))
-    return MZ_FALSE;
-
   if (!mz_zip_get_file_modified_time(pSrc_filename, &dos_time, &dos_date))
     return MZ_FALSE;
     
@@ -4451,15 +4596,15 @@ mz_bool mz_zip_writer_add_file(mz_zip_archive *pZip, const char *pArchive_name,
   uncomp_size = MZ_FTELL64(pSrc_file);
   MZ_FSEEK64(pSrc_file, 0, SEEK_SET);
 
-  if (uncomp_size > 0xFFFFFFFF)
-  {
-    // No zip64 support yet
-    MZ_FCLOSE(pSrc_file);
-    return MZ_FALSE;
-  }
   if (uncomp_size <= 3)
     level = 0;
 
+  // NRR: decide up front whether the entry needs zip64, storing rather than compressing data that could end up either side of 4GB
+  if ((level) && (uncomp_size < 0xFFFFFFFF) && (uncomp_size + (uncomp_size >> 4) + 1024 >= 0xFFFFFFFF))
+    level = 0;
+  local_zip64 = mz_zip_writer_needs_zip64(uncomp_size, uncomp_size, local_dir_header_ofs + num_alignment_padding_bytes);
+  local_zip64_extra_size = local_zip64 ? 4 + 2 * sizeof(mz_uint64) : 0;
+
   if (!mz_zip_writer_write_zeros(pZip, cur_archive_file_ofs, num_alignment_padding_bytes + sizeof(local_dir_header)))
   {
     MZ_FCLOSE(pSrc_file);
@@ -4476,6 +4621,8 @@ mz_bool mz_zip_writer_add_file(mz_zip_archive *pZip, const char *pArchive_name,
     return MZ_FALSE;
   }
   cur_archive_file_ofs += archive_name_size;
+  // NRR: skip over the zip64 extra field, if any; it's written with the local header below
+  cur_archive_file_ofs += local_zip64_extra_size;
 
   if (uncomp_size)
   {
@@ -4569,16 +4716,24 @@ mz_bool mz_zip_writer_add_file(mz_zip_archive *pZip, const char *pArchive_name,
 
   MZ_FCLOSE(pSrc_file); pSrc_file = NULL;
 
-  // no zip64 support yet
-  if ((comp_size > 0xFFFFFFFF) || (cur_archive_file_ofs > 0xFFFFFFFF))
+  // NRR: the final sizes have to agree with the zip64 decision made up front, when space for the extra field was reserved
+  if (local_zip64 != mz_zip_writer_needs_zip64(uncomp_size, comp_size, local_dir_header_ofs))
     return MZ_FALSE;
 
-  if (!mz_zip_writer_create_local_dir_header(pZip, local_dir_header, (mz_uint16)archive_name_size, 0, uncomp_size, comp_size, uncomp_crc32, method, 0, dos_time, dos_date))
+  if (!mz_zip_writer_create_local_dir_header(pZip, local_dir_header, (mz_uint16)archive_name_size, (mz_uint16)local_zip64_extra_size, uncomp_size, comp_size, uncomp_crc32, method, 0, dos_time, dos_date, local_zip64))
     return MZ_FALSE;
 
   if (pZip->m_pWrite(pZip->m_pIO_opaque, local_dir_header_ofs, local_dir_header, sizeof(local_dir_header)) != sizeof(local_dir_header))
     return MZ_FALSE;
 
+  if (local_zip64)
+  {
+    mz_uint8 local_zip64_extra[MZ_ZIP64_MAX_EXTRA_FIELD_SIZE];
+    mz_zip_writer_create_zip64_extra_data(local_zip64_extra, &uncomp_size, &comp_size, NULL);
+    if (pZip->m_pWrite(pZip->m_pIO_opaque, local_dir_header_ofs + sizeof(local_dir_header) + archive_name_size, local_zip64_extra, local_zip64_extra_size) != local_zip64_extra_size)
+      return MZ_FALSE;
+  }
+
   if (!mz_zip_writer_add_to_central_dir(pZip, pArchive_name, (mz_uint16)archive_name_size, NULL, 0, pComment, comment_size, uncomp_size, comp_size, uncomp_crc32, method, 0, dos_time, dos_date, local_dir_header_ofs, ext_attributes))
     return MZ_FALSE;
 
@@ -4595,8 +4750,11 @@ mz_bool mz_zip_writer_add_from_zip_reader(mz_zip_archive *pZip, mz_zip_archive *
   mz_uint64 comp_bytes_remaining, local_dir_header_ofs;
   mz_uint64 cur_src_file_ofs, cur_dst_file_ofs;
   mz_uint32 local_header_u32[(MZ_ZIP_LOCAL_DIR_HEADER_SIZE + sizeof(mz_uint32) - 1) / sizeof(mz_uint32)]; mz_uint8 *pLocal_header = (mz_uint8 *)local_header_u32;
-  mz_uint8 central_header[MZ_ZIP_CENTRAL_DIR_HEADER_SIZE];
-  size_t orig_central_dir_size;
+  mz_uint64 src_comp_size, src_uncomp_size, src_local_header_ofs;
+  mz_uint8 *pDst_central_header;
+  const mz_uint8 *pSrc_extra;
+  mz_uint8 *pExtra;
+  mz_uint src_extra_size, extra_size;
   mz_zip_internal_state *pState;
   void *pBuf; const mz_uint8 *pSrc_central_header;
 
@@ -4608,11 +4766,12 @@ mz_bool mz_zip_writer_add_from_zip_reader(mz_zip_archive *pZip, mz_zip_archive *
 
   num_alignment_padding_bytes = mz_zip_writer_compute_padding_needed_for_file_alignment(pZip);
 
-  // no zip64 support yet
-  if ((pZip->m_total_files == 0xFFFF) || ((pZip->m_archive_size + num_alignment_padding_bytes + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE) > 0xFFFFFFFF))
+  if (pZip->m_total_files == 0xFFFFFFFF)
+    return MZ_FALSE;
+  if (!mz_zip_reader_get_cdh_sizes(pSrc_central_header, &src_comp_size, &src_uncomp_size, &src_local_header_ofs))
     return MZ_FALSE;
 
-  cur_src_file_ofs = MZ_READ_LE32(pSrc_central_header + MZ_ZIP_CDH_LOCAL_HEADER_OFS);
+  cur_src_file_ofs = src_local_header_ofs;
   cur_dst_file_ofs = pZip->m_archive_size;
 
   if (pSource_zip->m_pRead(pSource_zip->m_pIO_opaque, cur_src_file_ofs, pLocal_header, MZ_ZIP_LOCAL_DIR_HEADER_SIZE) != MZ_ZIP_LOCAL_DIR_HEADER_SIZE)
@@ -4632,9 +4791,9 @@ mz_bool mz_zip_writer_add_from_zip_reader(mz_zip_archive *pZip, mz_zip_archive *
   cur_dst_file_ofs += MZ_ZIP_LOCAL_DIR_HEADER_SIZE;
 
   n = MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_FILENAME_LEN_OFS) + MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_EXTRA_LEN_OFS);
-  comp_bytes_remaining = n + MZ_READ_LE32(pSrc_central_header + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS);
+  comp_bytes_remaining = n + src_comp_size;
 
-  if (NULL == (pBuf = pZip->m_pAlloc(pZip->m_pAlloc_opaque, 1, (size_t)MZ_MAX(sizeof(mz_uint32) * 4, MZ_MIN(MZ_ZIP_MAX_IO_BUF_SIZE, comp_bytes_remaining)))))
+  if (NULL == (pBuf = pZip->m_pAlloc(pZip->m_pAlloc_opaque, 1, (size_t)MZ_MAX(sizeof(mz_uint32) * 6, MZ_MIN(MZ_ZIP_MAX_IO_BUF_SIZE, comp_bytes_remaining)))))
     return MZ_FALSE;
 
   while (comp_bytes_remaining)
@@ -4661,13 +4820,15 @@ mz_bool mz_zip_writer_add_from_zip_reader(mz_zip_archive *pZip, mz_zip_archive *
   if (bit_flags & 8)
   {
     // Copy data descriptor
-    if (pSource_zip->m_pRead(pSource_zip->m_pIO_opaque, cur_src_file_ofs, pBuf, sizeof(mz_uint32) * 4) != sizeof(mz_uint32) * 4)
+    // NRR: zip64 entries have 64-bit sizes in the data descriptor
+    mz_uint desc_size = sizeof(mz_uint32) * (mz_zip_writer_needs_zip64(src_uncomp_size, src_comp_size, src_local_header_ofs) ? 5 : 3);
+    if (pSource_zip->m_pRead(pSource_zip->m_pIO_opaque, cur_src_file_ofs, pBuf, desc_size + sizeof(mz_uint32)) != desc_size + sizeof(mz_uint32))
     {
       pZip->m_pFree(pZip->m_pAlloc_opaque, pBuf);
       return MZ_FALSE;
     }
 
-    n = sizeof(mz_uint32) * ((MZ_READ_LE32(pBuf) == 0x08074b50) ? 4 : 3);
+    n = desc_size + ((MZ_READ_LE32(pBuf) == 0x08074b50) ? sizeof(mz_uint32) : 0);
     if (pZip->m_pWrite(pZip->m_pIO_opaque, cur_dst_file_ofs, pBuf, n) != n)
     {
       pZip->m_pFree(pZip->m_pAlloc_opaque, pBuf);
@@ -4679,32 +4840,49 @@ mz_bool mz_zip_writer_add_from_zip_reader(mz_zip_archive *pZip, mz_zip_archive *
   }
   pZip->m_pFree(pZip->m_pAlloc_opaque, pBuf);
 
-  // no zip64 support yet
-  if (cur_dst_file_ofs > 0xFFFFFFFF)
-    return MZ_FALSE;
-
-  orig_central_dir_size = pState->m_central_dir.m_size;
-
-  memcpy(central_header, pSrc_central_header, MZ_ZIP_CENTRAL_DIR_HEADER_SIZE);
-  MZ_WRITE_LE32(central_header + MZ_ZIP_CDH_LOCAL_HEADER_OFS, local_dir_header_ofs);
-  if (!mz_zip_array_push_back(pZip, &pState->m_central_dir, central_header, MZ_ZIP_CENTRAL_DIR_HEADER_SIZE))
-    return MZ_FALSE;
-
-  n = MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_FILENAME_LEN_OFS) + MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_EXTRA_LEN_OFS) + MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_COMMENT_LEN_OFS);
-  if (!mz_zip_array_push_back(pZip, &pState->m_central_dir, pSrc_central_header + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE, n))
+  // NRR: rebuild the central directory entry, since the new local header offset may need a zip64 extra
+  // field where the source's didn't, or vice versa.  Copy all the source's other extra fields.
+  src_extra_size = MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_EXTRA_LEN_OFS);
+  pSrc_extra = pSrc_central_header + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_FILENAME_LEN_OFS);
+  pExtra = NULL;
+  extra_size = 0;
+  if (src_extra_size)
   {
-    mz_zip_array_resize(pZip, &pState->m_central_dir, orig_central_dir_size, MZ_FALSE);
-    return MZ_FALSE;
+    mz_uint i = 0;
+    if (NULL == (pExtra = (mz_uint8 *)pZip->m_pAlloc(pZip->m_pAlloc_opaque, 1, src_extra_size)))
+      return MZ_FALSE;
+    while (i + 2 * sizeof(mz_uint16) <= src_extra_size)
+    {
+      mz_uint field_id = MZ_READ_LE16(pSrc_extra + i);
+      mz_uint field_size = 2 * sizeof(mz_uint16) + MZ_READ_LE16(pSrc_extra + i + sizeof(mz_uint16));
+      if (i + field_size > src_extra_size)
+        break;
+      if (field_id != MZ_ZIP64_EXTENDED_INFORMATION_FIELD_HEADER_ID)
+      {
+        memcpy(pExtra + extra_size, pSrc_extra + i, field_size);
+        extra_size += field_size;
+      }
+      i += field_size;
+    }
   }
 
-  if (pState->m_central_dir.m_size > 0xFFFFFFFF)
-    return MZ_FALSE;
-  n = (mz_uint32)orig_central_dir_size;
-  if (!mz_zip_array_push_back(pZip, &pState->m_central_dir_offsets, &n, 1))
+  if (!mz_zip_writer_add_to_central_dir(pZip,
+          (const char *)pSrc_central_header + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE, MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_FILENAME_LEN_OFS),
+          pExtra, (mz_uint16)extra_size,
+          pSrc_extra + src_extra_size, MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_COMMENT_LEN_OFS),
+          src_uncomp_size, src_comp_size, MZ_READ_LE32(pSrc_central_header + MZ_ZIP_CDH_CRC32_OFS),
+          MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_METHOD_OFS), MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_BIT_FLAG_OFS),
+          MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_FILE_TIME_OFS), MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_FILE_DATE_OFS),
+          local_dir_header_ofs, MZ_READ_LE32(pSrc_central_header + MZ_ZIP_CDH_EXTERNAL_ATTR_OFS)))
   {
-    mz_zip_array_resize(pZip, &pState->m_central_dir, orig_central_dir_size, MZ_FALSE);
+    pZip->m_pFree(pZip->m_pAlloc_opaque, pExtra);
     return MZ_FALSE;
   }
+  pZip->m_pFree(pZip->m_pAlloc_opaque, pExtra);
+
+  pDst_central_header = (mz_uint8 *)pState->m_central_dir.m_p + MZ_ZIP_ARRAY_ELEMENT(&pState->m_central_dir_offsets, mz_uint32, pState->m_central_dir_offsets.m_size - 1);
+  memcpy(pDst_central_header + MZ_ZIP_CDH_VERSION_MADE_BY_OFS, pSrc_central_header + MZ_ZIP_CDH_VERSION_MADE_BY_OFS, sizeof(mz_uint16));
+  memcpy(pDst_central_header + MZ_ZIP_CDH_INTERNAL_ATTR_OFS, pSrc_central_header + MZ_ZIP_CDH_INTERNAL_ATTR_OFS, sizeof(mz_uint16));
 
   pZip->m_total_files++;
   pZip->m_archive_size = cur_dst_file_ofs;
@@ -4717,16 +4895,13 @@ mz_bool mz_zip_writer_finalize_archive(mz_zip_archive *pZip)
   mz_zip_internal_state *pState;
   mz_uint64 central_dir_ofs, central_dir_size;
   mz_uint8 hdr[MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE];
+  mz_uint8 zip64_hdr[MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE + MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE];
 
   if ((!pZip) || (!pZip->m_pState) || (pZip->m_zip_mode != MZ_ZIP_MODE_WRITING))
     return MZ_FALSE;
 
   pState = pZip->m_pState;
 
-  // no zip64 support yet
-  if ((pZip->m_total_files > 0xFFFF) || ((pZip->m_archive_size + pState->m_central_dir.m_size + MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE) > 0xFFFFFFFF))
-    return MZ_FALSE;
-
   central_dir_ofs = 0;
   central_dir_size = 0;
   if (pZip->m_total_files)
@@ -4740,13 +4915,36 @@ mz_bool mz_zip_writer_finalize_archive(mz_zip_archive *pZip)
     pZip->m_archive_size += central_dir_size;
   }
 
+  // NRR: write zip64 end of central directory record and locator, if anything overflows the regular record
+  if ((pZip->m_total_files >= 0xFFFF) || (central_dir_ofs >= 0xFFFFFFFF) || (central_dir_size >= 0xFFFFFFFF))
+  {
+    mz_uint8 *pLocator = zip64_hdr + MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE;
+    MZ_CLEAR_OBJ(zip64_hdr);
+    MZ_WRITE_LE32(zip64_hdr + MZ_ZIP64_ECDH_SIG_OFS, MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIG);
+    MZ_WRITE_LE64(zip64_hdr + MZ_ZIP64_ECDH_SIZE_OF_RECORD_OFS, MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE - sizeof(mz_uint32) - sizeof(mz_uint64));
+    MZ_WRITE_LE16(zip64_hdr + MZ_ZIP64_ECDH_VERSION_MADE_BY_OFS, MZ_ZIP64_VERSION_NEEDED);
+    MZ_WRITE_LE16(zip64_hdr + MZ_ZIP64_ECDH_VERSION_NEEDED_OFS, MZ_ZIP64_VERSION_NEEDED);
+    MZ_WRITE_LE64(zip64_hdr + MZ_ZIP64_ECDH_CDIR_NUM_ENTRIES_ON_DISK_OFS, pZip->m_total_files);
+    MZ_WRITE_LE64(zip64_hdr + MZ_ZIP64_ECDH_CDIR_TOTAL_ENTRIES_OFS, pZip->m_total_files);
+    MZ_WRITE_LE64(zip64_hdr + MZ_ZIP64_ECDH_CDIR_SIZE_OFS, central_dir_size);
+    MZ_WRITE_LE64(zip64_hdr + MZ_ZIP64_ECDH_CDIR_OFS_OFS, central_dir_ofs);
+
+    MZ_WRITE_LE32(pLocator + MZ_ZIP64_ECDL_SIG_OFS, MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIG);
+    MZ_WRITE_LE64(pLocator + MZ_ZIP64_ECDL_REL_OFS_TO_ZIP64_ECDR_OFS, pZip->m_archive_size);
+    MZ_WRITE_LE32(pLocator + MZ_ZIP64_ECDL_TOTAL_NUMBER_OF_DISKS_OFS, 1);
+
+    if (pZip->m_pWrite(pZip->m_pIO_opaque, pZip->m_archive_size, zip64_hdr, sizeof(zip64_hdr)) != sizeof(zip64_hdr))
+      return MZ_FALSE;
+    pZip->m_archive_size += sizeof(zip64_hdr);
+  }
+
   // Write end of central directory record
   MZ_CLEAR_OBJ(hdr);
   MZ_WRITE_LE32(hdr + MZ_ZIP_ECDH_SIG_OFS, MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIG);
-  MZ_WRITE_LE16(hdr + MZ_ZIP_ECDH_CDIR_NUM_ENTRIES_ON_DISK_OFS, pZip->m_total_files);
-  MZ_WRITE_LE16(hdr + MZ_ZIP_ECDH_CDIR_TOTAL_ENTRIES_OFS, pZip->m_total_files);
-  MZ_WRITE_LE32(hdr + MZ_ZIP_ECDH_CDIR_SIZE_OFS, central_dir_size);
-  MZ_WRITE_LE32(hdr + MZ_ZIP_ECDH_CDIR_OFS_OFS, central_dir_ofs);
+  MZ_WRITE_LE16(hdr + MZ_ZIP_ECDH_CDIR_NUM_ENTRIES_ON_DISK_OFS, MZ_MIN(pZip->m_total_files, 0xFFFF));
+  MZ_WRITE_LE16(hdr + MZ_ZIP_ECDH_CDIR_TOTAL_ENTRIES_OFS, MZ_MIN(pZip->m_total_files, 0xFFFF));
+  MZ_WRITE_LE32(hdr + MZ_ZIP_ECDH_CDIR_SIZE_OFS, MZ_MIN(central_dir_size, 0xFFFFFFFF));
+  MZ_WRITE_LE32(hdr + MZ_ZIP_ECDH_CDIR_OFS_OFS, MZ_MIN(central_dir_ofs, 0xFFFFFFFF));
 
   if (pZip->m_pWrite(pZip->m_pIO_opaque, pZip->m_archive_size, hdr, sizeof(hdr)) != sizeof(hdr))
     return MZ_FALSE;
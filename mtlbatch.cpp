@@ -0,0 +1,169 @@
+#include "framework.h"
+
+namespace Framework
+{
+	// MtlBatchList implementation
+
+	MtlBatchList::MtlBatchList()
+	:	m_opaqueBatchCount(0),
+		m_drawsUnbatched(0),
+		m_drawsBatched(0),
+		m_bindsUnbatched(0),
+		m_bindsBatched(0)
+	{
+	}
+
+	void MtlBatchList::Reset()
+	{
+		m_batches.clear();
+		m_opaqueBatchCount = 0;
+		m_triSlices.clear();
+		m_drawsUnbatched = 0;
+		m_drawsBatched = 0;
+		m_bindsUnbatched = 0;
+		m_bindsBatched = 0;
+		m_pBufTriSlices.release();
+		m_pSrvTriSlices.release();
+	}
+
+	void MtlBatchList::Build(const Mesh * pMesh, const TextureArrayLib * pTexArrayLib)
+	{
+		ASSERT_ERR(pMesh);
+		ASSERT_ERR(pTexArrayLib);
+		ASSERT_ERR(pMesh->m_primtopo == D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+
+		Reset();
+		m_triSlices.assign(pMesh->m_indexCount / 3, 0);
+
+		int mtlRangeCount = int(pMesh->m_mtlRanges.size());
+		for (int pass = 0; pass < 2; ++pass)
+		{
+			bool alphaTest = (pass == 1);
+			for (int i = 0; i < mtlRangeCount; ++i)
+			{
+				const Mesh::MtlRange & range = pMesh->m_mtlRanges[i];
+				ASSERT_ERR(range.m_pMtl);
+				ASSERT_ERR(range.m_indexStart % 3 == 0 && range.m_indexCount % 3 == 0);
+				ASSERT_ERR(range.m_indexStart + range.m_indexCount <= pMesh->m_indexCount);
+
+				if (range.m_pMtl->m_alphaTest != alphaTest || range.m_indexCount == 0)
+					continue;
+
+				Texture2DArray * pTexArray = nullptr;
+				int slice = 0;
+				if (const Texture2D * pTex = range.m_pMtl->m_pTexDiffuseColor)
+				{
+					const TextureArrayLib::Slice * pSlice = pTexArrayLib->Lookup(pTex);
+					ASSERT_WARN_MSG(pSlice, "Material %s: diffuse texture isn't in the texture array library", range.m_pMtl->m_mtlName);
+					if (pSlice)
+					{
+						pTexArray = pSlice->m_pTexArray;
+						slice = pSlice->m_slice;
+					}
+				}
+
+				Texture2D * pTexMask = nullptr;
+				int maskChannel = -1;
+				if (alphaTest && range.m_pMtl->m_pTexPacked && range.m_pMtl->m_packedChannels[PACKCH_Mask] >= 0)
+				{
+					pTexMask = range.m_pMtl->m_pTexPacked;
+					maskChannel = range.m_pMtl->m_packedChannels[PACKCH_Mask];
+				}
+
+				for (int iTri = range.m_indexStart / 3, iTriEnd = iTri + range.m_indexCount / 3; iTri < iTriEnd; ++iTri)
+					m_triSlices[iTri] = ushort(slice);
+
+				// Extend the last batch if this range picks up right where it left off
+				MtlBatch * pBatchPrev = m_batches.empty() ? nullptr : &m_batches.back();
+				if (pBatchPrev &&
+					pBatchPrev->m_alphaTest == alphaTest &&
+					pBatchPrev->m_pTexArray == pTexArray &&
+					pBatchPrev->m_pTexMask == pTexMask &&
+					pBatchPrev->m_maskChannel == maskChannel &&
+					pBatchPrev->m_indexStart + pBatchPrev->m_indexCount == range.m_indexStart)
+				{
+					pBatchPrev->m_indexCount += range.m_indexCount;
+					++pBatchPrev->m_mtlRangeCount;
+				}
+				else
+				{
+					MtlBatch batch =
+					{
+						pTexArray,
+						alphaTest,
+						pTexMask,
+						maskChannel,
+						range.m_indexStart,
+						range.m_indexCount,
+						range.m_indexStart / 3,
+						1,		// mtlRangeCount
+					};
+					m_batches.push_back(batch);
+				}
+
+				++m_drawsUnbatched;
+				++m_bindsUnbatched;
+			}
+
+			if (!alphaTest)
+				m_opaqueBatchCount = int(m_batches.size());
+		}
+
+		// Only rebind when the array changes from one batch to the next
+		m_drawsBatched = int(m_batches.size());
+		for (int i = 0; i < m_drawsBatched; ++i)
+		{
+			if (i == 0 || m_batches[i].m_pTexArray != m_batches[i-1].m_pTexArray)
+				++m_bindsBatched;
+		}
+
+		LOG("Batched %d material ranges into %d draws (%d saved), with %d texture binds (%d saved)",
+			m_drawsUnbatched, m_drawsBatched, m_drawsUnbatched - m_drawsBatched,
+			m_bindsBatched, m_bindsUnbatched - m_bindsBatched);
+	}
+
+	void MtlBatchList::UploadToGPU(ID3D11Device * pDevice)
+	{
+		ASSERT_ERR(pDevice);
+		ASSERT_ERR(!m_triSlices.empty());
+
+		m_pBufTriSlices.release();
+		m_pSrvTriSlices.release();
+
+		D3D11_BUFFER_DESC bufDesc =
+		{
+			UINT(sizeof(ushort) * m_triSlices.size()),
+			D3D11_USAGE_IMMUTABLE,
+			D3D11_BIND_SHADER_RESOURCE,
+			0,	// no cpu access
+			0,	// no misc flags
+			0,	// structured buffer stride
+		};
+		D3D11_SUBRESOURCE_DATA bufData = { &m_triSlices[0], 0, 0 };
+		CHECK_D3D(pDevice->CreateBuffer(&bufDesc, &bufData, &m_pBufTriSlices));
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = { DXGI_FORMAT_R16_UINT, D3D11_SRV_DIMENSION_BUFFER, };
+		srvDesc.Buffer.FirstElement = 0;
+		srvDesc.Buffer.NumElements = UINT(m_triSlices.size());
+		CHECK_D3D(pDevice->CreateShaderResourceView(m_pBufTriSlices, &srvDesc, &m_pSrvTriSlices));
+	}
+
+	void MtlBatchList::DrawBatch(
+		ID3D11DeviceContext * pCtx,
+		Mesh * pMesh,
+		int iBatch,
+		int streamMask /* = VSTREAMMASK_All */,
+		int instanceCount /* = 1 */,
+		int instanceStart /* = 0 */)
+	{
+		ASSERT_ERR(pCtx);
+		ASSERT_ERR(pMesh);
+		ASSERT_ERR(iBatch >= 0 && iBatch < int(m_batches.size()));
+		ASSERT_ERR(instanceCount >= 0 && instanceStart >= 0);
+
+		const MtlBatch * pBatch = &m_batches[iBatch];
+
+		pMesh->Bind(pCtx, streamMask);
+		pCtx->DrawIndexedInstanced(pBatch->m_indexCount, instanceCount, pBatch->m_indexStart, 0, instanceStart);
+	}
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+namespace Framework
+{
+	class Mesh;
+	class Texture2D;
+	class Texture2DArray;
+	class TextureArrayLib;
+
+	// Material batching: once the textures are grouped into arrays (see TextureArrayLib),
+	// neighboring material ranges whose diffuse textures live in the same array can be
+	// drawn together.
+	//  * Ranges are merged when they're adjacent in the index buffer and agree on alpha
+	//      testing and diffuse array.  Untextured materials batch together with a null array.
+	//  * Alpha-tested ranges whose mask is packed with their spec and height (see
+	//      ACF_MtlPackChannels) also have to agree on the packed texture, as it isn't arrayed.
+	//  * The slice for each triangle goes in a buffer indexed by SV_PrimitiveID plus the
+	//      batch's m_triangleBase, since one draw now covers several textures.
+	//  * Opaque batches come first, then alpha-tested ones, matching the order the
+	//      ranges would be drawn in one at a time.
+	struct MtlBatch
+	{
+		Texture2DArray *	m_pTexArray;			// Diffuse texture array, or null if untextured
+		bool				m_alphaTest;
+		Texture2D *			m_pTexMask;				// Packed texture holding the alpha-test mask, or null
+		int					m_maskChannel;			// Channel of m_pTexMask holding the mask, or -1
+		int					m_indexStart, m_indexCount;
+		int					m_triangleBase;			// m_indexStart / 3
+		int					m_mtlRangeCount;		// How many ranges were merged into this one
+	};
+
+	class MtlBatchList
+	{
+	public:
+		std::vector<MtlBatch>		m_batches;
+		int							m_opaqueBatchCount;		// Alpha-tested batches start here
+		std::vector<ushort>			m_triSlices;			// Diffuse array slice for each triangle in the mesh
+
+		// Draws and texture binds per frame for the ranges drawn one at a time, vs. batched
+		int							m_drawsUnbatched, m_drawsBatched;
+		int							m_bindsUnbatched, m_bindsBatched;
+
+		// GPU resources
+		comptr<ID3D11Buffer>				m_pBufTriSlices;
+		comptr<ID3D11ShaderResourceView>	m_pSrvTriSlices;
+
+				MtlBatchList();
+		void	Reset();
+
+		// Does the batching; doesn't touch the GPU
+		void	Build(const Mesh * pMesh, const TextureArrayLib * pTexArrayLib);
+
+		// Creates the triangle slice buffer on the GPU from m_triSlices
+		void	UploadToGPU(ID3D11Device * pDevice);
+
+		void	DrawBatch(
+					ID3D11DeviceContext * pCtx,
+					Mesh * pMesh,
+					int iBatch,
+					int streamMask = VSTREAMMASK_All,
+					int instanceCount = 1,
+					int instanceStart = 0);
+	};
+}
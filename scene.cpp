@@ -0,0 +1,164 @@
+#include "framework.h"
+
+namespace Framework
+{
+	void AppendInstanceInputElementDescs(std::vector<D3D11_INPUT_ELEMENT_DESC> * pDescsOut)
+	{
+		ASSERT_ERR(pDescsOut);
+
+		for (int i = 0; i < ISTREAM_Count; ++i)
+		{
+			D3D11_INPUT_ELEMENT_DESC desc =
+			{
+				"INSTANCE_XFM", UINT(i), DXGI_FORMAT_R32G32B32A32_FLOAT,
+				UINT(s_iSlotFirstInstanceStream + i), 0,
+				D3D11_INPUT_PER_INSTANCE_DATA, 1,
+			};
+			pDescsOut->push_back(desc);
+		}
+	}
+
+
+
+	// Scene implementation
+
+	Scene::Scene()
+	:	m_instanceCount(0),
+		m_bounds(empty)
+	{
+	}
+
+	void Scene::Reset()
+	{
+		m_pPack.release();
+		m_meshes.clear();
+		m_instanceRanges.clear();
+		m_instanceCount = 0;
+		for (int i = 0; i < ISTREAM_Count; ++i)
+		{
+			m_aInstanceXfms[i].clear();
+			m_apInstanceBuffers[i].release();
+		}
+		m_instanceBoundsMins.clear();
+		m_instanceBoundsMaxs.clear();
+		m_bounds = box3(empty);
+	}
+
+	void Scene::BindInstanceBuffers(ID3D11DeviceContext * pCtx)
+	{
+		ASSERT_ERR(pCtx);
+
+		// Instance ranges are selected with the draw's start instance, so the buffers
+		// are always bound from the beginning
+		ID3D11Buffer * apBuffers[ISTREAM_Count];
+		UINT aStrides[ISTREAM_Count];
+		UINT aOffsets[ISTREAM_Count] = {};
+		for (int i = 0; i < ISTREAM_Count; ++i)
+		{
+			apBuffers[i] = m_apInstanceBuffers[i];
+			aStrides[i] = sizeof(float4);
+		}
+
+		pCtx->IASetVertexBuffers(s_iSlotFirstInstanceStream, ISTREAM_Count, apBuffers, aStrides, aOffsets);
+	}
+
+	void Scene::DrawMesh(ID3D11DeviceContext * pCtx, int iMesh, int streamMask /* = VSTREAMMASK_All */)
+	{
+		ASSERT_ERR(pCtx);
+		ASSERT_ERR(iMesh >= 0 && iMesh < int(m_meshes.size()));
+
+		const InstanceRange & range = m_instanceRanges[iMesh];
+		if (range.m_instanceCount == 0)
+			return;
+
+		BindInstanceBuffers(pCtx);
+		m_meshes[iMesh].Draw(pCtx, streamMask, range.m_instanceCount, range.m_instanceStart);
+	}
+
+	void Scene::DrawMtlRange(ID3D11DeviceContext * pCtx, int iMesh, int iMtlRange, int streamMask /* = VSTREAMMASK_All */)
+	{
+		ASSERT_ERR(pCtx);
+		ASSERT_ERR(iMesh >= 0 && iMesh < int(m_meshes.size()));
+
+		const InstanceRange & range = m_instanceRanges[iMesh];
+		if (range.m_instanceCount == 0)
+			return;
+
+		BindInstanceBuffers(pCtx);
+		m_meshes[iMesh].DrawMtlRange(pCtx, iMtlRange, streamMask, range.m_instanceCount, range.m_instanceStart);
+	}
+
+	void Scene::DrawDepthOpaque(ID3D11DeviceContext * pCtx, int iMesh)
+	{
+		ASSERT_ERR(pCtx);
+		ASSERT_ERR(iMesh >= 0 && iMesh < int(m_meshes.size()));
+
+		const InstanceRange & range = m_instanceRanges[iMesh];
+		if (range.m_instanceCount == 0)
+			return;
+
+		BindInstanceBuffers(pCtx);
+		m_meshes[iMesh].DrawDepthOpaque(pCtx, range.m_instanceCount, range.m_instanceStart);
+	}
+
+	void Scene::DrawDepthAlphaTestRange(ID3D11DeviceContext * pCtx, int iMesh, int iDepthMtlRange)
+	{
+		ASSERT_ERR(pCtx);
+		ASSERT_ERR(iMesh >= 0 && iMesh < int(m_meshes.size()));
+
+		const InstanceRange & range = m_instanceRanges[iMesh];
+		if (range.m_instanceCount == 0)
+			return;
+
+		BindInstanceBuffers(pCtx);
+		m_meshes[iMesh].DrawDepthAlphaTestRange(pCtx, iDepthMtlRange, range.m_instanceCount, range.m_instanceStart);
+	}
+
+	void Scene::Draw(ID3D11DeviceContext * pCtx, int streamMask /* = VSTREAMMASK_All */)
+	{
+		ASSERT_ERR(pCtx);
+
+		for (int iMesh = 0, cMesh = int(m_meshes.size()); iMesh < cMesh; ++iMesh)
+			DrawMesh(pCtx, iMesh, streamMask);
+	}
+
+	void Scene::GetInputElementDescs(int iMesh, int streamMask, std::vector<D3D11_INPUT_ELEMENT_DESC> * pDescsOut) const
+	{
+		ASSERT_ERR(iMesh >= 0 && iMesh < int(m_meshes.size()));
+		ASSERT_ERR(pDescsOut);
+
+		m_meshes[iMesh].GetInputElementDescs(streamMask, pDescsOut);
+		AppendInstanceInputElementDescs(pDescsOut);
+	}
+
+	void Scene::UploadToGPU(ID3D11Device * pDevice)
+	{
+		ASSERT_ERR(pDevice);
+
+		for (int i = 0, c = int(m_meshes.size()); i < c; ++i)
+			m_meshes[i].UploadToGPU(pDevice);
+
+		for (int i = 0; i < ISTREAM_Count; ++i)
+			m_apInstanceBuffers[i].release();
+
+		if (m_instanceCount == 0)
+			return;
+
+		for (int i = 0; i < ISTREAM_Count; ++i)
+		{
+			ASSERT_ERR(int(m_aInstanceXfms[i].size()) == m_instanceCount);
+
+			D3D11_BUFFER_DESC instBufferDesc =
+			{
+				UINT(sizeof(float4) * m_instanceCount),
+				D3D11_USAGE_IMMUTABLE,
+				D3D11_BIND_VERTEX_BUFFER,
+				0,	// no cpu access
+				0,	// no misc flags
+				0,	// structured buffer stride
+			};
+			D3D11_SUBRESOURCE_DATA instBufferData = { &m_aInstanceXfms[i][0], 0, 0 };
+			CHECK_D3D(pDevice->CreateBuffer(&instBufferDesc, &instBufferData, &m_apInstanceBuffers[i]));
+		}
+	}
+}
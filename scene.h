@@ -0,0 +1,83 @@
+#pragma once
+
+namespace Framework
+{
+	class MaterialLib;
+
+	// Per-instance transforms are fed to the vertex shader as extra vertex streams, in the
+	// IA slots after the mesh's own streams.  Each one holds a column of the 3x4
+	// local-to-world matrix, so worldPos[i] = dot(float4(pos, 1), INSTANCE_XFM[i]).
+	enum ISTREAM
+	{
+		ISTREAM_XfmX,
+		ISTREAM_XfmY,
+		ISTREAM_XfmZ,
+
+		ISTREAM_Count
+	};
+
+	static const int s_iSlotFirstInstanceStream = VSTREAM_Count;
+
+	// Append the per-instance elements to a mesh's input layout
+	void AppendInstanceInputElementDescs(std::vector<D3D11_INPUT_ELEMENT_DESC> * pDescsOut);
+
+	// A set of placed mesh instances.  Each unique mesh is stored and uploaded once, and
+	// drawn with one instanced draw per material range, however many times it's placed.
+	class Scene
+	{
+	public:
+		// Asset pack that this scene's data is sourced from
+		comptr<AssetPack>			m_pPack;
+
+		// Unique meshes referenced by the scene
+		std::vector<Mesh>			m_meshes;
+
+		// Instances are sorted by mesh; this gives the range belonging to each mesh
+		struct InstanceRange
+		{
+			int		m_instanceStart, m_instanceCount;
+		};
+		std::vector<InstanceRange>	m_instanceRanges;		// Parallel to m_meshes
+
+		// Per-instance data, stored SoA
+		int							m_instanceCount;
+		std::vector<float4>			m_aInstanceXfms[ISTREAM_Count];	// Columns of local-to-world matrix
+		std::vector<float3>			m_instanceBoundsMins;			// World-space bounding boxes
+		std::vector<float3>			m_instanceBoundsMaxs;
+		box3						m_bounds;						// Bounding box of the whole scene
+
+		// GPU resources
+		comptr<ID3D11Buffer>		m_apInstanceBuffers[ISTREAM_Count];
+
+				Scene();
+		void	Reset();
+
+		// Draw all the instances of one mesh, either the whole thing or one material range
+		void	DrawMesh(ID3D11DeviceContext * pCtx, int iMesh, int streamMask = VSTREAMMASK_All);
+		void	DrawMtlRange(ID3D11DeviceContext * pCtx, int iMesh, int iMtlRange, int streamMask = VSTREAMMASK_All);
+
+		// Depth-only drawing of all the instances of one mesh; see Mesh::DrawDepthOpaque
+		void	DrawDepthOpaque(ID3D11DeviceContext * pCtx, int iMesh);
+		void	DrawDepthAlphaTestRange(ID3D11DeviceContext * pCtx, int iMesh, int iDepthMtlRange);
+
+		// Draw everything, one instanced draw per mesh
+		void	Draw(ID3D11DeviceContext * pCtx, int streamMask = VSTREAMMASK_All);
+
+		// Input layout elements for drawing one of the meshes instanced
+		void	GetInputElementDescs(int iMesh, int streamMask, std::vector<D3D11_INPUT_ELEMENT_DESC> * pDescsOut) const;
+
+		// Uploads the meshes and creates the instance buffers
+		void	UploadToGPU(ID3D11Device * pDevice);
+
+	protected:
+		void	BindInstanceBuffers(ID3D11DeviceContext * pCtx);
+	};
+
+	// Load a scene from an asset pack, along with all the meshes it references (which must
+	// be in the same pack), resolving their materials using the given material library
+	bool LoadSceneFromAssetPack(
+		AssetPack * pPack,
+		const char * path,
+		MaterialLib * pMtlLib,
+		Scene * pSceneOut);
+}
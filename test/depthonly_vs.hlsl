@@ -0,0 +1,9 @@
+#include "shader-common.hlsli"
+
+// Position-only vertex shader for depth-only passes, fed from just the position stream
+void main(
+	in float3 i_pos : POSITION,
+	out float4 o_posClip : SV_Position)
+{
+	o_posClip = mul(float4(i_pos, 1.0), g_matWorldToClip);
+}
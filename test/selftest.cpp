@@ -0,0 +1,560 @@
+#include <framework.h>
+#include <asset-internal.h>
+#include <io.h>
+
+using namespace util;
+using namespace Framework;
+
+// Headless self-tests of the framework's CPU-side logic.  These feed synthetic data to the
+// parts that don't need a device, and check the decisions they make.
+
+// The zip64 test writes a pack of over 4GB to the temp directory.  It's a sparse file, so it
+// only takes a few MB of disk, but it still takes a few seconds; set this to 0 to skip it.
+#define SELFTEST_ZIP64 1
+
+// Warn and fail the test if a condition doesn't hold
+#define SELFTEST_CHECK(f) \
+		{ \
+			if (!(f)) \
+			{ \
+				WARN("Self-test check failed: %s", #f); \
+				return false; \
+			} \
+		}
+
+
+
+// Vertex streams: strides and slots for each layout, and input elements that agree with them
+
+static bool SelfTestVertexStreams()
+{
+	// Interleaved: the whole vertex is in the position stream, and there's no attribute stream
+	SELFTEST_CHECK(StrideOfVertexStream(VLAYOUT_Interleaved, 0, VSTREAM_Pos) == 12);
+	SELFTEST_CHECK(StrideOfVertexStream(VLAYOUT_Interleaved, 0, VSTREAM_Attribs) == 0);
+	SELFTEST_CHECK(StrideOfVertexStream(VLAYOUT_Interleaved, VATTR_Default, VSTREAM_Pos) == 32);
+	SELFTEST_CHECK(StrideOfVertexStream(VLAYOUT_Interleaved, VATTR_Default, VSTREAM_Attribs) == 0);
+	SELFTEST_CHECK(StrideOfVertexStream(VLAYOUT_Interleaved, VATTR_All, VSTREAM_Pos) == 44);
+
+	// Split: just the position in one stream, and everything else in the other
+	SELFTEST_CHECK(StrideOfVertexStream(VLAYOUT_Split, 0, VSTREAM_Pos) == 12);
+	SELFTEST_CHECK(StrideOfVertexStream(VLAYOUT_Split, 0, VSTREAM_Attribs) == 0);
+	SELFTEST_CHECK(StrideOfVertexStream(VLAYOUT_Split, VATTR_UV, VSTREAM_Attribs) == 8);
+	SELFTEST_CHECK(StrideOfVertexStream(VLAYOUT_Split, VATTR_Default, VSTREAM_Pos) == 12);
+	SELFTEST_CHECK(StrideOfVertexStream(VLAYOUT_Split, VATTR_Default, VSTREAM_Attribs) == 20);
+	SELFTEST_CHECK(StrideOfVertexStream(VLAYOUT_Split, VATTR_All, VSTREAM_Attribs) == 32);
+
+	// Interleaved meshes need their one stream in slot 0 whatever's asked for
+	int aiStreamForSlot[VSTREAM_Count];
+	SELFTEST_CHECK(SelectVertexStreams(VLAYOUT_Interleaved, VSTREAMMASK_Pos, aiStreamForSlot) == 1);
+	SELFTEST_CHECK(aiStreamForSlot[0] == VSTREAM_Pos && aiStreamForSlot[1] == -1);
+	SELFTEST_CHECK(SelectVertexStreams(VLAYOUT_Interleaved, VSTREAMMASK_Attribs, aiStreamForSlot) == 1);
+	SELFTEST_CHECK(aiStreamForSlot[0] == VSTREAM_Pos && aiStreamForSlot[1] == -1);
+	SELFTEST_CHECK(SelectVertexStreams(VLAYOUT_Interleaved, VSTREAMMASK_All, aiStreamForSlot) == 1);
+	SELFTEST_CHECK(aiStreamForSlot[0] == VSTREAM_Pos && aiStreamForSlot[1] == -1);
+
+	// Split meshes keep each stream in its own slot, leaving a gap for one not asked for
+	SELFTEST_CHECK(SelectVertexStreams(VLAYOUT_Split, VSTREAMMASK_Pos, aiStreamForSlot) == 1);
+	SELFTEST_CHECK(aiStreamForSlot[0] == VSTREAM_Pos && aiStreamForSlot[1] == -1);
+	SELFTEST_CHECK(SelectVertexStreams(VLAYOUT_Split, VSTREAMMASK_Attribs, aiStreamForSlot) == 2);
+	SELFTEST_CHECK(aiStreamForSlot[0] == -1 && aiStreamForSlot[1] == VSTREAM_Attribs);
+	SELFTEST_CHECK(SelectVertexStreams(VLAYOUT_Split, VSTREAMMASK_All, aiStreamForSlot) == 2);
+	SELFTEST_CHECK(aiStreamForSlot[0] == VSTREAM_Pos && aiStreamForSlot[1] == VSTREAM_Attribs);
+
+	// Every input element has to come from a slot that's bound, at its place in the vertex
+	// relative to the start of the stream in that slot, and fit in that stream's stride
+	static const int s_aStreamMasks[] = { VSTREAMMASK_Pos, VSTREAMMASK_Attribs, VSTREAMMASK_All };
+	std::vector<D3D11_INPUT_ELEMENT_DESC> descs;
+	for (int vlayout = 0; vlayout < VLAYOUT_Count; ++vlayout)
+	{
+		for (int vattribs = 0; vattribs <= VATTR_All; ++vattribs)
+		{
+			const VertexFormat & format = GetVertexFormat(vattribs);
+			for (int iMask = 0; iMask < dim(s_aStreamMasks); ++iMask)
+			{
+				int streamMask = s_aStreamMasks[iMask];
+				int slotsUsed = SelectVertexStreams(VLAYOUT(vlayout), streamMask, aiStreamForSlot);
+				GetInputElementDescs(VLAYOUT(vlayout), vattribs, streamMask, &descs);
+
+				int attribCount = ((vattribs & VATTR_Normal) ? 1 : 0) + ((vattribs & VATTR_UV) ? 1 : 0) + ((vattribs & VATTR_Tangent) ? 1 : 0);
+				int descCountExpected = ((streamMask & VSTREAMMASK_Pos) ? 1 : 0) + ((streamMask & VSTREAMMASK_Attribs) ? attribCount : 0);
+				SELFTEST_CHECK(int(descs.size()) == descCountExpected);
+
+				for (int i = 0, c = int(descs.size()); i < c; ++i)
+				{
+					const D3D11_INPUT_ELEMENT_DESC & desc = descs[i];
+					SELFTEST_CHECK(int(desc.InputSlot) < slotsUsed);
+					int iStream = aiStreamForSlot[desc.InputSlot];
+					SELFTEST_CHECK(iStream >= 0);
+
+					int offsetInVertex = 0;
+					if (strcmp(desc.SemanticName, "NORMAL") == 0)
+						offsetInVertex = format.m_offsetNormal;
+					else if (strcmp(desc.SemanticName, "UV") == 0)
+						offsetInVertex = format.m_offsetUV;
+					else if (strcmp(desc.SemanticName, "TANGENT") == 0)
+						offsetInVertex = format.m_offsetTangent;
+					else
+						SELFTEST_CHECK(strcmp(desc.SemanticName, "POSITION") == 0);
+
+					int streamStart = (iStream == VSTREAM_Attribs) ? int(sizeof(float3)) : 0;
+					SELFTEST_CHECK(int(desc.AlignedByteOffset) == offsetInVertex - streamStart);
+					SELFTEST_CHECK(int(desc.AlignedByteOffset) + BitsPerPixel(desc.Format) / 8 <=
+									StrideOfVertexStream(VLAYOUT(vlayout), vattribs, iStream));
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+
+
+// Synthetic textures: just the metadata, with no pixel data behind them
+
+static void InitSyntheticTexture(int2 dims, DXGI_FORMAT format, Texture2D * pTexOut)
+{
+	pTexOut->m_dims = dims;
+	pTexOut->m_mipLevels = CalculateMipCount(dims);
+	pTexOut->m_format = format;
+	pTexOut->m_apPixels.assign(pTexOut->m_mipLevels, nullptr);
+}
+
+// Bytes taken by a texture's mips from mipFirst down
+static i64 SizeOfMips(const Texture2D * pTex, int mipFirst)
+{
+	return i64(pTex->SizeInBytes()) - i64(CalculateMipPyramidSizeInBytes(pTex->m_dims, pTex->m_format, mipFirst));
+}
+
+
+
+// TextureStreamer: budgeting by priority, eviction before upload, and falling back to the tail
+
+class RecordingTextureStreamSink : public TextureStreamSink
+{
+public:
+	std::vector<std::pair<Texture2D *, int>>	m_calls;
+
+	virtual void SetResidentMips(Texture2D * pTex, int mipFirst)
+		{ m_calls.push_back(std::make_pair(pTex, mipFirst)); }
+};
+
+static bool SelfTestTextureStreamer()
+{
+	// Two 1024x1024 textures; with the default 64-texel tail, their tails start at mip 4
+	Texture2D texA, texB;
+	InitSyntheticTexture(int2(1024), DXGI_FORMAT_R8G8B8A8_UNORM, &texA);
+	InitSyntheticTexture(int2(1024), DXGI_FORMAT_R8G8B8A8_UNORM, &texB);
+
+	// Enough budget to bring both down to mip 2, and then one of them to mip 1
+	i64 budgetBytes = SizeOfMips(&texA, 2) + SizeOfMips(&texB, 2) + (SizeOfMips(&texA, 1) - SizeOfMips(&texA, 2));
+
+	RecordingTextureStreamSink sink;
+	TextureStreamer streamer;
+	streamer.Init(&sink, budgetBytes);
+	streamer.m_framesToKeep = 0;
+	streamer.AddTexture(&texA);
+	streamer.AddTexture(&texB);
+
+	SELFTEST_CHECK(sink.m_calls.size() == 2);
+	SELFTEST_CHECK(sink.m_calls[0] == std::make_pair(&texA, 4));
+	SELFTEST_CHECK(sink.m_calls[1] == std::make_pair(&texB, 4));
+	SELFTEST_CHECK(streamer.m_residentBytes == SizeOfMips(&texA, 4) + SizeOfMips(&texB, 4));
+
+	// Both want mip 0.  The coarser levels go to both first; the tie for mip 1 goes to
+	// the texture added first, and mip 0 doesn't fit for either.
+	float uvPerPixelMip0 = 1.0f / 2048.0f;
+	sink.m_calls.clear();
+	streamer.RequestTexture(&texA, uvPerPixelMip0);
+	streamer.RequestTexture(&texB, uvPerPixelMip0);
+	streamer.Update();
+
+	SELFTEST_CHECK(streamer.m_texStates[0].m_mipResident == 1);
+	SELFTEST_CHECK(streamer.m_texStates[1].m_mipResident == 2);
+	SELFTEST_CHECK(streamer.m_residentBytes == budgetBytes);
+	SELFTEST_CHECK(sink.m_calls.size() == 2);
+
+	// Now only B is requested, and A falls back to its tail at once.  A has to be evicted
+	// before B's upload, so B can take its place in the budget.
+	sink.m_calls.clear();
+	streamer.RequestTexture(&texB, uvPerPixelMip0);
+	streamer.Update();
+
+	SELFTEST_CHECK(streamer.m_texStates[0].m_mipResident == 4);
+	SELFTEST_CHECK(streamer.m_texStates[1].m_mipResident == 1);
+	SELFTEST_CHECK(streamer.m_residentBytes <= budgetBytes);
+	SELFTEST_CHECK(sink.m_calls.size() == 2);
+	SELFTEST_CHECK(sink.m_calls[0] == std::make_pair(&texA, 4));
+	SELFTEST_CHECK(sink.m_calls[1] == std::make_pair(&texB, 1));
+
+	// With no requests at all, everything goes back to the tails
+	streamer.Update();
+	SELFTEST_CHECK(streamer.m_texStates[0].m_mipResident == 4);
+	SELFTEST_CHECK(streamer.m_texStates[1].m_mipResident == 4);
+	SELFTEST_CHECK(streamer.m_residentBytes == SizeOfMips(&texA, 4) + SizeOfMips(&texB, 4));
+
+	return true;
+}
+
+
+
+// VTPager and VTPageTable: loading coarsest first, LRU eviction, and page table fallback
+
+// Whether a page table entry is valid and points at the given slot and mip
+static bool IsPageTableEntry(byte4 entry, int slotX, int slotY, int mip)
+{
+	return (entry.x == slotX && entry.y == slotY && entry.z == mip && entry.w == 1);
+}
+
+static bool SelfTestVirtualTexturePaging()
+{
+	// 1024x1024 in 128-texel tiles: 8x8, 4x4, 2x2 and 1x1 tiles at mips 0-3
+	VTLayout layout = { int2(1024), 0, 128, 4, DXGI_FORMAT_R8G8B8A8_UNORM };
+	layout.m_mipLevels = CalculateVTMipCount(layout.m_dims, layout.m_tileSize);
+	SELFTEST_CHECK(layout.m_mipLevels == 4);
+	SELFTEST_CHECK(layout.TotalTileCount() == 85);
+
+	VTPager pager;
+	pager.Init(layout, 5);
+	VTPageTable pageTable;
+	pageTable.Init(layout, 4);
+
+	std::vector<VTPager::Update> updates;
+	auto processFrame = [&](const VTileID * aTiles, int tileCount)
+	{
+		updates.clear();
+		pager.ProcessFeedback(aTiles, tileCount, &updates);
+		for (int i = 0, c = int(updates.size()); i < c; ++i)
+		{
+			if (updates[i].m_tileEvicted != s_vtileNone)
+				pageTable.SetTileEvicted(updates[i].m_tileEvicted);
+			pageTable.SetTileResident(updates[i].m_tile, updates[i].m_slot);
+		}
+		pageTable.Rebuild();
+	};
+
+	// Frame 1: a mip 1 tile.  It and its ancestors load coarsest first, into the low slots.
+	VTileID aTiles1[] = { MakeVTileID(1, 0, 0) };
+	processFrame(aTiles1, dim(aTiles1));
+	SELFTEST_CHECK(updates.size() == 3);
+	SELFTEST_CHECK(updates[0].m_tile == MakeVTileID(3, 0, 0) && updates[0].m_slot == 0);
+	SELFTEST_CHECK(updates[1].m_tile == MakeVTileID(2, 0, 0) && updates[1].m_slot == 1);
+	SELFTEST_CHECK(updates[2].m_tile == MakeVTileID(1, 0, 0) && updates[2].m_slot == 2);
+	SELFTEST_CHECK(updates[2].m_tileEvicted == s_vtileNone);
+
+	// Frame 2: another mip 1 tile, with a different parent, fills the cache
+	VTileID aTiles2[] = { MakeVTileID(1, 3, 3) };
+	processFrame(aTiles2, dim(aTiles2));
+	SELFTEST_CHECK(updates.size() == 2);
+	SELFTEST_CHECK(updates[0].m_tile == MakeVTileID(2, 1, 1) && updates[0].m_slot == 3);
+	SELFTEST_CHECK(updates[1].m_tile == MakeVTileID(1, 3, 3) && updates[1].m_slot == 4);
+
+	// Frame 3: the first tile again, so its branch is now the most recently used
+	processFrame(aTiles1, dim(aTiles1));
+	SELFTEST_CHECK(updates.empty());
+
+	// Frame 4: a new branch.  The frame 2 tiles are least recently used, so they go, even
+	// though the frame 1 tiles were loaded earlier; the pinned coarsest tile stays.
+	VTileID aTiles4[] = { MakeVTileID(1, 0, 3) };
+	processFrame(aTiles4, dim(aTiles4));
+	SELFTEST_CHECK(updates.size() == 2);
+	SELFTEST_CHECK(updates[0].m_tile == MakeVTileID(2, 0, 1) && updates[0].m_slot == 3);
+	SELFTEST_CHECK(updates[0].m_tileEvicted == MakeVTileID(2, 1, 1));
+	SELFTEST_CHECK(updates[1].m_tile == MakeVTileID(1, 0, 3) && updates[1].m_slot == 4);
+	SELFTEST_CHECK(updates[1].m_tileEvicted == MakeVTileID(1, 3, 3));
+	SELFTEST_CHECK(pager.FindSlot(MakeVTileID(3, 0, 0)) == 0);
+
+	// Resident tiles point at their own slots: (slot x, slot y, mip, valid)
+	SELFTEST_CHECK(IsPageTableEntry(pageTable.Lookup(MakeVTileID(1, 0, 3)), 0, 1, 1));
+	SELFTEST_CHECK(IsPageTableEntry(pageTable.Lookup(MakeVTileID(1, 0, 0)), 2, 0, 1));
+
+	// Others fall back to their nearest resident ancestor, down to the coarsest tile
+	SELFTEST_CHECK(IsPageTableEntry(pageTable.Lookup(MakeVTileID(0, 0, 6)), 0, 1, 1));
+	SELFTEST_CHECK(IsPageTableEntry(pageTable.Lookup(MakeVTileID(0, 7, 7)), 0, 0, 3));
+	SELFTEST_CHECK(IsPageTableEntry(pageTable.Lookup(MakeVTileID(1, 3, 3)), 0, 0, 3));
+
+	// Frame 5: both branches at once.  The tiles in use this frame are never evicted, so
+	// there's only room to start on the second.
+	VTileID aTiles5[] = { MakeVTileID(1, 0, 3), MakeVTileID(0, 7, 7) };
+	processFrame(aTiles5, dim(aTiles5));
+	SELFTEST_CHECK(updates.size() == 2);
+	SELFTEST_CHECK(updates[0].m_tile == MakeVTileID(2, 1, 1) && updates[0].m_tileEvicted == MakeVTileID(2, 0, 0));
+	SELFTEST_CHECK(updates[1].m_tile == MakeVTileID(1, 3, 3) && updates[1].m_tileEvicted == MakeVTileID(1, 0, 0));
+	SELFTEST_CHECK(pager.FindSlot(MakeVTileID(0, 7, 7)) < 0);
+	SELFTEST_CHECK(pager.FindSlot(MakeVTileID(1, 0, 3)) == 4);
+	SELFTEST_CHECK(IsPageTableEntry(pageTable.Lookup(MakeVTileID(0, 7, 7)), 2, 0, 1));
+
+	return true;
+}
+
+
+
+// MtlBatchList: merging adjacent ranges that share a texture array, with opaque ranges first
+
+static bool SelfTestMtlBatches()
+{
+	// Two 256x256 textures that share an array, and a 512x512 one in an array of its own
+	Texture2D aTex[3];
+	InitSyntheticTexture(int2(256), DXGI_FORMAT_R8G8B8A8_UNORM, &aTex[0]);
+	InitSyntheticTexture(int2(256), DXGI_FORMAT_R8G8B8A8_UNORM, &aTex[1]);
+	InitSyntheticTexture(int2(512), DXGI_FORMAT_R8G8B8A8_UNORM, &aTex[2]);
+	const Texture2D * apTexs[] = { &aTex[0], &aTex[1], &aTex[2] };
+
+	TextureArrayLib texArrayLib;
+	texArrayLib.Build(apTexs, dim(apTexs));
+	SELFTEST_CHECK(texArrayLib.m_texArrays.size() == 2);
+	const TextureArrayLib::Slice * pSlice0 = texArrayLib.Lookup(&aTex[0]);
+	const TextureArrayLib::Slice * pSlice1 = texArrayLib.Lookup(&aTex[1]);
+	const TextureArrayLib::Slice * pSlice2 = texArrayLib.Lookup(&aTex[2]);
+	SELFTEST_CHECK(pSlice0 && pSlice1 && pSlice2);
+	SELFTEST_CHECK(pSlice0->m_pTexArray == pSlice1->m_pTexArray && pSlice0->m_slice == 0 && pSlice1->m_slice == 1);
+	SELFTEST_CHECK(pSlice2->m_pTexArray != pSlice0->m_pTexArray && pSlice2->m_slice == 0);
+	Texture2DArray * pTexArray256 = pSlice0->m_pTexArray;
+	Texture2DArray * pTexArray512 = pSlice2->m_pTexArray;
+
+	// A packed texture holding one material's alpha-test mask
+	Texture2D texPacked;
+	InitSyntheticTexture(int2(256), DXGI_FORMAT_R8G8B8A8_UNORM, &texPacked);
+
+	Material aMtl[7] = {};
+	const char * aMtlNames[] = { "a", "b", "c", "untextured", "alpha_a", "alpha_b", "alpha_b_masked" };
+	Texture2D * apTexDiffuse[] = { &aTex[0], &aTex[1], &aTex[2], nullptr, &aTex[0], &aTex[1], &aTex[1] };
+	for (int i = 0; i < dim(aMtl); ++i)
+	{
+		aMtl[i].m_mtlName = aMtlNames[i];
+		aMtl[i].m_pTexDiffuseColor = apTexDiffuse[i];
+		aMtl[i].m_alphaTest = (i >= 4);
+		for (int j = 0; j < PACKCH_Count; ++j)
+			aMtl[i].m_packedChannels[j] = -1;
+	}
+	aMtl[6].m_pTexPacked = &texPacked;
+	aMtl[6].m_packedChannels[PACKCH_Mask] = 1;
+
+	// Ranges in index buffer order, 10 triangles each.  The alpha-tested ones are
+	// interleaved with the opaque ones, so they can't merge with their neighbors there.
+	int aiMtlRange[] = { 0, 1, 4, 5, 6, 2, 0, 3 };
+	Mesh mesh;
+	mesh.m_primtopo = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	for (int i = 0; i < dim(aiMtlRange); ++i)
+	{
+		Mesh::MtlRange range = { &aMtl[aiMtlRange[i]], 30 * i, 30 };
+		mesh.m_mtlRanges.push_back(range);
+	}
+	mesh.m_indexCount = 30 * dim(aiMtlRange);
+
+	MtlBatchList batches;
+	batches.Build(&mesh, &texArrayLib);
+
+	// Opaque: ranges 0+1 share the 256 array; 5 is on the 512 one, so 6 starts over;
+	// 7 is untextured.  Alpha-tested: 2+3 share the 256 array; 4 follows on from them, but
+	// has a mask they don't.
+	SELFTEST_CHECK(batches.m_batches.size() == 6);
+	SELFTEST_CHECK(batches.m_opaqueBatchCount == 4);
+	struct Expected
+	{
+		Texture2DArray *	m_pTexArray;
+		bool				m_alphaTest;
+		Texture2D *			m_pTexMask;
+		int					m_indexStart, m_indexCount;
+		int					m_mtlRangeCount;
+	};
+	Expected aExpected[] =
+	{
+		{ pTexArray256, false, nullptr, 0, 60, 2 },
+		{ pTexArray512, false, nullptr, 150, 30, 1 },
+		{ pTexArray256, false, nullptr, 180, 30, 1 },
+		{ nullptr, false, nullptr, 210, 30, 1 },
+		{ pTexArray256, true, nullptr, 60, 60, 2 },
+		{ pTexArray256, true, &texPacked, 120, 30, 1 },
+	};
+	for (int i = 0; i < dim(aExpected); ++i)
+	{
+		const MtlBatch & batch = batches.m_batches[i];
+		SELFTEST_CHECK(batch.m_pTexArray == aExpected[i].m_pTexArray);
+		SELFTEST_CHECK(batch.m_alphaTest == aExpected[i].m_alphaTest);
+		SELFTEST_CHECK(batch.m_pTexMask == aExpected[i].m_pTexMask);
+		SELFTEST_CHECK(batch.m_indexStart == aExpected[i].m_indexStart);
+		SELFTEST_CHECK(batch.m_indexCount == aExpected[i].m_indexCount);
+		SELFTEST_CHECK(batch.m_triangleBase == aExpected[i].m_indexStart / 3);
+		SELFTEST_CHECK(batch.m_mtlRangeCount == aExpected[i].m_mtlRangeCount);
+	}
+	SELFTEST_CHECK(batches.m_batches[5].m_maskChannel == 1);
+
+	// Each triangle gets its diffuse slice; untextured ones get 0
+	int aSliceExpected[] = { 0, 1, 0, 1, 1, 0, 0, 0 };
+	for (int i = 0; i < dim(aSliceExpected); ++i)
+	{
+		for (int iTri = 10 * i; iTri < 10 * (i + 1); ++iTri)
+			SELFTEST_CHECK(batches.m_triSlices[iTri] == aSliceExpected[i]);
+	}
+
+	// 8 draws and binds one at a time; 6 draws batched, with a rebind at every array change
+	SELFTEST_CHECK(batches.m_drawsUnbatched == 8 && batches.m_bindsUnbatched == 8);
+	SELFTEST_CHECK(batches.m_drawsBatched == 6 && batches.m_bindsBatched == 5);
+
+	return true;
+}
+
+
+
+#if SELFTEST_ZIP64
+
+// Zip64 asset packs: over 65535 files, and one past 4GB, written to a sparse file with a hole
+// in front of the last one, then loaded back with CRCs checked
+
+static size_t WriteToSparseFile(void * pOpaque, mz_uint64 ofs, const void * pBuf, size_t n)
+{
+	FILE * pFile = (FILE *)pOpaque;
+	if (_fseeki64(pFile, i64(ofs), SEEK_SET) != 0)
+		return 0;
+	return fwrite(pBuf, 1, n, pFile);
+}
+
+static bool CheckZip64Pack(const char * packPath, int smallFileCount, u64 offsetBigFile, const std::vector<byte> & bigFile)
+{
+	mz_zip_archive zip = {};
+	SELFTEST_CHECK(mz_zip_reader_init_file(&zip, packPath, 0));
+
+	// The directory should have kept the 64-bit count and offset
+	int numFiles = int(mz_zip_reader_get_num_files(&zip));
+	mz_zip_archive_file_stat stat = {};
+	int iBigFile = mz_zip_reader_locate_file(&zip, "big", nullptr, 0);
+	bool dirOK = numFiles > smallFileCount &&
+				 iBigFile >= 0 &&
+				 mz_zip_reader_file_stat(&zip, iBigFile, &stat) &&
+				 stat.m_local_header_ofs == offsetBigFile;
+
+	// Load it with the CRCs checked, which also reads each file's local header
+	comptr<AssetPack> pPack = new AssetPack;
+	pPack->m_path = packPath;
+	bool loaded = dirOK && AssetCompiler::LoadAssetPackFromZip(&zip, pPack, nullptr, true);
+	mz_zip_reader_end(&zip);
+	SELFTEST_CHECK(dirOK);
+	SELFTEST_CHECK(loaded);
+
+	SELFTEST_CHECK(int(pPack->m_files.size()) == numFiles);
+	for (auto & file : pPack->m_files)
+	{
+		SELFTEST_CHECK(file.m_offset >= 0);
+		SELFTEST_CHECK(file.m_offset + file.m_size <= i64(pPack->m_data.size()));
+	}
+
+	void * pData;
+	i64 sizeBytes;
+	for (int i = 0; i < smallFileCount; ++i)
+	{
+		char suffix[16];
+		sprintf_s(suffix, "/%d", i);
+		SELFTEST_CHECK(pPack->LookupFile("small", suffix, &pData, &sizeBytes));
+		SELFTEST_CHECK(sizeBytes == sizeof(i) && *(int *)pData == i);
+	}
+	SELFTEST_CHECK(pPack->LookupFile("big", nullptr, &pData, &sizeBytes));
+	SELFTEST_CHECK(sizeBytes == i64(bigFile.size()) && memcmp(pData, &bigFile[0], bigFile.size()) == 0);
+
+	i64 dataSize;
+	SELFTEST_CHECK(AssetCompiler::GetAssetPackDataSize(packPath, &dataSize));
+	SELFTEST_CHECK(dataSize == i64(pPack->m_data.size()));
+
+	return true;
+}
+
+static bool SelfTestZip64Pack()
+{
+	char tempDir[MAX_PATH];
+	char packPath[MAX_PATH];
+	SELFTEST_CHECK(GetTempPath(dim(tempDir), tempDir) != 0);
+	SELFTEST_CHECK(GetTempFileName(tempDir, "pak", 0, packPath) != 0);
+
+	FILE * pFile = nullptr;
+	if (fopen_s(&pFile, packPath, "w+b") != 0)
+	{
+		WARN("Couldn't open %s for writing", packPath);
+		DeleteFile(packPath);
+		return false;
+	}
+
+	// Without a sparse file, the hole would really be written, so skip the test
+	DWORD bytesReturned;
+	if (!DeviceIoControl(HANDLE(_get_osfhandle(_fileno(pFile))), FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &bytesReturned, nullptr))
+	{
+		LOG("Skipping zip64 self-test, as %s can't be made a sparse file", packPath);
+		fclose(pFile);
+		DeleteFile(packPath);
+		return true;
+	}
+
+	static const int s_smallFileCount = 70000;
+	static const u64 s_offsetBigFile = 0x100000000ull + 0x1234;
+	std::vector<byte> bigFile(1024 * 1024);
+	for (int i = 0, c = int(bigFile.size()); i < c; ++i)
+		bigFile[i] = byte((i * 7) ^ (i >> 10));
+
+	mz_zip_archive zip = {};
+	zip.m_pWrite = &WriteToSparseFile;
+	zip.m_pIO_opaque = pFile;
+	bool written = (mz_zip_writer_init(&zip, 0) != 0);
+	{
+		AssetCompiler::ZipAssetSink sink(&zip);
+		for (int i = 0; i < s_smallFileCount && written; ++i)
+		{
+			char suffix[16];
+			sprintf_s(suffix, "/%d", i);
+			written = sink.WriteAssetData("small", suffix, &i, sizeof(i));
+		}
+
+		// Skip ahead to put the last file past 4GB
+		if (written)
+		{
+			zip.m_archive_size = s_offsetBigFile;
+			written = sink.WriteAssetData("big", nullptr, &bigFile[0], bigFile.size());
+		}
+		written = written && AssetCompiler::WritePackInfoToSink("small\nbig\n", &sink);
+	}
+	written = written && mz_zip_writer_finalize_archive(&zip);
+	mz_zip_writer_end(&zip);
+	fclose(pFile);
+
+	bool passed = written && CheckZip64Pack(packPath, s_smallFileCount, s_offsetBigFile, bigFile);
+	DeleteFile(packPath);
+	return passed;
+}
+
+#endif // SELFTEST_ZIP64
+
+
+
+bool RunSelfTests()
+{
+	int failCount = 0;
+	if (!SelfTestVertexStreams())
+	{
+		WARN("Vertex stream layout self-test failed");
+		++failCount;
+	}
+	if (!SelfTestTextureStreamer())
+	{
+		WARN("TextureStreamer self-test failed");
+		++failCount;
+	}
+	if (!SelfTestVirtualTexturePaging())
+	{
+		WARN("Virtual texture paging self-test failed");
+		++failCount;
+	}
+	if (!SelfTestMtlBatches())
+	{
+		WARN("MtlBatchList self-test failed");
+		++failCount;
+	}
+#if SELFTEST_ZIP64
+	if (!SelfTestZip64Pack())
+	{
+		WARN("Zip64 asset pack self-test failed");
+		++failCount;
+	}
+#endif
+
+	if (failCount == 0)
+		LOG("Self-tests passed");
+	return (failCount == 0);
+}
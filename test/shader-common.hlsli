@@ -29,6 +29,13 @@ cbuffer CBFrame : CB_FRAME					// matches struct CBFrame in test.cpp
 	float		g_exposure;					// Exposure multiplier
 }
 
+cbuffer CBShader : CB_SHADER				// matches struct CBShader in test.cpp
+{
+	uint		g_triangleBase;				// Added to SV_PrimitiveID to index g_bufTriSlices
+	uint		g_slice;					// Diffuse array slice, for draws that don't use g_bufTriSlices
+	int			g_maskChannel;				// Channel of g_texPacked holding the alpha-test mask, or -1 for diffuse alpha
+}
+
 cbuffer CBDebug : CB_DEBUG					// matches struct CBDebug in test.cpp
 {
 	float		g_debugKey;					// Mapped to spacebar - 0 if up, 1 if down
@@ -38,6 +45,24 @@ cbuffer CBDebug : CB_DEBUG					// matches struct CBDebug in test.cpp
 	float		g_debugSlider3;				// ...
 }
 
+// Diffuse array slice for each triangle of the mesh, when material ranges are batched
+Buffer<uint> g_bufTriSlices : TEX_TRISLICES;
+
+float TriangleSlice(uint primitiveID)
+{
+	return float(g_bufTriSlices[g_triangleBase + primitiveID]);
+}
+
+// Material's spec, mask and height maps, packed into one texture at compile time
+Texture2D<float4> g_texPacked : TEX_PACKED;
+
+float AlphaTestMask(SamplerState ss, float2 uv, float diffuseAlpha)
+{
+	if (g_maskChannel < 0)
+		return diffuseAlpha;
+	return g_texPacked.Sample(ss, uv)[g_maskChannel];
+}
+
 float square(float x) { return x*x; }
 float2 square(float2 x) { return x*x; }
 float3 square(float3 x) { return x*x; }
@@ -19,6 +19,8 @@
 
 #define TEX_DIFFUSE						TEXREG(0)
 #define TEX_SHADOW						TEXREG(1)
+#define TEX_TRISLICES					TEXREG(2)
+#define TEX_PACKED						TEXREG(3)
 
 #define SAMP_DEFAULT					SAMPREG(0)
 #define SAMP_SHADOW						SAMPREG(1)
@@ -1,6 +1,6 @@
 #include "shader-common.hlsli"
 
-Texture2D<float4> g_texDiffuse : register(t0);
+Texture2DArray<float4> g_texDiffuse : register(t0);
 SamplerState g_ss : register(s0);
 
 void main(
@@ -8,12 +8,13 @@ void main(
 	in float3 i_vecCamera : CAMERA,
 	in float4 i_uvzwShadow : UVZW_SHADOW,
 	in bool i_isFrontFace : SV_IsFrontFace,
+	in uint i_primitiveID : SV_PrimitiveID,
 	out float3 o_rgb : SV_Target)
 {
 	float3 normal = normalize(i_vtx.m_normal) * (i_isFrontFace ? 1.0 : -1.0);
 
-	float4 diffuseColor = g_texDiffuse.Sample(g_ss, i_vtx.m_uv);
-	if (diffuseColor.a < 0.5)
+	float4 diffuseColor = g_texDiffuse.Sample(g_ss, float3(i_vtx.m_uv, TriangleSlice(i_primitiveID)));
+	if (AlphaTestMask(g_ss, i_vtx.m_uv, diffuseColor.a) < 0.5)
 		discard;
 
 	// Sample shadow map
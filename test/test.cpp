@@ -7,6 +7,7 @@
 
 // Shader bytecode generated by build process
 #include "world_vs.h"
+#include "depthonly_vs.h"
 #include "simple_ps.h"
 #include "simple_alphatest_ps.h"
 #include "shadow_alphatest_ps.h"
@@ -47,6 +48,11 @@ using namespace Framework;
 
 
 
+// Headless self-tests of the framework; see selftest.cpp
+bool RunSelfTests();
+
+
+
 // Globals
 
 float3 g_vecDirectionalLight = normalize(float3(1.0f, 10.0f, 1.5f));
@@ -93,6 +99,13 @@ struct CBFrame								// matches cbuffer CBFrame in shader-common.hlsli
 	float		m_exposure;					// Exposure multiplier
 };
 
+struct CBShader								// matches cbuffer CBShader in shader-common.hlsli
+{
+	uint		m_triangleBase;				// Added to SV_PrimitiveID to index the triangle slice buffer
+	uint		m_slice;					// Diffuse array slice, for draws that don't use the triangle slice buffer
+	int			m_maskChannel;				// Channel of the packed texture holding the alpha-test mask, or -1 for diffuse alpha
+};
+
 struct CBDebug								// matches cbuffer CBDebug in shader-common.hlsli
 {
 	float		m_debugKey;					// Mapped to spacebar - 0 if up, 1 if down
@@ -129,6 +142,8 @@ public:
 	Mesh								m_meshSponza;
 	MaterialLib							m_mtlLibSponza;
 	TextureLib							m_texLibSponza;
+	TextureArrayLib						m_texArrayLibSponza;
+	MtlBatchList						m_mtlBatchesSponza;
 
 	// Render targets
 	RenderTarget						m_rtSceneMSAA;
@@ -138,6 +153,7 @@ public:
 
 	// Shaders
 	comptr<ID3D11VertexShader>			m_pVsWorld;
+	comptr<ID3D11VertexShader>			m_pVsDepthOnly;
 	comptr<ID3D11PixelShader>			m_pPsSimple;
 	comptr<ID3D11PixelShader>			m_pPsSimpleAlphaTest;
 	comptr<ID3D11PixelShader>			m_pPsShadowAlphaTest;
@@ -145,9 +161,11 @@ public:
 
 	// Other stuff
 	comptr<ID3D11InputLayout>			m_pInputLayout;
+	comptr<ID3D11InputLayout>			m_pInputLayoutDepthOnly;
 	CB<CBFrame>							m_cbFrame;
+	CB<CBShader>						m_cbShader;
 	CB<CBDebug>							m_cbDebug;
-	Texture2D							m_tex1x1White;
+	Texture2DArray						m_texArray1x1White;
 	FPSCamera							m_camera;
 	Timer								m_timer;
 
@@ -191,65 +209,38 @@ bool TestWindow::Init(HINSTANCE hInstance)
 {
 	super::Init("TestWindow", "Test", hInstance);
 
-	// Ensure the asset pack is up to date
+	// Ensure the asset pack is up to date.  The spec, bump and mask maps aren't listed, as the
+	// material lib packs them into one texture per material and generates the normal maps.
 	static const AssetCompileInfo s_assets[] =
 	{
-		{ "crytek-sponza/sponza.obj",								ACK_OBJMesh, },
-		{ "crytek-sponza/sponza.mtl",								ACK_OBJMtlLib, },
+		{ "crytek-sponza/sponza.obj",								ACK_OBJMesh, ACF_SplitVertexStreams, },
+		{ "crytek-sponza/sponza.mtl",								ACK_OBJMtlLib, ACF_MtlPackChannels, },
 		{ "crytek-sponza/textures/background.tga",					ACK_TextureWithMips, },
 		{ "crytek-sponza/textures/backgroundbgr.tga",				ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/background_bump.png",				ACK_TextureWithMips, },
 		{ "crytek-sponza/textures/chain_texture.tga",				ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/chain_texture_bump.png",			ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/chain_texture_mask.png",			ACK_TextureWithMips, },
 		{ "crytek-sponza/textures/gi_flag.tga",						ACK_TextureWithMips, },
 		{ "crytek-sponza/textures/lion.tga",						ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/lion2_bump.png",					ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/lion_bump.png",					ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/spnza_bricks_a_bump.png",			ACK_TextureWithMips, },
 		{ "crytek-sponza/textures/spnza_bricks_a_diff.tga",			ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/spnza_bricks_a_spec.tga",			ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_arch_bump.png",			ACK_TextureWithMips, },
 		{ "crytek-sponza/textures/sponza_arch_diff.tga",			ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_arch_spec.tga",			ACK_TextureWithMips, },
 		{ "crytek-sponza/textures/sponza_ceiling_a_diff.tga",		ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_ceiling_a_spec.tga",		ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_column_a_bump.png",		ACK_TextureWithMips, },
 		{ "crytek-sponza/textures/sponza_column_a_diff.tga",		ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_column_a_spec.tga",		ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_column_b_bump.png",		ACK_TextureWithMips, },
 		{ "crytek-sponza/textures/sponza_column_b_diff.tga",		ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_column_b_spec.tga",		ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_column_c_bump.png",		ACK_TextureWithMips, },
 		{ "crytek-sponza/textures/sponza_column_c_diff.tga",		ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_column_c_spec.tga",		ACK_TextureWithMips, },
 		{ "crytek-sponza/textures/sponza_curtain_blue_diff.tga",	ACK_TextureWithMips, },
 		{ "crytek-sponza/textures/sponza_curtain_diff.tga",			ACK_TextureWithMips, },
 		{ "crytek-sponza/textures/sponza_curtain_green_diff.tga",	ACK_TextureWithMips, },
 		{ "crytek-sponza/textures/sponza_details_diff.tga",			ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_details_spec.tga",			ACK_TextureWithMips, },
 		{ "crytek-sponza/textures/sponza_fabric_blue_diff.tga",		ACK_TextureWithMips, },
 		{ "crytek-sponza/textures/sponza_fabric_diff.tga",			ACK_TextureWithMips, },
 		{ "crytek-sponza/textures/sponza_fabric_green_diff.tga",	ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_fabric_spec.tga",			ACK_TextureWithMips, },
 		{ "crytek-sponza/textures/sponza_flagpole_diff.tga",		ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_flagpole_spec.tga",		ACK_TextureWithMips, },
 		{ "crytek-sponza/textures/sponza_floor_a_diff.tga",			ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_floor_a_spec.tga",			ACK_TextureWithMips, },
 		{ "crytek-sponza/textures/sponza_roof_diff.tga",			ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_thorn_bump.png",			ACK_TextureWithMips, },
 		{ "crytek-sponza/textures/sponza_thorn_diff.tga",			ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_thorn_mask.png",			ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_thorn_spec.tga",			ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/vase_bump.png",					ACK_TextureWithMips, },
 		{ "crytek-sponza/textures/vase_dif.tga",					ACK_TextureWithMips, },
 		{ "crytek-sponza/textures/vase_hanging.tga",				ACK_TextureWithMips, },
 		{ "crytek-sponza/textures/vase_plant.tga",					ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/vase_plant_mask.png",				ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/vase_plant_spec.tga",				ACK_TextureWithMips, },
 		{ "crytek-sponza/textures/vase_round.tga",					ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/vase_round_bump.png",				ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/vase_round_spec.tga",				ACK_TextureWithMips, },
 	};
 	comptr<AssetPack> pPack = new AssetPack;
 	if (!LoadAssetPackOrCompileIfOutOfDate("crytek-sponza-assets.zip", s_assets, dim(s_assets), pPack))
@@ -275,52 +266,59 @@ bool TestWindow::Init(HINSTANCE hInstance)
 		return false;
 	}
 
-	// Hardcode a list of alpha-tested materials, for now
-	static const char * s_aMtlAlphaTest[] =
-	{
-		"leaf",
-		"material__57",
-		"chain",
-	};
-	for (int i = 0; i < dim(s_aMtlAlphaTest); ++i)
-	{
-		if (Material * pMtl = m_mtlLibSponza.Lookup(s_aMtlAlphaTest[i]))
-			pMtl->m_alphaTest = true;
-	}
+	// Group the diffuse textures into arrays, so material ranges can be drawn in batches
+	m_texArrayLibSponza.Build(&m_mtlLibSponza);
+	m_mtlBatchesSponza.Build(&m_meshSponza, &m_texArrayLibSponza);
 
-	// Upload all assets to GPU
+	// Upload all assets to GPU.  The diffuse textures are only used through the arrays, and
+	// of the rest, only the packed textures holding alpha-test masks are sampled.
 	m_meshSponza.UploadToGPU(m_pDevice);
-	m_texLibSponza.UploadAllToGPU(m_pDevice);
+	m_texArrayLibSponza.UploadAllToGPU(m_pDevice);
+	m_mtlBatchesSponza.UploadToGPU(m_pDevice);
+	for (auto iter = m_mtlLibSponza.m_mtls.begin(), end = m_mtlLibSponza.m_mtls.end(); iter != end; ++iter)
+	{
+		const Material * pMtl = &iter->second;
+		if (pMtl->m_alphaTest && pMtl->m_pTexPacked && pMtl->m_packedChannels[PACKCH_Mask] >= 0 &&
+			!pMtl->m_pTexPacked->m_pSrv)
+		{
+			pMtl->m_pTexPacked->UploadToGPU(m_pDevice);
+		}
+	}
 
 	// Init shadow map
 	m_shmp.Init(m_pDevice, int2(4096));
 
 	// Load shaders
 	CHECK_D3D(m_pDevice->CreateVertexShader(world_vs_bytecode, dim(world_vs_bytecode), nullptr, &m_pVsWorld));
+	CHECK_D3D(m_pDevice->CreateVertexShader(depthonly_vs_bytecode, dim(depthonly_vs_bytecode), nullptr, &m_pVsDepthOnly));
 	CHECK_D3D(m_pDevice->CreatePixelShader(simple_ps_bytecode, dim(simple_ps_bytecode), nullptr, &m_pPsSimple));
 	CHECK_D3D(m_pDevice->CreatePixelShader(simple_alphatest_ps_bytecode, dim(simple_alphatest_ps_bytecode), nullptr, &m_pPsSimpleAlphaTest));
 	CHECK_D3D(m_pDevice->CreatePixelShader(shadow_alphatest_ps_bytecode, dim(shadow_alphatest_ps_bytecode), nullptr, &m_pPsShadowAlphaTest));
 	CHECK_D3D(m_pDevice->CreatePixelShader(tonemap_ps_bytecode, dim(tonemap_ps_bytecode), nullptr, &m_pPsTonemap));
 
-	// Initialize the input layout, and validate it against all the vertex shaders
+	// Initialize the input layouts from the mesh's vertex streams, and validate them
+	// against the vertex shaders that use them
 
-	D3D11_INPUT_ELEMENT_DESC aInputDescs[] =
-	{
-		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, UINT(offsetof(Vertex, m_pos)), D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, UINT(offsetof(Vertex, m_normal)), D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		{ "UV", 0, DXGI_FORMAT_R32G32_FLOAT, 0, UINT(offsetof(Vertex, m_uv)), D3D11_INPUT_PER_VERTEX_DATA, 0 },
-	};
+	std::vector<D3D11_INPUT_ELEMENT_DESC> inputDescs;
+	m_meshSponza.GetInputElementDescs(VSTREAMMASK_All, &inputDescs);
 	CHECK_D3D(m_pDevice->CreateInputLayout(
-							aInputDescs, dim(aInputDescs),
+							&inputDescs[0], UINT(inputDescs.size()),
 							world_vs_bytecode, dim(world_vs_bytecode),
 							&m_pInputLayout));
 
+	m_meshSponza.GetInputElementDescs(VSTREAMMASK_Pos, &inputDescs);
+	CHECK_D3D(m_pDevice->CreateInputLayout(
+							&inputDescs[0], UINT(inputDescs.size()),
+							depthonly_vs_bytecode, dim(depthonly_vs_bytecode),
+							&m_pInputLayoutDepthOnly));
+
 	// Init constant buffers
 	m_cbFrame.Init(m_pDevice);
+	m_cbShader.Init(m_pDevice);
 	m_cbDebug.Init(m_pDevice);
 
 	// Init default textures
-	CreateTexture1x1(m_pDevice, rgba(1.0f), &m_tex1x1White);
+	CreateTexture2DArray1x1(m_pDevice, rgba(1.0f), &m_texArray1x1White);
 
 	// Init the camera
 	m_camera.m_moveSpeed = 3.0f;
@@ -418,6 +416,8 @@ void TestWindow::Shutdown()
 
 	m_meshSponza.Reset();
 	m_mtlLibSponza.Reset();
+	m_mtlBatchesSponza.Reset();
+	m_texArrayLibSponza.Reset();
 	m_texLibSponza.Reset();
 
 	m_rtSceneMSAA.Reset();
@@ -426,15 +426,18 @@ void TestWindow::Shutdown()
 	m_shmp.Reset();
 
 	m_pVsWorld.release();
+	m_pVsDepthOnly.release();
 	m_pPsSimple.release();
 	m_pPsSimpleAlphaTest.release();
 	m_pPsShadowAlphaTest.release();
 	m_pPsTonemap.release();
 
 	m_pInputLayout.release();
+	m_pInputLayoutDepthOnly.release();
 	m_cbFrame.Reset();
+	m_cbShader.Reset();
 	m_cbDebug.Reset();
-	m_tex1x1White.Reset();
+	m_texArray1x1White.Reset();
 
 	super::Shutdown();
 }
@@ -670,50 +673,38 @@ void TestWindow::OnRender()
 
 void TestWindow::DrawMaterials(ID3D11PixelShader * pPs, ID3D11PixelShader * pPsAlphaTest)
 {
-	// Draw the individual material ranges of the mesh
+	// Draw the material batches of the mesh: runs of material ranges whose diffuse textures
+	// share an array, with the slice for each triangle looked up in the shader
 
-	// Non-alpha-tested materials
-	m_pCtx->PSSetShader(pPs, nullptr, 0);
-	m_pCtx->RSSetState(m_pRsDefault);
-	for (int i = 0, c = int(m_meshSponza.m_mtlRanges.size()); i < c; ++i)
-	{
-		Material * pMtl = m_meshSponza.m_mtlRanges[i].m_pMtl;
-		ASSERT_ERR(pMtl);
+	m_pCtx->PSSetShaderResources(TEX_TRISLICES, 1, &m_mtlBatchesSponza.m_pSrvTriSlices);
+	m_cbShader.Bind(m_pCtx, CB_SHADER);
 
-		if (pMtl->m_alphaTest)
-			continue;
+	Texture2DArray * pTexArrayBound = nullptr;
+	for (int i = 0, c = int(m_mtlBatchesSponza.m_batches.size()); i < c; ++i)
+	{
+		const MtlBatch * pBatch = &m_mtlBatchesSponza.m_batches[i];
 
-		if (pPs)
+		// Non-alpha-tested batches come first, then alpha-tested ones
+		if (i == 0 || i == m_mtlBatchesSponza.m_opaqueBatchCount)
 		{
-			ID3D11ShaderResourceView * pSrv = m_tex1x1White.m_pSrv;
-			if (Texture2D * pTex = pMtl->m_pTexDiffuseColor)
-				pSrv = pTex->m_pSrv;
-			m_pCtx->PSSetShaderResources(TEX_DIFFUSE, 1, &pSrv);
+			m_pCtx->PSSetShader(pBatch->m_alphaTest ? pPsAlphaTest : pPs, nullptr, 0);
+			m_pCtx->RSSetState(pBatch->m_alphaTest ? m_pRsDoubleSided : m_pRsDefault);
 		}
 
-		m_meshSponza.DrawMtlRange(m_pCtx, i);
-	}
-
-	// Alpha-tested materials
-	m_pCtx->PSSetShader(pPsAlphaTest, nullptr, 0);
-	m_pCtx->RSSetState(m_pRsDoubleSided);
-	for (int i = 0, c = int(m_meshSponza.m_mtlRanges.size()); i < c; ++i)
-	{
-		Material * pMtl = m_meshSponza.m_mtlRanges[i].m_pMtl;
-		ASSERT_ERR(pMtl);
-
-		if (!pMtl->m_alphaTest)
-			continue;
-
-		if (pPsAlphaTest)
+		Texture2DArray * pTexArray = pBatch->m_pTexArray ? pBatch->m_pTexArray : &m_texArray1x1White;
+		if (pTexArray != pTexArrayBound)
 		{
-			ID3D11ShaderResourceView * pSrv = m_tex1x1White.m_pSrv;
-			if (Texture2D * pTex = pMtl->m_pTexDiffuseColor)
-				pSrv = pTex->m_pSrv;
-			m_pCtx->PSSetShaderResources(TEX_DIFFUSE, 1, &pSrv);
+			m_pCtx->PSSetShaderResources(TEX_DIFFUSE, 1, &pTexArray->m_pSrv);
+			pTexArrayBound = pTexArray;
 		}
 
-		m_meshSponza.DrawMtlRange(m_pCtx, i);
+		if (pBatch->m_pTexMask)
+			m_pCtx->PSSetShaderResources(TEX_PACKED, 1, &pBatch->m_pTexMask->m_pSrv);
+
+		CBShader cbShader = { UINT(pBatch->m_triangleBase), 0, pBatch->m_maskChannel, };
+		m_cbShader.Update(m_pCtx, &cbShader);
+
+		m_mtlBatchesSponza.DrawBatch(m_pCtx, &m_meshSponza, i);
 	}
 }
 
@@ -849,7 +840,6 @@ void TestWindow::RenderShadowMap()
 	m_shmp.m_boundsScene = { m_meshSponza.m_bounds.mins * sceneScale, m_meshSponza.m_bounds.maxs * sceneScale };
 	m_shmp.UpdateMatrix();
 
-	m_pCtx->IASetInputLayout(m_pInputLayout);
 	m_pCtx->OMSetDepthStencilState(m_pDssDepthTest, 0);
 
 	// Set up constant buffer for rendering to shadow map
@@ -863,10 +853,53 @@ void TestWindow::RenderShadowMap()
 	m_pCtx->ClearDepthStencilView(m_shmp.m_dst.m_pDsv, D3D11_CLEAR_DEPTH, 1.0f, 0);
 	m_shmp.Bind(m_pCtx);
 
-	m_pCtx->VSSetShader(m_pVsWorld, nullptr, 0);
 	m_pCtx->PSSetSamplers(SAMP_DEFAULT, 1, &m_pSsTrilinearRepeatAniso);
 
-	DrawMaterials(nullptr, m_pPsShadowAlphaTest);
+	// Opaque materials all go in one draw, using the welded depth-only indices and
+	// fetching just the position stream
+	m_pCtx->IASetInputLayout(m_pInputLayoutDepthOnly);
+	m_pCtx->VSSetShader(m_pVsDepthOnly, nullptr, 0);
+	m_pCtx->PSSetShader(nullptr, nullptr, 0);
+	m_pCtx->RSSetState(m_pRsDefault);
+	m_meshSponza.DrawDepthOpaque(m_pCtx);
+
+	// Alpha-tested materials need UVs, so go back to the full vertex format
+	m_pCtx->IASetInputLayout(m_pInputLayout);
+	m_pCtx->VSSetShader(m_pVsWorld, nullptr, 0);
+	m_pCtx->PSSetShader(m_pPsShadowAlphaTest, nullptr, 0);
+	m_pCtx->RSSetState(m_pRsDoubleSided);
+	m_cbShader.Bind(m_pCtx, CB_SHADER);
+	Texture2DArray * pTexArrayBound = nullptr;
+	for (int i = 0, c = int(m_meshSponza.m_depthMtlRanges.size()); i < c; ++i)
+	{
+		Material * pMtl = m_meshSponza.m_depthMtlRanges[i].m_pMtl;
+		ASSERT_ERR(pMtl);
+
+		// These ranges use the depth-only index buffer, so pass the slice directly
+		Texture2DArray * pTexArray = &m_texArray1x1White;
+		CBShader cbShader = { 0, 0, -1, };
+		if (pMtl->m_pTexPacked && pMtl->m_packedChannels[PACKCH_Mask] >= 0)
+		{
+			m_pCtx->PSSetShaderResources(TEX_PACKED, 1, &pMtl->m_pTexPacked->m_pSrv);
+			cbShader.m_maskChannel = pMtl->m_packedChannels[PACKCH_Mask];
+		}
+		if (Texture2D * pTex = pMtl->m_pTexDiffuseColor)
+		{
+			if (const TextureArrayLib::Slice * pSlice = m_texArrayLibSponza.Lookup(pTex))
+			{
+				pTexArray = pSlice->m_pTexArray;
+				cbShader.m_slice = UINT(pSlice->m_slice);
+			}
+		}
+		if (pTexArray != pTexArrayBound)
+		{
+			m_pCtx->PSSetShaderResources(TEX_DIFFUSE, 1, &pTexArray->m_pSrv);
+			pTexArrayBound = pTexArray;
+		}
+		m_cbShader.Update(m_pCtx, &cbShader);
+
+		m_meshSponza.DrawDepthAlphaTestRange(m_pCtx, i);
+	}
 }
 
 bool TestWindow::TryActivateVR()
@@ -1085,6 +1118,11 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 	(void)lpCmdLine;
 	(void)nCmdShow;
 
+#ifdef _DEBUG
+	// Check the framework's CPU-side decisions, without a device; see selftest.cpp
+	RunSelfTests();
+#endif
+
 	TestWindow w;
 	if (!w.Init(hInstance))
 	{
@@ -0,0 +1,343 @@
+#include "framework.h"
+#include <algorithm>
+
+namespace Framework
+{
+	// D3D11TextureStreamSink implementation
+
+	D3D11TextureStreamSink::D3D11TextureStreamSink()
+	:	m_texflags(TEXFLAG_Default)
+	{
+	}
+
+	void D3D11TextureStreamSink::SetResidentMips(Texture2D * pTex, int mipFirst)
+	{
+		ASSERT_ERR(m_pDevice);
+		ASSERT_ERR(pTex);
+
+		// D3D11 can't add or drop mips of an existing texture, so make a new one
+		pTex->UploadToGPU(m_pDevice, m_texflags, mipFirst);
+	}
+
+
+
+	// Helper functions
+
+	// Bytes taken by a texture's mips from mipFirst down
+	static i64 SizeOfMipsInBytes(const Texture2D * pTex, int mipFirst)
+	{
+		return i64(pTex->SizeInBytes()) - i64(CalculateMipPyramidSizeInBytes(pTex->m_dims, pTex->m_format, mipFirst));
+	}
+
+	// Whether a mip level can be the top level of a texture on the GPU; BC textures need
+	// the top level to be whole blocks
+	static bool IsValidMipFirst(const Texture2D * pTex, int level)
+	{
+		if (!IsBlockCompressedFormat(pTex->m_format))
+			return true;
+		int2 mipDims = CalculateMipDims(pTex->m_dims, level);
+		return (mipDims.x % 4 == 0 && mipDims.y % 4 == 0);
+	}
+
+	// Ratio of UV area to local-space area for each material range of a mesh, square-rooted
+	// to get UV units per local unit
+	static void CalculateUVDensities(const Mesh * pMesh, std::vector<float> * pDensitiesOut)
+	{
+		ASSERT_ERR(pMesh);
+		ASSERT_ERR(pDensitiesOut);
+
+		int mtlRangeCount = int(pMesh->m_mtlRanges.size());
+		pDensitiesOut->assign(mtlRangeCount, 0.0f);
+
+		if (!(pMesh->m_vattribs & VATTR_UV) || !pMesh->m_pIndices ||
+			pMesh->m_primtopo != D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST)
+		{
+			return;
+		}
+
+		// Find the positions and UVs in whichever streams they live in
+		const VertexFormat & format = GetVertexFormat(pMesh->m_vattribs);
+		const byte * pPosBase = (const byte *)pMesh->m_apVerts[VSTREAM_Pos];
+		int posStride = StrideOfVertexStream(pMesh->m_vlayout, pMesh->m_vattribs, VSTREAM_Pos);
+		const byte * pUVBase;
+		int uvStride;
+		if (pMesh->m_vlayout == VLAYOUT_Interleaved)
+		{
+			pUVBase = pPosBase + format.m_offsetUV;
+			uvStride = posStride;
+		}
+		else
+		{
+			pUVBase = (const byte *)pMesh->m_apVerts[VSTREAM_Attribs] + (format.m_offsetUV - int(sizeof(float3)));
+			uvStride = StrideOfVertexStream(pMesh->m_vlayout, pMesh->m_vattribs, VSTREAM_Attribs);
+		}
+		ASSERT_ERR(pPosBase);
+
+		for (int iRange = 0; iRange < mtlRangeCount; ++iRange)
+		{
+			const Mesh::MtlRange & range = pMesh->m_mtlRanges[iRange];
+			double areaLocal = 0.0, areaUV = 0.0;
+			for (int i = range.m_indexStart, iEnd = range.m_indexStart + range.m_indexCount; i + 2 < iEnd; i += 3)
+			{
+				int aiVert[3] = { pMesh->m_pIndices[i], pMesh->m_pIndices[i+1], pMesh->m_pIndices[i+2] };
+				float3 aPos[3];
+				float2 aUV[3];
+				for (int j = 0; j < 3; ++j)
+				{
+					aPos[j] = *(const float3 *)(pPosBase + aiVert[j] * posStride);
+					aUV[j] = *(const float2 *)(pUVBase + aiVert[j] * uvStride);
+				}
+				areaLocal += 0.5 * length(cross(aPos[1] - aPos[0], aPos[2] - aPos[0]));
+				float2 e1 = aUV[1] - aUV[0], e2 = aUV[2] - aUV[0];
+				areaUV += 0.5 * fabs(e1.x * e2.y - e1.y * e2.x);
+			}
+
+			if (areaLocal > 0.0)
+				(*pDensitiesOut)[iRange] = float(sqrt(areaUV / areaLocal));
+		}
+	}
+
+
+
+	// TextureStreamer implementation
+
+	TextureStreamer::TextureStreamer()
+	:	m_pSink(nullptr),
+		m_budgetBytes(0),
+		m_tailDim(64),
+		m_framesToKeep(30),
+		m_frame(0),
+		m_residentBytes(0)
+	{
+	}
+
+	void TextureStreamer::Init(TextureStreamSink * pSink, i64 budgetBytes)
+	{
+		ASSERT_ERR(pSink);
+		ASSERT_ERR(budgetBytes >= 0);
+
+		Reset();
+		m_pSink = pSink;
+		m_budgetBytes = budgetBytes;
+	}
+
+	void TextureStreamer::Reset()
+	{
+		m_pSink = nullptr;
+		m_budgetBytes = 0;
+		m_texStates.clear();
+		m_texIndices.clear();
+		m_meshUVDensities.clear();
+		m_frame = 0;
+		m_residentBytes = 0;
+	}
+
+	void TextureStreamer::AddTexture(Texture2D * pTex)
+	{
+		ASSERT_ERR(m_pSink);
+		ASSERT_ERR(pTex);
+		ASSERT_ERR(pTex->m_mipLevels > 0);
+		ASSERT_ERR(int(pTex->m_apPixels.size()) == pTex->m_mipLevels);
+
+		if (m_texIndices.find(pTex) != m_texIndices.end())
+			return;
+
+		// The tail starts at the first level that fits in m_tailDim, or the nearest finer
+		// level that can be the top of a texture
+		int mipTail = 0;
+		while (mipTail < pTex->m_mipLevels - 1 &&
+			   maxComponent(CalculateMipDims(pTex->m_dims, mipTail)) > m_tailDim)
+		{
+			++mipTail;
+		}
+		while (mipTail > 0 && !IsValidMipFirst(pTex, mipTail))
+			--mipTail;
+
+		TexState state =
+		{
+			pTex,
+			mipTail,
+			INT_MAX,		// mipRequested
+			mipTail,		// mipWanted
+			-1,				// frameLastRequested
+			mipTail,		// mipResident
+		};
+		m_texIndices.insert(std::make_pair(pTex, int(m_texStates.size())));
+		m_texStates.push_back(state);
+
+		m_pSink->SetResidentMips(pTex, mipTail);
+		m_residentBytes += SizeOfMipsInBytes(pTex, mipTail);
+	}
+
+	void TextureStreamer::AddTextureLib(TextureLib * pTexLib)
+	{
+		ASSERT_ERR(pTexLib);
+
+		for (auto iter = pTexLib->m_texs.begin(), end = pTexLib->m_texs.end(); iter != end; ++iter)
+			AddTexture(&iter->second);
+	}
+
+	int TextureStreamer::FindMipWanted(const TexState * pState, float uvPerPixel) const
+	{
+		ASSERT_ERR(pState);
+
+		// Pick the mip where one texel covers about one pixel
+		float texelsPerPixel = float(maxComponent(pState->m_pTex->m_dims)) * uvPerPixel;
+		int mip = (texelsPerPixel > 1.0f) ? int(floorf(log2f(texelsPerPixel))) : 0;
+		mip = min(mip, pState->m_mipTail);
+
+		// Round to a finer level if this one can't be the top of the texture
+		while (mip > 0 && !IsValidMipFirst(pState->m_pTex, mip))
+			--mip;
+
+		return mip;
+	}
+
+	void TextureStreamer::RequestTexture(Texture2D * pTex, float uvPerPixel)
+	{
+		ASSERT_ERR(pTex);
+		ASSERT_ERR(uvPerPixel >= 0.0f);
+
+		auto iter = m_texIndices.find(pTex);
+		if (iter == m_texIndices.end())
+			return;
+
+		TexState * pState = &m_texStates[iter->second];
+		pState->m_mipRequested = min(pState->m_mipRequested, FindMipWanted(pState, uvPerPixel));
+	}
+
+	void TextureStreamer::RequestMesh(const Mesh * pMesh, float worldUnitsPerPixel)
+	{
+		ASSERT_ERR(pMesh);
+		ASSERT_ERR(worldUnitsPerPixel >= 0.0f);
+
+		auto iter = m_meshUVDensities.find(pMesh);
+		if (iter == m_meshUVDensities.end())
+		{
+			iter = m_meshUVDensities.insert(std::make_pair(pMesh, std::vector<float>())).first;
+			CalculateUVDensities(pMesh, &iter->second);
+		}
+		const std::vector<float> & densities = iter->second;
+
+		for (int i = 0, c = int(pMesh->m_mtlRanges.size()); i < c; ++i)
+		{
+			const Material * pMtl = pMesh->m_mtlRanges[i].m_pMtl;
+			if (!pMtl || densities[i] <= 0.0f)
+				continue;
+
+			float uvPerPixel = densities[i] * worldUnitsPerPixel;
+			if (pMtl->m_pTexDiffuseColor)
+				RequestTexture(pMtl->m_pTexDiffuseColor, uvPerPixel);
+			if (pMtl->m_pTexSpecColor)
+				RequestTexture(pMtl->m_pTexSpecColor, uvPerPixel);
+			if (pMtl->m_pTexHeight)
+				RequestTexture(pMtl->m_pTexHeight, uvPerPixel);
+			if (pMtl->m_pTexNormal)
+				RequestTexture(pMtl->m_pTexNormal, uvPerPixel);
+			if (pMtl->m_pTexPacked)
+				RequestTexture(pMtl->m_pTexPacked, uvPerPixel);
+		}
+	}
+
+	void TextureStreamer::Update()
+	{
+		ASSERT_ERR(m_pSink);
+
+		int texCount = int(m_texStates.size());
+
+		// Fold this frame's requests into the wanted mips
+		for (int i = 0; i < texCount; ++i)
+		{
+			TexState * pState = &m_texStates[i];
+			if (pState->m_mipRequested != INT_MAX)
+			{
+				pState->m_mipWanted = pState->m_mipRequested;
+				pState->m_frameLastRequested = m_frame;
+				pState->m_mipRequested = INT_MAX;
+			}
+			else if (m_frame - pState->m_frameLastRequested > m_framesToKeep)
+			{
+				pState->m_mipWanted = pState->m_mipTail;
+			}
+		}
+
+		// List every level that could be added on top of the tails, with its cost.  Each
+		// texture's levels are taken in order, so a step's cost is what it adds to the
+		// previous one.
+		struct Step
+		{
+			int		m_iTex;
+			int		m_mip;
+			int		m_mipPrev;
+			int		m_priority;			// How many levels coarser than wanted; bigger goes first
+			i64		m_costBytes;
+		};
+		std::vector<Step> steps;
+		std::vector<int> aMipTarget(texCount);
+		i64 bytesTarget = 0;
+		for (int i = 0; i < texCount; ++i)
+		{
+			const TexState & state = m_texStates[i];
+			aMipTarget[i] = state.m_mipTail;
+			bytesTarget += SizeOfMipsInBytes(state.m_pTex, state.m_mipTail);
+
+			int mipPrev = state.m_mipTail;
+			for (int mip = state.m_mipTail - 1; mip >= state.m_mipWanted; --mip)
+			{
+				if (!IsValidMipFirst(state.m_pTex, mip))
+					continue;
+				Step step =
+				{
+					i, mip, mipPrev,
+					mip - state.m_mipWanted,
+					SizeOfMipsInBytes(state.m_pTex, mip) - SizeOfMipsInBytes(state.m_pTex, mipPrev),
+				};
+				steps.push_back(step);
+				mipPrev = mip;
+			}
+		}
+
+		// Hand out the budget, coarsest levels first; ties go to the cheaper step, then to
+		// the texture added first, so the result is deterministic
+		std::sort(steps.begin(), steps.end(), [](const Step & a, const Step & b)
+		{
+			if (a.m_priority != b.m_priority)
+				return a.m_priority > b.m_priority;
+			if (a.m_costBytes != b.m_costBytes)
+				return a.m_costBytes < b.m_costBytes;
+			return a.m_iTex < b.m_iTex;
+		});
+		for (int i = 0, c = int(steps.size()); i < c; ++i)
+		{
+			const Step & step = steps[i];
+
+			// Skip if an earlier level of this texture didn't fit
+			if (aMipTarget[step.m_iTex] != step.m_mipPrev)
+				continue;
+			if (bytesTarget + step.m_costBytes > m_budgetBytes)
+				continue;
+
+			aMipTarget[step.m_iTex] = step.m_mip;
+			bytesTarget += step.m_costBytes;
+		}
+
+		// Apply the changes, evicting before uploading to keep the peak down
+		for (int pass = 0; pass < 2; ++pass)
+		{
+			bool evicting = (pass == 0);
+			for (int i = 0; i < texCount; ++i)
+			{
+				TexState * pState = &m_texStates[i];
+				int mipTarget = aMipTarget[i];
+				if (mipTarget == pState->m_mipResident || (mipTarget > pState->m_mipResident) != evicting)
+					continue;
+
+				m_pSink->SetResidentMips(pState->m_pTex, mipTarget);
+				pState->m_mipResident = mipTarget;
+			}
+		}
+
+		m_residentBytes = bytesTarget;
+		++m_frame;
+	}
+}
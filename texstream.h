@@ -0,0 +1,90 @@
+#pragma once
+
+namespace Framework
+{
+	class Mesh;
+	class Texture2D;
+	class TextureLib;
+
+	// Receives the streamer's decisions about which mips each texture should have resident.
+	// The D3D11 sink recreates textures on the GPU; a sink that just records the calls lets
+	// the streamer's prioritization and budgeting run without a device.
+	class TextureStreamSink
+	{
+	public:
+		virtual			~TextureStreamSink() {}
+
+		// Make mips [mipFirst, pTex->m_mipLevels) of the texture resident, and no others
+		virtual void	SetResidentMips(Texture2D * pTex, int mipFirst) = 0;
+	};
+
+	class D3D11TextureStreamSink : public TextureStreamSink
+	{
+	public:
+		comptr<ID3D11Device>	m_pDevice;
+		int						m_texflags;		// TEXFLAG flags to create the textures with
+
+						D3D11TextureStreamSink();
+		virtual void	SetResidentMips(Texture2D * pTex, int mipFirst);
+	};
+
+	// World-space size of one pixel at a given distance from the camera, for RequestMesh
+	inline float CalculateWorldUnitsPerPixel(float distance, float fovy, int screenHeight)
+		{ return 2.0f * distance * tanf(0.5f * fovy) / float(screenHeight); }
+
+	// Streams texture mips in and out to keep GPU memory under a budget.
+	//  * Each texture starts with only its mip tail resident: the levels no bigger than
+	//      m_tailDim.  The tail always stays resident, and counts against the budget.
+	//  * Each frame, the app requests the textures it's drawing, with how much of the UV
+	//      space one screen pixel covers; RequestMesh works that out from the UV density
+	//      of each material range.  This gives the finest mip each texture needs.
+	//  * Update then hands out the budget, coarser levels first across all textures, so
+	//      when it runs short everything loses detail evenly.  Textures that haven't been
+	//      requested for m_framesToKeep frames fall back to their tails.
+	//  * Mip data comes from the per-mip entries in the asset pack, via Texture2D::m_apPixels.
+	class TextureStreamer
+	{
+	public:
+		TextureStreamSink *		m_pSink;
+		i64						m_budgetBytes;
+		int						m_tailDim;
+		int						m_framesToKeep;
+
+		struct TexState
+		{
+			Texture2D *		m_pTex;
+			int				m_mipTail;				// Coarsest level allowed to be the top resident mip
+			int				m_mipRequested;			// Finest mip requested this frame, or INT_MAX if none
+			int				m_mipWanted;			// Finest mip requested recently
+			int				m_frameLastRequested;
+			int				m_mipResident;			// Top mip currently resident
+		};
+		std::vector<TexState>								m_texStates;
+		std::unordered_map<Texture2D *, int>				m_texIndices;			// Index into m_texStates
+		std::unordered_map<const Mesh *, std::vector<float>>	m_meshUVDensities;	// UV units per local unit, per material range
+
+		int						m_frame;
+		i64						m_residentBytes;
+
+				TextureStreamer();
+		void	Init(TextureStreamSink * pSink, i64 budgetBytes);
+		void	Reset();
+
+		// Start streaming a texture; uploads just its tail
+		void	AddTexture(Texture2D * pTex);
+		void	AddTextureLib(TextureLib * pTexLib);
+
+		// Per-frame requests.  Textures that weren't added to the streamer are ignored.
+		// uvPerPixel is the amount of UV space covered by one screen pixel; worldUnitsPerPixel
+		// is the size of one pixel in the mesh's local units.
+		void	RequestTexture(Texture2D * pTex, float uvPerPixel);
+		void	RequestMesh(const Mesh * pMesh, float worldUnitsPerPixel);
+
+		// Choose the resident mips for this frame's requests, within the budget, and tell
+		// the sink about any changes.  Call once per frame, after making the requests.
+		void	Update();
+
+	protected:
+		int		FindMipWanted(const TexState * pState, float uvPerPixel) const;
+	};
+}
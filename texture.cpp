@@ -1,4 +1,5 @@
 #include "framework.h"
+#include <algorithm>
 
 namespace Framework
 {
@@ -7,7 +8,8 @@ namespace Framework
 	Texture2D::Texture2D()
 	:	m_dims(0),
 		m_mipLevels(0),
-		m_format(DXGI_FORMAT_UNKNOWN)
+		m_format(DXGI_FORMAT_UNKNOWN),
+		m_mipFirstResident(0)
 	{
 	}
 
@@ -21,6 +23,7 @@ namespace Framework
 		m_pTex.release();
 		m_pSrv.release();
 		m_pUav.release();
+		m_mipFirstResident = 0;
 	}
 
 	void Texture2D::Init(
@@ -67,14 +70,20 @@ namespace Framework
 		m_dims = dims;
 		m_mipLevels = texDesc.MipLevels;
 		m_format = format;
+		m_mipFirstResident = 0;
 	}
 
 	void Texture2D::UploadToGPU(
 		ID3D11Device * pDevice,
-		int flags /* = TEXFLAG_Default */)
+		int flags /* = TEXFLAG_Default */,
+		int mipFirst /* = 0 */)
 	{
 		ASSERT_ERR(pDevice);
 		ASSERT_ERR(int(m_apPixels.size()) == m_mipLevels);
+		ASSERT_ERR(mipFirst >= 0 && mipFirst < m_mipLevels);
+
+		int2 dimsResident = CalculateMipDims(m_dims, mipFirst);
+		int mipLevelsResident = m_mipLevels - mipFirst;
 
 		// Always map the format to its typeless version, if possible;
 		// enables views of other formats to be created if desired
@@ -84,8 +93,8 @@ namespace Framework
 
 		D3D11_TEXTURE2D_DESC texDesc =
 		{
-			UINT(m_dims.x), UINT(m_dims.y),
-			UINT(m_mipLevels), 1,
+			UINT(dimsResident.x), UINT(dimsResident.y),
+			UINT(mipLevelsResident), 1,
 			formatTex,
 			{ 1, 0 },
 			D3D11_USAGE_DEFAULT,
@@ -97,19 +106,23 @@ namespace Framework
 			texDesc.BindFlags |= D3D11_BIND_UNORDERED_ACCESS;
 		}
 
-		std::vector<D3D11_SUBRESOURCE_DATA> aInitialData(m_mipLevels);
-		for (int i = 0; i < m_mipLevels; ++i)
+		std::vector<D3D11_SUBRESOURCE_DATA> aInitialData(mipLevelsResident);
+		for (int i = 0; i < mipLevelsResident; ++i)
 		{
 			D3D11_SUBRESOURCE_DATA * pInitialData = &aInitialData[i];
-			pInitialData->pSysMem = m_apPixels[i];
-			pInitialData->SysMemPitch = CalculateMipDims(m_dims.x, i) * BitsPerPixel(m_format) / 8;
+			pInitialData->pSysMem = m_apPixels[mipFirst + i];
+			pInitialData->SysMemPitch = CalculateRowPitch(CalculateMipDims(m_dims.x, mipFirst + i), m_format);
 			pInitialData->SysMemSlicePitch = 0;
 		}
 
+		m_pTex.release();
+		m_pSrv.release();
+		m_pUav.release();
+
 		CHECK_D3D(pDevice->CreateTexture2D(&texDesc, &aInitialData[0], &m_pTex));
 
 		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = { m_format, D3D11_SRV_DIMENSION_TEXTURE2D, };
-		srvDesc.Texture2D.MipLevels = m_mipLevels;
+		srvDesc.Texture2D.MipLevels = mipLevelsResident;
 		CHECK_D3D(pDevice->CreateShaderResourceView(m_pTex, &srvDesc, &m_pSrv));
 
 		if (flags & TEXFLAG_EnableUAV)
@@ -117,6 +130,8 @@ namespace Framework
 			D3D11_UNORDERED_ACCESS_VIEW_DESC uavDesc = { m_format, D3D11_UAV_DIMENSION_TEXTURE2D, };
 			CHECK_D3D(pDevice->CreateUnorderedAccessView(m_pTex, &uavDesc, &m_pUav));
 		}
+
+		m_mipFirstResident = mipFirst;
 	}
 
 	void Texture2D::Readback(
@@ -126,7 +141,7 @@ namespace Framework
 	{
 		ASSERT_ERR(m_pTex);
 		ASSERT_ERR(pCtx);
-		ASSERT_ERR(level >= 0 && level < m_mipLevels);
+		ASSERT_ERR(level >= m_mipFirstResident && level < m_mipLevels);
 		ASSERT_ERR(pDataOut);
 
 		comptr<ID3D11Device> pDevice;
@@ -149,16 +164,17 @@ namespace Framework
 		pDevice->CreateTexture2D(&texDesc, nullptr, &pTexStaging);
 
 		// Copy the data to the staging resource
-		pCtx->CopySubresourceRegion(pTexStaging, 0, 0, 0, 0, m_pTex, level, nullptr);
+		pCtx->CopySubresourceRegion(pTexStaging, 0, 0, 0, 0, m_pTex, level - m_mipFirstResident, nullptr);
 
 		// Map the staging resource
 		D3D11_MAPPED_SUBRESOURCE mapped = {};
 		CHECK_D3D(pCtx->Map(pTexStaging, 0, D3D11_MAP_READ, 0, &mapped));
 
 		// Copy the data out row by row, in case the pitch is different
-		int rowSize = mipDims.x * BitsPerPixel(m_format) / 8;
+		int rowSize = CalculateRowPitch(mipDims.x, m_format);
+		int rowCount = CalculateRowCount(mipDims.y, m_format);
 		ASSERT_ERR(mapped.RowPitch >= UINT(rowSize));
-		for (int y = 0; y < mipDims.y; ++y)
+		for (int y = 0; y < rowCount; ++y)
 		{
 			memcpy(
 				offsetPtr(pDataOut, y * rowSize),
@@ -276,7 +292,7 @@ namespace Framework
 			{
 				D3D11_SUBRESOURCE_DATA * pInitialData = &aInitialData[face * m_mipLevels + level];
 				pInitialData->pSysMem = m_apPixels[face * m_mipLevels + level];
-				pInitialData->SysMemPitch = CalculateMipDims(m_cubeSize, level) * BitsPerPixel(m_format) / 8;
+				pInitialData->SysMemPitch = CalculateRowPitch(CalculateMipDims(m_cubeSize, level), m_format);
 				pInitialData->SysMemSlicePitch = 0;
 			}
 		}
@@ -334,9 +350,10 @@ namespace Framework
 		CHECK_D3D(pCtx->Map(pTexStaging, 0, D3D11_MAP_READ, 0, &mapped));
 
 		// Copy the data out row by row, in case the pitch is different
-		int rowSize = mipDim * BitsPerPixel(m_format) / 8;
+		int rowSize = CalculateRowPitch(mipDim, m_format);
+		int rowCount = CalculateRowCount(mipDim, m_format);
 		ASSERT_ERR(mapped.RowPitch >= UINT(rowSize));
-		for (int y = 0; y < mipDim; ++y)
+		for (int y = 0; y < rowCount; ++y)
 		{
 			memcpy(
 				offsetPtr(pDataOut, y * rowSize),
@@ -448,8 +465,8 @@ namespace Framework
 			int3 mipDims = CalculateMipDims(m_dims, i);
 			D3D11_SUBRESOURCE_DATA * pInitialData = &aInitialData[i];
 			pInitialData->pSysMem = m_apPixels[i];
-			pInitialData->SysMemPitch = mipDims.x * BitsPerPixel(m_format) / 8;
-			pInitialData->SysMemSlicePitch = pInitialData->SysMemPitch * mipDims.y;
+			pInitialData->SysMemPitch = CalculateRowPitch(mipDims.x, m_format);
+			pInitialData->SysMemSlicePitch = pInitialData->SysMemPitch * CalculateRowCount(mipDims.y, m_format);
 		}
 
 		CHECK_D3D(pDevice->CreateTexture3D(&texDesc, &aInitialData[0], &m_pTex));
@@ -502,13 +519,14 @@ namespace Framework
 		CHECK_D3D(pCtx->Map(pTexStaging, 0, D3D11_MAP_READ, 0, &mapped));
 
 		// Copy the data out slice by slice and row by row, in case the pitches are different
-		int rowSize = mipDims.x * BitsPerPixel(m_format) / 8;
-		int sliceSize = mipDims.y * rowSize;
+		int rowSize = CalculateRowPitch(mipDims.x, m_format);
+		int rowCount = CalculateRowCount(mipDims.y, m_format);
+		int sliceSize = rowCount * rowSize;
 		ASSERT_ERR(mapped.RowPitch >= UINT(rowSize));
 		ASSERT_ERR(mapped.DepthPitch >= UINT(sliceSize));
 		for (int z = 0; z < mipDims.z; ++z)
 		{
-			for (int y = 0; y < mipDims.y; ++y)
+			for (int y = 0; y < rowCount; ++y)
 			{
 				memcpy(
 					offsetPtr(pDataOut, z * sliceSize + y * rowSize),
@@ -522,6 +540,75 @@ namespace Framework
 
 
 
+	// Texture2DArray implementation
+
+	Texture2DArray::Texture2DArray()
+	:	m_dims(0),
+		m_sliceCount(0),
+		m_mipLevels(0),
+		m_format(DXGI_FORMAT_UNKNOWN)
+	{
+	}
+
+	void Texture2DArray::Reset()
+	{
+		m_pPack.release();
+		m_apPixels.clear();
+		m_dims = int2(0);
+		m_sliceCount = 0;
+		m_mipLevels = 0;
+		m_format = DXGI_FORMAT_UNKNOWN;
+		m_pTex.release();
+		m_pSrv.release();
+	}
+
+	void Texture2DArray::UploadToGPU(ID3D11Device * pDevice)
+	{
+		ASSERT_ERR(pDevice);
+		ASSERT_ERR(m_sliceCount > 0);
+		ASSERT_ERR(int(m_apPixels.size()) == m_mipLevels * m_sliceCount);
+
+		// Always map the format to its typeless version, if possible;
+		// enables views of other formats to be created if desired
+		DXGI_FORMAT formatTex = FindTypelessFormat(m_format);
+		if (formatTex == DXGI_FORMAT_UNKNOWN)
+			formatTex = m_format;
+
+		D3D11_TEXTURE2D_DESC texDesc =
+		{
+			UINT(m_dims.x), UINT(m_dims.y),
+			UINT(m_mipLevels), UINT(m_sliceCount),
+			formatTex,
+			{ 1, 0 },
+			D3D11_USAGE_DEFAULT,
+			D3D11_BIND_SHADER_RESOURCE,
+			0, 0,
+		};
+
+		std::vector<D3D11_SUBRESOURCE_DATA> aInitialData(m_mipLevels * m_sliceCount);
+		for (int slice = 0; slice < m_sliceCount; ++slice)
+		{
+			for (int level = 0; level < m_mipLevels; ++level)
+			{
+				D3D11_SUBRESOURCE_DATA * pInitialData = &aInitialData[slice * m_mipLevels + level];
+				pInitialData->pSysMem = m_apPixels[slice * m_mipLevels + level];
+				pInitialData->SysMemPitch = CalculateRowPitch(CalculateMipDims(m_dims.x, level), m_format);
+				pInitialData->SysMemSlicePitch = 0;
+			}
+		}
+
+		m_pTex.release();
+		m_pSrv.release();
+		CHECK_D3D(pDevice->CreateTexture2D(&texDesc, &aInitialData[0], &m_pTex));
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = { m_format, D3D11_SRV_DIMENSION_TEXTURE2DARRAY, };
+		srvDesc.Texture2DArray.MipLevels = m_mipLevels;
+		srvDesc.Texture2DArray.ArraySize = m_sliceCount;
+		CHECK_D3D(pDevice->CreateShaderResourceView(m_pTex, &srvDesc, &m_pSrv));
+	}
+
+
+
 	// Texture creation - helper functions
 
 	void CreateTexture1x1(
@@ -625,6 +712,57 @@ namespace Framework
 		pTexOut->m_format = format;
 	}
 
+	void CreateTexture2DArray1x1(
+		ID3D11Device * pDevice,
+		rgba color,
+		Texture2DArray * pTexOut,
+		DXGI_FORMAT format /*= DXGI_FORMAT_R8G8B8A8_UNORM_SRGB*/)
+	{
+		ASSERT_ERR(pDevice);
+		ASSERT_ERR(pTexOut);
+
+		// Convert floats to 8-bit format
+		byte4 colorBytes = byte4(round(255.0f * saturate(color)));
+
+		// Always map the format to its typeless version, if possible;
+		// enables views of other formats to be created if desired
+		DXGI_FORMAT formatTex = FindTypelessFormat(format);
+		if (formatTex == DXGI_FORMAT_UNKNOWN)
+			formatTex = format;
+
+		D3D11_TEXTURE2D_DESC texDesc = 
+		{
+			1, 1, 1, 1,
+			formatTex,
+			{ 1, 0 },
+			D3D11_USAGE_DEFAULT,
+			D3D11_BIND_SHADER_RESOURCE,
+			0, 0,
+		};
+
+		D3D11_SUBRESOURCE_DATA initialData = { colorBytes, sizeof(colorBytes), };
+		comptr<ID3D11Texture2D> pTex;
+		CHECK_D3D(pDevice->CreateTexture2D(&texDesc, &initialData, &pTex));
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc =
+		{
+			format,
+			D3D11_SRV_DIMENSION_TEXTURE2DARRAY,
+		};
+		srvDesc.Texture2DArray.MipLevels = 1;
+		srvDesc.Texture2DArray.ArraySize = 1;
+
+		comptr<ID3D11ShaderResourceView> pSrv = nullptr;
+		CHECK_D3D(pDevice->CreateShaderResourceView(pTex, &srvDesc, &pSrv));
+
+		pTexOut->m_pTex = pTex;
+		pTexOut->m_pSrv = pSrv;
+		pTexOut->m_dims = int2(1);
+		pTexOut->m_sliceCount = 1;
+		pTexOut->m_mipLevels = 1;
+		pTexOut->m_format = format;
+	}
+
 	void CreateTexture2DFromMemory(
 		ID3D11Device * pDevice,
 		int2 dims,
@@ -652,7 +790,7 @@ namespace Framework
 			0, 0,
 		};
 
-		D3D11_SUBRESOURCE_DATA initialData = { pPixels, UINT(dims.x * BitsPerPixel(format) / 8) };
+		D3D11_SUBRESOURCE_DATA initialData = { pPixels, UINT(CalculateRowPitch(dims.x, format)) };
 		comptr<ID3D11Texture2D> pTex;
 		CHECK_D3D(pDevice->CreateTexture2D(&texDesc, &initialData, &pTex));
 
@@ -690,10 +828,15 @@ namespace Framework
 		return &iter->second;
 	}
 
-	void TextureLib::UploadAllToGPU(ID3D11Device * pDevice, int flags /* = TEXFLAG_Default */)
+	void TextureLib::UploadAllToGPU(
+		ID3D11Device * pDevice,
+		int flags /* = TEXFLAG_Default */,
+		const TextureArrayLib * pTexArrayLibSkip /* = nullptr */)
 	{
 		for (auto iter = m_texs.begin(), end = m_texs.end(); iter != end; ++iter)
 		{
+			if (pTexArrayLibSkip && pTexArrayLibSkip->Lookup(&iter->second))
+				continue;
 			iter->second.UploadToGPU(pDevice, flags);
 		}
 	}
@@ -705,6 +848,141 @@ namespace Framework
 
 
 
+	// TextureArrayLib implementation
+
+	TextureArrayLib::TextureArrayLib()
+	{
+	}
+
+	void TextureArrayLib::Build(const MaterialLib * pMtlLib)
+	{
+		ASSERT_ERR(pMtlLib);
+
+		// Sort the materials by name, so the textures come out in the same order every time
+		std::vector<const Material *> mtls;
+		mtls.reserve(pMtlLib->m_mtls.size());
+		for (auto iter = pMtlLib->m_mtls.begin(), end = pMtlLib->m_mtls.end(); iter != end; ++iter)
+			mtls.push_back(&iter->second);
+		std::sort(mtls.begin(), mtls.end(), [](const Material * pA, const Material * pB)
+		{
+			return strcmp(pA->m_mtlName, pB->m_mtlName) < 0;
+		});
+
+		std::vector<const Texture2D *> apTexs;
+		for (int i = 0, c = int(mtls.size()); i < c; ++i)
+		{
+			if (const Texture2D * pTex = mtls[i]->m_pTexDiffuseColor)
+				apTexs.push_back(pTex);
+		}
+
+		Build(apTexs.empty() ? nullptr : &apTexs[0], int(apTexs.size()));
+	}
+
+	void TextureArrayLib::Build(const Texture2D * const * apTexs, int texCount)
+	{
+		ASSERT_ERR(apTexs || texCount == 0);
+
+		// D3D11_REQ_TEXTURE2D_ARRAY_AXIS_DIMENSION; bigger groups get split
+		static const int s_maxSlices = 2048;
+
+		Reset();
+
+		// Sort the textures stably by the properties that have to match within an array,
+		// so each group comes out in the order the textures were given in.  Each texture
+		// goes in just once, as several materials can share one.
+		std::vector<const Texture2D *> texs;
+		std::unordered_set<const Texture2D *> texsSeen;
+		texs.reserve(texCount);
+		for (int i = 0; i < texCount; ++i)
+		{
+			const Texture2D * pTex = apTexs[i];
+			ASSERT_ERR(pTex);
+			if (pTex->m_mipLevels == 0 || int(pTex->m_apPixels.size()) != pTex->m_mipLevels)
+				continue;
+			if (texsSeen.insert(pTex).second)
+				texs.push_back(pTex);
+		}
+		std::stable_sort(texs.begin(), texs.end(), [](const Texture2D * pA, const Texture2D * pB)
+		{
+			if (pA->m_format != pB->m_format)
+				return pA->m_format < pB->m_format;
+			if (pA->m_dims.x != pB->m_dims.x)
+				return pA->m_dims.x < pB->m_dims.x;
+			if (pA->m_dims.y != pB->m_dims.y)
+				return pA->m_dims.y < pB->m_dims.y;
+			return pA->m_mipLevels < pB->m_mipLevels;
+		});
+
+		// Find where each array starts
+		std::vector<int> aiArrayStart;
+		for (int i = 0, c = int(texs.size()); i < c; ++i)
+		{
+			const Texture2D * pTex = texs[i];
+			const Texture2D * pTexPrev = (i > 0) ? texs[i-1] : nullptr;
+			if (!pTexPrev ||
+				pTex->m_format != pTexPrev->m_format ||
+				any(pTex->m_dims != pTexPrev->m_dims) ||
+				pTex->m_mipLevels != pTexPrev->m_mipLevels ||
+				i - aiArrayStart.back() == s_maxSlices)
+			{
+				aiArrayStart.push_back(i);
+			}
+		}
+		aiArrayStart.push_back(int(texs.size()));
+
+		// Fill out the arrays.  The vector isn't resized after this, so the Slice
+		// pointers stay valid.
+		int arrayCount = int(aiArrayStart.size()) - 1;
+		m_texArrays.resize(arrayCount);
+		for (int iArray = 0; iArray < arrayCount; ++iArray)
+		{
+			Texture2DArray * pTexArray = &m_texArrays[iArray];
+			const Texture2D * pTexFirst = texs[aiArrayStart[iArray]];
+			pTexArray->m_pPack = pTexFirst->m_pPack;
+			pTexArray->m_dims = pTexFirst->m_dims;
+			pTexArray->m_sliceCount = aiArrayStart[iArray + 1] - aiArrayStart[iArray];
+			pTexArray->m_mipLevels = pTexFirst->m_mipLevels;
+			pTexArray->m_format = pTexFirst->m_format;
+
+			for (int slice = 0; slice < pTexArray->m_sliceCount; ++slice)
+			{
+				const Texture2D * pTex = texs[aiArrayStart[iArray] + slice];
+				ASSERT_WARN(pTex->m_pPack.p == pTexArray->m_pPack.p);
+				pTexArray->m_apPixels.insert(pTexArray->m_apPixels.end(), pTex->m_apPixels.begin(), pTex->m_apPixels.end());
+
+				Slice sliceInfo = { pTexArray, slice };
+				m_slices.insert(std::make_pair(pTex, sliceInfo));
+			}
+		}
+
+		LOG("Grouped %d textures into %d texture arrays", int(texs.size()), arrayCount);
+	}
+
+	const TextureArrayLib::Slice * TextureArrayLib::Lookup(const Texture2D * pTex) const
+	{
+		auto iter = m_slices.find(pTex);
+		if (iter == m_slices.end())
+			return nullptr;
+
+		return &iter->second;
+	}
+
+	void TextureArrayLib::UploadAllToGPU(ID3D11Device * pDevice)
+	{
+		for (int i = 0, c = int(m_texArrays.size()); i < c; ++i)
+		{
+			m_texArrays[i].UploadToGPU(pDevice);
+		}
+	}
+
+	void TextureArrayLib::Reset()
+	{
+		m_texArrays.clear();
+		m_slices.clear();
+	}
+
+
+
 	// Utility functions
 	
 	const char * NameOfFormat(DXGI_FORMAT format)
@@ -1105,6 +1383,12 @@ namespace Framework
 		return s_typelessFormat[format];
 	}
 
+	bool IsBlockCompressedFormat(DXGI_FORMAT format)
+	{
+		return (format >= DXGI_FORMAT_BC1_TYPELESS && format <= DXGI_FORMAT_BC5_SNORM) ||
+			   (format >= DXGI_FORMAT_BC6H_TYPELESS && format <= DXGI_FORMAT_BC7_UNORM_SRGB);
+	}
+
 
 
 	// Helper functions for saving out screenshots of textures
@@ -6,9 +6,21 @@ namespace Framework
 	const char * NameOfFormat(DXGI_FORMAT format);
 	int BitsPerPixel(DXGI_FORMAT format);
 	DXGI_FORMAT FindTypelessFormat(DXGI_FORMAT format);
+	bool IsBlockCompressedFormat(DXGI_FORMAT format);
 
-	// Utility functions for counting mips
-	// Note: these don't take into account minimum block sizes for compressed formats.
+	// Size of one row of pixels (or 4x4 blocks, for compressed formats), and number of rows
+	inline int CalculateRowPitch(int width, DXGI_FORMAT format)
+	{
+		if (IsBlockCompressedFormat(format))
+			return ((width + 3) / 4) * BitsPerPixel(format) * 2;
+		return width * BitsPerPixel(format) / 8;
+	}
+	inline int CalculateRowCount(int height, DXGI_FORMAT format)
+		{ return IsBlockCompressedFormat(format) ? (height + 3) / 4 : height; }
+
+	// Utility functions for counting mips.  Sizes round down at each level, for non-pow2 textures.
+	// Note: the mip counts and dims are in pixels; the sizes in bytes account for compressed
+	// formats storing whole 4x4 blocks, even for mips smaller than a block.
 
 	inline int CalculateMipCount(int size)
 		{ return log2_floor(size) + 1; }
@@ -25,11 +37,11 @@ namespace Framework
 		{ return max(int3(baseDims.x >> level, baseDims.y >> level, baseDims.z >> level), int3(1)); }
 
 	inline int CalculateMipSizeInBytes(int baseDim, int level, DXGI_FORMAT format)
-		{ return square(CalculateMipDims(baseDim, level)) * BitsPerPixel(format); }
+		{ int mipDim = CalculateMipDims(baseDim, level); return CalculateRowCount(mipDim, format) * CalculateRowPitch(mipDim, format); }
 	inline int CalculateMipSizeInBytes(int2 baseDims, int level, DXGI_FORMAT format)
-		{ int2 mipDims = CalculateMipDims(baseDims, level); return mipDims.x * mipDims.y * BitsPerPixel(format); }
+		{ int2 mipDims = CalculateMipDims(baseDims, level); return CalculateRowCount(mipDims.y, format) * CalculateRowPitch(mipDims.x, format); }
 	inline int CalculateMipSizeInBytes(int3 baseDims, int level, DXGI_FORMAT format)
-		{ int3 mipDims = CalculateMipDims(baseDims, level); return mipDims.x * mipDims.y * mipDims.z * BitsPerPixel(format); }
+		{ int3 mipDims = CalculateMipDims(baseDims, level); return mipDims.z * CalculateRowCount(mipDims.y, format) * CalculateRowPitch(mipDims.x, format); }
 
 	inline int CalculateMipPyramidSizeInBytes(int baseDim, DXGI_FORMAT format, int mipLevels = -1)
 	{
@@ -81,16 +93,21 @@ namespace Framework
 		int							m_mipLevels;
 		DXGI_FORMAT					m_format;
 
-		// GPU resources
+		// GPU resources.  These may hold just the mips from m_mipFirstResident down, when
+		// the texture is streamed (see TextureStreamer); mip N on the GPU is then level
+		// m_mipFirstResident + N of the full texture.
 		comptr<ID3D11Texture2D>				m_pTex;
 		comptr<ID3D11ShaderResourceView>	m_pSrv;
 		comptr<ID3D11UnorderedAccessView>	m_pUav;
+		int									m_mipFirstResident;
 
 				Texture2D();
 		void	Reset();
 
 		int		SizeInBytes() const
 					{ return CalculateMipPyramidSizeInBytes(m_dims, m_format, m_mipLevels); }
+		int		ResidentSizeInBytes() const
+					{ return SizeInBytes() - CalculateMipPyramidSizeInBytes(m_dims, m_format, m_mipFirstResident); }
 
 		// Creates a texture that exists only on the GPU, not backed by asset data
 		void	Init(
@@ -99,10 +116,12 @@ namespace Framework
 					DXGI_FORMAT format,
 					int flags = TEXFLAG_Default);
 
-		// Creates the texture on the GPU from m_apPixels
+		// Creates the texture on the GPU from m_apPixels, optionally leaving out the top
+		// mipFirst levels.  Replaces any previous GPU texture.
 		void	UploadToGPU(
 					ID3D11Device * pDevice,
-					int flags = TEXFLAG_Default);
+					int flags = TEXFLAG_Default,
+					int mipFirst = 0);
 
 		// Read back the data to main memory - you're responsible for allocing enough
 		void	Readback(
@@ -137,7 +156,7 @@ namespace Framework
 		void	Reset();
 
 		int		SizeInBytes() const
-					{ return CalculateMipPyramidSizeInBytes(m_cubeSize, m_format, m_mipLevels); }
+					{ return 6 * CalculateMipPyramidSizeInBytes(m_cubeSize, m_format, m_mipLevels); }
 
 		// Creates the texture on the GPU from m_apPixels
 		void	UploadToGPU(
@@ -192,6 +211,34 @@ namespace Framework
 					void * pDataOut);
 	};
 
+	class Texture2DArray
+	{
+	public:
+		// Asset pack that this texture's data is sourced from
+		comptr<AssetPack>			m_pPack;
+
+		// Pointers to pixel data in the asset pack, for each slice and mip level
+		// (all the mips of slice 0, then slice 1, etc.)
+		std::vector<void *>			m_apPixels;
+		int2						m_dims;
+		int							m_sliceCount;
+		int							m_mipLevels;
+		DXGI_FORMAT					m_format;
+
+		// GPU resources
+		comptr<ID3D11Texture2D>				m_pTex;
+		comptr<ID3D11ShaderResourceView>	m_pSrv;
+
+				Texture2DArray();
+		void	Reset();
+
+		int		SizeInBytes() const
+					{ return m_sliceCount * CalculateMipPyramidSizeInBytes(m_dims, m_format, m_mipLevels); }
+
+		// Creates the texture on the GPU from m_apPixels
+		void	UploadToGPU(ID3D11Device * pDevice);
+	};
+
 
 
 	// Texture loading from asset packs
@@ -201,7 +248,18 @@ namespace Framework
 		const char * path,
 		Texture2D * pTexOut);
 
-	// !!!UNDONE: load cubemaps and 3D textures as well
+	// Cubemaps can also return their irradiance, as 9 SH coefficients (bands 0-2, in
+	// the usual order); evaluate them with the SH basis for a normal to get irradiance
+	bool LoadTextureCubeFromAssetPack(
+		AssetPack * pPack,
+		const char * path,
+		TextureCube * pTexOut,
+		rgb * aIrradianceSH9Out = nullptr);
+
+	bool LoadTexture3DFromAssetPack(
+		AssetPack * pPack,
+		const char * path,
+		Texture3D * pTexOut);
 
 	// Helper function for quick and dirty apps - just get a texture from
 	// an image file, no messing around with asset packs or mipmaps
@@ -223,6 +281,12 @@ namespace Framework
 		TextureCube * pTexOut,
 		DXGI_FORMAT format = DXGI_FORMAT_R8G8B8A8_UNORM_SRGB);
 
+	void CreateTexture2DArray1x1(
+		ID3D11Device * pDevice,
+		rgba color,
+		Texture2DArray * pTexOut,
+		DXGI_FORMAT format = DXGI_FORMAT_R8G8B8A8_UNORM_SRGB);
+
 	void CreateTexture2DFromMemory(
 		ID3D11Device * pDevice,
 		int2 dims,
@@ -233,6 +297,7 @@ namespace Framework
 
 
 	// Texture library: indexes a set of textures by name.
+	class TextureArrayLib;
 	class TextureLib
 	{
 	public:
@@ -244,9 +309,11 @@ namespace Framework
 		Texture2D *	Lookup(const std::string & name);
 		Texture2D *	Lookup(const char * name)
 						{ return Lookup(std::string(name)); }
+		// Textures that are in pTexArrayLibSkip are left out, as they're drawn from the arrays
 		void		UploadAllToGPU(
 						ID3D11Device * pDevice,
-						int flags = TEXFLAG_Default);
+						int flags = TEXFLAG_Default,
+						const TextureArrayLib * pTexArrayLibSkip = nullptr);
 		void		Reset();
 	};
 
@@ -258,6 +325,37 @@ namespace Framework
 		int numAssets,
 		TextureLib * pTexLibOut);
 
+	// Texture array library: groups textures into Texture2DArrays, one per combination of
+	// size, format and mip count, so materials can share a texture binding.  Only the
+	// textures it's given are arrayed - by default the diffuse textures of a material
+	// library, as that's what MtlBatchList looks up.  Textures keep the order they're
+	// given in within each array, so the arrays, and each texture's slice, come out the
+	// same every time.
+	class MaterialLib;
+	class TextureArrayLib
+	{
+	public:
+		struct Slice
+		{
+			Texture2DArray *	m_pTexArray;
+			int					m_slice;
+		};
+
+		std::vector<Texture2DArray>						m_texArrays;
+		std::unordered_map<const Texture2D *, Slice>	m_slices;
+
+						TextureArrayLib();
+
+		// Does the grouping; doesn't touch the GPU.  The first version takes the diffuse
+		// textures of the materials, in order of material name.
+		void			Build(const MaterialLib * pMtlLib);
+		void			Build(const Texture2D * const * apTexs, int texCount);
+
+		const Slice *	Lookup(const Texture2D * pTex) const;
+		void			UploadAllToGPU(ID3D11Device * pDevice);
+		void			Reset();
+	};
+
 
 
 	// Helper functions for saving out screenshots of textures
@@ -0,0 +1,493 @@
+#include "framework.h"
+#include <algorithm>
+
+namespace Framework
+{
+	int CalculateVTMipCount(int2 dims, int tileSize)
+	{
+		ASSERT_ERR(all(dims > 0));
+		ASSERT_ERR(tileSize > 0);
+
+		int mipLevels = 1;
+		while (maxComponent(CalculateMipDims(dims, mipLevels - 1)) > tileSize)
+			++mipLevels;
+		return mipLevels;
+	}
+
+
+
+	// VTLayout implementation
+
+	int2 VTLayout::TileCount(int mip) const
+	{
+		ASSERT_ERR(mip >= 0 && mip < m_mipLevels);
+		return (CalculateMipDims(m_dims, mip) + (m_tileSize - 1)) / m_tileSize;
+	}
+
+	int VTLayout::TotalTileCount() const
+	{
+		int total = 0;
+		for (int mip = 0; mip < m_mipLevels; ++mip)
+		{
+			int2 tileCount = TileCount(mip);
+			total += tileCount.x * tileCount.y;
+		}
+		return total;
+	}
+
+	int VTLayout::TileIndex(VTileID tile) const
+	{
+		ASSERT_ERR(IsValidTile(tile));
+
+		int mip = VTileMip(tile);
+		int index = 0;
+		for (int i = 0; i < mip; ++i)
+		{
+			int2 tileCount = TileCount(i);
+			index += tileCount.x * tileCount.y;
+		}
+		return index + VTileY(tile) * TileCount(mip).x + VTileX(tile);
+	}
+
+	bool VTLayout::IsValidTile(VTileID tile) const
+	{
+		int mip = VTileMip(tile);
+		if (mip >= m_mipLevels)
+			return false;
+		int2 tileCount = TileCount(mip);
+		return (VTileX(tile) < tileCount.x && VTileY(tile) < tileCount.y);
+	}
+
+	VTileID VTLayout::ParentOf(VTileID tile) const
+	{
+		ASSERT_ERR(IsValidTile(tile));
+
+		int mip = VTileMip(tile);
+		if (mip + 1 >= m_mipLevels)
+			return s_vtileNone;
+
+		// Odd mip sizes round down, so the last row/column of tiles can map past the end
+		// of the parent level
+		int2 tileCountParent = TileCount(mip + 1);
+		return MakeVTileID(
+					mip + 1,
+					min(VTileX(tile) / 2, tileCountParent.x - 1),
+					min(VTileY(tile) / 2, tileCountParent.y - 1));
+	}
+
+	VTileID VTLayout::TileAt(float2 uv, int mip) const
+	{
+		ASSERT_ERR(mip >= 0 && mip < m_mipLevels);
+
+		int2 mipDims = CalculateMipDims(m_dims, mip);
+		int2 tileCount = TileCount(mip);
+		int x = clamp(int(floorf(uv.x * float(mipDims.x) / float(m_tileSize))), 0, tileCount.x - 1);
+		int y = clamp(int(floorf(uv.y * float(mipDims.y) / float(m_tileSize))), 0, tileCount.y - 1);
+		return MakeVTileID(mip, x, y);
+	}
+
+
+
+	// VTPager implementation
+
+	VTPager::VTPager()
+	:	m_layout(),
+		m_maxUpdatesPerFrame(16),
+		m_frame(0)
+	{
+	}
+
+	void VTPager::Init(const VTLayout & layout, int slotCount)
+	{
+		ASSERT_ERR(layout.m_mipLevels > 0);
+		ASSERT_ERR(slotCount > 0);
+
+		Reset();
+		m_layout = layout;
+		m_tileInSlot.assign(slotCount, s_vtileNone);
+		m_frameLastUsed.assign(slotCount, -1);
+
+		// Hand out the low slots first
+		m_freeSlots.resize(slotCount);
+		for (int i = 0; i < slotCount; ++i)
+			m_freeSlots[i] = slotCount - 1 - i;
+	}
+
+	void VTPager::Reset()
+	{
+		m_layout = VTLayout();
+		m_tileInSlot.clear();
+		m_frameLastUsed.clear();
+		m_freeSlots.clear();
+		m_slotOfTile.clear();
+		m_frame = 0;
+	}
+
+	int VTPager::FindSlot(VTileID tile) const
+	{
+		auto iter = m_slotOfTile.find(tile);
+		return (iter == m_slotOfTile.end()) ? -1 : iter->second;
+	}
+
+	void VTPager::ProcessFeedback(
+		const VTileID * aTiles,
+		int tileCount,
+		std::vector<Update> * pUpdatesOut)
+	{
+		ASSERT_ERR(aTiles || tileCount == 0);
+		ASSERT_ERR(tileCount >= 0);
+		ASSERT_ERR(pUpdatesOut);
+		ASSERT_ERR(!m_tileInSlot.empty());
+
+		++m_frame;
+
+		// Mark the requested tiles and all their ancestors as used, and collect the ones
+		// that aren't resident.  The coarsest mip goes in first so it's always requested.
+		std::vector<VTileID> tilesWanted;
+		int mipCoarsest = m_layout.m_mipLevels - 1;
+		int2 tileCountCoarsest = m_layout.TileCount(mipCoarsest);
+		for (int y = 0; y < tileCountCoarsest.y; ++y)
+			for (int x = 0; x < tileCountCoarsest.x; ++x)
+				tilesWanted.push_back(MakeVTileID(mipCoarsest, x, y));
+		tilesWanted.insert(tilesWanted.end(), aTiles, aTiles + tileCount);
+
+		std::unordered_set<VTileID> tilesSeen;
+		std::vector<VTileID> tilesMissing;
+		for (int i = 0, c = int(tilesWanted.size()); i < c; ++i)
+		{
+			if (!m_layout.IsValidTile(tilesWanted[i]))
+				continue;
+
+			for (VTileID tile = tilesWanted[i]; tile != s_vtileNone; tile = m_layout.ParentOf(tile))
+			{
+				// Stop once we reach a tile whose ancestors have already been handled
+				if (!tilesSeen.insert(tile).second)
+					break;
+
+				int slot = FindSlot(tile);
+				if (slot < 0)
+					tilesMissing.push_back(tile);
+				else if (m_frameLastUsed[slot] != INT_MAX)
+					m_frameLastUsed[slot] = m_frame;
+			}
+		}
+
+		// Load coarser mips first, so every tile has a resident ancestor as soon as possible;
+		// sort by ID within a mip to keep the order deterministic
+		std::sort(tilesMissing.begin(), tilesMissing.end(), [](VTileID a, VTileID b)
+		{
+			if (VTileMip(a) != VTileMip(b))
+				return VTileMip(a) > VTileMip(b);
+			return a < b;
+		});
+
+		int updateCount = min(int(tilesMissing.size()), m_maxUpdatesPerFrame);
+		for (int i = 0; i < updateCount; ++i)
+		{
+			VTileID tile = tilesMissing[i];
+
+			// Take a free slot if there is one, otherwise the least recently used slot
+			// whose tile wasn't needed this frame
+			int slot = -1;
+			if (!m_freeSlots.empty())
+			{
+				slot = m_freeSlots.back();
+				m_freeSlots.pop_back();
+			}
+			else
+			{
+				int frameOldest = m_frame;
+				for (int j = 0, c = int(m_tileInSlot.size()); j < c; ++j)
+				{
+					if (m_frameLastUsed[j] < frameOldest)
+					{
+						slot = j;
+						frameOldest = m_frameLastUsed[j];
+					}
+				}
+				if (slot < 0)
+					break;		// Cache is full of tiles in use; try again next frame
+			}
+
+			Update update = { tile, slot, m_tileInSlot[slot] };
+			if (update.m_tileEvicted != s_vtileNone)
+				m_slotOfTile.erase(update.m_tileEvicted);
+			m_tileInSlot[slot] = tile;
+			m_frameLastUsed[slot] = (VTileMip(tile) == mipCoarsest) ? INT_MAX : m_frame;
+			m_slotOfTile[tile] = slot;
+			pUpdatesOut->push_back(update);
+		}
+	}
+
+
+
+	// VTPageTable implementation
+
+	VTPageTable::VTPageTable()
+	:	m_layout(),
+		m_cacheSlotsX(0),
+		m_dirty(false)
+	{
+	}
+
+	void VTPageTable::Init(const VTLayout & layout, int cacheSlotsX)
+	{
+		ASSERT_ERR(layout.m_mipLevels > 0);
+		ASSERT_ERR(cacheSlotsX > 0 && cacheSlotsX <= 256);
+
+		m_layout = layout;
+		m_cacheSlotsX = cacheSlotsX;
+		int totalTileCount = layout.TotalTileCount();
+		m_slotOfTile.assign(totalTileCount, -1);
+		m_entries.assign(totalTileCount, byte4(0, 0, 0, 0));
+		m_dirty = true;
+	}
+
+	void VTPageTable::Reset()
+	{
+		m_layout = VTLayout();
+		m_cacheSlotsX = 0;
+		m_slotOfTile.clear();
+		m_entries.clear();
+		m_dirty = false;
+	}
+
+	void VTPageTable::SetTileResident(VTileID tile, int slot)
+	{
+		ASSERT_ERR(slot >= 0);
+		m_slotOfTile[m_layout.TileIndex(tile)] = slot;
+		m_dirty = true;
+	}
+
+	void VTPageTable::SetTileEvicted(VTileID tile)
+	{
+		m_slotOfTile[m_layout.TileIndex(tile)] = -1;
+		m_dirty = true;
+	}
+
+	void VTPageTable::Rebuild()
+	{
+		for (int mip = m_layout.m_mipLevels - 1; mip >= 0; --mip)
+		{
+			int2 tileCount = m_layout.TileCount(mip);
+			for (int y = 0; y < tileCount.y; ++y)
+			{
+				for (int x = 0; x < tileCount.x; ++x)
+				{
+					VTileID tile = MakeVTileID(mip, x, y);
+					int index = m_layout.TileIndex(tile);
+					int slot = m_slotOfTile[index];
+					if (slot >= 0)
+					{
+						m_entries[index] = byte4(
+											byte(slot % m_cacheSlotsX),
+											byte(slot / m_cacheSlotsX),
+											byte(mip),
+											byte(1));
+					}
+					else
+					{
+						VTileID parent = m_layout.ParentOf(tile);
+						m_entries[index] = (parent != s_vtileNone) ?
+											m_entries[m_layout.TileIndex(parent)] :
+											byte4(0, 0, 0, 0);
+					}
+				}
+			}
+		}
+	}
+
+
+
+	// VirtualTexture implementation
+
+	VirtualTexture::VirtualTexture()
+	:	m_layout(),
+		m_cacheSlots(0),
+		m_feedbackReady(false),
+		m_quit(false)
+	{
+	}
+
+	VirtualTexture::~VirtualTexture()
+	{
+		StopPager();
+	}
+
+	void VirtualTexture::Reset()
+	{
+		StopPager();
+
+		m_pPack.release();
+		m_layout = VTLayout();
+		m_apTiles.clear();
+		m_cacheSlots = int2(0);
+		m_texCache.Reset();
+		m_pageTable.Reset();
+		m_texPageTable.Reset();
+		m_pager.Reset();
+		m_feedbackPending.clear();
+		m_feedbackReady = false;
+		m_updatesDone.clear();
+	}
+
+	void VirtualTexture::Init(ID3D11Device * pDevice, i64 cacheBudgetBytes)
+	{
+		ASSERT_ERR(pDevice);
+		ASSERT_ERR(cacheBudgetBytes > 0);
+		ASSERT_ERR(int(m_apTiles.size()) == m_layout.TotalTileCount());
+		ASSERT_ERR(!m_thread.joinable());
+
+		// Fit as many slots in the budget as we can, laid out in a roughly square grid.
+		// The grid is limited by the max texture size, and by the page table's byte coordinates.
+		static const int s_maxTextureDim = 16384;
+		int tileSizeWithBorder = m_layout.TileSizeWithBorder();
+		i64 tileBytes = CalculateMipSizeInBytes(int2(tileSizeWithBorder), 0, m_layout.m_format);
+		int maxSlotsPerAxis = min(s_maxTextureDim / tileSizeWithBorder, 256);
+		int slotCount = int(min(cacheBudgetBytes / tileBytes, i64(square(maxSlotsPerAxis))));
+		if (slotCount < m_layout.m_mipLevels)
+		{
+			WARN("Virtual texture cache budget of %lld bytes only fits %d tiles; using %d",
+				cacheBudgetBytes, slotCount, m_layout.m_mipLevels);
+			slotCount = m_layout.m_mipLevels;
+		}
+		m_cacheSlots.x = min(int(ceilf(sqrtf(float(slotCount)))), maxSlotsPerAxis);
+		m_cacheSlots.y = slotCount / m_cacheSlots.x;
+		slotCount = m_cacheSlots.x * m_cacheSlots.y;
+
+		m_texCache.Init(pDevice, m_cacheSlots * tileSizeWithBorder, m_layout.m_format);
+
+		// The page table has a texel per tile at each mip, padded up to pow2 so each
+		// level's tiles fit in the matching mip of the page table texture
+		int2 tileCountBase = m_layout.TileCount(0);
+		int2 dimsPageTable = { pow2_ceil(tileCountBase.x), pow2_ceil(tileCountBase.y) };
+		m_texPageTable.Init(pDevice, dimsPageTable, DXGI_FORMAT_R8G8B8A8_UINT, TEXFLAG_Mipmaps);
+		ASSERT_ERR(m_texPageTable.m_mipLevels >= m_layout.m_mipLevels);
+		m_pageTable.Init(m_layout, m_cacheSlots.x);
+
+		// Start the pager, and have it load the coarsest mip right away
+		m_pager.Init(m_layout, slotCount);
+		m_quit = false;
+		m_feedbackReady = false;
+		m_thread = std::thread(&VirtualTexture::PagerThreadMain, this);
+		SubmitFeedback(nullptr, 0);
+
+		LOG("Virtual texture cache: %dx%d tiles, %0.1f MB",
+			m_cacheSlots.x, m_cacheSlots.y, float(slotCount * tileBytes) / 1048576.0f);
+	}
+
+	void VirtualTexture::SubmitFeedback(const VTileID * aTiles, int tileCount)
+	{
+		ASSERT_ERR(aTiles || tileCount == 0);
+		ASSERT_ERR(tileCount >= 0);
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_feedbackPending.assign(aTiles, aTiles + tileCount);
+			m_feedbackReady = true;
+		}
+		m_cv.notify_one();
+	}
+
+	void VirtualTexture::Update(ID3D11DeviceContext * pCtx)
+	{
+		ASSERT_ERR(pCtx);
+		ASSERT_ERR(m_texCache.m_pTex);
+
+		std::vector<VTPager::Update> updates;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			updates.swap(m_updatesDone);
+		}
+
+		// Copy the new tiles into their slots
+		int tileSizeWithBorder = m_layout.TileSizeWithBorder();
+		UINT rowPitch = UINT(CalculateRowPitch(tileSizeWithBorder, m_layout.m_format));
+		for (int i = 0, c = int(updates.size()); i < c; ++i)
+		{
+			const VTPager::Update & update = updates[i];
+			if (update.m_tileEvicted != s_vtileNone)
+				m_pageTable.SetTileEvicted(update.m_tileEvicted);
+
+			int2 slotPos = int2(update.m_slot % m_cacheSlots.x, update.m_slot / m_cacheSlots.x) * tileSizeWithBorder;
+			D3D11_BOX box =
+			{
+				UINT(slotPos.x), UINT(slotPos.y), 0,
+				UINT(slotPos.x + tileSizeWithBorder), UINT(slotPos.y + tileSizeWithBorder), 1,
+			};
+			pCtx->UpdateSubresource(
+					m_texCache.m_pTex, 0, &box,
+					m_apTiles[m_layout.TileIndex(update.m_tile)],
+					rowPitch, 0);
+
+			m_pageTable.SetTileResident(update.m_tile, update.m_slot);
+		}
+
+		if (!m_pageTable.m_dirty)
+			return;
+
+		// Re-upload the whole page table; it's small enough not to bother tracking
+		// which parts changed
+		m_pageTable.Rebuild();
+		std::vector<byte4> entries;
+		for (int mip = 0; mip < m_layout.m_mipLevels; ++mip)
+		{
+			int2 dimsMip = CalculateMipDims(m_texPageTable.m_dims, mip);
+			int2 tileCount = m_layout.TileCount(mip);
+			entries.assign(dimsMip.x * dimsMip.y, byte4(0, 0, 0, 0));
+			for (int y = 0; y < tileCount.y; ++y)
+			{
+				for (int x = 0; x < tileCount.x; ++x)
+					entries[y * dimsMip.x + x] = m_pageTable.Lookup(MakeVTileID(mip, x, y));
+			}
+			pCtx->UpdateSubresource(
+					m_texPageTable.m_pTex, mip, nullptr,
+					&entries[0], dimsMip.x * sizeof(byte4), 0);
+		}
+		m_pageTable.m_dirty = false;
+	}
+
+	void VirtualTexture::PagerThreadMain()
+	{
+		std::vector<VTileID> feedback;
+		std::vector<VTPager::Update> updates;
+
+		for (;;)
+		{
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				while (!m_quit && !m_feedbackReady)
+					m_cv.wait(lock);
+				if (m_quit)
+					return;
+				feedback.swap(m_feedbackPending);
+				m_feedbackReady = false;
+			}
+
+			updates.clear();
+			m_pager.ProcessFeedback(
+						feedback.empty() ? nullptr : &feedback[0],
+						int(feedback.size()),
+						&updates);
+
+			// Hand the decisions back to the main thread, after any it hasn't applied yet
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_updatesDone.insert(m_updatesDone.end(), updates.begin(), updates.end());
+			}
+		}
+	}
+
+	void VirtualTexture::StopPager()
+	{
+		if (!m_thread.joinable())
+			return;
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_quit = true;
+		}
+		m_cv.notify_one();
+		m_thread.join();
+	}
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+namespace Framework
+{
+	// Virtual texturing: a texture too big to keep on the GPU is cut into fixed-size tiles
+	// at each mip level, and only the tiles being sampled are kept resident, in a cache
+	// texture with a fixed number of slots.
+	//  * Each tile is stored with a border of pixels from its neighbors, so filtering
+	//      inside a tile never needs to read another tile.
+	//  * The page table has an entry per tile per mip, pointing to the slot holding that
+	//      tile or, if it isn't resident, its nearest resident ancestor.  Entries are
+	//      RGBA8_UINT: (slot x, slot y, mip of the tile actually in the slot, 1 if valid).
+	//  * The app renders a feedback buffer of the tiles it samples, reads it back and passes
+	//      it to SubmitFeedback.  The pager decides what to load and evict (least recently
+	//      used first) on a worker thread, and Update applies its decisions on the GPU.
+	//  * VTLayout, VTPager and VTPageTable don't touch D3D or threads, so they can be
+	//      driven with synthetic feedback.
+
+	// Tiles are addressed by mip level and tile coordinates within that level
+	typedef uint VTileID;
+	static const VTileID s_vtileNone = ~0u;
+
+	inline VTileID MakeVTileID(int mip, int x, int y)
+		{ return (uint(mip) << 26) | (uint(y) << 13) | uint(x); }
+	inline int VTileMip(VTileID tile)
+		{ return int(tile >> 26); }
+	inline int VTileX(VTileID tile)
+		{ return int(tile & 0x1fff); }
+	inline int VTileY(VTileID tile)
+		{ return int((tile >> 13) & 0x1fff); }
+
+	// Number of mip levels in a virtual texture: down to the first level that fits in one tile
+	int CalculateVTMipCount(int2 dims, int tileSize);
+
+	struct VTLayout
+	{
+		int2			m_dims;
+		int				m_mipLevels;
+		int				m_tileSize;				// Not counting borders
+		int				m_tileBorder;
+		DXGI_FORMAT		m_format;
+
+		int		TileSizeWithBorder() const
+					{ return m_tileSize + 2 * m_tileBorder; }
+		int2	TileCount(int mip) const;
+		int		TotalTileCount() const;
+		int		TileIndex(VTileID tile) const;			// Linear index over all mips, coarser mips after finer
+		bool	IsValidTile(VTileID tile) const;
+		VTileID	ParentOf(VTileID tile) const;			// s_vtileNone for the coarsest mip
+		VTileID	TileAt(float2 uv, int mip) const;
+	};
+
+	// Decides which tiles to keep in a fixed number of cache slots, based on feedback
+	class VTPager
+	{
+	public:
+		struct Update
+		{
+			VTileID		m_tile;					// Tile to load
+			int			m_slot;					// Slot to load it into
+			VTileID		m_tileEvicted;			// Tile that was in the slot, or s_vtileNone
+		};
+
+		VTLayout							m_layout;
+		int									m_maxUpdatesPerFrame;
+		std::vector<VTileID>				m_tileInSlot;			// s_vtileNone if free
+		std::vector<int>					m_frameLastUsed;		// Per slot; INT_MAX for pinned tiles
+		std::vector<int>					m_freeSlots;
+		std::unordered_map<VTileID, int>	m_slotOfTile;
+		int									m_frame;
+
+				VTPager();
+		void	Init(const VTLayout & layout, int slotCount);
+		void	Reset();
+
+		int		FindSlot(VTileID tile) const;			// -1 if not resident
+
+		// Take one frame's feedback and decide what to load.  Requested tiles and their
+		// ancestors are marked as used; missing ones are loaded coarsest first, into free
+		// slots or else the least recently used ones.  Tiles used this frame are never
+		// evicted, and the coarsest mip is always resident.
+		void	ProcessFeedback(
+					const VTileID * aTiles,
+					int tileCount,
+					std::vector<Update> * pUpdatesOut);
+	};
+
+	// CPU copy of the page table
+	class VTPageTable
+	{
+	public:
+		VTLayout				m_layout;
+		int						m_cacheSlotsX;			// Slots per row of the cache texture
+		std::vector<int>		m_slotOfTile;			// By TileIndex; -1 if not resident
+		std::vector<byte4>		m_entries;				// By TileIndex
+		bool					m_dirty;
+
+				VTPageTable();
+		void	Init(const VTLayout & layout, int cacheSlotsX);
+		void	Reset();
+
+		void	SetTileResident(VTileID tile, int slot);
+		void	SetTileEvicted(VTileID tile);
+
+		// Recompute the entries, coarsest mip first so each tile can inherit its parent's
+		void	Rebuild();
+
+		byte4	Lookup(VTileID tile) const
+					{ return m_entries[m_layout.TileIndex(tile)]; }
+	};
+
+	class VirtualTexture
+	{
+	public:
+		// Asset pack that this texture's data is sourced from
+		comptr<AssetPack>			m_pPack;
+
+		// Pointers to tile data in the asset pack, by TileIndex
+		VTLayout					m_layout;
+		std::vector<void *>			m_apTiles;
+
+		// Cache of resident tiles, and the page table pointing into it
+		int2						m_cacheSlots;
+		Texture2D					m_texCache;
+		VTPageTable					m_pageTable;
+		Texture2D					m_texPageTable;			// Mip N holds the entries for mip N's tiles
+
+		// Pager, run on a worker thread.  Shared state is guarded by m_mutex.
+		VTPager						m_pager;
+		std::thread					m_thread;
+		std::mutex					m_mutex;
+		std::condition_variable		m_cv;
+		std::vector<VTileID>		m_feedbackPending;
+		bool						m_feedbackReady;
+		bool						m_quit;
+		std::vector<VTPager::Update>	m_updatesDone;
+
+				VirtualTexture();
+				~VirtualTexture();
+		void	Reset();
+
+		// Create the cache and page table on the GPU, with as many slots as fit in the
+		// budget, and start the pager
+		void	Init(ID3D11Device * pDevice, i64 cacheBudgetBytes);
+
+		// Hand a frame's feedback to the pager.  Replaces any that hasn't been processed yet.
+		void	SubmitFeedback(const VTileID * aTiles, int tileCount);
+
+		// Upload the tiles the pager has decided on so far, and update the page table
+		void	Update(ID3D11DeviceContext * pCtx);
+
+	protected:
+		void	PagerThreadMain();
+		void	StopPager();
+	};
+
+	// Load a virtual texture's layout and tile pointers from an asset pack
+	bool LoadVirtualTextureFromAssetPack(
+		AssetPack * pPack,
+		const char * path,
+		VirtualTexture * pVTexOut);
+}